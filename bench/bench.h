@@ -0,0 +1,234 @@
+//
+// Created by admin on 2022/9/17.
+//
+/*
+ * 很小的基准测试框架, 给zfx_bench和后面的负载测试用
+ * 每个基准先估计一次要跑多少轮才能超过minTime, 再重复reps次, 报告中位数, 最小值和MAD
+ * 单位统一是每个op多少纳秒, items是一个op处理了多少个东西(点, 字符, 指令), 用来算吞吐
+ * 结果可以写成JSON, 对比工具只认name和ns_per_op, 其他字段是给人看的
+ * */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace zfx_bench {
+
+//防止编译器把结果优化掉
+template <class T>
+inline void keep(T const& v) {
+    asm volatile("" : : "r,m"(v) : "memory");
+}
+
+struct Options {
+    std::string filter;         //名字里包含它的才跑
+    std::string json;           //不为空就把结果写到这个文件
+    int reps = 9;
+    double minTime = 0.01;      //每次重复至少跑这么多秒
+    bool list = false;
+};
+
+struct Result {
+    std::string name;
+    double nsPerOp = 0;         //中位数
+    double minNs = 0;
+    double madPct = 0;          //中位数绝对偏差, 相对中位数的百分比
+    double items = 1;           //每个op处理的东西
+    double bytes = 0;           //每个op读写的字节, 不知道的话是0
+    std::uint64_t iters = 0;
+    int reps = 0;
+    std::vector<std::pair<std::string, double>> counters;   //各个程序自己加的指标, 原样写进JSON
+
+    double itemsPerSec() const {
+        return nsPerOp > 0 ? items * 1e9 / nsPerOp : 0;
+    }
+};
+
+//body(iters)连续执行iters次op
+using Body = std::function<void(std::uint64_t iters)>;
+
+struct Case {
+    std::string name;
+    double items;
+    double bytes;
+    Body body;
+};
+
+inline std::vector<Case>& registry() {
+    static std::vector<Case> cases;
+    return cases;
+}
+
+inline void add(std::string name, double items, double bytes, Body body) {
+    registry().push_back({std::move(name), items, bytes, std::move(body)});
+}
+
+//body多数时候就是一个循环, 这里包一下
+template <class F>
+inline void addLoop(std::string name, double items, double bytes, F op) {
+    add(std::move(name), items, bytes, [op](std::uint64_t iters) mutable {
+        for (std::uint64_t i = 0; i < iters; i++) {
+            op();
+        }
+    });
+}
+
+inline double seconds(Body& body, std::uint64_t iters) {
+    auto t0 = std::chrono::steady_clock::now();
+    body(iters);
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(t1 - t0).count();
+}
+
+inline double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    std::size_t n = v.size();
+    return n % 2 ? v[n / 2] : 0.5 * (v[n / 2 - 1] + v[n / 2]);
+}
+
+inline Result measure(Case& c, const Options& opt) {
+    Result r;
+    r.name = c.name;
+    r.items = c.items;
+    r.bytes = c.bytes;
+    r.reps = opt.reps;
+    //先跑一次预热, 再翻倍直到超过minTime的十分之一, 然后按比例估计
+    seconds(c.body, 1);
+    std::uint64_t iters = 1;
+    double t = seconds(c.body, iters);
+    while (t < opt.minTime * 0.1 && iters < (1ull << 40)) {
+        iters *= 2;
+        t = seconds(c.body, iters);
+    }
+    if (t < opt.minTime) {
+        double scale = opt.minTime / std::max(t, 1e-9);
+        iters = std::max<std::uint64_t>(iters, static_cast<std::uint64_t>(iters * scale));
+    }
+    r.iters = iters;
+    std::vector<double> ns;
+    for (int i = 0; i < opt.reps; i++) {
+        ns.push_back(seconds(c.body, iters) * 1e9 / static_cast<double>(iters));
+    }
+    r.nsPerOp = median(ns);
+    r.minNs = *std::min_element(ns.begin(), ns.end());
+    std::vector<double> dev;
+    for (double v : ns) {
+        dev.push_back(std::fabs(v - r.nsPerOp));
+    }
+    r.madPct = r.nsPerOp > 0 ? median(dev) / r.nsPerOp * 100 : 0;
+    return r;
+}
+
+inline std::string escape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+inline void writeJson(const std::string& path, const std::vector<Result>& results) {
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) {
+        std::fprintf(stderr, "cannot write %s\n", path.c_str());
+        std::exit(1);
+    }
+    std::fprintf(f, "{\n  \"context\": {\n");
+#if defined(__VERSION__)
+    std::fprintf(f, "    \"compiler\": \"%s\",\n", escape(__VERSION__).c_str());
+#endif
+#if defined(NDEBUG)
+    std::fprintf(f, "    \"assertions\": false,\n");
+#else
+    std::fprintf(f, "    \"assertions\": true,\n");
+#endif
+    std::fprintf(f, "    \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+    std::fprintf(f, "    \"timestamp\": %lld\n  },\n  \"benchmarks\": [\n",
+                 static_cast<long long>(std::chrono::duration_cast<std::chrono::seconds>(
+                     std::chrono::system_clock::now().time_since_epoch()).count()));
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        std::fprintf(f, "    {\"name\": \"%s\", \"ns_per_op\": %.4f, \"min_ns\": %.4f, \"mad_pct\": %.3f, "
+                        "\"items_per_op\": %.0f, \"items_per_second\": %.6g, \"bytes_per_op\": %.0f, "
+                        "\"iterations\": %llu, \"repetitions\": %d",
+                     escape(r.name).c_str(), r.nsPerOp, r.minNs, r.madPct, r.items, r.itemsPerSec(), r.bytes,
+                     static_cast<unsigned long long>(r.iters), r.reps);
+        for (auto const& [key, value] : r.counters) {
+            std::fprintf(f, ", \"%s\": %.6g", escape(key).c_str(), value);
+        }
+        std::fprintf(f, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(f, "  ]\n}\n");
+    std::fclose(f);
+}
+
+//extra处理程序自己的参数, 认识这个参数就返回true, value()取下一个参数
+using ExtraArgs = std::function<bool(const std::string& arg, const std::function<std::string()>& value)>;
+
+inline Options parse(int argc, char** argv, const ExtraArgs& extra = {}, const char* extraUsage = "") {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                std::fprintf(stderr, "%s needs a value\n", a.c_str());
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        if (a == "--filter") {
+            opt.filter = value();
+        } else if (a == "--json") {
+            opt.json = value();
+        } else if (a == "--reps") {
+            opt.reps = std::max(1, std::atoi(value().c_str()));
+        } else if (a == "--min-time") {
+            opt.minTime = std::atof(value().c_str());
+        } else if (a == "--list") {
+            opt.list = true;
+        } else if (!extra || !extra(a, value)) {
+            std::fprintf(stderr, "usage: %s [--filter substr] [--json file] [--reps n] [--min-time seconds] [--list]%s\n",
+                         argv[0], extraUsage);
+            std::exit(2);
+        }
+    }
+    return opt;
+}
+
+//跑所有登记的基准, 打一张表, JSON由调用的地方用writeJson写
+inline std::vector<Result> runAll(const Options& opt, bool header = true) {
+    std::vector<Result> results;
+    if (!opt.list && header) {
+        std::printf("%-40s %14s %10s %8s %16s\n", "benchmark", "ns/op", "min", "mad%", "items/s");
+    }
+    for (Case& c : registry()) {
+        if (!opt.filter.empty() && c.name.find(opt.filter) == std::string::npos) {
+            continue;
+        }
+        if (opt.list) {
+            std::printf("%s\n", c.name.c_str());
+            continue;
+        }
+        Result r = measure(c, opt);
+        std::printf("%-40s %14.3f %10.3f %8.2f %16.6g\n", r.name.c_str(), r.nsPerOp, r.minNs, r.madPct,
+                    r.itemsPerSec());
+        std::fflush(stdout);
+        results.push_back(r);
+    }
+    return results;
+}
+
+}
@@ -0,0 +1,335 @@
+//
+// Created by admin on 2022/9/17.
+//
+/*
+ * zfx的微基准
+ * vm.*      每条指令的分派开销: 先读16个属性, 再把同一条指令重复kRepeat次, 对kPoints个点执行
+ *           items是指令数乘点数, ns/op是整个程序跑一遍, 减掉vm.*.prologue就是纯指令的开销
+ * builtin.* lane函数的吞吐, 直接调用zmathlib/znoise/zrandom, 不经过虚拟机
+ * api.*     C++调用zfx函数的固定开销
+ * 词法分析, 语法分析和编译器还没有能编译的实现, 等它们能用了再加tokenizer/parser/compiler的基准
+ *
+ * zfx_bench [--filter substr] [--json file] [--reps n] [--min-time seconds] [--list]
+ * */
+#include "bench.h"
+#include "zfx/ZFXModule.h"
+#include "zfx/VM/zapi.h"
+#include "zfx/VM/zbuiltins.h"
+#include <random>
+
+using namespace zeno::zfx;
+
+namespace {
+
+constexpr int kPoints = 64 * ZFX_LANES;
+constexpr int kRepeat = 256;
+constexpr int kInputs = 16;
+//r0到r15是输入, 结果写到kOut开始的寄存器
+constexpr int kOut = 32;
+
+std::vector<float> uniform(std::size_t n, float lo, float hi, unsigned seed) {
+    std::mt19937 g(seed);
+    std::uniform_real_distribution<float> u(lo, hi);
+    std::vector<float> v(n);
+    for (auto& x : v) {
+        x = u(g);
+    }
+    return v;
+}
+
+//随机数的id, 按点的编号
+std::vector<int> iota(std::size_t n) {
+    std::vector<int> v(n);
+    for (std::size_t i = 0; i < n; i++) {
+        v[i] = static_cast<int>(i);
+    }
+    return v;
+}
+
+//一段要重复的指令, 扩展字和常量也在里面
+struct OpCase {
+    const char* name;
+    std::vector<std::uint32_t> words;
+};
+
+std::uint32_t ext(int w, int d = 0, int f = 0) {
+    return ZFX_INSN_EXT(w, d, f);
+}
+
+std::uint32_t abc(OpCode op, int a, int b, int c) {
+    return ZFX_INSN_ABC(op, a, b, c);
+}
+
+std::vector<OpCase> opcases() {
+    int sinfn = zfx_findCFunction("sin");
+    int perlinfn = zfx_findCFunction("perlin3");
+    int scalarfn = zfx_findCFunction("bench_madd");
+    return {
+        {"assign", {abc(OpCode::kAssign, kOut, 0, 0)}},
+        {"const", {abc(OpCode::kLoadConstFloat, kOut, 0, 0), 0x3f800000u}},
+        {"load", {abc(OpCode::kLoadPtr, kOut, 0, 0)}},
+        {"store", {abc(OpCode::kStorePtr, 0, kInputs, 0)}},
+        {"add", {abc(OpCode::kPlus, kOut, 0, 1)}},
+        {"mul", {abc(OpCode::kMultiply, kOut, 0, 1)}},
+        {"div", {abc(OpCode::kDivide, kOut, 0, 1)}},
+        {"mod", {abc(OpCode::kModulus, kOut, 0, 1)}},
+        {"cmplt", {abc(OpCode::kCmpLessThan, kOut, 0, 1)}},
+        {"bitand", {abc(OpCode::kBitAnd, kOut, 0, 1)}},
+        {"dot3", {abc(OpCode::kDot, kOut, 0, 4), ext(3)}},
+        {"cross", {abc(OpCode::kCross, kOut, 0, 4), ext(3)}},
+        {"length3", {abc(OpCode::kLength, kOut, 0, 0), ext(3)}},
+        {"normalize3", {abc(OpCode::kNormalize, kOut, 0, 0), ext(3)}},
+        {"normalize3_fast", {abc(OpCode::kNormalize, kOut, 0, 0), ext(3, 0, ZFX_VEC_FAST)}},
+        {"lerp3", {abc(OpCode::kLerp, kOut, 0, 4), ext(3, 8, ZFX_VEC_SCALAR)}},
+        {"clamp3", {abc(OpCode::kClamp, kOut, 0, 4), ext(3, 8, ZFX_VEC_SCALAR)}},
+        {"smoothstep", {abc(OpCode::kSmoothstep, kOut, 0, 1), ext(1, 2)}},
+        {"matmul4", {abc(OpCode::kMatMul, kOut, 0, 0), ext(4)}},
+        {"inverse4", {abc(OpCode::kInverse, kOut, 0, 0), ext(4)}},
+        {"inverse3", {abc(OpCode::kInverse, kOut, 0, 0), ext(3)}},
+        {"xformpoint4", {abc(OpCode::kTransformPoint, kOut, 0, 4), ext(4)}},
+        {"xformnormal4", {abc(OpCode::kTransformNormal, kOut, 0, 4), ext(4)}},
+        {"qmul", {abc(OpCode::kQuatMul, kOut, 0, 4), ext(0)}},
+        {"qrotate", {abc(OpCode::kQuatRotate, kOut, 0, 4), ext(0)}},
+        {"sample1d_rgb", {abc(OpCode::kSample, kOut, 0, 0), ext(0, 0, ZFX_SAMPLE_LINEAR)}},
+        {"sample1d_cubic", {abc(OpCode::kSample, kOut, 0, 0), ext(0, 0, ZFX_SAMPLE_CUBIC)}},
+        {"sample3d_rgb", {abc(OpCode::kSample, kOut, 1, 0), ext(0, 0, ZFX_SAMPLE_LINEAR)}},
+        {"call.sin", {abc(OpCode::kFastCall, kOut, sinfn, 0)}},
+        {"call.perlin3", {abc(OpCode::kFastCall, kOut, perlinfn, 0)}},
+        {"call.scalar", {abc(OpCode::kFastCall, kOut, scalarfn, 0)}},
+    };
+}
+
+float bench_madd(float a, float b, float c) {
+    return a * b + c;
+}
+
+//所有vm基准共享的数据, 只读的那些在多次运行之间不变
+struct VMData {
+    std::vector<std::vector<float>> in;
+    std::vector<std::vector<double>> din;
+    std::vector<float> out;
+    std::vector<double> dout;
+    std::vector<float> ramp, lut;
+
+    VMData() {
+        for (int k = 0; k < kInputs; k++) {
+            //输入都在[0.5, 1.5], 除法和矩阵求逆不会碰到0
+            auto v = uniform(kPoints, 0.5f, 1.5f, 100 + k);
+            din.emplace_back(v.begin(), v.end());
+            in.push_back(std::move(v));
+        }
+        out.resize(kPoints);
+        dout.resize(kPoints);
+        ramp = uniform(256 * 3, 0, 1, 7);
+        lut = uniform(17 * 17 * 17 * 3, 0, 1, 8);
+    }
+
+    void bind(zfx_State* l, bool dbl) {
+        for (int k = 0; k < kInputs; k++) {
+            if (dbl) {
+                zfx_bindAttribute(l, k, din[k]);
+            } else {
+                zfx_bindAttribute(l, k, in[k]);
+            }
+        }
+        if (dbl) {
+            zfx_bindAttribute(l, kInputs, dout);
+        } else {
+            zfx_bindAttribute(l, kInputs, out);
+        }
+        zfx_Table t;
+        t.data = ramp;
+        t.size[0] = 256;
+        t.channels = 3;
+        zfx_bindTable(l, 0, t);
+        zfx_Table c;
+        c.data = lut;
+        c.dims = 3;
+        c.size[0] = c.size[1] = c.size[2] = 17;
+        c.channels = 3;
+        zfx_bindTable(l, 1, c);
+    }
+};
+
+VMData& vmdata() {
+    static VMData data;
+    return data;
+}
+
+void addVM(const std::string& prefix, const OpCase& op, int repeat, Zfx_NumberType number) {
+    Proto p;
+    p.nregs = kOut + 16;
+    p.number = number;
+    p.tables = {"ramp", "lut"};
+    for (int k = 0; k < kInputs; k++) {
+        p.syms.push_back("in" + std::to_string(k));
+        p.code.push_back(abc(OpCode::kLoadPtr, k, k, 0));
+    }
+    p.syms.push_back("out");
+    for (int i = 0; i < repeat; i++) {
+        p.code.insert(p.code.end(), op.words.begin(), op.words.end());
+    }
+    auto module = Module::create(std::move(p));
+    bool dbl = number == Zfx_NumberType::kDouble;
+    zfx_bench::add(prefix + op.name, static_cast<double>(repeat) * kPoints, 0,
+                   [module, dbl](std::uint64_t iters) {
+                       //状态在计时里创建一次, 和执行次数比起来可以忽略
+                       zfx_State* l = zfx_newstate(module);
+                       vmdata().bind(l, dbl);
+                       for (std::uint64_t i = 0; i < iters; i++) {
+                           zfx_run(l, &module->main(), kPoints);
+                       }
+                       zfx_close(l);
+                   });
+}
+
+void addVMCases() {
+    auto cases = opcases();
+    addVM("vm.float.", {"prologue", {}}, 0, Zfx_NumberType::kFloat);
+    for (auto const& op : cases) {
+        addVM("vm.float.", op, kRepeat, Zfx_NumberType::kFloat);
+    }
+    addVM("vm.double.", {"prologue", {}}, 0, Zfx_NumberType::kDouble);
+    for (auto const& op : cases) {
+        std::string name = op.name;
+        if (name == "add" || name == "mul" || name == "div" || name == "matmul4" || name == "call.sin") {
+            addVM("vm.double.", op, kRepeat, Zfx_NumberType::kDouble);
+        }
+    }
+}
+
+constexpr int kBatch = 1 << 16;
+
+struct LaneData {
+    std::vector<float> x = uniform(kBatch, -100, 100, 1);
+    std::vector<float> y = uniform(kBatch, -100, 100, 2);
+    std::vector<float> z = uniform(kBatch, -100, 100, 3);
+    std::vector<float> pos = uniform(kBatch, 0.01f, 100, 4);
+    std::vector<int> ids = iota(kBatch);
+    std::vector<int> seeds = std::vector<int>(kBatch, 7);
+    std::vector<float> out = std::vector<float>(kBatch);
+    std::vector<float> out2 = std::vector<float>(kBatch);
+    std::vector<float> out3 = std::vector<float>(kBatch);
+};
+
+LaneData& lanedata() {
+    static LaneData data;
+    return data;
+}
+
+void addUnary(const char* name, void (*fn)(float*, const float*, int, Zfx_MathPrecision), bool positive) {
+    for (auto prec : {Zfx_MathPrecision::kPrecise, Zfx_MathPrecision::kFast}) {
+        std::string n = std::string("builtin.") + name + (prec == Zfx_MathPrecision::kFast ? "_fast" : "");
+        zfx_bench::addLoop(n, kBatch, kBatch * 8.0, [=] {
+            LaneData& d = lanedata();
+            fn(d.out.data(), positive ? d.pos.data() : d.x.data(), kBatch, prec);
+            zfx_bench::keep(d.out[0]);
+        });
+    }
+}
+
+void addBuiltinCases() {
+    addUnary("sin", zfx_vsin, false);
+    addUnary("cos", zfx_vcos, false);
+    addUnary("tan", zfx_vtan, false);
+    addUnary("atan", zfx_vatan, false);
+    addUnary("exp", zfx_vexp, false);
+    addUnary("log", zfx_vlog, true);
+    zfx_bench::addLoop("builtin.atan2", kBatch, kBatch * 12.0, [] {
+        LaneData& d = lanedata();
+        zfx_vatan2(d.out.data(), d.y.data(), d.x.data(), kBatch, Zfx_MathPrecision::kPrecise);
+        zfx_bench::keep(d.out[0]);
+    });
+    zfx_bench::addLoop("builtin.pow", kBatch, kBatch * 12.0, [] {
+        LaneData& d = lanedata();
+        zfx_vpow(d.out.data(), d.pos.data(), d.x.data(), kBatch, Zfx_MathPrecision::kPrecise);
+        zfx_bench::keep(d.out[0]);
+    });
+    zfx_bench::addLoop("builtin.floor", kBatch, kBatch * 8.0, [] {
+        LaneData& d = lanedata();
+        zfx_vfloor(d.out.data(), d.x.data(), kBatch);
+        zfx_bench::keep(d.out[0]);
+    });
+    for (int dim = 1; dim <= 4; dim++) {
+        std::string suffix = std::to_string(dim);
+        auto noise = [dim](void (*fn)(float*, int, const float* const*, int)) {
+            return [dim, fn] {
+                LaneData& d = lanedata();
+                const float* p[] = {d.x.data(), d.y.data(), d.z.data(), d.pos.data()};
+                fn(d.out.data(), dim, p, kBatch);
+                zfx_bench::keep(d.out[0]);
+            };
+        };
+        zfx_bench::addLoop("builtin.perlin" + suffix, kBatch, kBatch * 4.0 * (dim + 1), noise(zfx_vperlin));
+        zfx_bench::addLoop("builtin.simplex" + suffix, kBatch, kBatch * 4.0 * (dim + 1), noise(zfx_vsimplex));
+    }
+    zfx_bench::addLoop("builtin.curl", kBatch, kBatch * 24.0, [] {
+        LaneData& d = lanedata();
+        float* out[] = {d.out.data(), d.out2.data(), d.out3.data()};
+        const float* p[] = {d.x.data(), d.y.data(), d.z.data()};
+        zfx_vcurl(out, p, kBatch);
+        zfx_bench::keep(d.out[0]);
+    });
+    zfx_bench::addLoop("builtin.fbm3_oct4", kBatch, kBatch * 16.0, [] {
+        static std::vector<float> octaves(kBatch, 4), lacunarity(kBatch, 2), gain(kBatch, 0.5f);
+        LaneData& d = lanedata();
+        const float* p[] = {d.x.data(), d.y.data(), d.z.data()};
+        zfx_vfbm(d.out.data(), 3, p, octaves.data(), lacunarity.data(), gain.data(), kBatch);
+        zfx_bench::keep(d.out[0]);
+    });
+    zfx_bench::addLoop("builtin.rand", kBatch, kBatch * 12.0, [] {
+        LaneData& d = lanedata();
+        zfx_vrand(d.out.data(), d.ids.data(), d.seeds.data(), kBatch);
+        zfx_bench::keep(d.out[0]);
+    });
+    zfx_bench::addLoop("builtin.randn", kBatch, kBatch * 12.0, [] {
+        LaneData& d = lanedata();
+        zfx_vrandn(d.out.data(), d.ids.data(), d.seeds.data(), kBatch);
+        zfx_bench::keep(d.out[0]);
+    });
+    zfx_bench::addLoop("builtin.randsphere", kBatch, kBatch * 20.0, [] {
+        LaneData& d = lanedata();
+        float* out[] = {d.out.data(), d.out2.data(), d.out3.data()};
+        zfx_vrandsphere(out, d.ids.data(), d.seeds.data(), kBatch);
+        zfx_bench::keep(d.out[0]);
+    });
+}
+
+//一个参数一个返回值的zfx函数, 只执行一条kFastCall
+void addAPICases() {
+    Proto fn;
+    fn.name = "f";
+    fn.nregs = 4;
+    fn.params = {Zfx_ArgKind::kFloat, Zfx_ArgKind::kFloat, Zfx_ArgKind::kFloat};
+    fn.ret = Zfx_ArgKind::kFloat;
+    fn.code = {abc(OpCode::kFastCall, 3, zfx_findCFunction("bench_madd"), 0), abc(OpCode::kReturn, 3, 0, 0)};
+    Proto top;
+    top.p.push_back(fn);
+    auto module = Module::create(std::move(top));
+    zfx_bench::add("api.function.call", 1, 0, [module](std::uint64_t iters) {
+        auto f = module->get<float(float, float, float)>("f");
+        zfx_State* l = zfx_newstate(module);
+        float acc = 0;
+        for (std::uint64_t i = 0; i < iters; i++) {
+            acc = f(l, acc, 0.5f, 1.0f);
+        }
+        zfx_bench::keep(acc);
+        zfx_close(l);
+    });
+}
+
+}
+
+int main(int argc, char** argv) {
+    auto opt = zfx_bench::parse(argc, argv);
+    zfx_openlibs();
+    zfx_register<&bench_madd>("bench_madd");
+    addVMCases();
+    addBuiltinCases();
+    addAPICases();
+    auto results = zfx_bench::runAll(opt);
+    if (!opt.json.empty() && !opt.list) {
+        zfx_bench::writeJson(opt.json, results);
+    }
+    return 0;
+}
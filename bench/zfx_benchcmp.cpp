@@ -0,0 +1,384 @@
+//
+// Created by admin on 2022/9/19.
+//
+/*
+ * 基准的回归检查, 把这次的JSON和签入的基线比较
+ *   zfx_benchcmp baseline.json current.json... [--threshold pct] [--noise k] [--all] [--update]
+ * 比的是min_ns, 重复几次里最快的那次, 受机器上别的负载干扰最小
+ * current可以是同一个程序跑几次的结果, 每项取最快的那次
+ * 每个基准允许的变慢幅度是max(threshold_pct, noise * (两边的mad_pct之和), spread_pct)
+ * 两边的context(编译器, 断言, 硬件线程数)不一样的时候结果没有可比性, 直接拒绝比较并返回2
+ * threshold_pct可以写在基线的每一项里, 没写的用--threshold(默认10%)
+ * 表里只列变慢, 变快, 缺少和新增的基准, --all列出全部
+ * 有基准变慢超过允许的幅度就返回1, 基线里有但这次没跑的也算失败
+ *
+ * --update用这次的结果覆盖基线, 保留基线里原来的threshold_pct
+ * 同一台机器上每次跑的min_ns也会差好几成, mad_pct只看得到一次运行里的波动, 所以基线最好用几次独立运行生成,
+ * 基线里的spread_pct就是这几次之间的波动, 几次运行隔开一点时间, 波动才能测全
+ * */
+#include "bench.h"
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+namespace {
+
+/*
+ * 只认bench.h写出来的那种JSON: 对象, 数组, 字符串, 数字, true/false
+ * 每个基准读成一个Result, 不认识的数字字段都放进counters
+ * */
+struct Reader {
+    std::string s;
+    std::size_t i = 0;
+
+    [[noreturn]] void fail(const char* what) {
+        std::fprintf(stderr, "bad json at offset %zu: %s\n", i, what);
+        std::exit(2);
+    }
+
+    void ws() {
+        while (i < s.size() && std::isspace(static_cast<unsigned char>(s[i]))) {
+            i++;
+        }
+    }
+
+    bool eat(char c) {
+        ws();
+        if (i < s.size() && s[i] == c) {
+            i++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c) {
+        if (!eat(c)) {
+            fail("unexpected character");
+        }
+    }
+
+    std::string string() {
+        expect('"');
+        std::string out;
+        while (i < s.size() && s[i] != '"') {
+            if (s[i] == '\\' && i + 1 < s.size()) {
+                i++;
+            }
+            out += s[i++];
+        }
+        expect('"');
+        return out;
+    }
+
+    double number() {
+        ws();
+        std::size_t end = i;
+        while (end < s.size() && (std::isdigit(static_cast<unsigned char>(s[end])) || std::strchr("+-.eE", s[end]))) {
+            end++;
+        }
+        if (end == i) {
+            fail("expected a number");
+        }
+        double v = std::strtod(s.c_str() + i, nullptr);
+        i = end;
+        return v;
+    }
+
+    //跳过一个不关心的值
+    void skip() {
+        ws();
+        if (i >= s.size()) {
+            fail("unexpected end");
+        }
+        if (s[i] == '"') {
+            string();
+        } else if (s[i] == '{' || s[i] == '[') {
+            char close = s[i] == '{' ? '}' : ']';
+            i++;
+            if (eat(close)) {
+                return;
+            }
+            do {
+                if (close == '}') {
+                    string();
+                    expect(':');
+                }
+                skip();
+            } while (eat(','));
+            expect(close);
+        } else if (s.compare(i, 4, "true") == 0) {
+            i += 4;
+        } else if (s.compare(i, 5, "false") == 0) {
+            i += 5;
+        } else {
+            number();
+        }
+    }
+
+    zfx_bench::Result benchmark() {
+        zfx_bench::Result r;
+        expect('{');
+        do {
+            std::string key = string();
+            expect(':');
+            ws();
+            if (key == "name") {
+                r.name = string();
+            } else if (i < s.size() && (s[i] == '-' || std::isdigit(static_cast<unsigned char>(s[i])))) {
+                double v = number();
+                if (key == "ns_per_op") {
+                    r.nsPerOp = v;
+                } else if (key == "min_ns") {
+                    r.minNs = v;
+                } else if (key == "mad_pct") {
+                    r.madPct = v;
+                } else if (key == "items_per_op") {
+                    r.items = v;
+                } else if (key == "bytes_per_op") {
+                    r.bytes = v;
+                } else if (key == "iterations") {
+                    r.iters = static_cast<std::uint64_t>(v);
+                } else if (key == "repetitions") {
+                    r.reps = static_cast<int>(v);
+                } else if (key != "items_per_second") {
+                    r.counters.emplace_back(key, v);
+                }
+            } else {
+                skip();
+            }
+        } while (eat(','));
+        expect('}');
+        return r;
+    }
+
+    //一个值的原文, 字符串去掉引号
+    std::string raw() {
+        ws();
+        if (i < s.size() && s[i] == '"') {
+            return string();
+        }
+        std::size_t begin = i;
+        skip();
+        return s.substr(begin, i - begin);
+    }
+
+    void context(std::map<std::string, std::string>& out) {
+        expect('{');
+        if (eat('}')) {
+            return;
+        }
+        do {
+            std::string key = string();
+            expect(':');
+            out[key] = raw();
+        } while (eat(','));
+        expect('}');
+    }
+
+    std::vector<zfx_bench::Result> file(std::map<std::string, std::string>& ctx) {
+        std::vector<zfx_bench::Result> out;
+        expect('{');
+        do {
+            std::string key = string();
+            expect(':');
+            if (key == "context") {
+                context(ctx);
+                continue;
+            }
+            if (key != "benchmarks") {
+                skip();
+                continue;
+            }
+            expect('[');
+            if (eat(']')) {
+                continue;
+            }
+            do {
+                out.push_back(benchmark());
+            } while (eat(','));
+            expect(']');
+        } while (eat(','));
+        expect('}');
+        return out;
+    }
+};
+
+std::vector<zfx_bench::Result> load(const std::string& path, std::map<std::string, std::string>& ctx) {
+    std::ifstream in(path);
+    if (!in) {
+        std::fprintf(stderr, "cannot read %s\n", path.c_str());
+        std::exit(2);
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    Reader r{ss.str()};
+    return r.file(ctx);
+}
+
+//影响结果的context字段, timestamp不算
+constexpr const char* kContextKeys[] = {"compiler", "assertions", "hardware_threads"};
+
+/*
+ * 同一个程序跑了几次的结果, 每项取min_ns最小的那次
+ * 跑了不止一次的话spread_pct记下最慢的那次比最快的慢了百分之几
+ * */
+std::vector<zfx_bench::Result> best(const std::vector<std::string>& files, std::map<std::string, std::string>& ctx) {
+    std::vector<std::string> order;
+    std::map<std::string, std::vector<zfx_bench::Result>> runs;
+    for (std::size_t f = 0; f < files.size(); f++) {
+        std::map<std::string, std::string> c;
+        for (auto& r : load(files[f], c)) {
+            if (runs[r.name].empty()) {
+                order.push_back(r.name);
+            }
+            runs[r.name].push_back(std::move(r));
+        }
+        for (const char* key : kContextKeys) {
+            if (f > 0 && c[key] != ctx[key]) {
+                std::fprintf(stderr, "context differs: %s is \"%s\" in %s but \"%s\" in %s\n", key,
+                             ctx[key].c_str(), files[0].c_str(), c[key].c_str(), files[f].c_str());
+                std::exit(2);
+            }
+        }
+        ctx = c;
+    }
+    std::vector<zfx_bench::Result> out;
+    for (auto const& name : order) {
+        auto& rs = runs[name];
+        std::sort(rs.begin(), rs.end(), [](auto const& a, auto const& b) { return a.minNs < b.minNs; });
+        zfx_bench::Result r = rs.front();
+        if (rs.size() > 1) {
+            r.counters.emplace_back("spread_pct", r.minNs > 0 ? (rs.back().minNs / r.minNs - 1) * 100 : 0);
+        }
+        out.push_back(std::move(r));
+    }
+    return out;
+}
+
+double counter(const zfx_bench::Result& r, const std::string& key, double fallback) {
+    for (auto const& [k, v] : r.counters) {
+        if (k == key) {
+            return v;
+        }
+    }
+    return fallback;
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> files;
+    double threshold = 10;
+    double noise = 3;
+    bool update = false;
+    bool all = false;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--threshold" && i + 1 < argc) {
+            threshold = std::atof(argv[++i]);
+        } else if (a == "--noise" && i + 1 < argc) {
+            noise = std::atof(argv[++i]);
+        } else if (a == "--all") {
+            all = true;
+        } else if (a == "--update") {
+            update = true;
+        } else if (!a.empty() && a[0] != '-') {
+            files.push_back(a);
+        } else {
+            files.clear();
+            break;
+        }
+    }
+    if (files.size() < 2) {
+        std::fprintf(stderr, "usage: %s baseline.json current.json... [--threshold pct] [--noise k] [--all] [--update]\n",
+                     argv[0]);
+        return 2;
+    }
+
+    std::map<std::string, std::string> baseCtx, curCtx;
+    auto base = load(files[0], baseCtx);
+    auto cur = best(std::vector<std::string>(files.begin() + 1, files.end()), curCtx);
+
+    if (update) {
+        std::map<std::string, double> kept, spreads;
+        for (auto const& r : base) {
+            double t = counter(r, "threshold_pct", -1);
+            if (t >= 0) {
+                kept[r.name] = t;
+            }
+            double sp = counter(r, "spread_pct", -1);
+            if (sp >= 0) {
+                spreads[r.name] = sp;
+            }
+        }
+        for (auto& r : cur) {
+            //只跑了一次的话没有波动可算, 沿用原来的
+            if (files.size() == 2 && spreads.count(r.name)) {
+                r.counters.emplace_back("spread_pct", spreads[r.name]);
+            }
+            auto it = kept.find(r.name);
+            if (it != kept.end()) {
+                r.counters.emplace_back("threshold_pct", it->second);
+            }
+        }
+        zfx_bench::writeJson(files[0], cur);
+        std::printf("updated %s with %zu benchmarks from %zu run(s)\n", files[0].c_str(), cur.size(), files.size() - 1);
+        return 0;
+    }
+
+    std::map<std::string, const zfx_bench::Result*> byName;
+    for (auto const& r : cur) {
+        byName[r.name] = &r;
+    }
+
+    bool comparable = true;
+    for (const char* key : kContextKeys) {
+        if (baseCtx[key] != curCtx[key]) {
+            std::fprintf(stderr, "context differs: %s is \"%s\" in %s but \"%s\" in %s\n", key, baseCtx[key].c_str(),
+                         files[0].c_str(), curCtx[key].c_str(), files[1].c_str());
+            comparable = false;
+        }
+    }
+    if (!comparable) {
+        std::fprintf(stderr, "refusing to compare, regenerate the baseline on this machine with --update (cmake target bench_baseline)\n");
+        return 2;
+    }
+
+    int regressions = 0, missing = 0;
+    std::printf("%-40s %14s %14s %9s %9s  %s\n", "benchmark", "baseline min", "current min", "change", "allowed", "");
+    for (auto const& b : base) {
+        auto it = byName.find(b.name);
+        if (it == byName.end()) {
+            std::printf("%-40s %14.3f %14s %9s %9s  MISSING\n", b.name.c_str(), b.minNs, "-", "-", "-");
+            missing++;
+            continue;
+        }
+        const zfx_bench::Result& c = *it->second;
+        double change = b.minNs > 0 ? (c.minNs / b.minNs - 1) * 100 : 0;
+        double allowed = std::max({counter(b, "threshold_pct", threshold), noise * (b.madPct + c.madPct),
+                                   counter(b, "spread_pct", 0)});
+        const char* verdict = "";
+        if (change > allowed) {
+            verdict = "REGRESSION";
+            regressions++;
+        } else if (change < -allowed) {
+            verdict = "faster";
+        }
+        if (all || *verdict) {
+            std::printf("%-40s %14.3f %14.3f %+8.1f%% %8.1f%%  %s\n", b.name.c_str(), b.minNs, c.minNs, change,
+                        allowed, verdict);
+        }
+        byName.erase(it);
+    }
+    for (auto const& [name, r] : byName) {
+        std::printf("%-40s %14s %14.3f %9s %9s  new\n", name.c_str(), "-", r->minNs, "-", "-");
+    }
+
+    if (regressions || missing) {
+        std::printf("\n%d regression(s), %d missing benchmark(s)\n", regressions, missing);
+        return 1;
+    }
+    std::printf("\nno regressions in %zu benchmarks\n", base.size());
+    return 0;
+}
@@ -0,0 +1,737 @@
+//
+// Created by admin on 2022/9/18.
+//
+/*
+ * 端到端的负载测试, 每个负载是一段有代表性的特效脚本和一个手写的C++版本
+ * 编译器还不能用, 脚本是照着编译器会生成的样子手写的字节码, 注释里是对应的zfx源码
+ * 每个负载对每种点数跑一遍C++基准和几种执行方式:
+ *   cpp     手写C++, 单线程, 噪声和随机数调用同一套lane函数
+ *   st      zfx_run, 单线程float程序
+ *   mt      zfx_runparallel, 线程数是硬件线程数
+ *   double  zfx_run, double程序
+ * 报告每秒多少个点, 每个点读写多少字节, 以及相对cpp慢多少倍(ratio_vs_cpp, 越接近1越好)
+ * 所有负载只读输入属性, 结果写到单独的输出属性, 重复执行的时候数据不会漂移
+ * zfx的每种执行方式第一次跑完都要和cpp的输出对一遍, 对不上直接退出
+ *
+ * --roofline 对每个zfx结果再打印一份roofline报告, 看离带宽或者浮点的上限还有多远, 见zroofline.h
+ *
+ * zfx_workloads [--points 10000,1000000] [--modes cpp,st,mt,double] [--roofline] [通用参数见bench.h]
+ * 1亿个点每种数值类型要好几GB内存
+ * */
+#include "bench.h"
+#include "zfx/ZFXModule.h"
+#include "zfx/VM/zapi.h"
+#include "zfx/VM/zbuiltins.h"
+#include "zfx/VM/zmetrics.h"
+#include "zfx/VM/zpar.h"
+#include "zfx/VM/zroofline.h"
+#include <cmath>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+
+using namespace zeno::zfx;
+using zeno::bit_cast;
+
+namespace {
+
+//手写字节码用的小工具, 跳转偏移相对下一条指令, 按字算
+struct Asm {
+    std::vector<std::uint32_t> code;
+
+    void op(OpCode o, int a, int b = 0, int c = 0) {
+        code.push_back(ZFX_INSN_ABC(o, a, b, c));
+    }
+
+    void vec(OpCode o, int a, int b, int c, int w, int d = 0, int f = 0) {
+        op(o, a, b, c);
+        code.push_back(ZFX_INSN_EXT(w, d, f));
+    }
+
+    void constant(int a, float v) {
+        op(OpCode::kLoadConstFloat, a);
+        code.push_back(bit_cast<std::uint32_t>(v));
+    }
+
+    void integer(int a, int v) {
+        op(OpCode::kLoadConstInt, a);
+        code.push_back(static_cast<std::uint32_t>(v));
+    }
+
+    void call(int a, const char* fn, int c) {
+        op(OpCode::kFastCall, a, zfx_findCFunction(fn), c);
+    }
+
+    int here() const {
+        return static_cast<int>(code.size());
+    }
+
+    //先空着偏移, 知道目标以后再patch
+    int jumpIfNot(int a) {
+        code.push_back(ZFX_INSN_AsBx(OpCode::kJumpIfNot, a, 0));
+        return here() - 1;
+    }
+
+    void patch(int at) {
+        code[at] = ZFX_INSN_AsBx(OpCode::kJumpIfNot, ZFX_INSN_A(code[at]), here() - (at + 1));
+    }
+
+    void jumpTo(int target) {
+        code.push_back(ZFX_INSN_AsBx(OpCode::kJump, 0, target - (here() + 1)));
+    }
+};
+
+//点数据, 每个属性一个数组, double程序用d里的副本
+struct Points {
+    std::size_t n = 0;
+    std::vector<std::vector<float>> f;
+    std::vector<std::vector<double>> d;
+    std::vector<float> table;       //ramp用的颜色表
+};
+
+constexpr int kRampSize = 256;
+constexpr std::size_t kGridWidth = 1024;
+
+float clampf(float x, float lo, float hi) {
+    return x < lo ? lo : (x > hi ? hi : x);
+}
+
+//id按位存在属性里, 1亿个点也不会丢精度, 宿主函数按int参数读回来
+void fillIds(Points& pts, int k) {
+    for (std::size_t i = 0; i < pts.n; i++) {
+        pts.f[k][i] = bit_cast<float>(static_cast<std::int32_t>(i));
+    }
+}
+
+void fillUniform(Points& pts, int k, float lo, float hi, unsigned seed) {
+    std::mt19937 g(seed);
+    std::uniform_real_distribution<float> u(lo, hi);
+    for (auto& x : pts.f[k]) {
+        x = u(g);
+    }
+}
+
+struct Workload {
+    const char* name;
+    const char* source;     //对应的zfx脚本, 只是给人看的
+    int nattrs;
+    int reads, writes;      //每个点读写几个属性, 用来算bytes/point, 输出属性都放在最后
+    int idattr;             //按位存id的属性, 没有的话是-1
+    void (*init)(Points&);
+    Proto (*program)();
+    void (*cpp)(Points&);
+    void (*bind)(zfx_State*, Points&);
+};
+
+/*
+ * 粒子沿curl noise平流
+ *   @v1 = @v + curl(@P * 0.5) * 0.04; @P1 = @P + @v1 * 0.04;
+ * 属性: P(0-2) v(3-5) -> P1(6-8) v1(9-11)
+ * */
+void advectInit(Points& pts) {
+    for (int k = 0; k < 3; k++) {
+        fillUniform(pts, k, -10, 10, 10 + k);
+        fillUniform(pts, 3 + k, -1, 1, 20 + k);
+    }
+}
+
+Proto advectProgram() {
+    Asm a;
+    for (int k = 0; k < 6; k++) {
+        a.op(OpCode::kLoadPtr, k, k);
+    }
+    a.constant(6, 0.5f);
+    a.constant(7, 0.04f);
+    for (int k = 0; k < 3; k++) {
+        a.op(OpCode::kMultiply, 8 + k, k, 6);
+    }
+    a.call(11, "curl", 8);
+    for (int k = 0; k < 3; k++) {
+        a.op(OpCode::kMultiply, 14, 11 + k, 7);
+        a.op(OpCode::kPlus, 3 + k, 3 + k, 14);
+        a.op(OpCode::kMultiply, 14, 3 + k, 7);
+        a.op(OpCode::kPlus, k, k, 14);
+        a.op(OpCode::kStorePtr, k, 6 + k);
+        a.op(OpCode::kStorePtr, 3 + k, 9 + k);
+    }
+    Proto p;
+    p.nregs = 16;
+    p.syms = {"P.x", "P.y", "P.z", "v.x", "v.y", "v.z", "P1.x", "P1.y", "P1.z", "v1.x", "v1.y", "v1.z"};
+    p.code = std::move(a.code);
+    return p;
+}
+
+void advectCpp(Points& pts) {
+    float c[3][ZFX_LANES], q[3][ZFX_LANES];
+    for (std::size_t b = 0; b < pts.n; b += ZFX_LANES) {
+        int m = static_cast<int>(std::min<std::size_t>(ZFX_LANES, pts.n - b));
+        for (int k = 0; k < 3; k++) {
+            const float* p = pts.f[k].data() + b;
+            for (int i = 0; i < m; i++) {
+                q[k][i] = p[i] * 0.5f;
+            }
+        }
+        float* out[] = {c[0], c[1], c[2]};
+        const float* in[] = {q[0], q[1], q[2]};
+        zfx_vcurl(out, in, m);
+        for (int k = 0; k < 3; k++) {
+            const float* p = pts.f[k].data() + b;
+            const float* v = pts.f[3 + k].data() + b;
+            float* p1 = pts.f[6 + k].data() + b;
+            float* v1 = pts.f[9 + k].data() + b;
+            for (int i = 0; i < m; i++) {
+                float nv = v[i] + c[k][i] * 0.04f;
+                v1[i] = nv;
+                p1[i] = p[i] + nv * 0.04f;
+            }
+        }
+    }
+}
+
+/*
+ * 颜色ramp
+ *   @Cd = sample(ramp, clamp(@h, 0, 1));
+ * 属性: h(0) -> Cd(1-3)
+ * */
+void rampInit(Points& pts) {
+    fillUniform(pts, 0, -0.1f, 1.1f, 30);
+    pts.table.resize(kRampSize * 3);
+    for (int i = 0; i < kRampSize; i++) {
+        float t = static_cast<float>(i) / (kRampSize - 1);
+        pts.table[i * 3] = t;
+        pts.table[i * 3 + 1] = t * t;
+        pts.table[i * 3 + 2] = 1 - t;
+    }
+}
+
+Proto rampProgram() {
+    Asm a;
+    a.op(OpCode::kLoadPtr, 0, 0);
+    a.vec(OpCode::kSample, 1, 0, 0, 0, 0, ZFX_SAMPLE_LINEAR);
+    for (int k = 0; k < 3; k++) {
+        a.op(OpCode::kStorePtr, 1 + k, 1 + k);
+    }
+    Proto p;
+    p.nregs = 4;
+    p.syms = {"h", "Cd.x", "Cd.y", "Cd.z"};
+    p.tables = {"ramp"};
+    p.code = std::move(a.code);
+    return p;
+}
+
+void rampCpp(Points& pts) {
+    const float* h = pts.f[0].data();
+    const float* t = pts.table.data();
+    float* out[] = {pts.f[1].data(), pts.f[2].data(), pts.f[3].data()};
+    for (std::size_t i = 0; i < pts.n; i++) {
+        float u = clampf(h[i], 0, 1) * (kRampSize - 1);
+        int j = static_cast<int>(u);
+        int j1 = j + 1 < kRampSize ? j + 1 : j;
+        float f = u - static_cast<float>(j);
+        for (int k = 0; k < 3; k++) {
+            out[k][i] = t[j * 3 + k] * (1 - f) + t[j1 * 3 + k] * f;
+        }
+    }
+}
+
+void rampBind(zfx_State* l, Points& pts) {
+    zfx_Table t;
+    t.data = pts.table;
+    t.size[0] = kRampSize;
+    t.channels = 3;
+    zfx_bindTable(l, 0, t);
+}
+
+/*
+ * 沿法线做噪声位移
+ *   @P1 = @P + @N * fbm(@P * 0.3, 4, 2, 0.5) * 0.2;
+ * 属性: P(0-2) N(3-5) -> P1(6-8)
+ * */
+void displaceInit(Points& pts) {
+    for (int k = 0; k < 3; k++) {
+        fillUniform(pts, k, -10, 10, 40 + k);
+    }
+    std::mt19937 g(45);
+    std::normal_distribution<float> u;
+    for (std::size_t i = 0; i < pts.n; i++) {
+        float x = u(g), y = u(g), z = u(g);
+        float s = 1 / std::sqrt(x * x + y * y + z * z + 1e-20f);
+        pts.f[3][i] = x * s;
+        pts.f[4][i] = y * s;
+        pts.f[5][i] = z * s;
+    }
+}
+
+Proto displaceProgram() {
+    Asm a;
+    for (int k = 0; k < 6; k++) {
+        a.op(OpCode::kLoadPtr, k, k);
+    }
+    a.constant(6, 0.3f);
+    for (int k = 0; k < 3; k++) {
+        a.op(OpCode::kMultiply, 7 + k, k, 6);
+    }
+    a.constant(10, 4);
+    a.constant(11, 2);
+    a.constant(12, 0.5f);
+    a.call(13, "fbm3", 7);
+    a.constant(14, 0.2f);
+    a.op(OpCode::kMultiply, 13, 13, 14);
+    for (int k = 0; k < 3; k++) {
+        a.op(OpCode::kMultiply, 15, 3 + k, 13);
+        a.op(OpCode::kPlus, 15, k, 15);
+        a.op(OpCode::kStorePtr, 15, 6 + k);
+    }
+    Proto p;
+    p.nregs = 16;
+    p.syms = {"P.x", "P.y", "P.z", "N.x", "N.y", "N.z", "P1.x", "P1.y", "P1.z"};
+    p.code = std::move(a.code);
+    return p;
+}
+
+void displaceCpp(Points& pts) {
+    float q[3][ZFX_LANES], h[ZFX_LANES];
+    static const std::vector<float> octaves(ZFX_LANES, 4), lacunarity(ZFX_LANES, 2), gain(ZFX_LANES, 0.5f);
+    for (std::size_t b = 0; b < pts.n; b += ZFX_LANES) {
+        int m = static_cast<int>(std::min<std::size_t>(ZFX_LANES, pts.n - b));
+        for (int k = 0; k < 3; k++) {
+            const float* p = pts.f[k].data() + b;
+            for (int i = 0; i < m; i++) {
+                q[k][i] = p[i] * 0.3f;
+            }
+        }
+        const float* in[] = {q[0], q[1], q[2]};
+        zfx_vfbm(h, 3, in, octaves.data(), lacunarity.data(), gain.data(), m);
+        for (int k = 0; k < 3; k++) {
+            const float* p = pts.f[k].data() + b;
+            const float* nrm = pts.f[3 + k].data() + b;
+            float* p1 = pts.f[6 + k].data() + b;
+            for (int i = 0; i < m; i++) {
+                p1[i] = p[i] + nrm[i] * (h[i] * 0.2f);
+            }
+        }
+    }
+}
+
+/*
+ * 分支和遮罩
+ *   float v = cos(@P.z);
+ *   if (@P.y > 0) v = sin(@P.x);
+ *   @mask = rand(@id, 7) < 0.3 ? v : 0;
+ * 属性: P(0-2) id(3) -> mask(4)
+ * if编译成kJumpIfNot加上按条件混合, 没有lane走进去的时候整段跳过
+ * */
+void branchInit(Points& pts) {
+    for (int k = 0; k < 3; k++) {
+        fillUniform(pts, k, -10, 10, 50 + k);
+    }
+    fillIds(pts, 3);
+}
+
+Proto branchProgram() {
+    Asm a;
+    for (int k = 0; k < 4; k++) {
+        a.op(OpCode::kLoadPtr, k, k);
+    }
+    a.constant(4, 0);
+    a.op(OpCode::kCmpGreaterThan, 5, 1, 4);
+    a.call(6, "cos", 2);
+    int skip = a.jumpIfNot(5);
+    a.call(7, "sin", 0);
+    a.vec(OpCode::kLerp, 6, 6, 7, 1, 5);
+    a.patch(skip);
+    a.op(OpCode::kAssign, 8, 3);
+    a.integer(9, 7);
+    a.call(10, "rand", 8);
+    a.constant(11, 0.3f);
+    a.op(OpCode::kCmpLessThan, 10, 10, 11);
+    a.op(OpCode::kMultiply, 6, 6, 10);
+    a.op(OpCode::kStorePtr, 6, 4);
+    Proto p;
+    p.nregs = 12;
+    p.syms = {"P.x", "P.y", "P.z", "id", "mask"};
+    p.code = std::move(a.code);
+    return p;
+}
+
+void branchCpp(Points& pts) {
+    float r[ZFX_LANES];
+    int id[ZFX_LANES], seed[ZFX_LANES];
+    std::fill(seed, seed + ZFX_LANES, 7);
+    for (std::size_t b = 0; b < pts.n; b += ZFX_LANES) {
+        int m = static_cast<int>(std::min<std::size_t>(ZFX_LANES, pts.n - b));
+        for (int i = 0; i < m; i++) {
+            id[i] = bit_cast<std::int32_t>(pts.f[3][b + i]);
+        }
+        zfx_vrand(r, id, seed, m);
+        const float* x = pts.f[0].data() + b;
+        const float* y = pts.f[1].data() + b;
+        const float* z = pts.f[2].data() + b;
+        float* out = pts.f[4].data() + b;
+        for (int i = 0; i < m; i++) {
+            float v = y[i] > 0 ? std::sin(x[i]) : std::cos(z[i]);
+            out[i] = r[i] < 0.3f ? v : 0;
+        }
+    }
+}
+
+/*
+ * 网格上的邻居平滑, 邻居通过宿主函数读, 这是zfx里访问别的点的唯一办法
+ *   @f1 = smooth(f, @id);
+ * 属性: f(0) id(1) -> f1(2), f同时作为资源0传进去
+ * */
+float wl_smooth(span<float const> f, int id) {
+    auto n = static_cast<std::int64_t>(f.size());
+    auto w = static_cast<std::int64_t>(kGridWidth);
+    auto at = [&](std::int64_t j) {
+        return f[static_cast<std::size_t>(j < 0 ? 0 : (j >= n ? n - 1 : j))];
+    };
+    std::int64_t i = id;
+    return 0.5f * f[static_cast<std::size_t>(i)] + 0.125f * (at(i - 1) + at(i + 1) + at(i - w) + at(i + w));
+}
+
+void smoothInit(Points& pts) {
+    fillUniform(pts, 0, 0, 1, 60);
+    fillIds(pts, 1);
+}
+
+Proto smoothProgram() {
+    Asm a;
+    a.integer(0, 0);
+    a.op(OpCode::kLoadPtr, 1, 1);
+    a.call(2, "wl_smooth", 0);
+    a.op(OpCode::kStorePtr, 2, 2);
+    Proto p;
+    p.nregs = 3;
+    p.syms = {"f", "id", "f1"};
+    p.code = std::move(a.code);
+    return p;
+}
+
+void smoothCpp(Points& pts) {
+    span<float const> f = pts.f[0];
+    float* out = pts.f[2].data();
+    for (std::size_t i = 0; i < pts.n; i++) {
+        out[i] = wl_smooth(f, static_cast<int>(i));
+    }
+}
+
+void smoothBind(zfx_State* l, Points& pts) {
+    zfx_addResource(l, pts.f[0]);
+}
+
+/*
+ * 迭代求解, 每个点是一个阻尼弹簧, 显式积分16步
+ *   float x = @x, v = @v;
+ *   for (int i = 0; i < 16; i++) { v += (-40 * x - 2 * v) * 0.01; x += v * 0.01; }
+ *   @x1 = x; @v1 = v;
+ * 属性: x(0) v(1) -> x1(2) v1(3)
+ * */
+void solverInit(Points& pts) {
+    fillUniform(pts, 0, -1, 1, 70);
+    fillUniform(pts, 1, -1, 1, 71);
+}
+
+Proto solverProgram() {
+    Asm a;
+    a.op(OpCode::kLoadPtr, 0, 0);
+    a.op(OpCode::kLoadPtr, 1, 1);
+    a.constant(2, 0);
+    a.constant(3, 16);
+    a.constant(4, 1);
+    a.constant(5, -40);
+    a.constant(6, 2);
+    a.constant(7, 0.01f);
+    int loop = a.here();
+    a.op(OpCode::kCmpLessThan, 8, 2, 3);
+    int exit = a.jumpIfNot(8);
+    a.op(OpCode::kMultiply, 9, 0, 5);
+    a.op(OpCode::kMultiply, 10, 1, 6);
+    a.op(OpCode::kMinus, 9, 9, 10);
+    a.op(OpCode::kMultiply, 9, 9, 7);
+    a.op(OpCode::kPlus, 1, 1, 9);
+    a.op(OpCode::kMultiply, 9, 1, 7);
+    a.op(OpCode::kPlus, 0, 0, 9);
+    a.op(OpCode::kPlus, 2, 2, 4);
+    a.jumpTo(loop);
+    a.patch(exit);
+    a.op(OpCode::kStorePtr, 0, 2);
+    a.op(OpCode::kStorePtr, 1, 3);
+    Proto p;
+    p.nregs = 11;
+    p.syms = {"x", "v", "x1", "v1"};
+    p.code = std::move(a.code);
+    return p;
+}
+
+void solverCpp(Points& pts) {
+    const float* x0 = pts.f[0].data();
+    const float* v0 = pts.f[1].data();
+    float* x1 = pts.f[2].data();
+    float* v1 = pts.f[3].data();
+    for (std::size_t i = 0; i < pts.n; i++) {
+        float x = x0[i], v = v0[i];
+        for (int k = 0; k < 16; k++) {
+            v += (-40 * x - 2 * v) * 0.01f;
+            x += v * 0.01f;
+        }
+        x1[i] = x;
+        v1[i] = v;
+    }
+}
+
+const Workload kWorkloads[] = {
+    {"advect", "@v1 = @v + curl(@P * 0.5) * 0.04; @P1 = @P + @v1 * 0.04;", 12, 6, 6, -1,
+     advectInit, advectProgram, advectCpp, nullptr},
+    {"ramp", "@Cd = sample(ramp, clamp(@h, 0, 1));", 4, 1, 3, -1, rampInit, rampProgram, rampCpp, rampBind},
+    {"displace", "@P1 = @P + @N * fbm(@P * 0.3, 4, 2, 0.5) * 0.2;", 9, 6, 3, -1,
+     displaceInit, displaceProgram, displaceCpp, nullptr},
+    {"branch", "v = @P.y > 0 ? sin(@P.x) : cos(@P.z); @mask = rand(@id, 7) < 0.3 ? v : 0;", 5, 4, 1, 3,
+     branchInit, branchProgram, branchCpp, nullptr},
+    {"smooth", "@f1 = smooth(f, @id);", 3, 2, 1, 1, smoothInit, smoothProgram, smoothCpp, smoothBind},
+    {"solver", "16 steps of a damped spring per point", 4, 2, 2, -1, solverInit, solverProgram, solverCpp, nullptr},
+};
+
+//double程序的属性是一份按位转换过的副本, id这种按位存的属性要保持整数值
+void makeDouble(Points& pts, const Workload& w) {
+    pts.d.assign(w.nattrs, std::vector<double>(pts.n));
+    for (int k = 0; k < w.nattrs; k++) {
+        for (std::size_t i = 0; i < pts.n; i++) {
+            if (k == w.idattr) {
+                pts.d[k][i] = bit_cast<double>(static_cast<std::int64_t>(bit_cast<std::int32_t>(pts.f[k][i])));
+            } else {
+                pts.d[k][i] = pts.f[k][i];
+            }
+        }
+    }
+}
+
+struct Config {
+    std::vector<std::size_t> points = {10000, 1000000};
+    std::vector<std::string> modes = {"cpp", "st", "mt", "double"};
+    bool roofline = false;
+};
+
+template <class T>
+std::vector<T> split(const std::string& s) {
+    std::vector<T> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            std::stringstream is(item);
+            T v{};
+            is >> v;
+            out.push_back(v);
+        }
+    }
+    return out;
+}
+
+std::string pretty(std::size_t n) {
+    if (n % 1000000 == 0) {
+        return std::to_string(n / 1000000) + "M";
+    }
+    if (n % 1000 == 0) {
+        return std::to_string(n / 1000) + "K";
+    }
+    return std::to_string(n);
+}
+
+bool has(const Config& cfg, const std::string& mode) {
+    return std::find(cfg.modes.begin(), cfg.modes.end(), mode) != cfg.modes.end();
+}
+
+//C++版本的输出, 每个输出属性一个数组
+using Expected = std::vector<std::vector<float>>;
+
+Expected expected(const Workload& w, const Points& pts) {
+    Points ref = pts;
+    w.cpp(ref);
+    return Expected(ref.f.end() - w.writes, ref.f.end());
+}
+
+//sin, fbm这些内置函数和libm不是逐位一样的, solver还要迭代16步, 按相对误差比
+constexpr double kTolerance = 1e-3;
+
+bool matches(const Workload& w, const Points& pts, const Expected& want, bool dbl, const std::string& name) {
+    for (int k = 0; k < w.writes; k++) {
+        int attr = w.nattrs - w.writes + k;
+        for (std::size_t i = 0; i < pts.n; i++) {
+            double got = dbl ? pts.d[attr][i] : pts.f[attr][i];
+            double ref = want[k][i];
+            if (!(std::fabs(got - ref) <= kTolerance * std::max(1.0, std::fabs(ref)))) {
+                std::fprintf(stderr, "%s: attribute %d point %zu is %g, C++ gives %g\n", name.c_str(), attr, i, got, ref);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * 第一次执行完先和C++的结果对一遍, 对不上就退出, 不然测出来的速度没有意义
+ * 顺便从运行时指标里记下每批执行了多少条指令, roofline估计有循环的程序的浮点运算数要用
+ * */
+void addZfx(const std::string& name, const Workload& w, const std::shared_ptr<Points>& pts,
+            const std::shared_ptr<const Expected>& want, std::shared_ptr<const Module> module, bool dbl, int threads,
+            std::map<std::string, double>& insnsPerBatch) {
+    double bytes = static_cast<double>(w.reads + w.writes) * (dbl ? sizeof(double) : sizeof(float));
+    auto checked = std::make_shared<bool>(false);
+    zfx_bench::add(name, static_cast<double>(pts->n), bytes * static_cast<double>(pts->n),
+                   [&w, name, pts, want, module, dbl, threads, checked, &insnsPerBatch](std::uint64_t iters) {
+                       zfx_State* l = zfx_newstate(module);
+                       for (int k = 0; k < w.nattrs; k++) {
+                           if (dbl) {
+                               zfx_bindAttribute(l, k, pts->d[k]);
+                           } else {
+                               zfx_bindAttribute(l, k, pts->f[k]);
+                           }
+                       }
+                       if (w.bind) {
+                           w.bind(l, *pts);
+                       }
+                       for (std::uint64_t i = 0; i < iters; i++) {
+                           zfx_Metrics before;
+                           if (!*checked) {
+                               before = zfx_getMetrics();
+                           }
+                           int s = threads > 1 ? zfx_runparallel(l, pts->n, threads)
+                                               : zfx_run(l, &module->main(), pts->n);
+                           if (s != ZFX_OK) {
+                               std::fprintf(stderr, "zfx error %d\n", s);
+                               std::exit(1);
+                           }
+                           if (!*checked) {
+                               zfx_Metrics after = zfx_getMetrics();
+                               auto delta = [&](Zfx_Metric m) {
+                                   return static_cast<double>(after[m] - before[m]);
+                               };
+                               if (delta(Zfx_Metric::kBatches) > 0) {
+                                   insnsPerBatch[name] = delta(Zfx_Metric::kInstructions) / delta(Zfx_Metric::kBatches);
+                               }
+                               if (!matches(w, *pts, *want, dbl, name)) {
+                                   std::exit(1);
+                               }
+                               *checked = true;
+                           }
+                       }
+                       zfx_close(l);
+                   });
+}
+}
+
+int main(int argc, char** argv) {
+    Config cfg;
+    auto opt = zfx_bench::parse(argc, argv, [&](const std::string& arg, const std::function<std::string()>& value) {
+        if (arg == "--points") {
+            cfg.points = split<std::size_t>(value());
+            return true;
+        }
+        if (arg == "--modes") {
+            cfg.modes = split<std::string>(value());
+            return true;
+        }
+        if (arg == "--roofline") {
+            cfg.roofline = true;
+            return true;
+        }
+        return false;
+    }, " [--points n,n,...] [--modes cpp,st,mt,double] [--roofline]");
+    zfx_openlibs();
+    zfx_register<&wl_smooth>("wl_smooth");
+    int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+    std::vector<zfx_bench::Result> all;
+    std::vector<std::pair<std::string, zfx_Roofline>> roofs;
+    std::map<std::string, double> insnsPerBatch;
+    bool header = true;
+    for (std::size_t n : cfg.points) {
+        for (const Workload& w : kWorkloads) {
+            std::string base = std::string("wl.") + w.name + ".";
+            std::string size = "." + pretty(n);
+            //按负载和点数分开登记, 跑完一组就释放这组数据
+            zfx_bench::registry().clear();
+            bool wanted = false;
+            for (auto const& mode : cfg.modes) {
+                wanted |= opt.filter.empty() || (base + mode + size).find(opt.filter) != std::string::npos;
+            }
+            if (!wanted) {
+                continue;
+            }
+            auto pts = std::make_shared<Points>();
+            pts->n = n;
+            pts->f.assign(w.nattrs, std::vector<float>(n));
+            w.init(*pts);
+            if (has(cfg, "cpp")) {
+                double bytes = static_cast<double>(w.reads + w.writes) * sizeof(float) * static_cast<double>(n);
+                zfx_bench::addLoop(base + "cpp" + size, static_cast<double>(n), bytes, [&w, pts] { w.cpp(*pts); });
+            }
+            auto want = std::make_shared<const Expected>(expected(w, *pts));
+            Proto p = w.program();
+            Proto pd = p;
+            pd.number = Zfx_NumberType::kDouble;
+            if (has(cfg, "st")) {
+                addZfx(base + "st" + size, w, pts, want, Module::create(p), false, 1, insnsPerBatch);
+            }
+            if (has(cfg, "mt")) {
+                addZfx(base + "mt" + size, w, pts, want, Module::create(p), false, threads, insnsPerBatch);
+            }
+            if (has(cfg, "double")) {
+                makeDouble(*pts, w);
+                addZfx(base + "double" + size, w, pts, want, Module::create(pd), true, 1, insnsPerBatch);
+            }
+            auto results = zfx_bench::runAll(opt, header);
+            header = false;
+
+            double cpp = 0;
+            for (auto const& r : results) {
+                if (r.name == base + "cpp" + size) {
+                    cpp = r.nsPerOp;
+                }
+            }
+            for (auto& r : results) {
+                r.counters.emplace_back("points", static_cast<double>(n));
+                r.counters.emplace_back("bytes_per_point", r.bytes / static_cast<double>(n));
+                bool mt = r.name.find(".mt.") != std::string::npos;
+                bool dbl = r.name.find(".double.") != std::string::npos;
+                if (mt) {
+                    r.counters.emplace_back("threads", threads);
+                }
+                if (cpp > 0) {
+                    r.counters.emplace_back("ratio_vs_cpp", r.nsPerOp / cpp);
+                }
+                if (cfg.roofline && r.name.find(".cpp.") == std::string::npos) {
+                    zfx_Roofline roof = zfx_roofline(dbl ? &pd : &p, r.itemsPerSec(), mt ? threads : 1,
+                                                     insnsPerBatch[r.name]);
+                    r.counters.emplace_back("intensity", roof.traffic.intensity());
+                    r.counters.emplace_back("roof_pct", roof.efficiency * 100);
+                    roofs.emplace_back(r.name, roof);
+                }
+                all.push_back(r);
+            }
+        }
+    }
+
+    std::printf("\n%-32s %16s %12s %12s\n", "workload", "points/s", "bytes/pt", "vs cpp");
+    for (auto const& r : all) {
+        double ratio = 0, bpp = 0;
+        for (auto const& [key, value] : r.counters) {
+            if (key == "ratio_vs_cpp") {
+                ratio = value;
+            } else if (key == "bytes_per_point") {
+                bpp = value;
+            }
+        }
+        std::printf("%-32s %16.6g %12.0f %11.2fx\n", r.name.c_str(), r.itemsPerSec(), bpp, ratio);
+    }
+    for (auto const& [name, roof] : roofs) {
+        std::printf("\nroofline %s\n", name.c_str());
+        zfx_dumpRoofline(roof, stdout);
+    }
+    if (!opt.json.empty() && !opt.list) {
+        zfx_bench::writeJson(opt.json, all);
+    }
+    return 0;
+}
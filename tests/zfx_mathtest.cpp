@@ -0,0 +1,238 @@
+//
+// Created by admin on 2022/9/27.
+//
+/*
+ * lane数学函数的误差测试, 和double的libm结果比, 检查zbuiltins.h里写的ULP上限
+ * 参数按float的位模式等距取, 从很小的数一直到适用范围的边上, 正负都有
+ * 后面还有噪声在极端参数下的检查
+ * */
+#include "zfx/VM/zbuiltins.h"
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, __func__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+using Unary = void (*)(float*, const float*, int, Zfx_MathPrecision);
+
+constexpr double kPreciseUlps = 1.0;
+constexpr double kFastUlps = 4.0;
+constexpr int kSamples = 1 << 18;
+
+float fromBits(std::uint32_t u) {
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+std::uint32_t toBits(float f) {
+    std::uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+//r和正确结果差几个ULP, ULP按舍入成float以后的结果算, 非规格化数的ULP是2^-149
+double ulps(float r, double ref) {
+    if (std::isnan(ref)) {
+        return std::isnan(r) ? 0 : INFINITY;
+    }
+    auto rf = static_cast<float>(ref);
+    if (std::isinf(rf)) {
+        return r == rf ? 0 : INFINITY;
+    }
+    float a = std::fabs(rf);
+    double u = a < FLT_MIN ? std::ldexp(1.0, -149) : std::ldexp(1.0, std::ilogb(a) - 23);
+    return std::fabs(r - ref) / u;
+}
+
+//[lo, hi]里按位模式等距取n个数, 正负各一份
+std::vector<float> sweep(float lo, float hi, int n = kSamples) {
+    std::vector<float> x;
+    std::uint32_t a = toBits(lo), b = toBits(hi);
+    std::uint32_t step = (b - a) / n + 1;
+    for (std::uint64_t u = a; u <= b; u += step) {
+        x.push_back(fromBits(static_cast<std::uint32_t>(u)));
+        x.push_back(-fromBits(static_cast<std::uint32_t>(u)));
+    }
+    x.push_back(hi);
+    x.push_back(-hi);
+    return x;
+}
+
+//flush是快速档exp的约定, 正确结果比FLT_MIN小的时候给0也算对
+double maxUlps(Unary fn, double (*ref)(double), const std::vector<float>& x, Zfx_MathPrecision prec,
+               bool flush = false) {
+    std::vector<float> out(x.size());
+    fn(out.data(), x.data(), static_cast<int>(x.size()), prec);
+    double worst = 0;
+    for (std::size_t i = 0; i < x.size(); i++) {
+        double r = ref(x[i]);
+        double e = flush && r < FLT_MIN && out[i] == 0.0f ? 0 : ulps(out[i], r);
+        if (e > worst) {
+            worst = e;
+        }
+    }
+    return worst;
+}
+
+void checkUnary(const char* name, Unary fn, double (*ref)(double), const std::vector<float>& x, bool flush = false) {
+    double precise = maxUlps(fn, ref, x, Zfx_MathPrecision::kPrecise);
+    double fast = maxUlps(fn, ref, x, Zfx_MathPrecision::kFast, flush);
+    if (!(precise <= kPreciseUlps && fast <= kFastUlps)) {
+        std::fprintf(stderr, "%s: precise %.3f ulp, fast %.3f ulp\n", name, precise, fast);
+    }
+    CHECK(precise <= kPreciseUlps);
+    CHECK(fast <= kFastUlps);
+}
+
+void testUnaryUlps() {
+    //超过1.6e6的三角函数参数直接用libm, 快速档在8192以上换double约简, 两边都要扫到
+    std::vector<float> trig = sweep(1e-30f, 1.6e6f);
+    checkUnary("sin", zfx_vsin, std::sin, trig);
+    checkUnary("cos", zfx_vcos, std::cos, trig);
+    checkUnary("tan", zfx_vtan, std::tan, trig);
+    checkUnary("asin", zfx_vasin, std::asin, sweep(1e-30f, 1.0f));
+    checkUnary("acos", zfx_vacos, std::acos, sweep(1e-30f, 1.0f));
+    checkUnary("atan", zfx_vatan, std::atan, sweep(1e-30f, 1e30f));
+    checkUnary("exp", zfx_vexp, std::exp, sweep(1e-30f, 100.0f), true);
+    std::vector<float> pos = sweep(FLT_MIN, FLT_MAX);
+    for (float& v : pos) {
+        v = std::fabs(v);
+    }
+    checkUnary("log", zfx_vlog, std::log, pos);
+}
+
+void testBinaryUlps() {
+    std::vector<float> y = sweep(1e-30f, 1e30f), x = sweep(1e-30f, 1e30f);
+    //y和x错开, 不然每对都是同一个数
+    for (std::size_t i = 0; i < x.size(); i++) {
+        x[i] = y[(i * 7919) % y.size()];
+    }
+    std::vector<float> out(x.size());
+    for (auto prec : {Zfx_MathPrecision::kPrecise, Zfx_MathPrecision::kFast}) {
+        zfx_vatan2(out.data(), y.data(), x.data(), static_cast<int>(x.size()), prec);
+        double worst = 0;
+        for (std::size_t i = 0; i < x.size(); i++) {
+            worst = std::fmax(worst, ulps(out[i], std::atan2(static_cast<double>(y[i]), static_cast<double>(x[i]))));
+        }
+        CHECK(worst <= (prec == Zfx_MathPrecision::kPrecise ? kPreciseUlps : kFastUlps));
+    }
+    //pow的底数是正数, 指数让结果大致落在float的范围里, 两个档位都走double
+    std::vector<float> base = sweep(1e-3f, 1e3f), e = sweep(1e-3f, 12.0f);
+    for (float& v : base) {
+        v = std::fabs(v);
+    }
+    std::size_t n = base.size() < e.size() ? base.size() : e.size();
+    zfx_vpow(out.data(), base.data(), e.data(), static_cast<int>(n), Zfx_MathPrecision::kPrecise);
+    double worst = 0;
+    for (std::size_t i = 0; i < n; i++) {
+        worst = std::fmax(worst, ulps(out[i], std::pow(static_cast<double>(base[i]), static_cast<double>(e[i]))));
+    }
+    CHECK(worst <= kPreciseUlps);
+}
+
+//out和x是同一个数组的时候结果也要一样, 有libm修正的lane(nan, 大参数)混在里面
+void testAlias() {
+    std::vector<float> x = sweep(1e-3f, 1e7f, 1 << 12);
+    x.push_back(NAN);
+    x.push_back(INFINITY);
+    for (Unary fn : {zfx_vsin, zfx_vexp, zfx_vlog}) {
+        for (auto prec : {Zfx_MathPrecision::kPrecise, Zfx_MathPrecision::kFast}) {
+            std::vector<float> out(x.size()), inplace = x;
+            fn(out.data(), x.data(), static_cast<int>(x.size()), prec);
+            fn(inplace.data(), inplace.data(), static_cast<int>(inplace.size()), prec);
+            CHECK(std::memcmp(out.data(), inplace.data(), out.size() * sizeof(float)) == 0);
+        }
+    }
+}
+
+//超出int范围和nan的参数以前会先转成int, 现在要原样返回
+void testFloorCeil() {
+    std::vector<float> x = {-0.5f, 0.5f, -0.0f, 2.5f, -2.5f, 8388607.5f, 3e9f, -3e9f, 1e30f, INFINITY, NAN};
+    std::vector<float> f(x.size()), c(x.size());
+    zfx_vfloor(f.data(), x.data(), static_cast<int>(x.size()));
+    zfx_vceil(c.data(), x.data(), static_cast<int>(x.size()));
+    for (std::size_t i = 0; i < x.size(); i++) {
+        if (std::isnan(x[i])) {
+            CHECK(std::isnan(f[i]) && std::isnan(c[i]));
+            continue;
+        }
+        CHECK(f[i] == std::floor(x[i]));
+        CHECK(c[i] == std::ceil(x[i]));
+        CHECK(std::signbit(f[i]) == std::signbit(std::floor(x[i])));
+    }
+}
+
+//一批里octaves不一样, 层数少的lane不能被后面几层的nan污染, 结果要和单独算的时候一样
+void testFbmOctaves() {
+    constexpr int n = 8;
+    float x[n], y[n], z[n], oct[n], lac[n], gain[n], out[n];
+    for (int i = 0; i < n; i++) {
+        x[i] = 0.37f * static_cast<float>(i) + 0.11f;
+        y[i] = 1.7f - 0.23f * static_cast<float>(i);
+        z[i] = 0.5f;
+        oct[i] = i % 2 == 0 ? 2.5f : 16.0f;
+        //第二层以后freq就溢出成inf了
+        lac[i] = 1e20f;
+        gain[i] = 0.5f;
+    }
+    const float* p[] = {x, y, z};
+    zfx_vfbm(out, 3, p, oct, lac, gain, n);
+    for (int i = 0; i < n; i++) {
+        float alone;
+        const float* q[] = {x + i, y + i, z + i};
+        zfx_vfbm(&alone, 3, q, oct + i, lac + i, gain + i, 1);
+        CHECK(out[i] == alone);
+        if (oct[i] < 3.0f) {
+            CHECK(std::isfinite(out[i]));
+        }
+    }
+}
+
+//超出int范围的坐标和nan以前会在转int的时候溢出
+void testNoiseCoords() {
+    float c[] = {3e9f, -3e9f, 1e30f, -INFINITY, NAN, 16777216.0f, 0.5f};
+    constexpr int n = sizeof(c) / sizeof(c[0]);
+    for (int dim = 1; dim <= 4; dim++) {
+        const float* p[] = {c, c, c, c};
+        float out[n];
+        zfx_vperlin(out, dim, p, n);
+        for (int i = 0; i < n; i++) {
+            CHECK(std::isnan(c[i]) || std::isfinite(out[i]));
+        }
+        zfx_vsimplex(out, dim, p, n);
+        for (int i = 0; i < n; i++) {
+            CHECK(std::isnan(c[i]) || std::isfinite(out[i]));
+        }
+    }
+}
+
+}
+
+int main() {
+    testUnaryUlps();
+    testBinaryUlps();
+    testAlias();
+    testFloorCeil();
+    testFbmOctaves();
+    testNoiseCoords();
+    if (failures != 0) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::puts("all tests passed");
+    return 0;
+}
@@ -0,0 +1,1515 @@
+//
+// Created by admin on 2022/9/27.
+//
+/*
+ * 虚拟机的回归测试, 字节码是手写的, 注释里是对应的zfx源码
+ * 每个测试是一个函数, 失败的时候打印出来, 有失败的话返回1, ctest跑的就是它
+ * */
+#include "zfx/ZFXModule.h"
+#include "zfx/VM/zapi.h"
+#include "zfx/VM/zbuiltins.h"
+#include "zfx/VM/zdo.h"
+#include "zfx/VM/zdump.h"
+#include "zfx/VM/zlut.h"
+#include "zfx/VM/zmetrics.h"
+#include "zfx/VM/zpar.h"
+#include "zfx/VM/zperf.h"
+#include "zfx/VM/zprof.h"
+#include "zfx/VM/zroofline.h"
+#include "zfx/VM/zstats.h"
+#include "zfx/VM/ztrace.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace zeno::zfx;
+using zeno::bit_cast;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, __func__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+//和bench/zfx_workloads.cpp里的一样, 跳转偏移相对下一条指令, 按字算
+struct Asm {
+    std::vector<std::uint32_t> code;
+    int nattrs = 0;
+
+    void op(OpCode o, int a, int b = 0, int c = 0) {
+        code.push_back(ZFX_INSN_ABC(o, a, b, c));
+        if (o == OpCode::kLoadPtr || o == OpCode::kStorePtr) {
+            nattrs = std::max(nattrs, b + 1);
+        }
+    }
+
+    void constant(int a, float v) {
+        op(OpCode::kLoadConstFloat, a);
+        code.push_back(bit_cast<std::uint32_t>(v));
+    }
+
+    void integer(int a, int v) {
+        op(OpCode::kLoadConstInt, a);
+        code.push_back(static_cast<std::uint32_t>(v));
+    }
+
+    //向量和矩阵指令, 后面跟扩展字
+    void vec(OpCode o, int a, int b, int c, int w, int d = 0, int f = 0) {
+        op(o, a, b, c);
+        code.push_back(ZFX_INSN_EXT(w, d, f));
+    }
+
+    int here() const {
+        return static_cast<int>(code.size());
+    }
+
+    int jumpIfNot(int a) {
+        code.push_back(ZFX_INSN_AsBx(OpCode::kJumpIfNot, a, 0));
+        return here() - 1;
+    }
+
+    int jump() {
+        code.push_back(ZFX_INSN_AsBx(OpCode::kJump, 0, 0));
+        return here() - 1;
+    }
+
+    //把at处的跳转指向下一条要生成的指令
+    void patch(int at) {
+        code[at] = ZFX_INSN_AsBx(static_cast<OpCode>(ZFX_INSN_OP(code[at])), ZFX_INSN_A(code[at]), here() - (at + 1));
+    }
+
+    void jumpTo(int target) {
+        code.push_back(ZFX_INSN_AsBx(OpCode::kJump, 0, target - (here() + 1)));
+    }
+
+    //用到的属性按下标起名, 名字在测试里没有用
+    Proto proto(std::uint32_t nregs) {
+        Proto p;
+        p.nregs = nregs;
+        for (int k = 0; k < nattrs; k++) {
+            p.syms.push_back("a" + std::to_string(k));
+        }
+        p.code = std::move(code);
+        return p;
+    }
+};
+
+std::vector<float> run(Proto p, std::vector<std::vector<float>> attrs, int out, std::size_t n) {
+    auto m = Module::create(std::move(p));
+    zfx_State* l = zfx_newstate(m);
+    for (std::size_t k = 0; k < attrs.size(); k++) {
+        attrs[k].resize(n);
+        zfx_bindAttribute(l, static_cast<int>(k), attrs[k]);
+    }
+    CHECK(zfx_runmain(l, n) == ZFX_OK);
+    zfx_close(l);
+    return attrs[out];
+}
+
+//只跑一个点, 把regs里的寄存器依次存到属性0, 1, 2...再读回来
+std::vector<float> runRegs(Asm& a, std::uint32_t nregs, const std::vector<int>& regs) {
+    for (std::size_t k = 0; k < regs.size(); k++) {
+        a.op(OpCode::kStorePtr, regs[k], static_cast<int>(k));
+    }
+    std::vector<std::vector<float>> attrs(regs.size());
+    auto m = Module::create(a.proto(nregs));
+    zfx_State* l = zfx_newstate(m);
+    for (std::size_t k = 0; k < attrs.size(); k++) {
+        attrs[k].resize(1);
+        zfx_bindAttribute(l, static_cast<int>(k), attrs[k]);
+    }
+    CHECK(zfx_runmain(l, 1) == ZFX_OK);
+    zfx_close(l);
+    std::vector<float> out;
+    for (auto const& v : attrs) {
+        out.push_back(v[0]);
+    }
+    return out;
+}
+
+bool near(const std::vector<float>& got, const std::vector<float>& want, float tol = 1e-5f) {
+    if (got.size() != want.size()) {
+        return false;
+    }
+    for (std::size_t k = 0; k < got.size(); k++) {
+        if (!(std::fabs(got[k] - want[k]) <= tol)) {
+            std::fprintf(stderr, "  [%zu] got %g want %g\n", k, got[k], want[k]);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * x = 0; while (x < @lim) x += 1; @out = x;
+ * 属性: lim(0) -> out(1)
+ * */
+Proto divergentLoop() {
+    Asm a;
+    a.op(OpCode::kLoadPtr, 0, 0);
+    a.constant(1, 0);
+    a.constant(2, 1);
+    int loop = a.here();
+    a.op(OpCode::kCmpLessThan, 3, 1, 0);
+    int exit = a.jumpIfNot(3);
+    a.op(OpCode::kPlus, 1, 1, 2);
+    a.jumpTo(loop);
+    a.patch(exit);
+    a.op(OpCode::kStorePtr, 1, 1);
+    return a.proto(4);
+}
+
+void testDivergentLoop() {
+    std::vector<float> lim = {1, 5, 3, 0};
+    auto out = run(divergentLoop(), {lim, {}}, 1, lim.size());
+    CHECK(out == lim);
+
+    //跨好几批, 每批里的次数都不一样
+    std::vector<float> many(1000);
+    for (std::size_t i = 0; i < many.size(); i++) {
+        many[i] = static_cast<float>(i * 7 % 13);
+    }
+    CHECK(run(divergentLoop(), {many, {}}, 1, many.size()) == many);
+}
+
+/*
+ * if (@x > 0) { @out = 1; } else { @out = @x * 2; } @seen = 3;
+ * 属性: x(0) -> out(1) seen(2)
+ * */
+void testDivergentIf() {
+    Asm a;
+    a.op(OpCode::kLoadPtr, 0, 0);
+    a.constant(1, 0);
+    a.op(OpCode::kCmpGreaterThan, 2, 0, 1);
+    int other = a.jumpIfNot(2);
+    a.constant(3, 1);
+    a.op(OpCode::kStorePtr, 3, 1);
+    int done = a.jump();
+    a.patch(other);
+    a.constant(3, 2);
+    a.op(OpCode::kMultiply, 3, 0, 3);
+    a.op(OpCode::kStorePtr, 3, 1);
+    a.patch(done);
+    a.constant(3, 3);
+    a.op(OpCode::kStorePtr, 3, 2);
+
+    std::vector<float> x = {1, -1, 2, -3, 0, 5};
+    std::vector<float> old = {9, 9, 9, 9, 9, 9};
+    auto m = Module::create(a.proto(4));
+    zfx_State* l = zfx_newstate(m);
+    std::vector<float> out = old, seen = old;
+    zfx_bindAttribute(l, 0, x);
+    zfx_bindAttribute(l, 1, out);
+    zfx_bindAttribute(l, 2, seen);
+    CHECK(zfx_runmain(l, x.size()) == ZFX_OK);
+    CHECK((out == std::vector<float>{1, -2, 1, -6, 0, 1}));
+    CHECK((seen == std::vector<float>{3, 3, 3, 3, 3, 3}));
+    zfx_close(l);
+}
+
+/*
+ * 没有else的if里写属性, 条件不成立的点不能被写
+ * if (@x > 0) @out = @x;
+ * */
+void testDivergentStore() {
+    Asm a;
+    a.op(OpCode::kLoadPtr, 0, 0);
+    a.constant(1, 0);
+    a.op(OpCode::kCmpGreaterThan, 2, 0, 1);
+    int skip = a.jumpIfNot(2);
+    a.op(OpCode::kStorePtr, 0, 1);
+    a.patch(skip);
+    std::vector<float> x = {1, -1, 2, -3};
+    auto out = run(a.proto(3), {x, {7, 7, 7, 7}}, 1, x.size());
+    CHECK((out == std::vector<float>{1, 7, 2, 7}));
+}
+
+/*
+ * 分叉的循环里按时间片挂起, 恢复之后每个点的结果还是对的
+ * 每个点的次数都不一样, 也不按批重复, 挂起时保存的掩码要是留给了下一批, 结果就会错
+ * 挂起之后不恢复, 直接重新执行或者调用函数, 也要从所有lane开始
+ * */
+void testDivergentYield() {
+    std::vector<float> lim(300), out(300);
+    for (std::size_t i = 0; i < lim.size(); i++) {
+        lim[i] = static_cast<float>((i * 7919 + 13) % 3001);
+    }
+    Proto p = divergentLoop();
+    //half(x) = x * 0.5
+    Asm h;
+    h.constant(1, 0.5f);
+    h.op(OpCode::kMultiply, 2, 0, 1);
+    h.op(OpCode::kReturn, 2);
+    Proto half = h.proto(3);
+    half.name = "half";
+    half.params = {Zfx_ArgKind::kFloat};
+    half.ret = Zfx_ArgKind::kFloat;
+    p.p.push_back(std::move(half));
+    auto m = Module::create(std::move(p));
+    zfx_State* l = zfx_newstate(m);
+    zfx_bindAttribute(l, 0, lim);
+    zfx_bindAttribute(l, 1, out);
+    int status = zfx_start(l, &m->main(), lim.size(), std::chrono::microseconds(50));
+    int yields = 0;
+    while (status == ZFX_YIELD) {
+        yields++;
+        status = zfx_resume(l, std::chrono::microseconds(50));
+    }
+    CHECK(status == ZFX_OK);
+    CHECK(yields > 0);
+    CHECK(out == lim);
+
+    auto f = m->get<float(float)>("half");
+    for (int k = 0; k < 20; k++) {
+        std::fill(out.begin(), out.end(), -1.0f);
+        CHECK(zfx_start(l, &m->main(), lim.size(), std::chrono::nanoseconds(0)) == ZFX_YIELD);
+        CHECK(f(l, 3) == 1.5f);
+        CHECK(zfx_runrange(l, &m->main(), 0, lim.size()) == ZFX_OK);
+        CHECK(out == lim);
+    }
+    zfx_close(l);
+}
+
+float cancelRun(float x) {
+    zfx_State* l = zfx_running();
+    if (l->cancel) {
+        l->cancel->cancel();
+    }
+    return x;
+}
+
+/*
+ * cancelRun(0); x = 0; while (x < @lim) x += 1; @out = x;
+ * 属性: lim(0) -> out(1)
+ * */
+Proto cancelledLoop() {
+    int fn = zfx_register<&cancelRun>("test.cancelRun");
+    Asm a;
+    a.op(OpCode::kLoadPtr, 0, 0);
+    a.constant(1, 0);
+    a.constant(2, 1);
+    a.op(OpCode::kFastCall, 3, fn, 1);
+    int loop = a.here();
+    a.op(OpCode::kCmpLessThan, 3, 1, 0);
+    int exit = a.jumpIfNot(3);
+    a.op(OpCode::kPlus, 1, 1, 2);
+    a.jumpTo(loop);
+    a.patch(exit);
+    a.op(OpCode::kStorePtr, 1, 1);
+    return a.proto(4);
+}
+
+//执行到一半置上取消标志, 下一次检查就停下来; 去掉令牌以后这个状态还能接着用
+void testCancelMidRun() {
+    auto m = Module::create(cancelledLoop());
+    std::vector<float> lim(64, 1e6f), out(64, -1);
+    zfx_State* l = zfx_newstate(m);
+    zfx_bindAttribute(l, 0, lim);
+    zfx_bindAttribute(l, 1, out);
+    l->cancel = std::make_shared<zfx_CancelToken>();
+    std::uint64_t cancels = zfx_getMetrics()[Zfx_Metric::kCancels];
+    CHECK(zfx_runmain(l, lim.size()) == ZFX_CANCELLED);
+    CHECK(out == std::vector<float>(64, -1));
+    CHECK(zfx_getMetrics()[Zfx_Metric::kCancels] == cancels + 1);
+
+    l->cancel = nullptr;
+    std::fill(lim.begin(), lim.end(), 3.0f);
+    CHECK(zfx_runmain(l, lim.size()) == ZFX_OK);
+    CHECK(out == lim);
+    zfx_close(l);
+}
+
+//超过截止时间: 死循环在回边上停下来, 直线程序在批之间停下来, 并行执行的所有线程都停下来
+void testDeadline() {
+    using clock = std::chrono::steady_clock;
+    auto m = Module::create(divergentLoop());
+    std::vector<float> lim(256, INFINITY), out(256, -1);
+    zfx_State* l = zfx_newstate(m);
+    zfx_bindAttribute(l, 0, lim);
+    zfx_bindAttribute(l, 1, out);
+    l->cancel = std::make_shared<zfx_CancelToken>();
+    l->cancel->deadline = clock::now() + std::chrono::milliseconds(5);
+    auto t0 = clock::now();
+    CHECK(zfx_runmain(l, lim.size()) == ZFX_CANCELLED);
+    l->cancel = std::make_shared<zfx_CancelToken>();
+    l->cancel->deadline = clock::now() + std::chrono::milliseconds(5);
+    CHECK(zfx_runparallel(l, lim.size(), 2) == ZFX_CANCELLED);
+    CHECK(l->cancel->cancelled.load());
+    CHECK(clock::now() - t0 < std::chrono::seconds(10));
+    zfx_close(l);
+
+    Asm a;
+    a.op(OpCode::kLoadPtr, 0, 0);
+    a.op(OpCode::kStorePtr, 0, 1);
+    m = Module::create(a.proto(1));
+    std::vector<float> x(1 << 16, 1), y(x.size(), 0);
+    l = zfx_newstate(m);
+    zfx_bindAttribute(l, 0, x);
+    zfx_bindAttribute(l, 1, y);
+    l->cancel = std::make_shared<zfx_CancelToken>();
+    l->cancel->deadline = clock::now();
+    CHECK(zfx_runmain(l, x.size()) == ZFX_CANCELLED);
+    CHECK(y[0] == 1);
+    CHECK(y.back() == 0);
+    zfx_close(l);
+}
+
+//没有循环也没有调用的程序在批之间挂起
+void testStraightLineYield() {
+    Asm a;
+    a.op(OpCode::kLoadPtr, 0, 0);
+    a.op(OpCode::kPlus, 0, 0, 0);
+    a.op(OpCode::kStorePtr, 0, 1);
+    auto m = Module::create(a.proto(1));
+    std::vector<float> x(1 << 20), out(x.size());
+    for (std::size_t i = 0; i < x.size(); i++) {
+        x[i] = static_cast<float>(i);
+    }
+    zfx_State* l = zfx_newstate(m);
+    zfx_bindAttribute(l, 0, x);
+    zfx_bindAttribute(l, 1, out);
+    int status = zfx_start(l, &m->main(), x.size(), std::chrono::microseconds(20));
+    int yields = 0;
+    while (status == ZFX_YIELD) {
+        yields++;
+        status = zfx_resume(l, std::chrono::microseconds(20));
+    }
+    CHECK(status == ZFX_OK);
+    CHECK(yields > 0);
+    bool same = true;
+    for (std::size_t i = 0; i < x.size(); i++) {
+        same = same && out[i] == 2 * x[i];
+    }
+    CHECK(same);
+    zfx_close(l);
+}
+
+/*
+ * @r = rand(@id, 7);
+ * 属性: id(0) -> r(1), id按位存int
+ * double程序里int是int64, 以前当double转成float都变成0, 每个点的随机数都一样
+ * */
+void testRandIntArgs() {
+    zfx_openlibs();
+    Asm a;
+    a.op(OpCode::kLoadPtr, 0, 0);
+    a.integer(1, 7);
+    a.op(OpCode::kFastCall, 2, zfx_findCFunction("rand"), 0);
+    a.op(OpCode::kStorePtr, 2, 1);
+    Proto pf = a.proto(3), pd = pf;
+    pd.number = Zfx_NumberType::kDouble;
+    constexpr int n = 100;
+    std::vector<float> id(n), rf(n);
+    std::vector<double> idd(n), rd(n);
+    std::vector<int> ids(n), seeds(n, 7);
+    for (int i = 0; i < n; i++) {
+        ids[i] = i;
+        id[i] = bit_cast<float>(static_cast<std::int32_t>(i));
+        idd[i] = bit_cast<double>(static_cast<std::int64_t>(i));
+    }
+    std::vector<float> ref(n);
+    zfx_vrand(ref.data(), ids.data(), seeds.data(), n);
+    auto mf = Module::create(std::move(pf)), md = Module::create(std::move(pd));
+    zfx_State* l = zfx_newstate(mf);
+    zfx_bindAttribute(l, 0, id);
+    zfx_bindAttribute(l, 1, rf);
+    CHECK(zfx_runmain(l, n) == ZFX_OK);
+    zfx_close(l);
+    l = zfx_newstate(md);
+    zfx_bindAttribute(l, 0, idd);
+    zfx_bindAttribute(l, 1, rd);
+    CHECK(zfx_runmain(l, n) == ZFX_OK);
+    zfx_close(l);
+    bool same = true;
+    for (int i = 0; i < n; i++) {
+        same = same && rf[i] == ref[i] && static_cast<float>(rd[i]) == ref[i];
+    }
+    CHECK(same);
+    CHECK(ref[0] != ref[1]);
+}
+
+/*
+ * 曲线的格点不等距的时候, 三次插值要按实际间距算切线, 线性的数据在中间的区间上要原样插出来
+ * 格点等距的时候和等距的表结果一样
+ * */
+void testCurveCubic() {
+    std::vector<float> keys = {0, 0.1f, 0.5f, 0.6f, 2, 3}, vals(keys.size());
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        vals[i] = 3 * keys[i] + 1;
+    }
+    zfx_Table t;
+    t.data = vals;
+    t.keys = keys;
+    t.size[0] = static_cast<int>(keys.size());
+    float p[ZFX_LANES], out[ZFX_LANES];
+    int n = 0;
+    for (float x = 0.1f; x < 2 && n < ZFX_LANES; x += 0.05f) {
+        p[n++] = x;
+    }
+    zfx_sample(t, out, p, n, ZFX_SAMPLE_CUBIC);
+    bool exact = true;
+    for (int i = 0; i < n; i++) {
+        exact = exact && std::fabs(out[i] - (3 * p[i] + 1)) < 1e-4f;
+    }
+    CHECK(exact);
+
+    std::vector<float> ukeys = {0, 0.25f, 0.5f, 0.75f, 1}, uvals = {0, 1, 0.5f, 2, -1};
+    zfx_Table c = t, u;
+    c.data = uvals;
+    c.keys = ukeys;
+    c.size[0] = 5;
+    u.data = uvals;
+    u.size[0] = 5;
+    n = 0;
+    for (float x = -0.1f; x < 1.1f && n < ZFX_LANES; x += 0.03f) {
+        p[n++] = x;
+    }
+    float ref[ZFX_LANES];
+    zfx_sample(c, out, p, n, ZFX_SAMPLE_CUBIC);
+    zfx_sample(u, ref, p, n, ZFX_SAMPLE_CUBIC);
+    bool same = true;
+    for (int i = 0; i < n; i++) {
+        same = same && std::fabs(out[i] - ref[i]) < 1e-5f;
+    }
+    CHECK(same);
+}
+
+//属性没有绑定或者比点数短的时候整个执行返回ZFX_ERRRUN, 不读写越界; 没有声明的属性在创建module时就拒绝
+void testAttributeBinding() {
+    Asm a;
+    a.op(OpCode::kLoadPtr, 0, 0);
+    a.op(OpCode::kStorePtr, 0, 1);
+    Proto p = a.proto(1);
+    auto m = Module::create(p);
+    std::vector<float> x(100, 1), out(100, 0), shorter(99, 0);
+    zfx_State* l = zfx_newstate(m);
+    zfx_bindAttribute(l, 0, x);
+    CHECK(zfx_runmain(l, x.size()) == ZFX_ERRRUN);
+    zfx_bindAttribute(l, 1, shorter);
+    CHECK(zfx_runmain(l, x.size()) == ZFX_ERRRUN);
+    CHECK(zfx_runparallel(l, x.size(), 2) == ZFX_ERRRUN);
+    CHECK(shorter == std::vector<float>(99, 0));
+    zfx_bindAttribute(l, 1, out);
+    CHECK(zfx_runmain(l, x.size()) == ZFX_OK);
+    CHECK(out == x);
+    zfx_close(l);
+
+    p.syms.pop_back();
+    bool threw = false;
+    try {
+        Module::create(p);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+float resourceSum(span<float const> r) {
+    float sum = 0;
+    for (float v : r) {
+        sum += v;
+    }
+    return sum;
+}
+
+/*
+ * @out = resourceSum(@which); 资源的编号是从属性读进来的, 不是登记过的编号就是运行时错误
+ * 属性: which(0) -> out(1)
+ * */
+void testResourceIndex() {
+    int fn = zfx_register<&resourceSum>("test.resourceSum");
+    Asm a;
+    a.op(OpCode::kLoadPtr, 0, 0);
+    a.op(OpCode::kFastCall, 1, fn, 0);
+    a.op(OpCode::kStorePtr, 1, 1);
+    auto m = Module::create(a.proto(2));
+    std::vector<float> data = {1, 2, 3}, which(1), out(1);
+    zfx_State* l = zfx_newstate(m);
+    zfx_bindAttribute(l, 0, which);
+    zfx_bindAttribute(l, 1, out);
+    int idx = zfx_addResource(l, data);
+    for (int bad : {idx + 1, -1, 1 << 20}) {
+        which[0] = bit_cast<float>(static_cast<std::int32_t>(bad));
+        CHECK(zfx_runmain(l, 1) == ZFX_ERRRUN);
+    }
+    which[0] = bit_cast<float>(static_cast<std::int32_t>(idx));
+    CHECK(zfx_runmain(l, 1) == ZFX_OK);
+    CHECK(out[0] == 6);
+    zfx_close(l);
+}
+
+float twice(float x) {
+    return 2 * x;
+}
+
+float thrice(float x) {
+    return 3 * x;
+}
+
+float sum2(float x, float y) {
+    return x + y;
+}
+
+//同名同签名的重新注册替换实现, 编号不变; 签名不一样的拒绝, 原来的那个还在
+void testReregister() {
+    int fn = zfx_register<&twice>("test.scale");
+    CHECK(zfx_register<&thrice>("test.scale") == fn);
+    CHECK(zfx_cfunctions()[fn].fn == (&zfx_details::signature<decltype(&thrice)>::wrapper<&thrice, float>));
+    std::size_t count = zfx_cfunctionCount();
+    bool threw = false;
+    try {
+        zfx_register<&sum2>("test.scale");
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(zfx_cfunctionCount() == count);
+    CHECK(zfx_cfunctions()[fn].args.size() == 1);
+}
+
+void quatBatch(span<float> x, span<float> y, span<float> z, span<float> w, span<float const> a) {
+    for (std::size_t i = 0; i < a.size(); i++) {
+        x[i] = a[i];
+        y[i] = a[i] + 1;
+        z[i] = a[i] + 2;
+        w[i] = a[i] + 3;
+    }
+}
+
+//四个输出的按批函数返回quat, 校验按四个寄存器算, 目的寄存器放不下的程序创建不了
+void testBatchResultKind() {
+    int fn = zfx_registerBatch<&quatBatch>("test.quatBatch");
+    CHECK(zfx_cfunctions()[fn].ret == Zfx_ArgKind::kQuat);
+    CHECK(zfx_cfunctions()[fn].nrets == 4);
+    Asm a;
+    a.op(OpCode::kLoadPtr, 0, 0);
+    a.op(OpCode::kFastCall, 2, fn, 0);
+    a.op(OpCode::kStorePtr, 4, 1);
+    bool threw = false;
+    try {
+        Module::create(a.proto(5));
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    Asm b;
+    b.op(OpCode::kLoadPtr, 0, 0);
+    b.op(OpCode::kFastCall, 2, fn, 0);
+    b.op(OpCode::kStorePtr, 5, 1);
+    std::vector<float> x = {1, 2}, out(2);
+    CHECK(run(b.proto(6), {x, out}, 1, x.size()) == (std::vector<float>{4, 5}));
+}
+
+Proto function(const char* name, std::vector<Zfx_ArgKind> params, Zfx_ArgKind ret, Asm& a, std::uint32_t nregs) {
+    Proto p = a.proto(nregs);
+    p.name = name;
+    p.params = std::move(params);
+    p.ret = ret;
+    return p;
+}
+
+/*
+ * scale(vec3 v, float s) = v * s; toFloat(int i) = float(i); noReturn(float x)没有kReturn
+ * float和double两种程序都要把参数和返回值转对
+ * */
+std::shared_ptr<const Module> handleModule(Zfx_NumberType number) {
+    Proto top;
+    top.number = number;
+    Asm s;
+    for (int k = 0; k < 3; k++) {
+        s.op(OpCode::kMultiply, 4 + k, k, 3);
+    }
+    s.op(OpCode::kReturn, 4);
+    top.p.push_back(function("scale", {Zfx_ArgKind::kVec3, Zfx_ArgKind::kFloat}, Zfx_ArgKind::kVec3, s, 7));
+    Asm t;
+    t.op(OpCode::kIntToFloat, 1, 0);
+    t.op(OpCode::kReturn, 1);
+    top.p.push_back(function("toFloat", {Zfx_ArgKind::kInt}, Zfx_ArgKind::kFloat, t, 2));
+    Asm n;
+    n.op(OpCode::kAssign, 1, 0);
+    top.p.push_back(function("noReturn", {Zfx_ArgKind::kFloat}, Zfx_ArgKind::kFloat, n, 2));
+    for (auto& sub : top.p) {
+        sub.number = number;
+    }
+    return Module::create(std::move(top));
+}
+
+template <class F>
+bool throws(F&& f) {
+    try {
+        f();
+    } catch (const std::exception&) {
+        return true;
+    }
+    return false;
+}
+
+void testFunctionHandles() {
+    for (auto number : {Zfx_NumberType::kFloat, Zfx_NumberType::kDouble}) {
+        auto m = handleModule(number);
+        zfx_State* l = zfx_newstate(m);
+        auto scale = m->get<Zfx_Vec3(Zfx_Vec3, float)>("scale");
+        Zfx_Vec3 v = scale(l, {1, -2, 0.5f}, 4);
+        CHECK(v.x == 4 && v.y == -8 && v.z == 2);
+        auto toFloat = m->get<float(int)>("toFloat");
+        CHECK(toFloat(l, -7) == -7.0f);
+        CHECK(toFloat(l, 1 << 20) == 1048576.0f);
+
+        //没有kReturn, 签名不对, 名字不存在
+        auto noReturn = m->get<float(float)>("noReturn");
+        Object* top = l->top;
+        CHECK(throws([&] { noReturn(l, 1); }));
+        CHECK(l->top == top);
+        CHECK(throws([&] { m->get<float(float)>("scale"); }));
+        CHECK(throws([&] { m->get<Zfx_Vec3(Zfx_Vec3)>("scale"); }));
+        CHECK(throws([&] { m->get<float(float)>("missing"); }));
+        zfx_close(l);
+    }
+}
+
+//栈快满了的时候在保护调用之外开不了帧, 抛异常而不是越过guard page, 栈腾出来以后照常调用
+void testFunctionStackFull() {
+    auto m = handleModule(Zfx_NumberType::kFloat);
+    auto toFloat = m->get<float(int)>("toFloat");
+    zfx_State* l = zfx_newstate(m);
+    std::vector<void*> frames;
+    for (std::size_t bytes : {std::size_t(1) << 20, std::size_t(64)}) {
+        while (zfx_hasroom(l, bytes)) {
+            frames.push_back(zfx_pushframe(l, bytes));
+        }
+    }
+    CHECK(!zfx_hasroom(l, zfx_framesize<float>(2)));
+    CHECK(throws([&] { toFloat(l, 1); }));
+    while (!frames.empty()) {
+        zfx_popframe(l, frames.back());
+        frames.pop_back();
+    }
+    CHECK(l->top == l->stack);
+    CHECK(toFloat(l, 3) == 3.0f);
+    zfx_close(l);
+}
+
+/*
+ * 每条向量指令算一个结果已知的例子
+ * r0..2 = (1, 2, 3), r3..5 = (4, 5, 6), r6 = 0.5, r7 = 2.5, r12..13 = (3, 4)
+ * */
+void testVectorOps() {
+    Asm a;
+    float init[] = {1, 2, 3, 4, 5, 6, 0.5f, 2.5f};
+    for (int k = 0; k < 8; k++) {
+        a.constant(k, init[k]);
+    }
+    a.constant(12, 3);
+    a.constant(13, 4);
+    a.vec(OpCode::kDot, 8, 0, 3, 3);
+    a.vec(OpCode::kCross, 9, 0, 3, 3);
+    a.vec(OpCode::kLength, 14, 12, 0, 2);
+    a.vec(OpCode::kDistance, 15, 0, 3, 3);
+    a.vec(OpCode::kNormalize, 16, 12, 0, 2);
+    a.vec(OpCode::kLerp, 18, 0, 3, 3, 6, ZFX_VEC_SCALAR);
+    a.vec(OpCode::kClamp, 21, 0, 6, 3, 7, ZFX_VEC_SCALAR);
+    a.vec(OpCode::kMin, 24, 3, 0, 3);
+    a.vec(OpCode::kMax, 27, 0, 7, 3, 0, ZFX_VEC_SCALAR);
+    //reflect((1, -1), (0, 1)) = (1, 1)
+    a.constant(30, 1);
+    a.constant(31, -1);
+    a.constant(32, 0);
+    a.constant(33, 1);
+    a.vec(OpCode::kReflect, 34, 30, 32, 2);
+    std::vector<int> regs;
+    for (int r = 8; r < 36; r++) {
+        if ((r < 12 || r > 13) && (r < 30 || r > 33)) {
+            regs.push_back(r);
+        }
+    }
+    auto got = runRegs(a, 36, regs);
+    CHECK(near(got, {
+        32,
+        -3, 6, -3,
+        5,
+        std::sqrt(27.0f),
+        0.6f, 0.8f,
+        2.5f, 3.5f, 4.5f,
+        1, 2, 2.5f,
+        1, 2, 3,
+        2.5f, 2.5f, 3,
+        1, 1,
+    }));
+}
+
+//扩展字里的宽度不对的指令在Module::create就被拒绝, 不会在执行时越界
+void testBadVectorWidth() {
+    struct Bad {
+        OpCode op;
+        int w;
+    };
+    for (Bad bad : {Bad{OpCode::kDot, 0}, Bad{OpCode::kNormalize, 5}, Bad{OpCode::kMin, 255},
+                    Bad{OpCode::kCross, 2}, Bad{OpCode::kCross, 4}, Bad{OpCode::kInverse, 2},
+                    Bad{OpCode::kMatMul, 0}}) {
+        Asm a;
+        a.vec(bad.op, 0, 0, 0, bad.w);
+        bool rejected = false;
+        try {
+            Module::create(a.proto(64));
+        } catch (const std::invalid_argument&) {
+            rejected = true;
+        }
+        CHECK(rejected);
+    }
+    //四元数不看宽度
+    Asm q;
+    q.vec(OpCode::kQuatMul, 0, 0, 4, 0);
+    Module::create(q.proto(8));
+}
+
+/*
+ * r0 = 0.5; r[a..] = sample(rgb, r0); 三个通道都存出来
+ * nregs = 4, a = 1的时候正好放得下三通道的表, a = 2的时候只放得下单通道的
+ * */
+Proto sampleProgram(int a) {
+    Asm s;
+    s.constant(0, 0.5f);
+    s.vec(OpCode::kSample, a, 0, 0, 0, 0, ZFX_SAMPLE_LINEAR);
+    s.op(OpCode::kStorePtr, a, 0);
+    Proto p = s.proto(4);
+    p.tables = {"rgb"};
+    return p;
+}
+
+void testSampleChannels() {
+    std::vector<float> rgb = {1, 2, 3, 1, 2, 3};
+    zfx_Table t;
+    t.data = rgb;
+    t.size[0] = 2;
+    t.channels = 3;
+    std::vector<float> out(1);
+
+    auto fits = Module::create(sampleProgram(1));
+    zfx_State* l = zfx_newstate(fits);
+    zfx_bindTable(l, 0, t);
+    zfx_bindAttribute(l, 0, out);
+    CHECK(zfx_runmain(l, 1) == ZFX_OK);
+    CHECK(out[0] == 1);
+    zfx_close(l);
+
+    //校验的时候不知道表有几个通道, 绑定的时候才拒绝
+    auto tight = Module::create(sampleProgram(2));
+    l = zfx_newstate(tight);
+    bool rejected = false;
+    try {
+        zfx_bindTable(l, 0, t);
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    CHECK(rejected);
+    zfx_bindAttribute(l, 0, out);
+    CHECK(zfx_runmain(l, 1) == ZFX_ERRRUN);
+    //绕过zfx_bindTable直接塞进去的表, 执行的时候也不能写出寄存器帧
+    l->tables.assign(1, t);
+    CHECK(zfx_runmain(l, 1) == ZFX_ERRRUN);
+    //单通道的时候数据就是1, 2, 3, ...这几个格点, 0.5在1和2正中间
+    zfx_Table mono = t;
+    mono.channels = 1;
+    zfx_bindTable(l, 0, mono);
+    out[0] = 0;
+    CHECK(zfx_runmain(l, 1) == ZFX_OK);
+    CHECK(out[0] == 1.5f);
+    zfx_close(l);
+}
+
+//把按行写的dim阶矩阵按列放进r开始的寄存器
+void loadMatrix(Asm& a, int r, int dim, std::vector<float> rows) {
+    for (int row = 0; row < dim; row++) {
+        for (int col = 0; col < dim; col++) {
+            a.constant(r + col * dim + row, rows[row * dim + col]);
+        }
+    }
+}
+
+std::vector<int> range(int r, int n) {
+    std::vector<int> regs;
+    for (int k = 0; k < n; k++) {
+        regs.push_back(r + k);
+    }
+    return regs;
+}
+
+std::vector<float> identity(int dim) {
+    std::vector<float> m(dim * dim, 0.0f);
+    for (int k = 0; k < dim; k++) {
+        m[k * dim + k] = 1;
+    }
+    return m;
+}
+
+/*
+ * 逆乘原矩阵得到单位阵, 已知矩阵的行列式
+ * mat4 = [2 1 0 1; 0 3 1 2; 1 0 4 3; 0 0 0 1], 行列式25
+ * mat3 = [1 2 0; 0 1 3; 2 0 1], 行列式13
+ * */
+void testMatrixInverse() {
+    for (int dim : {3, 4}) {
+        Asm a;
+        int nn = dim * dim;
+        if (dim == 4) {
+            loadMatrix(a, 0, 4, {2, 1, 0, 1, 0, 3, 1, 2, 1, 0, 4, 3, 0, 0, 0, 1});
+        } else {
+            loadMatrix(a, 0, 3, {1, 2, 0, 0, 1, 3, 2, 0, 1});
+        }
+        a.vec(OpCode::kInverse, nn, 0, 0, dim);
+        a.vec(OpCode::kMatMul, 2 * nn, nn, 0, dim);
+        a.vec(OpCode::kMatMul, 3 * nn, 0, nn, dim);
+        a.vec(OpCode::kDeterminant, 4 * nn, 0, 0, dim);
+        a.vec(OpCode::kDeterminant, 4 * nn + 1, nn, 0, dim);
+        auto regs = range(2 * nn, 2 * nn + 2);
+        auto got = runRegs(a, 4 * nn + 2, regs);
+        std::vector<float> want = identity(dim);
+        want.insert(want.end(), want.begin(), want.end());
+        float det = dim == 4 ? 25.0f : 13.0f;
+        want.push_back(det);
+        want.push_back(1 / det);
+        CHECK(near(got, want));
+    }
+
+    //奇异矩阵的逆是全0
+    Asm s;
+    loadMatrix(s, 0, 3, {1, 2, 3, 2, 4, 6, 0, 1, 1});
+    s.vec(OpCode::kInverse, 9, 0, 0, 3);
+    s.vec(OpCode::kDeterminant, 18, 0, 0, 3);
+    CHECK(near(runRegs(s, 19, range(9, 10)), std::vector<float>(10, 0.0f)));
+}
+
+/*
+ * 用上面的mat4变换p = (1, 2, 3)
+ * 点加上最后一列的平移得到(5, 11, 16), 向量只用3x3得到(4, 9, 13)
+ * 法线用逆的转置, 变换之后和变换过的向量点积不变: n = (1, 0, 1), n·p = 4
+ * */
+void testTransform() {
+    Asm a;
+    loadMatrix(a, 0, 4, {2, 1, 0, 1, 0, 3, 1, 2, 1, 0, 4, 3, 0, 0, 0, 1});
+    a.constant(16, 1);
+    a.constant(17, 2);
+    a.constant(18, 3);
+    a.constant(19, 1);
+    a.constant(20, 0);
+    a.constant(21, 1);
+    a.vec(OpCode::kTransformPoint, 22, 0, 16, 4);
+    a.vec(OpCode::kTransformVector, 25, 0, 16, 4);
+    a.vec(OpCode::kTransformNormal, 28, 0, 19, 4);
+    a.vec(OpCode::kDot, 31, 28, 25, 3);
+    auto got = runRegs(a, 32, {22, 23, 24, 25, 26, 27, 31});
+    CHECK(near(got, {5, 11, 16, 4, 9, 13, 4}, 1e-4f));
+}
+
+/*
+ * q是绕z轴转90度, 把(1, 2, 3)转成(-2, 1, 3)
+ * 转成矩阵以后乘出来一样, q * q是绕z轴转180度(0, 0, 1, 0)
+ * */
+void testQuaternion() {
+    float h = std::sqrt(0.5f);
+    Asm a;
+    a.constant(0, 0);
+    a.constant(1, 0);
+    a.constant(2, h);
+    a.constant(3, h);
+    a.constant(4, 1);
+    a.constant(5, 2);
+    a.constant(6, 3);
+    a.vec(OpCode::kQuatRotate, 7, 0, 4, 0);
+    a.vec(OpCode::kQuatToMat, 10, 0, 0, 3);
+    a.vec(OpCode::kTransformVector, 19, 10, 4, 3);
+    a.vec(OpCode::kQuatToMat, 22, 0, 0, 4);
+    a.vec(OpCode::kTransformPoint, 38, 22, 4, 4);
+    a.vec(OpCode::kQuatMul, 41, 0, 0, 0);
+    std::vector<int> regs = {7, 8, 9, 19, 20, 21, 38, 39, 40, 41, 42, 43, 44};
+    auto got = runRegs(a, 45, regs);
+    CHECK(near(got, {-2, 1, 3, -2, 1, 3, -2, 1, 3, 0, 0, 1, 0}));
+    //mat4的最后一行和最后一列是单位阵的
+    Asm m;
+    m.constant(0, 0);
+    m.constant(1, 0);
+    m.constant(2, h);
+    m.constant(3, h);
+    m.vec(OpCode::kQuatToMat, 4, 0, 0, 4);
+    auto mat = runRegs(m, 20, range(4, 16));
+    CHECK(near(mat, {0, 1, 0, 0, -1, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1}));
+}
+
+const std::uint32_t* seenPc = nullptr;
+
+float recordPc(float x) {
+    seenPc = zfx_running()->profpc;
+    return x;
+}
+
+//分析器没开的时候解释器不写profpc, 开着的时候宿主函数里看到的是那条kFastCall
+void testProfilerPc() {
+    int fn = zfx_register<&recordPc>("test.recordPc");
+    Asm a;
+    a.constant(0, 1);
+    int call = a.here();
+    a.op(OpCode::kFastCall, 1, fn, 0);
+    a.op(OpCode::kStorePtr, 1, 0);
+    auto m = Module::create(a.proto(2));
+    std::vector<float> out(4);
+    zfx_State* l = zfx_newstate(m);
+    zfx_bindAttribute(l, 0, out);
+    seenPc = m->main().code.data();
+    CHECK(zfx_runmain(l, out.size()) == ZFX_OK);
+    CHECK(seenPc == nullptr);
+    if (zfx_startProfiler(1000)) {
+        CHECK(zfx_profilerRunning());
+        CHECK(zfx_runmain(l, out.size()) == ZFX_OK);
+        zfx_stopProfiler();
+        CHECK(seenPc == m->main().code.data() + call);
+        CHECK(l->profpc == nullptr);
+    }
+    CHECK(!zfx_profilerRunning());
+    zfx_close(l);
+}
+
+//把打印到FILE*的报告读回来
+template <class F>
+std::string capture(F&& print) {
+    std::FILE* f = std::tmpfile();
+    if (f == nullptr) {
+        return {};
+    }
+    print(f);
+    std::string text;
+    std::rewind(f);
+    char buf[4096];
+    std::size_t got;
+    while ((got = std::fread(buf, 1, sizeof(buf), f)) != 0) {
+        text.append(buf, got);
+    }
+    std::fclose(f);
+    return text;
+}
+
+/*
+ * divergentLoop对lim = 5跑一批, 每条指令执行的次数是确定的:
+ * 循环头比较和条件跳转6次, 循环体5次, 前后的指令各1次
+ * */
+void testOpStats() {
+    auto m = Module::create(divergentLoop());
+    std::vector<float> lim(4, 5), out(4);
+    zfx_State* l = zfx_newstate(m);
+    zfx_bindAttribute(l, 0, lim);
+    zfx_bindAttribute(l, 1, out);
+#ifdef ZFX_OPSTATS
+    CHECK(zfx_enableOpStats(l, true) == 1);
+    CHECK(zfx_runmain(l, lim.size()) == ZFX_OK);
+    const zfx_OpStats& s = *l->opstats;
+    auto count = [&](OpCode op) {
+        return s.count[static_cast<int>(op)];
+    };
+    CHECK(count(OpCode::kLoadPtr) == 1);
+    CHECK(count(OpCode::kLoadConstFloat) == 2);
+    CHECK(count(OpCode::kCmpLessThan) == 6);
+    CHECK(count(OpCode::kJumpIfNot) == 6);
+    CHECK(count(OpCode::kPlus) == 5);
+    CHECK(count(OpCode::kJump) == 5);
+    CHECK(count(OpCode::kStorePtr) == 1);
+    std::uint64_t total = 0, sampled = 0, binned = 0;
+    for (int op = 0; op < 256; op++) {
+        total += s.count[op];
+        sampled += s.sampled[op];
+        for (int b = 0; b < ZFX_OPSTATS_BUCKETS; b++) {
+            binned += s.hist[op][b];
+        }
+    }
+    CHECK(total == 26);
+    CHECK(sampled <= total && binned == sampled);
+
+    //工作线程的统计合并回来是相加
+    zfx_State* w = zfx_newstate(m);
+    zfx_bindAttribute(w, 0, lim);
+    zfx_bindAttribute(w, 1, out);
+    zfx_enableOpStats(w, true);
+    CHECK(zfx_runmain(w, lim.size()) == ZFX_OK);
+    zfx_mergeOpStats(l, w);
+    CHECK(count(OpCode::kPlus) == 10);
+    zfx_close(w);
+    std::string report = capture([&](std::FILE* f) { zfx_dumpOpStats(l, f); });
+    CHECK(report.find("opstats: 52 instructions") == 0);
+    CHECK(report.find("kCmpLessThan") != std::string::npos);
+
+    zfx_resetOpStats(l);
+    CHECK(count(OpCode::kPlus) == 0);
+    zfx_enableOpStats(l, false);
+    CHECK(capture([&](std::FILE* f) { zfx_dumpOpStats(l, f); }) == "opstats: not enabled on this state\n");
+#else
+    //没有编译进去的时候打不开, 照常执行
+    CHECK(zfx_enableOpStats(l, true) == 0);
+    CHECK(zfx_runmain(l, lim.size()) == ZFX_OK);
+    CHECK(out == lim);
+    CHECK(capture([&](std::FILE* f) { zfx_dumpOpStats(l, f); }).find("not compiled in") != std::string::npos);
+#endif
+    zfx_close(l);
+}
+
+/*
+ * 硬件计数器在容器里经常打不开, 两种情况都要能跑:
+ * 打不开的时候状态不带计数器, 结果全是0; 打开了的话没打开的那些一直是0, 每次执行记一次, 点数按执行完的算
+ * 换一个线程执行的时候在新线程上重新打开这个组
+ * */
+void testPerfGroup() {
+    auto m = Module::create(divergentLoop());
+    std::vector<float> lim(100, 3), out(100);
+    zfx_State* l = zfx_newstate(m);
+    zfx_bindAttribute(l, 0, lim);
+    zfx_bindAttribute(l, 1, out);
+    unsigned available = zfx_enablePerf(l, true);
+    CHECK((available & ~0x1fu) == 0);
+    CHECK(zfx_runmain(l, lim.size()) == ZFX_OK);
+    if (available == 0) {
+        CHECK(!l->perf);
+        zfx_PerfCounters t = zfx_getPerf(l);
+        CHECK(t.runs == 0 && t.points == 0 && t.cycles == 0 && t.available == 0);
+        CHECK(capture([&](std::FILE* f) { zfx_dumpPerf(l, f); }).find("not enabled or not available") !=
+              std::string::npos);
+        zfx_close(l);
+        return;
+    }
+    std::thread([&] { CHECK(zfx_runmain(l, 40) == ZFX_OK); }).join();
+    zfx_PerfCounters t = zfx_getPerf(l);
+    CHECK(t.available == available);
+    CHECK(t.runs == 2 && t.points == 140);
+    CHECK((available & ZFX_PERF_CYCLES) ? t.cycles > 0 : t.cycles == 0);
+    CHECK((available & ZFX_PERF_INSTRUCTIONS) ? t.instructions > 0 : t.instructions == 0);
+    CHECK((available & ZFX_PERF_BRANCHMISSES) || t.branchMisses == 0);
+    CHECK((available & ZFX_PERF_L1DMISSES) || t.l1dMisses == 0);
+    CHECK((available & ZFX_PERF_LLCMISSES) || t.llcMisses == 0);
+
+    zfx_State* w = zfx_newstate(m);
+    zfx_bindAttribute(w, 0, lim);
+    zfx_bindAttribute(w, 1, out);
+    CHECK(zfx_enablePerf(w, true) == available);
+    CHECK(zfx_runmain(w, 10) == ZFX_OK);
+    zfx_mergePerf(l, w);
+    CHECK(zfx_getPerf(l).runs == 3 && zfx_getPerf(l).points == 150);
+    zfx_close(w);
+
+    zfx_resetPerf(l);
+    t = zfx_getPerf(l);
+    CHECK(t.runs == 0 && t.points == 0 && t.cycles == 0 && t.available == available);
+    CHECK(zfx_enablePerf(l, false) == 0 && !l->perf);
+    zfx_close(l);
+}
+
+//按空白切开, 多个空格当一个
+std::vector<std::string> words(const std::string& line) {
+    std::vector<std::string> out;
+    std::size_t i = 0;
+    while (i < line.size()) {
+        std::size_t j = line.find(' ', i);
+        if (j == std::string::npos) {
+            j = line.size();
+        }
+        if (j > i) {
+            out.push_back(line.substr(i, j - i));
+        }
+        i = j + 1;
+    }
+    return out;
+}
+
+/*
+ * 1: x = @a0
+ * 2: @a1 = min(x + 1, 1)
+ * 反汇编每一行是 pc 行号 U/V 寄存器压力 周期 指令 操作数 ; 注释, 行号变化的地方先打源码, 子函数接在后面
+ * */
+void testDisassemble() {
+    Asm a;
+    a.op(OpCode::kLoadPtr, 0, 0);
+    a.constant(1, 1);
+    a.op(OpCode::kPlus, 2, 0, 1);
+    a.vec(OpCode::kMin, 3, 2, 1, 1, 0, ZFX_VEC_SCALAR);
+    a.op(OpCode::kStorePtr, 3, 1);
+    Proto p = a.proto(4);
+    p.lineinfo = {{0, 1, 1}, {1, 2, 1}};
+    Asm h;
+    h.constant(0, 0.5f);
+    Proto half = h.proto(1);
+    half.name = "half";
+    p.p.push_back(half);
+    auto m = Module::create(std::move(p));
+
+    std::string text = capture([&](std::FILE* f) { zfx_disassemble(&m->main(), f, "x = @a0\n@a1 = min(x + 1, 1)\n"); });
+    std::vector<std::string> lines;
+    for (std::size_t i = 0, j; i < text.size(); i = j + 1) {
+        j = text.find('\n', i);
+        lines.push_back(text.substr(i, j - i));
+    }
+    CHECK(lines.size() >= 14);
+    if (lines.size() < 14) {
+        return;
+    }
+    CHECK(lines[0] == "function <main>: 7 words, 4 registers, float");
+    CHECK(words(lines[1]) == (std::vector<std::string>{"pc", "line", "u/v", "live", "cycles", "op", "operands"}));
+    CHECK(lines[2] == "; 1: x = @a0");
+    CHECK(lines[4] == "; 2: @a1 = min(x + 1, 1)");
+    struct Row {
+        int at;
+        std::vector<std::string> head;      //pc, 行号, U/V
+        std::vector<std::string> tail;      //指令和操作数
+    };
+    Row rows[] = {
+        {3, {"0", "1", "V"}, {"loadptr", "r0,", "@a0"}},
+        {5, {"1", "2", "U"}, {"loadconstfloat", "r1", ";", "1.000000"}},
+        {6, {"3", "2", "V"}, {"plus", "r2,", "r0,", "r1"}},
+        {7, {"4", "2", "V"}, {"min", "r3,", "r2,", "r1", ";", "w=1", "scalar"}},
+        {8, {"6", "2", "V"}, {"storeptr", "@a1,", "r3"}},
+    };
+    for (const Row& r : rows) {
+        std::vector<std::string> w = words(lines[r.at]);
+        CHECK(w.size() == 5 + r.tail.size());
+        if (w.size() != 5 + r.tail.size()) {
+            continue;
+        }
+        CHECK(std::vector<std::string>(w.begin(), w.begin() + 3) == r.head);
+        CHECK(std::vector<std::string>(w.begin() + 5, w.end()) == r.tail);
+        CHECK(std::stod(w[4]) > 0);
+    }
+    CHECK(lines[9].find("; 5 instructions, max ") == 0);
+    CHECK(lines[11] == "function half: 2 words, 1 registers, float");
+    CHECK(words(lines[13]).size() == 9 && words(lines[13])[2] == "U");
+}
+
+/*
+ * 每个线程数在自己的分片上: 活着的时候快照要算上它, 退出以后留下的总数也不能丢
+ * 清零对活着的和退出了的线程都有效, 清零之前数的不会在线程退出时又冒出来
+ * */
+void testMetricShards() {
+    zfx_resetMetrics();
+    std::promise<void> counted, resetDone, exit;
+    std::thread t([&] {
+        zfx_metricCount(Zfx_Metric::kYields, 2);
+        counted.set_value();
+        resetDone.get_future().wait();
+        zfx_metricCount(Zfx_Metric::kYields, 1);
+        exit.get_future().wait();
+    });
+    counted.get_future().wait();
+    CHECK(zfx_getMetrics()[Zfx_Metric::kYields] == 2);
+    zfx_resetMetrics();
+    CHECK(zfx_getMetrics()[Zfx_Metric::kYields] == 0);
+    resetDone.set_value();
+    exit.set_value();
+    t.join();
+    CHECK(zfx_getMetrics()[Zfx_Metric::kYields] == 1);
+
+    std::thread([] { zfx_metricCount(Zfx_Metric::kYields, 4); }).join();
+    zfx_metricCount(Zfx_Metric::kYields, 10);
+    std::uint64_t live = zfx_getMetrics()[Zfx_Metric::kStatesLive];
+    zfx_resetMetrics();
+    zfx_metricCount(Zfx_Metric::kYields, 10);
+    zfx_metricAdd(Zfx_Metric::kYields, 1);
+    zfx_Metrics m = zfx_getMetrics();
+    CHECK(m[Zfx_Metric::kYields] == 11);
+    CHECK(m[Zfx_Metric::kStatesLive] == live);
+    std::string text = capture([&](std::FILE* f) { zfx_writeMetrics(m, f); });
+    CHECK(text.find("\nzfx_yields_total 11\n") != std::string::npos);
+    CHECK(text.find("\nzfx_states_live " + std::to_string(live) + "\n") != std::string::npos);
+    zfx_resetMetrics();
+}
+
+std::string readFile(const char* path) {
+    std::string text;
+    if (std::FILE* f = std::fopen(path, "r")) {
+        char buf[4096];
+        std::size_t got;
+        while ((got = std::fread(buf, 1, sizeof(buf), f)) != 0) {
+            text.append(buf, got);
+        }
+        std::fclose(f);
+    }
+    return text;
+}
+
+//名字是name的区间事件在哪个tid上, 没有的话返回-1
+int traceTid(const std::string& json, const std::string& name) {
+    std::size_t at = json.find("{\"name\": \"" + name + "\", \"cat\"");
+    if (at == std::string::npos) {
+        return -1;
+    }
+    at = json.find("\"tid\": ", at);
+    return std::atoi(json.c_str() + at + 7);
+}
+
+std::size_t occurrences(const std::string& text, const std::string& what) {
+    std::size_t n = 0;
+    for (std::size_t at = text.find(what); at != std::string::npos; at = text.find(what, at + 1)) {
+        n++;
+    }
+    return n;
+}
+
+/*
+ * 线程退出以后它的缓冲区给下一个线程接着用, 两个线程的事件在同一行上
+ * 下一次开始记录的时候, 已经退出的线程留下的事件不会再写出来
+ * 一个线程记满以后多出来的事件只计数
+ * */
+void testTraceReuse() {
+    const char* path = "zfx_vmtest_trace.json";
+    zfx_startTrace();
+    std::thread([] {
+        zfx_traceThreadName("worker");
+        zfx_traceComplete("first", 0, 1000);
+    }).join();
+    std::thread([] { zfx_traceComplete("second", 2000, 3000, "chunk", 7); }).join();
+    zfx_stopTrace();
+    CHECK(zfx_writeTrace(path));
+    std::string json = readFile(path);
+    CHECK(traceTid(json, "first") > 0);
+    CHECK(traceTid(json, "first") == traceTid(json, "second"));
+    CHECK(occurrences(json, "\"thread_name\"") == 1);
+    CHECK(json.find("\"args\": {\"chunk\": 7}") != std::string::npos);
+    CHECK(json.find("\"dropped_events\": 0") != std::string::npos);
+
+    zfx_startTrace();
+    std::thread([] {
+        for (int i = 0; i < ZFX_TRACE_CAPACITY + 3; i++) {
+            zfx_traceComplete("full", 0, 1);
+        }
+    }).join();
+    zfx_stopTrace();
+    CHECK(zfx_writeTrace(path));
+    json = readFile(path);
+    CHECK(traceTid(json, "first") == -1 && traceTid(json, "second") == -1);
+    CHECK(occurrences(json, "\"name\": \"full\"") == ZFX_TRACE_CAPACITY);
+    CHECK(json.find("\"dropped_events\": 3}") != std::string::npos);
+    std::remove(path);
+}
+
+/*
+ * divergentLoop直线走一遍是8条指令, 循环体4条: 比较, 条件跳转, 加法, 跳回去, 其中比较和加法是浮点运算
+ * lim = 5的时候每批执行26条指令, 比直线多出来的18条是4.5遍循环体, 每个点一共11次浮点运算(6次比较, 5次加法)
+ * */
+void testRooflineLoops() {
+    Proto p = divergentLoop();
+    zfx_Traffic t = zfx_traffic(&p);
+    CHECK(t.loops && t.insns == 8 && t.loopInsns == 4);
+    CHECK(t.flops == 2 && t.loopFlops == 2);
+    CHECK(t.bytesRead == 4 && t.bytesWritten == 4);
+
+    auto m = Module::create(std::move(p));
+    std::vector<float> lim(ZFX_LANES, 5), out(lim.size());
+    zfx_State* l = zfx_newstate(m);
+    zfx_bindAttribute(l, 0, lim);
+    zfx_bindAttribute(l, 1, out);
+    zfx_resetMetrics();
+    CHECK(zfx_runmain(l, lim.size()) == ZFX_OK);
+    zfx_Metrics after = zfx_getMetrics();
+    CHECK(after[Zfx_Metric::kBatches] == 1 && after[Zfx_Metric::kInstructions] == 26);
+    zfx_close(l);
+
+    double perBatch = static_cast<double>(after[Zfx_Metric::kInstructions]) / after[Zfx_Metric::kBatches];
+    zfx_Roofline r = zfx_roofline(&m->main(), 1e6, 1, perBatch);
+    CHECK(r.traffic.scaled && r.traffic.flops == 11);
+    CHECK(r.computeRoof > 0 && r.memoryRoof > 0);
+    CHECK(r.roof == std::min(r.memoryRoof, r.computeRoof));
+    CHECK(std::fabs(r.efficiency - 1e6 / r.roof) < 1e-9 * r.efficiency);
+    std::string report = capture([&](std::FILE* f) { zfx_dumpRoofline(r, f); });
+    CHECK(report.find("trip count estimated") != std::string::npos);
+
+    //不知道执行了多少条指令的时候不算浮点的屋顶
+    zfx_Roofline blind = zfx_roofline(&m->main(), 1e6);
+    CHECK(!blind.traffic.scaled && blind.traffic.flops == 2);
+    CHECK(blind.computeRoof == 0 && blind.memoryBound && blind.roof == blind.memoryRoof);
+    CHECK(capture([&](std::FILE* f) { zfx_dumpRoofline(blind, f); }).find("flops unreliable") != std::string::npos);
+}
+
+/*
+ * 有循环的程序不知道转几圈, 只按块数分线程; 直线程序的总周期数太少的时候不值得多开线程
+ * 拷贝一个属性每个点只要几个周期, 64块的量不够喂饱16个线程
+ * */
+void testSuggestThreads() {
+    Asm c;
+    c.op(OpCode::kLoadPtr, 0, 0);
+    c.op(OpCode::kStorePtr, 0, 1);
+    auto copy = Module::create(c.proto(1));
+    auto loop = Module::create(divergentLoop());
+    const zfx_Estimate& s = copy->estimate();
+    const zfx_Estimate& e = loop->estimate();
+    CHECK(!s.traffic.loops && s.insns == 2 && s.cycles > 0 && !s.hostCalls);
+    CHECK(e.traffic.loops && e.insns == 8 && e.nregs == 4 && e.frameBytes == 4 * ZFX_LANES * sizeof(float));
+    CHECK(e.cycles == zfx_estimate(&loop->main()).cycles);
+    //常量每个点都一样, 其他的都和属性有关
+    CHECK(e.uniformCycles > 0 && e.uniformCycles < e.cycles && s.uniformCycles == 0);
+
+    std::size_t npoints = 64 * ZFX_CHUNK;
+    double budget = std::floor(s.cycles * static_cast<double>(npoints) / 60000);
+    CHECK(budget < 16);
+    CHECK(zfx_suggestThreads(e, npoints, 16) == 16);
+    CHECK(zfx_suggestThreads(s, npoints, 16) == std::max(1, static_cast<int>(budget)));
+    //块数和maxThreads也是上限, 至少1个
+    CHECK(zfx_suggestThreads(e, 3 * ZFX_CHUNK, 16) == 3);
+    CHECK(zfx_suggestThreads(e, npoints, 4) == 4);
+    CHECK(zfx_suggestThreads(s, 100, 16) == 1);
+    CHECK(zfx_suggestThreads(e, 0, 16) == 1);
+}
+
+/*
+ * 宿主函数recurse(d)调用zfx函数down(d - 1), down再调用recurse, 一直到d是0, 结果就是d
+ * 每一层在值栈上开一帧寄存器, 深了就要按需提交, 再深就碰到guard page
+ * */
+const Proto* downProto = nullptr;
+
+float recurse(float depth) {
+    zfx_State* l = zfx_running();
+    if (depth <= 0) {
+        return 0;
+    }
+    auto* regs = zfx_pushregs<float>(l, downProto->nregs);
+    regs[0] = depth - 1;
+    int ret = -1;
+    int status = zfx_callproto(l, downProto, regs, &ret);
+    float v = status == ZFX_OK ? regs[ret * ZFX_LANES] : 0;
+    zfx_popregs(l, regs);
+    if (status != ZFX_OK) {
+        zfx_throw(l, status);
+    }
+    return v + 1;
+}
+
+std::shared_ptr<const Module> recursionModule() {
+    int fn = zfx_register<&recurse>("test.recurse");
+    Asm d;
+    d.op(OpCode::kFastCall, 1, fn, 0);
+    d.op(OpCode::kReturn, 1);
+    Proto down = d.proto(250);
+    down.name = "down";
+    down.params = {Zfx_ArgKind::kFloat};
+    down.ret = Zfx_ArgKind::kFloat;
+    Asm a;
+    a.op(OpCode::kLoadPtr, 0, 0);
+    a.op(OpCode::kFastCall, 1, fn, 0);
+    a.op(OpCode::kStorePtr, 1, 1);
+    Proto p = a.proto(2);
+    p.p.push_back(std::move(down));
+    auto m = Module::create(std::move(p));
+    downProto = m->find("down");
+    return m;
+}
+
+//栈按需提交, 太深的递归得到ZFX_ERRSTACK, 之后这个状态还能接着用
+void testStackGrowth() {
+    auto m = recursionModule();
+    zfx_State* l = zfx_newstate(m);
+    std::vector<float> depth = {20}, out = {0};
+    zfx_bindAttribute(l, 0, depth);
+    zfx_bindAttribute(l, 1, out);
+    std::uint64_t grows = zfx_getMetrics()[Zfx_Metric::kStackGrows];
+    CHECK(zfx_runmain(l, 1) == ZFX_OK);
+    CHECK(out[0] == 20);
+    CHECK(zfx_getMetrics()[Zfx_Metric::kStackGrows] > grows);
+
+    depth[0] = 1e6f;
+    Object* top = l->top;
+    CHECK(zfx_runmain(l, 1) == ZFX_ERRSTACK);
+    CHECK(l->top == top);
+
+    depth[0] = 5;
+    CHECK(zfx_runmain(l, 1) == ZFX_OK);
+    CHECK(out[0] == 5);
+    zfx_close(l);
+}
+
+//关闭的状态的栈留在线程缓存里, 下一个状态直接拿来用
+void testStackCache() {
+    Asm a;
+    a.op(OpCode::kLoadPtr, 0, 0);
+    auto m = Module::create(a.proto(1));
+    zfx_State* l = zfx_newstate(m);
+    Object* stack = l->stack;
+    zfx_close(l);
+    std::uint64_t hits = zfx_getMetrics()[Zfx_Metric::kStackCacheHits];
+    l = zfx_newstate(m);
+    CHECK(l->stack == stack);
+    CHECK(zfx_getMetrics()[Zfx_Metric::kStackCacheHits] == hits + 1);
+    zfx_close(l);
+}
+
+//工作线程各自计数, 线程退出以后它们的点数也要算在快照里, 清零以后从0开始
+void testMetrics() {
+    Asm a;
+    a.op(OpCode::kLoadPtr, 0, 0);
+    a.op(OpCode::kStorePtr, 0, 1);
+    auto m = Module::create(a.proto(1));
+    std::vector<float> x(100000), out(x.size());
+    zfx_State* l = zfx_newstate(m);
+    zfx_bindAttribute(l, 0, x);
+    zfx_bindAttribute(l, 1, out);
+    zfx_resetMetrics();
+    CHECK(zfx_getMetrics()[Zfx_Metric::kPoints] == 0);
+    CHECK(zfx_runparallel(l, x.size(), 4) == ZFX_OK);
+    CHECK(zfx_runmain(l, 1000) == ZFX_OK);
+    zfx_Metrics after = zfx_getMetrics();
+    CHECK(after[Zfx_Metric::kPoints] == x.size() + 1000);
+    CHECK(after[Zfx_Metric::kParallelChunks] == (x.size() + ZFX_CHUNK - 1) / ZFX_CHUNK);
+    zfx_resetMetrics();
+    CHECK(zfx_getMetrics()[Zfx_Metric::kPoints] == 0);
+    CHECK(zfx_getMetrics()[Zfx_Metric::kStatesLive] > 0);
+    zfx_close(l);
+}
+
+}
+
+int main() {
+    testDivergentLoop();
+    testDivergentIf();
+    testDivergentStore();
+    testDivergentYield();
+    testStraightLineYield();
+    testCancelMidRun();
+    testDeadline();
+    testRandIntArgs();
+    testCurveCubic();
+    testMetrics();
+    testStackGrowth();
+    testStackCache();
+    testAttributeBinding();
+    testResourceIndex();
+    testReregister();
+    testBatchResultKind();
+    testFunctionHandles();
+    testFunctionStackFull();
+    testVectorOps();
+    testBadVectorWidth();
+    testSampleChannels();
+    testMatrixInverse();
+    testTransform();
+    testQuaternion();
+    testProfilerPc();
+    testOpStats();
+    testPerfGroup();
+    testDisassemble();
+    testMetricShards();
+    testTraceReuse();
+    testRooflineLoops();
+    testSuggestThreads();
+    if (failures != 0) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::puts("all tests passed");
+    return 0;
+}
@@ -4,30 +4,48 @@
 #include <variant>
 #include <cmath>
 #include <string_view>
+#include <string>
+#include <vector>
 #include "enumtools.h"
 #include "overloaded.h"
+#include "ZFX.h"
 
 namespace zeno::zfx {
 
+//往栈上的某一个槽写值, vec3占用连续的三个槽
+#define setnilvalue(obj) \
+{ \
+   ::zeno::zfx::Object* i_o = (obj); \
+   *i_o = ::zeno::zfx::Object{};     \
+}
+
 #define setnvalue(obj, n) \
 { \
-   Object* i_o = (obj)            \
-                                  \
+   ::zeno::zfx::Object* i_o = (obj);                    \
+   *i_o = ::zeno::zfx::Object{static_cast<float>(n)};   \
+}
+
+#define setivalue(obj, n) \
+{ \
+   ::zeno::zfx::Object* i_o = (obj);                    \
+   *i_o = ::zeno::zfx::Object{static_cast<int>(n)};     \
 }
 
-#define setvvalue(obj, x, y, z, w) \
+#define setvvalue(obj, x, y, z) \
 {                                  \
-   Object* i_o = (obj);            \
-                                   \
+   ::zeno::zfx::Object* i_o = (obj);                      \
+   i_o[0] = ::zeno::zfx::Object{static_cast<float>(x)};   \
+   i_o[1] = ::zeno::zfx::Object{static_cast<float>(y)};   \
+   i_o[2] = ::zeno::zfx::Object{static_cast<float>(z)};   \
 }
 namespace object_details {
 
-struct Object;
+union Object;
 
 struct Pointer {
     void *ptr;
 
-    inline Object attr(std::string_view name);  // TODO
+    Object attr(std::string_view name);  // TODO
 };
 
 enum ObjectType : std::uint8_t {
@@ -271,7 +289,7 @@ inline Object pow(Object a, Object b) noexcept {
         } else if constexpr (std::is_same_v<B, Pointer>) {
             return b.attr("$rpow")({Object{a}});
         } else {
-            return Object{std::pow(a, b)};
+            return Object{static_cast<float>(std::pow(a, b))};
         }
     }, details::obj2var(a), details::obj2var(b));
 }
@@ -285,13 +303,33 @@ inline Object atan2(Object a, Object b) noexcept {
         } else if constexpr (std::is_same_v<B, Pointer>) {
             return b.attr("$ratan2")({Object{a}});
         } else {
-            return Object{std::atan2(a, b)};
+            return Object{static_cast<float>(std::atan2(a, b))};
         }
     }, details::obj2var(a), details::obj2var(b));
 }
 
 }
-    struct Proto {
+    using object_details::Object;
 
+    //从code[pc]开始的指令来自源码的哪一行哪一列, 到下一项的pc为止
+    struct LineInfo {
+        std::uint32_t pc;
+        std::uint32_t line;
+        std::uint32_t col;
+    };
+
+    //编译好的一个zfx函数, 类似lua的Proto
+    struct Proto {
+        std::vector<std::uint32_t> code;    //指令
+        std::vector<std::string> syms;      //用到的属性名, kLoadPtr/kStorePtr的B操作数就是它的下标
+        std::vector<std::string> tables;    //用到的查找表和曲线, kSample的B操作数就是它的下标
+        std::uint32_t nregs{};              //需要的寄存器数量
+
+        std::string name;                   //函数名, 顶层代码是空的
+        std::vector<Zfx_ArgKind> params;    //参数类型, 从0号寄存器开始依次存放, vec3占三个
+        Zfx_ArgKind ret = Zfx_ArgKind::kVoid;
+        Zfx_NumberType number = Zfx_NumberType::kFloat; //寄存器和属性是float还是double, 同一个模块里都一样
+        std::vector<Proto> p;               //模块里定义的function
+        std::vector<LineInfo> lineinfo;     //调试信息, 按pc递增, 只有位置变化的地方才有一项, 执行时不读
     };
 }
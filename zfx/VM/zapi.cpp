@@ -5,98 +5,165 @@
 
 #include "zapi.h"
 #include "zstate.h"
-//获取栈中下标为index的元素
-static Object* index2addr(zfx_State* L, int index) {
-    if (index > 0) {
-        Object* o = L->base + (index - 1);
+#include "zdo.h"
+#include "zdebug.h"
+#include "../ZFXModule.h"
+#include <cmath>
+#include <stdexcept>
 
-    } else if () {
+//栈不会在push时检查容量, 越界由guard page兜底, 见zdo.cpp
+#define api_incr_top(l) ((l)->top++)
 
+//获取栈中下标为index的元素
+static Object* index2addr(zfx_State* l, int index) {
+    if (index > 0) {
+        return l->base + (index - 1);
     } else {
-
+        //负数从栈顶往下数, -1就是栈顶元素
+        return l->top + index;
     }
-
 }
 
 const Object* zfx_toObject(zfx_State* l, int idx) {
-    Object* p = index2addr();
-    return (p ==  ? :);
+    return index2addr(l, idx);
 }
 
-void zfx_pushObject(zfx_State* l, int idx) {
-
+void zfx_pushObject(zfx_State* l, const Object* o) {
+    *l->top = *o;
+    api_incr_top(l);
 }
 
 //用来检查lua的虚拟栈
-int zfx_checkStack() {
-
+int zfx_checkStack(zfx_State* l, int n) {
+    return zfx_growstack(l, n);
 }
 
-int zfx_absIndex() {
-
+int zfx_absIndex(zfx_State* l, int idx) {
+    return idx > 0 ? idx : static_cast<int>(l->top - l->base) + idx + 1;
 }
 
-void zfx_getTop() {
-
+int zfx_getTop(zfx_State* l) {
+    return static_cast<int>(l->top - l->base);
 }
 
-void zfx_setTop() {
-
-};
-
-void zfx_remove() {
-
+void zfx_setTop(zfx_State* l, int idx) {
+    if (idx >= 0) {
+        Object* newtop = l->base + idx;
+        while (l->top < newtop) {
+            setnilvalue(l->top);
+            api_incr_top(l);
+        }
+        l->top = newtop;
+    } else {
+        l->top += idx + 1;
+    }
 }
 
-void zfx_insert() {
-
+void zfx_remove(zfx_State* l, int idx) {
+    Object* p = index2addr(l, idx);
+    while (++p < l->top) {
+        p[-1] = *p;
+    }
+    l->top--;
 }
 
-void zfx_replace() {
-
+void zfx_insert(zfx_State* l, int idx) {
+    Object* p = index2addr(l, idx);
+    for (Object* q = l->top; q > p; q--) {
+        *q = q[-1];
+    }
+    *p = *l->top;
 }
 
-void lua_pushValue() {
-
+void zfx_replace(zfx_State* l, int idx) {
+    *index2addr(l, idx) = l->top[-1];
+    l->top--;
 }
 
-int zfx_type() const {
-
+void zfx_pushValue(zfx_State* l, int idx) {
+    zfx_pushObject(l, index2addr(l, idx));
 }
 
-const char* zfx_TypeName() const {
-
+void zfx_bindAttribute(zfx_State* l, int idx, span<float> data) {
+    if (l->attrs.size() <= static_cast<std::size_t>(idx)) {
+        l->attrs.resize(idx + 1);
+    }
+    l->attrs[idx] = data;
 }
 
-int lua_equal() {
-
+void zfx_bindAttribute(zfx_State* l, int idx, span<double> data) {
+    if (l->dattrs.size() <= static_cast<std::size_t>(idx)) {
+        l->dattrs.resize(idx + 1);
+    }
+    l->dattrs[idx] = data;
 }
 
+void zfx_bindTable(zfx_State* l, int idx, const zfx_Table& table) {
+    if (table.dims < 1 || table.dims > 3 || table.channels < 1 || table.channels > 4) {
+        throw std::invalid_argument("zfx_bindTable: dims must be 1-3 and channels 1-4");
+    }
+    std::size_t points = 1;
+    for (int d = 0; d < table.dims; d++) {
+        if (table.size[d] < 1) {
+            throw std::invalid_argument("zfx_bindTable: empty dimension");
+        }
+        points *= static_cast<std::size_t>(table.size[d]);
+    }
+    if (table.data.size() < points * static_cast<std::size_t>(table.channels)) {
+        throw std::invalid_argument("zfx_bindTable: data is smaller than the table");
+    }
+    if (!table.keys.empty() && (table.dims != 1 || table.keys.size() != static_cast<std::size_t>(table.size[0]))) {
+        throw std::invalid_argument("zfx_bindTable: curve keys must match a 1D table");
+    }
+    for (std::size_t i = 1; i < table.keys.size(); i++) {
+        if (!(table.keys[i - 1] < table.keys[i])) {
+            throw std::invalid_argument("zfx_bindTable: curve keys must be increasing");
+        }
+    }
+    for (int d = 0; table.keys.empty() && d < table.dims; d++) {
+        if (!std::isfinite(table.hi[d] - table.lo[d]) || table.hi[d] == table.lo[d]) {
+            throw std::invalid_argument("zfx_bindTable: empty coordinate range");
+        }
+    }
+    if (l->tables.size() <= static_cast<std::size_t>(idx)) {
+        l->tables.resize(idx + 1);
+    }
+    //用这张表的kSample要放得下它的通道和坐标
+    zfx_Table old = l->tables[idx];
+    l->tables[idx] = table;
+    std::string err = zfx_verify(&l->module->main(), &l->tables);
+    if (!err.empty()) {
+        l->tables[idx] = old;
+        throw std::invalid_argument("zfx_bindTable: table does not fit " + err);
+    }
+}
 
-
+int zfx_addResource(zfx_State* l, span<float const> data) {
+    l->resources.push_back(data);
+    return static_cast<int>(l->resources.size() - 1);
+}
 
 //留给其他语言的接口
 void zfx_pushNil(zfx_State* l) {
-
+    setnilvalue(l->top);
+    api_incr_top(l);
 }
 
 void zfx_pushNumber(zfx_State* l, float n) {
     setnvalue(l->top, n);
     //压进去
-    return;
+    api_incr_top(l);
 }
 
 void zfx_pushInteger(zfx_State* l, int n) {
     //设置栈顶得值
-    setnvalue(l->top, n);
+    setivalue(l->top, n);
     //压进去
-    return ;
+    api_incr_top(l);
 }
 
 void zfx_pushVector(zfx_State* l, float x, float y, float z) {
-    setvvalue(l->top, x, y, z, 0.0f);
-    //压进去
-    return ;
+    setvvalue(l->top, x, y, z);
+    //压进去, vec3占三个槽
+    l->top += 3;
 }
-
-
@@ -1,4 +1,3 @@
-
 //
 // Created by admin on 2022/7/11.
 //
@@ -6,7 +5,21 @@
 //另一个是将Object插入到虚拟机栈中
 #pragma once
 
-#include "../Object.h
+#include "../Object.h"
+#include "../ZFX.h"
+#include "../span.h"
+#include "zstate.h"
+
+using zeno::zfx::Object;
+
+extern const Object* zfx_toObject(zfx_State* l, int idx);
+extern void zfx_pushObject(zfx_State* l, const Object* o);
 
-extern const Object* zfx_toObject();
-extern void zfx_pushObject();
+//把宿主的属性数组绑定到Proto::syms的第idx个符号上
+extern void zfx_bindAttribute(zfx_State* l, int idx, span<float> data);
+//Zfx_NumberType::kDouble的程序读写的是double的属性数组
+extern void zfx_bindAttribute(zfx_State* l, int idx, span<double> data);
+//把查找表绑定到Proto::tables的第idx个名字上, 维数, 通道数或者数据长度不对, 或者用它的kSample放不下通道和坐标的话抛std::invalid_argument
+extern void zfx_bindTable(zfx_State* l, int idx, const zfx_Table& table);
+//登记一个只读数组, 返回它的编号, span类型的参数就是用这个编号传的
+extern int zfx_addResource(zfx_State* l, span<float const> data);
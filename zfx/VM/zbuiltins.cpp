@@ -1,22 +1,258 @@
 //
 // Created by admin on 2022/7/7.
 //
+/*
+ * 内置数学函数, 噪声和随机数, 全部按批注册, 每一批点只调用一次zmathlib.cpp, znoise.cpp, zrandom.cpp里的lane循环
+ * 不带后缀的是精确档, _fast后缀的是快速档, 编译器按zfx_CompileOptions::mathPrecision选名字
+ * double程序的数学函数直接按lane调用libm的double版本, 噪声和随机数还是按float算
+ * */
+#include "zbuiltins.h"
+#include "../ZFXFunction.h"
+#include "../bc.h"
 #include <cmath>
-#include <time.h>
+#include <mutex>
 
-#define zfx_numAdd(a, b) ((a) + (b))
-#define zfx_numSub(a, b) ((a) - (b))
-#define zfx_numMul(a, b) ((a) * (b))
-#define zfx_numDiv(a, b) ((a) / (b))
+namespace {
 
-//判断指针是否相等
-inline bool zfx_veceq() {
+using Out = span<float>;
+using In = span<float const>;
+using OutD = span<double>;
+using InD = span<double const>;
+using InI = span<int const>;
 
+inline int lanes(Out out) {
+    return static_cast<int>(out.size());
 }
-static int math_abs() {
 
+#define ZFX_MATH_DOUBLE(name) \
+    void math_##name##_d(OutD out, InD x) { \
+        for (std::size_t i = 0; i < out.size(); i++) out[i] = std::name(x[i]); \
+    }
+
+#define ZFX_MATH_DOUBLE2(name) \
+    void math_##name##_d(OutD out, InD x, InD y) { \
+        for (std::size_t i = 0; i < out.size(); i++) out[i] = std::name(x[i], y[i]); \
+    }
+
+ZFX_MATH_DOUBLE(sin)
+ZFX_MATH_DOUBLE(cos)
+ZFX_MATH_DOUBLE(tan)
+ZFX_MATH_DOUBLE(asin)
+ZFX_MATH_DOUBLE(acos)
+ZFX_MATH_DOUBLE(atan)
+ZFX_MATH_DOUBLE(exp)
+ZFX_MATH_DOUBLE(log)
+ZFX_MATH_DOUBLE(floor)
+ZFX_MATH_DOUBLE(ceil)
+ZFX_MATH_DOUBLE2(atan2)
+ZFX_MATH_DOUBLE2(pow)
+
+#undef ZFX_MATH_DOUBLE
+#undef ZFX_MATH_DOUBLE2
+
+#define ZFX_MATH_UNARY(name, fn) \
+    void math_##name(Out out, In x) { \
+        fn(out.data(), x.data(), lanes(out), Zfx_MathPrecision::kPrecise); \
+    } \
+    void math_##name##_fast(Out out, In x) { \
+        fn(out.data(), x.data(), lanes(out), Zfx_MathPrecision::kFast); \
+    }
+
+ZFX_MATH_UNARY(sin, zfx_vsin)
+ZFX_MATH_UNARY(cos, zfx_vcos)
+ZFX_MATH_UNARY(tan, zfx_vtan)
+ZFX_MATH_UNARY(asin, zfx_vasin)
+ZFX_MATH_UNARY(acos, zfx_vacos)
+ZFX_MATH_UNARY(atan, zfx_vatan)
+ZFX_MATH_UNARY(exp, zfx_vexp)
+ZFX_MATH_UNARY(log, zfx_vlog)
+
+#undef ZFX_MATH_UNARY
+
+void math_atan2(Out out, In y, In x) {
+    zfx_vatan2(out.data(), y.data(), x.data(), lanes(out), Zfx_MathPrecision::kPrecise);
+}
+
+void math_atan2_fast(Out out, In y, In x) {
+    zfx_vatan2(out.data(), y.data(), x.data(), lanes(out), Zfx_MathPrecision::kFast);
+}
+
+void math_pow(Out out, In x, In y) {
+    zfx_vpow(out.data(), x.data(), y.data(), lanes(out), Zfx_MathPrecision::kPrecise);
+}
+
+void math_floor(Out out, In x) {
+    zfx_vfloor(out.data(), x.data(), lanes(out));
+}
+
+void math_ceil(Out out, In x) {
+    zfx_vceil(out.data(), x.data(), lanes(out));
+}
+
+//噪声的参数是一个个坐标分量
+#define ZFX_NOISE(name, fn) \
+    void noise_##name##1(Out out, In x) { \
+        const float* p[] = {x.data()}; \
+        fn(out.data(), 1, p, lanes(out)); \
+    } \
+    void noise_##name##2(Out out, In x, In y) { \
+        const float* p[] = {x.data(), y.data()}; \
+        fn(out.data(), 2, p, lanes(out)); \
+    } \
+    void noise_##name##3(Out out, In x, In y, In z) { \
+        const float* p[] = {x.data(), y.data(), z.data()}; \
+        fn(out.data(), 3, p, lanes(out)); \
+    } \
+    void noise_##name##4(Out out, In x, In y, In z, In w) { \
+        const float* p[] = {x.data(), y.data(), z.data(), w.data()}; \
+        fn(out.data(), 4, p, lanes(out)); \
+    }
+
+ZFX_NOISE(perlin, zfx_vperlin)
+ZFX_NOISE(simplex, zfx_vsimplex)
+
+#undef ZFX_NOISE
+
+void noise_curl(Out ox, Out oy, Out oz, In x, In y, In z) {
+    float* out[] = {ox.data(), oy.data(), oz.data()};
+    const float* p[] = {x.data(), y.data(), z.data()};
+    zfx_vcurl(out, p, lanes(ox));
+}
+
+void noise_fbm1(Out out, In x, In octaves, In lacunarity, In gain) {
+    const float* p[] = {x.data()};
+    zfx_vfbm(out.data(), 1, p, octaves.data(), lacunarity.data(), gain.data(), lanes(out));
+}
+
+void noise_fbm2(Out out, In x, In y, In octaves, In lacunarity, In gain) {
+    const float* p[] = {x.data(), y.data()};
+    zfx_vfbm(out.data(), 2, p, octaves.data(), lacunarity.data(), gain.data(), lanes(out));
+}
+
+void noise_fbm3(Out out, In x, In y, In z, In octaves, In lacunarity, In gain) {
+    const float* p[] = {x.data(), y.data(), z.data()};
+    zfx_vfbm(out.data(), 3, p, octaves.data(), lacunarity.data(), gain.data(), lanes(out));
+}
+
+void noise_fbm4(Out out, In x, In y, In z, In w, In octaves, In lacunarity, In gain) {
+    const float* p[] = {x.data(), y.data(), z.data(), w.data()};
+    zfx_vfbm(out.data(), 4, p, octaves.data(), lacunarity.data(), gain.data(), lanes(out));
+}
+
+void open_noise() {
+    zfx_registerBatch<&noise_perlin1>("perlin1");
+    zfx_registerBatch<&noise_perlin2>("perlin2");
+    zfx_registerBatch<&noise_perlin3>("perlin3");
+    zfx_registerBatch<&noise_perlin4>("perlin4");
+    zfx_registerBatch<&noise_simplex1>("simplex1");
+    zfx_registerBatch<&noise_simplex2>("simplex2");
+    zfx_registerBatch<&noise_simplex3>("simplex3");
+    zfx_registerBatch<&noise_simplex4>("simplex4");
+    zfx_registerBatch<&noise_curl>("curl");
+    zfx_registerBatch<&noise_fbm1>("fbm1");
+    zfx_registerBatch<&noise_fbm2>("fbm2");
+    zfx_registerBatch<&noise_fbm3>("fbm3");
+    zfx_registerBatch<&noise_fbm4>("fbm4");
+}
+
+void random_rand(Out out, InI id, InI seed) {
+    zfx_vrand(out.data(), id.data(), seed.data(), lanes(out));
+}
+
+void random_randn(Out out, InI id, InI seed) {
+    zfx_vrandn(out.data(), id.data(), seed.data(), lanes(out));
+}
+
+void random_randsphere(Out ox, Out oy, Out oz, InI id, InI seed) {
+    float* out[] = {ox.data(), oy.data(), oz.data()};
+    zfx_vrandsphere(out, id.data(), seed.data(), lanes(ox));
+}
+
+void open_random() {
+    zfx_registerBatch<&random_rand>("rand");
+    zfx_registerBatch<&random_randn>("randn");
+    zfx_registerBatch<&random_randsphere>("randsphere");
 }
 
-static int math_sin() {
+void open_math() {
+    zfx_registerBatch<&math_sin, &math_sin_d>("sin");
+    zfx_registerBatch<&math_cos, &math_cos_d>("cos");
+    zfx_registerBatch<&math_tan, &math_tan_d>("tan");
+    zfx_registerBatch<&math_asin, &math_asin_d>("asin");
+    zfx_registerBatch<&math_acos, &math_acos_d>("acos");
+    zfx_registerBatch<&math_atan, &math_atan_d>("atan");
+    zfx_registerBatch<&math_exp, &math_exp_d>("exp");
+    zfx_registerBatch<&math_log, &math_log_d>("log");
+    zfx_registerBatch<&math_atan2, &math_atan2_d>("atan2");
+    zfx_registerBatch<&math_pow, &math_pow_d>("pow");
+    zfx_registerBatch<&math_floor, &math_floor_d>("floor");
+    zfx_registerBatch<&math_ceil, &math_ceil_d>("ceil");
 
-}
\ No newline at end of file
+    zfx_registerBatch<&math_sin_fast, &math_sin_d>("sin_fast");
+    zfx_registerBatch<&math_cos_fast, &math_cos_d>("cos_fast");
+    zfx_registerBatch<&math_tan_fast, &math_tan_d>("tan_fast");
+    zfx_registerBatch<&math_asin_fast, &math_asin_d>("asin_fast");
+    zfx_registerBatch<&math_acos_fast, &math_acos_d>("acos_fast");
+    zfx_registerBatch<&math_atan_fast, &math_atan_d>("atan_fast");
+    zfx_registerBatch<&math_exp_fast, &math_exp_d>("exp_fast");
+    zfx_registerBatch<&math_log_fast, &math_log_d>("log_fast");
+    zfx_registerBatch<&math_atan2_fast, &math_atan2_d>("atan2_fast");
+    //pow, floor, ceil两个档位是同一个实现
+    zfx_registerBatch<&math_pow, &math_pow_d>("pow_fast");
+    zfx_registerBatch<&math_floor, &math_floor_d>("floor_fast");
+    zfx_registerBatch<&math_ceil, &math_ceil_d>("ceil_fast");
+}
+
+void open_libs() {
+    open_math();
+    open_noise();
+    open_random();
+}
+
+using zeno::zfx::OpCode;
+
+struct Intrinsic {
+    std::string_view name;
+    OpCode op;
+};
+
+constexpr Intrinsic intrinsics[] = {
+    {"dot", OpCode::kDot},
+    {"cross", OpCode::kCross},
+    {"length", OpCode::kLength},
+    {"distance", OpCode::kDistance},
+    {"normalize", OpCode::kNormalize},
+    {"lerp", OpCode::kLerp},
+    {"mix", OpCode::kLerp},
+    {"clamp", OpCode::kClamp},
+    {"smoothstep", OpCode::kSmoothstep},
+    {"reflect", OpCode::kReflect},
+    {"min", OpCode::kMin},
+    {"max", OpCode::kMax},
+    {"mul", OpCode::kMatMul},
+    {"transpose", OpCode::kTranspose},
+    {"inverse", OpCode::kInverse},
+    {"determinant", OpCode::kDeterminant},
+    {"transformpoint", OpCode::kTransformPoint},
+    {"transformvector", OpCode::kTransformVector},
+    {"transformnormal", OpCode::kTransformNormal},
+    {"qmul", OpCode::kQuatMul},
+    {"qrotate", OpCode::kQuatRotate},
+    {"qtomat", OpCode::kQuatToMat},
+};
+
+}
+
+int zfx_findIntrinsic(std::string_view name) {
+    for (auto const& it : intrinsics) {
+        if (it.name == name) {
+            return static_cast<int>(it.op);
+        }
+    }
+    return -1;
+}
+
+void zfx_openlibs() {
+    static std::once_flag once;
+    std::call_once(once, open_libs);
+}
@@ -4,3 +4,60 @@
 #pragma once
 
 //用来实现zfx的一些内置函数
+#include "../ZFX.h"
+#include <string_view>
+
+//lane循环在x86上编译出AVX-512, AVX2和默认三个版本, 运行时按cpu挑一个
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define ZFX_SIMD_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define ZFX_SIMD_CLONES
+#endif
+
+/*
+ * 数学函数都是按lane数组计算的, out和x可以是同一个数组
+ * kPrecise误差不超过1ULP, 中间在double里计算
+ * kFast误差不超过4ULP, 全部是float的多项式, exp本来是非规格化数的结果直接给0
+ * 超出多项式适用范围的lane(很大的参数, inf, nan)最后单独用libm重算
+ * */
+void zfx_vsin(float* out, const float* x, int n, Zfx_MathPrecision prec);
+void zfx_vcos(float* out, const float* x, int n, Zfx_MathPrecision prec);
+void zfx_vtan(float* out, const float* x, int n, Zfx_MathPrecision prec);
+void zfx_vasin(float* out, const float* x, int n, Zfx_MathPrecision prec);
+void zfx_vacos(float* out, const float* x, int n, Zfx_MathPrecision prec);
+void zfx_vatan(float* out, const float* x, int n, Zfx_MathPrecision prec);
+void zfx_vexp(float* out, const float* x, int n, Zfx_MathPrecision prec);
+void zfx_vlog(float* out, const float* x, int n, Zfx_MathPrecision prec);
+void zfx_vatan2(float* out, const float* y, const float* x, int n, Zfx_MathPrecision prec);
+//pow的float多项式达不到4ULP, 两个档位都走double
+void zfx_vpow(float* out, const float* x, const float* y, int n, Zfx_MathPrecision prec);
+void zfx_vfloor(float* out, const float* x, int n);
+void zfx_vceil(float* out, const float* x, int n);
+
+/*
+ * 梯度噪声, p是dim个坐标数组, dim从1到4, 结果大致在[-1, 1]
+ * 用整数哈希代替排列表, 关掉了乘加合并, 同样的输入在任何SIMD宽度和分批方式下结果都是一样的
+ * */
+void zfx_vperlin(float* out, int dim, const float* const* p, int n);
+void zfx_vsimplex(float* out, int dim, const float* const* p, int n);
+//三维的curl noise, 三个错开的perlin势场求旋度, 结果是无散度的速度场
+void zfx_vcurl(float* const* out, const float* const* p, int n);
+//perlin叠加octaves层, 每层频率乘lacunarity, 振幅乘gain, octaves的小数部分淡入最后一层, 最多16层
+void zfx_vfbm(float* out, int dim, const float* const* p, const float* octaves,
+              const float* lacunarity, const float* gain, int n);
+
+/*
+ * 基于计数器的随机数, 结果只由id和seed决定, 和线程数, 分批方式都没有关系
+ * rand在[0, 1)上均匀, randn是标准正态分布, randsphere是单位球面上均匀分布的点
+ * id和seed是int, 小数要先转成int, 比如rand(int(@P.x * 1000), 0)
+ * */
+void zfx_vrand(float* out, const int* id, const int* seed, int n);
+void zfx_vrandn(float* out, const int* id, const int* seed, int n);
+void zfx_vrandsphere(float* const* out, const int* id, const int* seed, int n);
+
+//把内置函数注册到宿主函数表里, 和lua的luaL_openlibs一样, 可以重复调用
+void zfx_openlibs();
+
+//dot cross normalize这些向量函数和矩阵, 四元数函数直接编译成专门的指令, 返回OpCode, 不是的话返回-1
+//mix是lerp的别名, mul是矩阵乘法, 矩阵之间的*也编译成它
+int zfx_findIntrinsic(std::string_view name);
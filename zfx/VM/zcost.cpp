@@ -0,0 +1,387 @@
+//
+// Created by admin on 2022/9/23.
+//
+#include "zcost.h"
+#include "../ZFXFunction.h"
+#include "zpar.h"
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstring>
+#include <set>
+
+namespace {
+
+//宿主函数按名字前缀查, 先匹配的优先, 没有列出来的按一次普通的标量函数算
+struct CallCost {
+    const char* prefix;
+    double cycles;
+};
+
+const CallCost callCosts[] = {
+    {"sin_fast", 10}, {"cos_fast", 10}, {"tan_fast", 10}, {"exp_fast", 8}, {"log_fast", 8},
+    {"asin", 15}, {"acos", 15}, {"atan2", 25}, {"atan", 15},
+    {"sin", 18}, {"cos", 18}, {"tan", 20}, {"exp", 15}, {"log", 15}, {"pow", 40},
+    {"floor", 3}, {"ceil", 3},
+    {"perlin1", 20}, {"perlin2", 45}, {"perlin3", 175}, {"perlin4", 300},
+    {"simplex1", 20}, {"simplex2", 60}, {"simplex3", 150}, {"simplex4", 250},
+    {"curl", 1000}, {"fbm", 600},
+    {"randn", 40}, {"randsphere", 45}, {"rand", 10},
+};
+
+double callCost(int index) {
+    if (static_cast<std::size_t>(index) >= zfx_cfunctionCount()) {
+        return 10;
+    }
+    const std::string& name = zfx_cfunctions()[index].name;
+    for (const CallCost& c : callCosts) {
+        if (name.compare(0, std::strlen(c.prefix), c.prefix) == 0) {
+            return c.cycles;
+        }
+    }
+    return 10;
+}
+
+double floatCost(const zfx_InsnInfo& d) {
+    double w = ZFX_EXT_W(d.ext);
+    switch (d.op) {
+        case OpCode::kJump:
+            return 0.1;
+        case OpCode::kJumpIfNot:
+            return 0.5;
+        case OpCode::kReturn:
+            return 0.1;
+        case OpCode::kModulus:
+            return 38;
+        //整数除法没有SIMD指令, 每个lane一次idiv
+        case OpCode::kIntDivide:
+        case OpCode::kIntModulus:
+            return 20;
+        case OpCode::kFastCall:
+            return callCost(d.b);
+        case OpCode::kDot:
+        case OpCode::kDistance:
+            return w * (d.op == OpCode::kDot ? 1 : 2);
+        case OpCode::kCross:
+            return 3;
+        case OpCode::kLength:
+            return 2 * w;
+        case OpCode::kNormalize:
+            return (ZFX_EXT_F(d.ext) & ZFX_VEC_FAST) ? 2.3 * w : 4 * w;
+        case OpCode::kLerp:
+        case OpCode::kClamp:
+        case OpCode::kReflect:
+            return 1.6 * w;
+        case OpCode::kSmoothstep:
+            return 10 * w;
+        case OpCode::kMin:
+        case OpCode::kMax:
+            return w;
+        case OpCode::kSample:
+            return (ZFX_EXT_F(d.ext) & ZFX_SAMPLE_CUBIC) ? 135 : 110;
+        case OpCode::kMatMul:
+            return w * w * w;
+        case OpCode::kTranspose:
+            return 0.5 * w * w;
+        case OpCode::kInverse:
+            return w == 4 ? 145 : 75;
+        case OpCode::kDeterminant:
+            return w == 4 ? 40 : 10;
+        case OpCode::kTransformPoint:
+        case OpCode::kTransformVector:
+            return 10;
+        case OpCode::kTransformNormal:
+            return w == 4 ? 58 : 40;
+        case OpCode::kQuatMul:
+        case OpCode::kQuatRotate:
+            return 7;
+        case OpCode::kQuatToMat:
+            return 10;
+        default:
+            //常量, 读写属性, 赋值和标量的算术比较位运算都差不多
+            return 1;
+    }
+}
+
+//向回跳转和它的目标之间就是循环体, 循环体里的指令和浮点运算另外记一份
+void scan(const Proto* p, std::set<int>* reads, std::set<int>* writes, zfx_Traffic* t) {
+    std::vector<zfx_InsnInfo> insns;
+    std::vector<std::size_t> pcs;
+    for (std::size_t pc = 0; pc < p->code.size();) {
+        zfx_InsnInfo d = zfx_decode(p, pc);
+        insns.push_back(d);
+        pcs.push_back(pc);
+        pc += d.size;
+    }
+    std::vector<bool> inLoop(insns.size(), false);
+    for (std::size_t i = 0; i < insns.size(); i++) {
+        if (insns[i].target >= 0 && insns[i].target <= static_cast<std::int64_t>(pcs[i])) {
+            t->loops = true;
+            for (std::size_t k = i + 1; k-- > 0 && static_cast<std::int64_t>(pcs[k]) >= insns[i].target;) {
+                inLoop[k] = true;
+            }
+        }
+    }
+    for (std::size_t i = 0; i < insns.size(); i++) {
+        const zfx_InsnInfo& d = insns[i];
+        if (d.op == OpCode::kLoadPtr) {
+            reads->insert(d.b);
+        } else if (d.op == OpCode::kStorePtr) {
+            writes->insert(d.b);
+        }
+        double flops = zfx_insnflops(p, d);
+        t->flops += flops;
+        t->insns++;
+        if (inLoop[i]) {
+            t->loopFlops += flops;
+            t->loopInsns++;
+        }
+    }
+    for (auto const& sub : p->p) {
+        scan(&sub, reads, writes, t);
+    }
+}
+
+}
+
+double zfx_insncost(const Proto* p, const zfx_InsnInfo& d) {
+    double cost = floatCost(d);
+    if (p->number == Zfx_NumberType::kDouble) {
+        if (d.op == OpCode::kMultiply || d.op == OpCode::kDivide) {
+            cost *= 2;
+        } else if (zfx_hasext(d.op) || d.op == OpCode::kFastCall) {
+            cost *= 1.2;
+        }
+    }
+    return cost;
+}
+
+double zfx_insnflops(const Proto* p, const zfx_InsnInfo& d) {
+    double w = ZFX_EXT_W(d.ext);
+    switch (d.op) {
+        case OpCode::kLoadConstInt:
+        case OpCode::kLoadConstFloat:
+        case OpCode::kLoadConstDouble:
+        case OpCode::kAddrSymbol:
+        case OpCode::kAddrOffset:
+        case OpCode::kLoadPtr:
+        case OpCode::kStorePtr:
+        case OpCode::kAssign:
+        case OpCode::kBitInverse:
+        case OpCode::kBitAnd:
+        case OpCode::kBitOr:
+        case OpCode::kBitXor:
+        case OpCode::kBitShl:
+        case OpCode::kBitShr:
+        case OpCode::kLogicNot:
+        case OpCode::kLogicAnd:
+        case OpCode::kLogicOr:
+        case OpCode::kReturn:
+        case OpCode::kJump:
+        case OpCode::kJumpIfNot:
+        case OpCode::kTranspose:
+        case OpCode::kIntNegate:
+        case OpCode::kIntPlus:
+        case OpCode::kIntMinus:
+        case OpCode::kIntMultiply:
+        case OpCode::kIntDivide:
+        case OpCode::kIntModulus:
+        case OpCode::kIntCmpEqual:
+        case OpCode::kIntCmpNotEqual:
+        case OpCode::kIntCmpLessThan:
+        case OpCode::kIntCmpLessEqual:
+        case OpCode::kIntCmpGreaterThan:
+        case OpCode::kIntCmpGreaterEqual:
+        case OpCode::kIntToFloat:
+        case OpCode::kFloatToInt:
+            return 0;
+        case OpCode::kFastCall:
+            return zfx_insncost(p, d);
+        case OpCode::kDot:
+            return 2 * w - 1;
+        case OpCode::kCross:
+            return 9;
+        case OpCode::kLength:
+            return 2 * w;
+        case OpCode::kDistance:
+            return 3 * w;
+        case OpCode::kNormalize:
+            return 3 * w + 1;
+        case OpCode::kLerp:
+            return 3 * w;
+        case OpCode::kClamp:
+            return 2 * w;
+        case OpCode::kSmoothstep:
+            return 7 * w;
+        case OpCode::kReflect:
+            return 5 * w;
+        case OpCode::kMin:
+        case OpCode::kMax:
+            return w;
+        case OpCode::kSample:
+            return (ZFX_EXT_F(d.ext) & ZFX_SAMPLE_CUBIC) ? 16 : 8;
+        case OpCode::kMatMul:
+            return 2 * w * w * w;
+        case OpCode::kInverse:
+            return w == 4 ? 200 : 50;
+        case OpCode::kDeterminant:
+            return w == 4 ? 40 : 14;
+        case OpCode::kTransformPoint:
+            return 21;
+        case OpCode::kTransformVector:
+            return 15;
+        case OpCode::kTransformNormal:
+            return 65;
+        case OpCode::kQuatMul:
+            return 28;
+        case OpCode::kQuatRotate:
+            return 30;
+        case OpCode::kQuatToMat:
+            return 25;
+        default:
+            return 1;
+    }
+}
+
+zfx_Analysis zfx_analyze(const Proto* p) {
+    zfx_Analysis a;
+    std::vector<int> index(p->code.size() + 1, -1);
+    for (std::size_t pc = 0; pc < p->code.size();) {
+        index[pc] = static_cast<int>(a.insns.size());
+        a.pcs.push_back(pc);
+        a.insns.push_back(zfx_decode(p, pc));
+        pc += a.insns.back().size;
+    }
+    int n = static_cast<int>(a.insns.size());
+    index[p->code.size()] = n;
+    //跳到code外面或者指令中间的当成跳到结尾
+    auto target = [&](const zfx_InsnInfo& d) {
+        if (d.target < 0 || d.target > static_cast<std::int64_t>(p->code.size()) || index[d.target] < 0) {
+            return n;
+        }
+        return index[d.target];
+    };
+
+    using Regs = std::bitset<256>;
+    auto bits = [](const zfx_RegRange& r) {
+        Regs s;
+        for (int k = 0; k < r.n && r.reg + k < 256; k++) {
+            s.set(r.reg + k);
+        }
+        return s;
+    };
+
+    //活跃变量, 从后往前迭代到不动点
+    std::vector<Regs> in(n), out(n);
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (int i = n - 1; i >= 0; i--) {
+            const zfx_InsnInfo& d = a.insns[i];
+            Regs o;
+            if (d.op != OpCode::kReturn) {
+                if (d.op != OpCode::kJump && i + 1 < n) {
+                    o |= in[i + 1];
+                }
+                int t = target(d);
+                if (d.target >= 0 && t < n) {
+                    o |= in[t];
+                }
+            }
+            Regs s = o & ~bits(d.def);
+            for (int k = 0; k < d.nuse; k++) {
+                s |= bits(d.use[k]);
+            }
+            if (s != in[i] || o != out[i]) {
+                in[i] = s;
+                out[i] = o;
+                changed = true;
+            }
+        }
+    }
+
+    //varying从读属性和函数参数开始传播, varying条件跳过的那一段里写的寄存器也是varying
+    Regs varying;
+    int nparams = 0;
+    for (Zfx_ArgKind k : p->params) {
+        nparams += zfx_kindregs(k);
+    }
+    varying |= bits({0, nparams});
+    std::vector<bool> divergent(n, false);
+    a.varying.assign(n, false);
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (int i = 0; i < n; i++) {
+            const zfx_InsnInfo& d = a.insns[i];
+            bool v = divergent[i] || d.op == OpCode::kLoadPtr || d.op == OpCode::kStorePtr;
+            for (int k = 0; k < d.nuse; k++) {
+                v = v || (bits(d.use[k]) & varying).any();
+            }
+            //没有参数的宿主函数多半是随机数之类的, 当成每个点不同
+            v = v || (d.op == OpCode::kFastCall && d.nuse == 0);
+            if (!v || a.varying[i]) {
+                continue;
+            }
+            a.varying[i] = true;
+            varying |= bits(d.def);
+            if (d.op == OpCode::kJumpIfNot) {
+                for (int k = i + 1; k < target(d); k++) {
+                    divergent[k] = true;
+                }
+            }
+            changed = true;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        int live = static_cast<int>((in[i] | out[i]).count());
+        a.live.push_back(live);
+        a.maxlive = std::max(a.maxlive, live);
+        a.cost.push_back(zfx_insncost(p, a.insns[i]));
+    }
+    return a;
+}
+
+zfx_Traffic zfx_traffic(const Proto* p) {
+    std::set<int> reads, writes;
+    zfx_Traffic t;
+    scan(p, &reads, &writes, &t);
+    double size = p->number == Zfx_NumberType::kDouble ? sizeof(double) : sizeof(float);
+    t.attrsRead = static_cast<int>(reads.size());
+    t.attrsWritten = static_cast<int>(writes.size());
+    t.bytesRead = t.attrsRead * size;
+    t.bytesWritten = t.attrsWritten * size;
+    return t;
+}
+
+zfx_Estimate zfx_estimate(const Proto* p) {
+    zfx_Analysis a = zfx_analyze(p);
+    zfx_Estimate e;
+    for (std::size_t i = 0; i < a.insns.size(); i++) {
+        const zfx_InsnInfo& d = a.insns[i];
+        e.cycles += a.cost[i];
+        if (!a.varying[i]) {
+            e.uniformCycles += a.cost[i];
+        }
+        if (d.op == OpCode::kFastCall) {
+            e.hostCalls = true;
+        }
+    }
+    std::size_t size = p->number == Zfx_NumberType::kDouble ? sizeof(double) : sizeof(float);
+    e.traffic = zfx_traffic(p);
+    e.insns = static_cast<int>(a.insns.size());
+    e.nregs = static_cast<int>(p->nregs);
+    e.maxlive = a.maxlive;
+    e.frameBytes = p->nregs * ZFX_LANES * size;
+    return e;
+}
+
+int zfx_suggestThreads(const zfx_Estimate& e, std::size_t npoints, int maxThreads) {
+    //叫醒一个工作线程加上建状态大约20us, 按3GHz折成周期
+    const double kThreadCycles = 60000;
+    double chunks = std::ceil(static_cast<double>(npoints) / ZFX_CHUNK);
+    double n = std::min(static_cast<double>(maxThreads), chunks);
+    if (!e.traffic.loops) {
+        n = std::min(n, std::floor(e.cycles * static_cast<double>(npoints) / kThreadCycles));
+    }
+    return n < 1 ? 1 : static_cast<int>(n);
+}
@@ -0,0 +1,86 @@
+//
+// Created by admin on 2022/9/23.
+//
+/*
+ * 静态代价模型, 估计一条指令对每个点要花多少个周期, 已经包含了分派摊到每个lane上的开销
+ * 数字是用zfx_bench的vm.*和builtin.*在3GHz左右的机器上测出来再换算的, 只适合用来比较和排序
+ * */
+#pragma once
+
+#include "zdebug.h"
+#include <vector>
+
+//float程序里每个点的周期数, double程序乘除法和内置函数更贵
+double zfx_insncost(const Proto* p, const zfx_InsnInfo& d);
+
+//每个点的浮点运算数, 比较和min/max也算, 宿主函数按它的周期数折算
+double zfx_insnflops(const Proto* p, const zfx_InsnInfo& d);
+
+/*
+ * 对一个函数做的静态分析, 按指令的顺序排列, 不包括子函数
+ * varying: 指令的结果每个点都可能不同; 读属性, 依赖varying的值, 或者在varying条件的分支里写的都是varying
+ *          寄存器不区分是哪一次赋值, 所以是偏保守的
+ * live: 执行这条指令前后活着的寄存器数, 就是寄存器压力
+ * */
+struct zfx_Analysis {
+    std::vector<zfx_InsnInfo> insns;
+    std::vector<std::size_t> pcs;       //每条指令在code里的下标
+    std::vector<bool> varying;
+    std::vector<int> live;
+    std::vector<double> cost;           //zfx_insncost
+    int maxlive = 0;
+};
+
+zfx_Analysis zfx_analyze(const Proto* p);
+
+/*
+ * 每个点读写属性的字节数和浮点运算数, main和子函数都算上
+ * 同一个属性读多次只算一次, 查找表默认在缓存里不算, 循环和分支按直线执行一遍估计
+ * */
+struct zfx_Traffic {
+    double bytesRead = 0;
+    double bytesWritten = 0;
+    double flops = 0;
+    int attrsRead = 0;
+    int attrsWritten = 0;
+    int insns = 0;              //直线执行一遍的指令数, 包括子函数
+    int loopInsns = 0;          //其中在循环体里的
+    double loopFlops = 0;
+    bool loops = false;         //有向回跳转, flops只是走一遍循环体的
+    bool scaled = false;        //flops已经按实际执行的指令数放大过
+
+    double bytes() const {
+        return bytesRead + bytesWritten;
+    }
+
+    //每字节多少次浮点运算, 不读写属性的程序是0
+    double intensity() const {
+        return bytes() > 0 ? flops / bytes() : 0;
+    }
+};
+
+zfx_Traffic zfx_traffic(const Proto* p);
+
+/*
+ * 给宿主的调度器用的静态估计, 编译完就能拿到, 不用先跑一遍
+ * 按直线执行一遍算: 有循环的话cycles是下限, 分支两边都算上所以是上限
+ * */
+struct zfx_Estimate {
+    double cycles = 0;          //每个点的周期数
+    double uniformCycles = 0;   //其中结果对所有点都一样的指令, 现在每个lane照样算一遍, 提到循环外或者JIT能省掉
+    zfx_Traffic traffic;        //zfx_traffic, 包括子函数
+    int insns = 0;
+    int nregs = 0;              //Proto::nregs
+    int maxlive = 0;            //同时活着的寄存器数的最大值
+    std::size_t frameBytes = 0; //一帧寄存器占的栈空间
+    bool hostCalls = false;     //调用了宿主函数, 这部分cycles是按函数名估计的
+};
+
+//cycles这些只估计p自己, 不包括p->p里的子函数, traffic包括; Module::estimate()缓存了main的结果
+zfx_Estimate zfx_estimate(const Proto* p);
+
+/*
+ * 按估计的总周期决定用几个线程合适, 每个线程至少分到一块ZFX_CHUNK, 并且要值得起一次线程切换
+ * 有循环的时候不知道要转几圈, cycles只是下限, 不按它减少线程, 只看块数
+ * */
+int zfx_suggestThreads(const zfx_Estimate& e, std::size_t npoints, int maxThreads);
@@ -0,0 +1,314 @@
+//
+// Created by admin on 2022/9/21.
+//
+#include "zdebug.h"
+#include "../ZFXFunction.h"
+#include <algorithm>
+
+void zfx_addlineinfo(Proto* p, std::uint32_t line, std::uint32_t col) {
+    auto pc = static_cast<std::uint32_t>(p->code.size());
+    auto& info = p->lineinfo;
+    //同一个pc上后来的位置覆盖前面的, 中间没有生成指令
+    if (!info.empty() && info.back().pc == pc) {
+        info.pop_back();
+    }
+    if (!info.empty() && info.back().line == line && info.back().col == col) {
+        return;
+    }
+    info.push_back({pc, line, col});
+}
+
+const LineInfo* zfx_getlineinfo(const Proto* p, std::size_t pc) {
+    auto const& info = p->lineinfo;
+    auto it = std::upper_bound(info.begin(), info.end(), pc, [](std::size_t pc, const LineInfo& li) {
+        return pc < li.pc;
+    });
+    if (it == info.begin()) {
+        return nullptr;
+    }
+    return &*(it - 1);
+}
+
+const Proto* zfx_findproto(const Proto* main, const Instruction* pc) {
+    const Instruction* code = main->code.data();
+    if (pc >= code && pc < code + main->code.size()) {
+        return main;
+    }
+    for (auto const& sub : main->p) {
+        if (const Proto* p = zfx_findproto(&sub, pc)) {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+int zfx_kindregs(Zfx_ArgKind kind) {
+    switch (kind) {
+        case Zfx_ArgKind::kVoid:
+            return 0;
+        case Zfx_ArgKind::kVec3:
+            return 3;
+        case Zfx_ArgKind::kQuat:
+            return 4;
+        case Zfx_ArgKind::kMat3:
+            return 9;
+        case Zfx_ArgKind::kMat4:
+            return 16;
+        default:
+            return 1;
+    }
+}
+
+zfx_InsnInfo zfx_decode(const Proto* p, std::size_t pc, const std::vector<zfx_Table>* tables) {
+    zfx_InsnInfo d;
+    Instruction insn = p->code[pc];
+    d.op = static_cast<OpCode>(ZFX_INSN_OP(insn));
+    d.size = zfx_insnsize(d.op);
+    d.a = ZFX_INSN_A(insn);
+    d.b = ZFX_INSN_B(insn);
+    d.c = ZFX_INSN_C(insn);
+    if (zfx_hasext(d.op) && pc + 1 < p->code.size()) {
+        d.ext = p->code[pc + 1];
+    }
+    auto def = [&](int reg, int n) {
+        d.def = {reg, n};
+    };
+    auto use = [&](int reg, int n) {
+        d.use[d.nuse++] = {reg, n};
+    };
+    int w = static_cast<int>(ZFX_EXT_W(d.ext));
+    int dd = static_cast<int>(ZFX_EXT_D(d.ext));
+    bool scalar = (ZFX_EXT_F(d.ext) & ZFX_VEC_SCALAR) != 0;
+    int sw = scalar ? 1 : w;
+    int nn = w * w;
+    switch (d.op) {
+        case OpCode::kLoadConstInt:
+        case OpCode::kLoadConstFloat:
+        case OpCode::kLoadConstDouble:
+        case OpCode::kLoadPtr:
+            def(d.a, 1);
+            break;
+        case OpCode::kStorePtr:
+            use(d.a, 1);
+            break;
+        case OpCode::kAddrSymbol:
+        case OpCode::kAddrOffset:
+            break;
+        case OpCode::kAssign:
+        case OpCode::kNegate:
+        case OpCode::kBitInverse:
+        case OpCode::kLogicNot:
+        case OpCode::kIntNegate:
+        case OpCode::kIntToFloat:
+        case OpCode::kFloatToInt:
+            def(d.a, 1);
+            use(d.b, 1);
+            break;
+        case OpCode::kFastCall: {
+            if (static_cast<std::size_t>(d.b) >= zfx_cfunctionCount()) {
+                break;
+            }
+            const zfx_CFunctionInfo& f = zfx_cfunctions()[d.b];
+            int nargs = 0;
+            for (Zfx_ArgKind k : f.args) {
+                nargs += zfx_kindregs(k);
+            }
+            def(d.a, f.batched ? f.nrets : zfx_kindregs(f.ret));
+            if (nargs != 0) {
+                use(d.c, nargs);
+            }
+            break;
+        }
+        case OpCode::kReturn:
+            use(d.a, zfx_kindregs(p->ret));
+            break;
+        case OpCode::kJump:
+            d.target = static_cast<std::int64_t>(pc) + 1 + ZFX_INSN_sBx(insn);
+            break;
+        case OpCode::kJumpIfNot:
+            use(d.a, 1);
+            d.target = static_cast<std::int64_t>(pc) + 1 + ZFX_INSN_sBx(insn);
+            break;
+        case OpCode::kDot:
+        case OpCode::kDistance:
+            def(d.a, 1);
+            use(d.b, w);
+            use(d.c, w);
+            break;
+        case OpCode::kCross:
+            def(d.a, 3);
+            use(d.b, 3);
+            use(d.c, 3);
+            break;
+        case OpCode::kLength:
+            def(d.a, 1);
+            use(d.b, w);
+            break;
+        case OpCode::kNormalize:
+            def(d.a, w);
+            use(d.b, w);
+            break;
+        case OpCode::kLerp:
+            def(d.a, w);
+            use(d.b, w);
+            use(d.c, w);
+            use(dd, sw);
+            break;
+        case OpCode::kClamp:
+            def(d.a, w);
+            use(d.b, w);
+            use(d.c, sw);
+            use(dd, sw);
+            break;
+        case OpCode::kSmoothstep:
+            def(d.a, w);
+            use(d.b, sw);
+            use(d.c, sw);
+            use(dd, w);
+            break;
+        case OpCode::kReflect:
+            def(d.a, w);
+            use(d.b, w);
+            use(d.c, w);
+            break;
+        case OpCode::kMin:
+        case OpCode::kMax:
+            def(d.a, w);
+            use(d.b, w);
+            use(d.c, sw);
+            break;
+        case OpCode::kSample: {
+            const zfx_Table* t = nullptr;
+            if (tables != nullptr && static_cast<std::size_t>(d.b) < tables->size() && !(*tables)[d.b].data.empty()) {
+                t = &(*tables)[d.b];
+            }
+            def(d.a, t ? t->channels : 1);
+            use(d.c, t ? t->dims : 1);
+            break;
+        }
+        case OpCode::kMatMul:
+            def(d.a, nn);
+            use(d.b, nn);
+            use(d.c, nn);
+            break;
+        case OpCode::kTranspose:
+        case OpCode::kInverse:
+            def(d.a, nn);
+            use(d.b, nn);
+            break;
+        case OpCode::kDeterminant:
+            def(d.a, 1);
+            use(d.b, nn);
+            break;
+        case OpCode::kTransformPoint:
+        case OpCode::kTransformVector:
+        case OpCode::kTransformNormal:
+            def(d.a, 3);
+            use(d.b, nn);
+            use(d.c, 3);
+            break;
+        case OpCode::kQuatMul:
+            def(d.a, 4);
+            use(d.b, 4);
+            use(d.c, 4);
+            break;
+        case OpCode::kQuatRotate:
+            def(d.a, 3);
+            use(d.b, 4);
+            use(d.c, 3);
+            break;
+        case OpCode::kQuatToMat:
+            def(d.a, nn);
+            use(d.b, 4);
+            break;
+        default:
+            //剩下的都是A = B op C
+            def(d.a, 1);
+            use(d.b, 1);
+            use(d.c, 1);
+            break;
+    }
+    return d;
+}
+
+//扩展字里的W不合法的话返回说明: 向量指令是1到4, kCross只能是3, 矩阵指令是3或4, 四元数的kQuatMul和kQuatRotate不看W
+static std::string check_width(const zfx_InsnInfo& d) {
+    if (!zfx_hasext(d.op) || d.op == OpCode::kSample) {
+        return {};
+    }
+    int w = static_cast<int>(ZFX_EXT_W(d.ext));
+    switch (d.op) {
+        case OpCode::kQuatMul:
+        case OpCode::kQuatRotate:
+            return {};
+        case OpCode::kCross:
+            return w == 3 ? std::string() : "cross needs width 3, got " + std::to_string(w);
+        case OpCode::kMatMul:
+        case OpCode::kTranspose:
+        case OpCode::kInverse:
+        case OpCode::kDeterminant:
+        case OpCode::kTransformPoint:
+        case OpCode::kTransformVector:
+        case OpCode::kTransformNormal:
+        case OpCode::kQuatToMat:
+            return w == 3 || w == 4 ? std::string() : "matrix size must be 3 or 4, got " + std::to_string(w);
+        default:
+            return w >= 1 && w <= 4 ? std::string() : "vector width must be 1 to 4, got " + std::to_string(w);
+    }
+}
+
+std::string zfx_verify(const Proto* p, const std::vector<zfx_Table>* tables) {
+    std::string where = p->name.empty() ? "main" : p->name;
+    std::size_t size = p->code.size();
+    std::vector<bool> starts(size + 1, false);
+    for (std::size_t pc = 0; pc < size;) {
+        starts[pc] = true;
+        auto op = static_cast<OpCode>(ZFX_INSN_OP(p->code[pc]));
+        if (op > OpCode::kFloatToInt) {
+            return where + ": unknown opcode " + std::to_string(static_cast<int>(op)) + " at pc " + std::to_string(pc);
+        }
+        if (pc + zfx_insnsize(op) > size) {
+            return where + ": truncated instruction at pc " + std::to_string(pc);
+        }
+        pc += zfx_insnsize(op);
+    }
+    starts[size] = true;
+    for (std::size_t pc = 0; pc < size;) {
+        zfx_InsnInfo d = zfx_decode(p, pc, tables);
+        std::string at = where + ": pc " + std::to_string(pc) + ": ";
+        if (d.op == OpCode::kFastCall && static_cast<std::size_t>(d.b) >= zfx_cfunctionCount()) {
+            return at + "host function #" + std::to_string(d.b) + " is not registered";
+        }
+        if ((d.op == OpCode::kLoadPtr || d.op == OpCode::kStorePtr) &&
+            static_cast<std::size_t>(d.b) >= p->syms.size()) {
+            return at + "attribute #" + std::to_string(d.b) + " is not declared in syms";
+        }
+        std::string bad = check_width(d);
+        if (!bad.empty()) {
+            return at + bad;
+        }
+        if (d.op == OpCode::kJump || d.op == OpCode::kJumpIfNot) {
+            if (d.target < 0 || d.target > static_cast<std::int64_t>(size) || !starts[d.target]) {
+                return at + "jump target " + std::to_string(d.target) + " is not an instruction";
+            }
+        }
+        auto inside = [&](const zfx_RegRange& r) {
+            return r.n == 0 || static_cast<std::uint32_t>(r.reg + r.n) <= p->nregs;
+        };
+        bool ok = inside(d.def);
+        for (int k = 0; k < d.nuse; k++) {
+            ok = ok && inside(d.use[k]);
+        }
+        if (!ok) {
+            return at + "register out of range, the function has " + std::to_string(p->nregs);
+        }
+        pc += d.size;
+    }
+    for (auto const& sub : p->p) {
+        std::string err = zfx_verify(&sub, tables);
+        if (!err.empty()) {
+            return err;
+        }
+    }
+    return {};
+}
@@ -0,0 +1,57 @@
+//
+// Created by admin on 2022/9/21.
+//
+/*
+ * 调试信息: 指令和源码位置的对应关系, 存在Proto::lineinfo里, 解释器执行时从来不读它
+ * 代码生成在开始生成一个语句或者表达式之前调用zfx_addlineinfo, 之后生成的指令都算在这个位置上
+ * 另外把一条指令解码成它读写的寄存器段, 给反汇编和静态分析用
+ * */
+#pragma once
+
+#include "zvm.h"
+#include <string>
+
+using zeno::zfx::LineInfo;
+
+//接下来追加到p->code的指令来自line行col列
+void zfx_addlineinfo(Proto* p, std::uint32_t line, std::uint32_t col);
+
+//code[pc]所在的位置, 没有调试信息的话返回nullptr
+const LineInfo* zfx_getlineinfo(const Proto* p, std::size_t pc);
+
+//在main和它的子函数里找代码包含pc的那一个, 找不到返回nullptr
+const Proto* zfx_findproto(const Proto* main, const Instruction* pc);
+
+//一个参数或者返回值占几个寄存器
+int zfx_kindregs(Zfx_ArgKind kind);
+
+//连续的一段寄存器[reg, reg+n)
+struct zfx_RegRange {
+    int reg = 0;
+    int n = 0;
+};
+
+/*
+ * 一条指令解码之后的样子
+ * kSample的通道数和维数要等表绑定了才知道, 没有给tables或者那张表还没绑定的时候只算第一个坐标和第一个通道
+ * */
+struct zfx_InsnInfo {
+    OpCode op{};
+    int size = 1;                   //占几个字
+    int a = 0, b = 0, c = 0;
+    Instruction ext = 0;            //向量和矩阵指令的扩展字, 没有的是0
+    zfx_RegRange def;               //写的寄存器
+    zfx_RegRange use[4];            //读的寄存器
+    int nuse = 0;
+    std::int64_t target = -1;       //跳转目标的pc, 不是跳转指令的话是-1
+};
+
+//解码p->code[pc]开始的那条指令, tables是按Proto::tables下标绑定的查找表
+zfx_InsnInfo zfx_decode(const Proto* p, std::size_t pc, const std::vector<zfx_Table>* tables = nullptr);
+
+/*
+ * 检查p和它的子函数里执行时不再检查的东西: 指令是否完整, 宿主函数的编号, 属性的编号是否在syms以内, 向量和矩阵的宽度, 跳转目标, 寄存器是否在nregs以内
+ * 没问题返回空串, 否则返回第一处问题的说明, Module::create用它拒绝坏的字节码
+ * 给了tables的话kSample按表的通道数和维数检查, zfx_bindTable用它拒绝放不下的表
+ * */
+std::string zfx_verify(const Proto* p, const std::vector<zfx_Table>* tables = nullptr);
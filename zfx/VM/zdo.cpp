@@ -0,0 +1,416 @@
+//
+// Created by admin on 2022/9/3.
+//
+/*
+ * 值栈不在每次push的时候检查容量, 而是预留一大块虚拟地址, 只提交前面一部分
+ * push越界的时候会访问到PROT_NONE的页, SIGSEGV处理函数里按需提交后返回重新执行那条指令,
+ * 到了预留区域的最后一页(guard page)就变成ZFX_ERRSTACK跳回保护调用
+ * 栈的地址永远不会移动, 所以也不需要像lua那样在扩容后修正指向栈的指针
+ */
+#include "zdo.h"
+#include "zmetrics.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <csetjmp>
+
+#if defined(__linux__)
+#define ZFX_USE_GUARDPAGE 1
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define ZFX_USE_GUARDPAGE 0
+#endif
+
+#if ZFX_USE_GUARDPAGE
+//SIGSEGV用SA_NODEFER安装, 跳出信号处理函数后不需要恢复信号掩码, 所以不保存掩码
+#define ZFX_THROW(c)    siglongjmp((c)->b, 1)
+#define ZFX_TRY(c, a)   if (sigsetjmp((c)->b, 0) == 0) { a }
+#define zfx_jmpbuf      sigjmp_buf
+#else
+#define ZFX_THROW(c)    longjmp((c)->b, 1)
+#define ZFX_TRY(c, a)   if (setjmp((c)->b) == 0) { a }
+#define zfx_jmpbuf      jmp_buf
+#endif
+
+struct zfx_longjmp {
+    struct zfx_longjmp* previous;
+    zfx_jmpbuf b;
+    volatile int status;
+};
+
+//当前线程正在保护模式下执行的状态, 给采样分析器用
+static thread_local zfx_State* running = nullptr;
+
+static void setstacklast(zfx_State* l) {
+    l->stack_last = reinterpret_cast<Object*>(l->stackRegion.base + l->stackRegion.committed);
+    l->stackSize = static_cast<int>(l->stack_last - l->stack);
+}
+
+#if ZFX_USE_GUARDPAGE
+
+static std::size_t pagesize() {
+    static const std::size_t size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+static bool region_reserve(zfx_Region* r, std::size_t bytes, std::size_t initial) {
+    std::size_t page = pagesize();
+    r->reserved = (bytes + page - 1) / page * page + page;
+    void* p = mmap(nullptr, r->reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        *r = zfx_Region{};
+        return false;
+    }
+    r->base = static_cast<char*>(p);
+    r->committed = std::min((initial + page - 1) / page * page, r->reserved - page);
+    zfx_metricAdd(Zfx_Metric::kStackBytes, r->committed);
+    return mprotect(r->base, r->committed, PROT_READ | PROT_WRITE) == 0;
+}
+
+static void region_release(zfx_Region* r) {
+    if (r->base != nullptr) {
+        zfx_metricSub(Zfx_Metric::kStackBytes, r->committed);
+        munmap(r->base, r->reserved);
+    }
+    *r = zfx_Region{};
+}
+
+static bool region_contains(const zfx_Region* r, const char* addr) {
+    return addr >= r->base + r->committed && addr < r->base + r->reserved;
+}
+
+//提交到能覆盖addr为止, 至少翻倍, 碰到guard page就返回false
+static bool region_commit(zfx_Region* r, const char* addr) {
+    std::size_t page = pagesize();
+    std::size_t limit = r->reserved - page;
+    std::size_t need = static_cast<std::size_t>(addr - r->base) / page * page + page;
+    if (need > limit) {
+        return false;
+    }
+    std::size_t grow = std::min(std::max(need, r->committed * 2), limit);
+    if (mprotect(r->base + r->committed, grow - r->committed, PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+    //在SIGSEGV处理函数里, 原子加法是异步信号安全的
+    zfx_metricAdd(Zfx_Metric::kStackGrows);
+    zfx_metricAdd(Zfx_Metric::kStackBytes, grow - r->committed);
+    r->committed = grow;
+    return true;
+}
+
+/*
+ * 所有活着的状态的栈, 信号处理函数按出错的地址在这里找是哪个状态的栈
+ * 不管是哪个线程建的状态, 也不管是不是在保护调用里, 越界都能按需提交
+ * 槽位只增不减, 空出来的槽位下一个状态接着用, 所以遍历的时候不需要加锁
+ */
+struct StackSlot {
+    std::atomic<bool> used{false};
+    std::atomic<zfx_State*> state{nullptr};
+    //槽位换主人的时候会改写, 信号处理函数可能同时在读, 所以也是原子变量, 先写地址再release发布state
+    std::atomic<const char*> base{nullptr};
+    std::atomic<std::size_t> reserved{0};
+    StackSlot* next = nullptr;
+};
+
+static std::atomic<StackSlot*> stackslots{nullptr};
+
+static void stack_register(zfx_State* l) {
+    StackSlot* slot = stackslots.load(std::memory_order_acquire);
+    for (; slot != nullptr; slot = slot->next) {
+        bool expected = false;
+        if (!slot->used.load(std::memory_order_relaxed) &&
+            slot->used.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            break;
+        }
+    }
+    if (slot == nullptr) {
+        slot = new StackSlot;
+        slot->used.store(true, std::memory_order_relaxed);
+        slot->next = stackslots.load(std::memory_order_relaxed);
+        while (!stackslots.compare_exchange_weak(slot->next, slot, std::memory_order_release)) {
+        }
+    }
+    slot->base.store(l->stackRegion.base, std::memory_order_relaxed);
+    slot->reserved.store(l->stackRegion.reserved, std::memory_order_relaxed);
+    slot->state.store(l, std::memory_order_release);
+}
+
+static void stack_unregister(zfx_State* l) {
+    for (StackSlot* slot = stackslots.load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+        if (slot->state.load(std::memory_order_relaxed) == l) {
+            slot->state.store(nullptr, std::memory_order_release);
+            slot->used.store(false, std::memory_order_release);
+            return;
+        }
+    }
+}
+
+//只在信号处理函数里调用, 地址落在某个状态预留的区域里就返回这个状态
+static zfx_State* stack_owner(const char* addr) {
+    for (StackSlot* slot = stackslots.load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+        zfx_State* l = slot->state.load(std::memory_order_acquire);
+        if (l == nullptr) {
+            continue;
+        }
+        const char* base = slot->base.load(std::memory_order_acquire);
+        std::size_t reserved = slot->reserved.load(std::memory_order_acquire);
+        //读地址的时候槽位可能刚好换了主人, 再看一次state没变才算数
+        if (addr >= base && addr < base + reserved && slot->state.load(std::memory_order_acquire) == l) {
+            return l;
+        }
+    }
+    return nullptr;
+}
+
+static struct sigaction oldsegv;
+
+static void segv_handler(int sig, siginfo_t* info, void* ctx) {
+    auto* addr = static_cast<const char*>(info->si_addr);
+    zfx_State* l = stack_owner(addr);
+    if (l != nullptr && region_contains(&l->stackRegion, addr)) {
+        if (region_commit(&l->stackRegion, addr)) {
+            setstacklast(l);
+            return; //返回之后会重新执行出错的那条指令
+        }
+        if (l->errorJmp != nullptr) {
+            l->errorJmp->status = ZFX_ERRSTACK;
+            ZFX_THROW(l->errorJmp);
+        }
+        static const char msg[] = "zfx: stack overflow outside protected call\n";
+        write(2, msg, sizeof(msg) - 1);
+        abort();
+    }
+
+    //不是zfx的栈, 交给原来的处理函数
+    if (oldsegv.sa_flags & SA_SIGINFO) {
+        oldsegv.sa_sigaction(sig, info, ctx);
+    } else if (oldsegv.sa_handler != SIG_DFL && oldsegv.sa_handler != SIG_IGN) {
+        oldsegv.sa_handler(sig);
+    } else {
+        //恢复默认行为, 返回后再触发一次就会正常core dump
+        signal(sig, SIG_DFL);
+    }
+}
+
+/*
+ * 处理函数用SA_ONSTACK安装, 执行zfx的每个线程都要有自己的备用信号栈,
+ * 不然C++的栈本身溢出的时候处理函数还是在溢出的栈上执行, 连转交给原来的处理函数都做不到
+ * 线程已经有备用栈(比如宿主自己设了)的话就用原来的, 线程退出时关掉并释放自己设的
+ */
+struct AltStack {
+    static constexpr std::size_t kSize = 64 * 1024;
+    void* base = nullptr;
+
+    AltStack() {
+        stack_t old{};
+        if (sigaltstack(nullptr, &old) == 0 && !(old.ss_flags & SS_DISABLE)) {
+            return;
+        }
+        void* p = mmap(nullptr, kSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return;
+        }
+        stack_t ss{};
+        ss.ss_sp = p;
+        ss.ss_size = kSize;
+        if (sigaltstack(&ss, nullptr) != 0) {
+            munmap(p, kSize);
+            return;
+        }
+        base = p;
+    }
+
+    ~AltStack() {
+        if (base != nullptr) {
+            stack_t ss{};
+            ss.ss_flags = SS_DISABLE;
+            sigaltstack(&ss, nullptr);
+            munmap(base, kSize);
+        }
+    }
+};
+
+static thread_local AltStack altstack;
+
+static bool install_handler() {
+    struct sigaction sa{};
+    sa.sa_sigaction = segv_handler;
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(SIGSEGV, &sa, &oldsegv) == 0;
+}
+
+#else
+
+static bool region_reserve(zfx_Region* r, std::size_t bytes, std::size_t) {
+    r->base = static_cast<char*>(std::malloc(bytes));
+    r->reserved = r->committed = r->base != nullptr ? bytes : 0;
+    zfx_metricAdd(Zfx_Metric::kStackBytes, r->committed);
+    return r->base != nullptr;
+}
+
+static void region_release(zfx_Region* r) {
+    zfx_metricSub(Zfx_Metric::kStackBytes, r->committed);
+    std::free(r->base);
+    *r = zfx_Region{};
+}
+
+#endif
+
+/*
+ * 关闭的状态把栈留在当前线程的缓存里, 下一个新建的状态直接拿来用
+ * 这样每个工作线程或者任务新建状态时不需要mmap, 也不需要加锁
+ */
+struct StackCache {
+    zfx_Region regions[ZFX_STACKCACHE];
+    int n = 0;
+
+    ~StackCache() {
+        while (n > 0) {
+            region_release(&regions[--n]);
+        }
+    }
+};
+
+static thread_local StackCache stackcache;
+
+void zfx_stackinit(zfx_State* l) {
+#if ZFX_USE_GUARDPAGE
+    static const bool installed = install_handler();
+    (void)installed;
+#endif
+    if (stackcache.n > 0) {
+        zfx_metricAdd(Zfx_Metric::kStackCacheHits);
+        l->stackRegion = stackcache.regions[--stackcache.n];
+    } else {
+        zfx_metricAdd(Zfx_Metric::kStackCacheMisses);
+        if (!region_reserve(&l->stackRegion, ZFX_MAXSTACK * sizeof(Object), ZFX_BASIC_STACK_SIZE * sizeof(Object))) {
+            std::fprintf(stderr, "zfx: cannot reserve vm stack\n");
+            std::abort();
+        }
+    }
+    l->stack = reinterpret_cast<Object*>(l->stackRegion.base);
+    l->top = l->stack;
+    l->base = l->stack;
+    setstacklast(l);
+#if ZFX_USE_GUARDPAGE
+    stack_register(l);
+#endif
+}
+
+void zfx_stackfree(zfx_State* l) {
+#if ZFX_USE_GUARDPAGE
+    stack_unregister(l);
+#endif
+    if (stackcache.n < ZFX_STACKCACHE) {
+        stackcache.regions[stackcache.n++] = l->stackRegion;
+        l->stackRegion = zfx_Region{};
+    } else {
+        region_release(&l->stackRegion);
+    }
+    l->stack = l->top = l->base = l->stack_last = nullptr;
+    l->stackSize = 0;
+}
+
+//栈上能用的字节数, 不包括guard page
+static std::size_t stack_usable(const zfx_State* l) {
+#if ZFX_USE_GUARDPAGE
+    return l->stackRegion.reserved - pagesize();
+#else
+    return l->stackRegion.reserved;
+#endif
+}
+
+void* zfx_pushframe(zfx_State* l, std::size_t bytes) {
+    //帧的开头记住原来的栈顶, 所以至少多占一个Object
+    auto addr = reinterpret_cast<std::uintptr_t>(l->top + 1);
+    addr = (addr + 63) & ~std::uintptr_t{63};
+    auto* frame = reinterpret_cast<char*>(addr);
+    //一帧寄存器比一页大得多, 越界的地方可能直接跳过guard page落到别的映射上, 所以帧要先检查
+    if (frame > l->stackRegion.base + stack_usable(l) ||
+        bytes > static_cast<std::size_t>(l->stackRegion.base + stack_usable(l) - frame)) {
+        zfx_throw(l, ZFX_ERRSTACK);
+    }
+    reinterpret_cast<Object**>(frame)[-1] = l->top;
+    l->top = reinterpret_cast<Object*>(frame + bytes);
+    return frame;
+}
+
+bool zfx_hasroom(zfx_State* l, std::size_t bytes) {
+    //和zfx_pushframe一样算上对齐和开头记栈顶的那个Object
+    std::size_t usable = stack_usable(l);
+    std::size_t used = static_cast<std::size_t>(reinterpret_cast<char*>(l->top + 1) - l->stackRegion.base) + 63;
+    return used <= usable && bytes <= usable - used;
+}
+
+void zfx_popframe(zfx_State* l, void* frame) {
+    l->top = reinterpret_cast<Object**>(frame)[-1];
+}
+
+int zfx_growstack(zfx_State* l, int n) {
+#if ZFX_USE_GUARDPAGE
+    (void)l;
+    (void)n;
+    return 1;
+#else
+    return l->stack_last - l->top >= n;
+#endif
+}
+
+void zfx_throw(zfx_State* l, int errcode) {
+    if (l->errorJmp != nullptr) {
+        l->errorJmp->status = errcode;
+        ZFX_THROW(l->errorJmp);
+    }
+    l->status = static_cast<std::uint8_t>(errcode);
+    std::fprintf(stderr, "zfx: unprotected error %d\n", errcode);
+    std::abort();
+}
+
+int zfx_checkcancel(zfx_State* l) {
+    using clock = std::chrono::steady_clock;
+    l->budget = ZFX_CHECKINTERVAL;
+    zfx_CancelToken* token = l->cancel.get();
+    bool timed = l->yieldAt != clock::time_point::max();
+    if (token == nullptr && !timed) {
+        return 0;
+    }
+    clock::time_point now = clock::now();
+    if (token != nullptr && (token->cancelled.load(std::memory_order_relaxed) || now >= token->deadline)) {
+        //让同一次执行的其他线程也停下来
+        token->cancel();
+        zfx_throw(l, ZFX_CANCELLED);
+    }
+    return timed && now >= l->yieldAt;
+}
+
+zfx_State* zfx_running() {
+    return running;
+}
+
+int zfx_rawrunprotected(zfx_State* l, Pfunc f, void* ud) {
+    zfx_longjmp lj;
+    lj.status = ZFX_OK;
+    lj.previous = l->errorJmp;
+    l->errorJmp = &lj;
+    std::ptrdiff_t oldtop = l->top - l->stack;
+    zfx_State* oldrunning = running;
+    running = l;
+#if ZFX_USE_GUARDPAGE
+    //第一次在这个线程上执行的时候设好备用信号栈
+    (void)altstack;
+#endif
+    ZFX_TRY(&lj,
+        f(l, ud);
+    )
+    running = oldrunning;
+    l->errorJmp = lj.previous;
+    if (lj.status != ZFX_OK) {
+        //出错之后把栈顶恢复到调用之前, 尤其是栈溢出时top已经越过了guard page
+        l->top = l->stack + oldtop;
+    }
+    return lj.status;
+}
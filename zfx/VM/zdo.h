@@ -4,4 +4,61 @@
 #pragma once
 
 //处理一些虚拟机上的栈操作
+#include "zstate.h"
 
+//值栈最多能放多少个Object, 超过之后就是stack overflow
+#define ZFX_MAXSTACK        1000000
+//新建状态时预先提交的大小
+#define ZFX_BASIC_STACK_SIZE (2 * ZFX_MINSTACK)
+//每个线程最多缓存几个关闭掉的状态的栈
+#define ZFX_STACKCACHE      8
+//每隔多少次循环回边或者函数调用检查一次取消和超时
+#define ZFX_CHECKINTERVAL   1024
+//没有循环也没有调用的程序每执行多少批检查一次, 批和批之间没有执行到一半的指令
+#define ZFX_BATCHCHECK      16
+
+using Pfunc = void (*)(zfx_State* l, void* ud);
+
+//预留整个值栈的虚拟地址空间, 后面的页全部是PROT_NONE
+void zfx_stackinit(zfx_State* l);
+
+void zfx_stackfree(zfx_State* l);
+
+//没有guard page的平台上检查还有没有n个空位, 有guard page的平台上直接返回1
+int zfx_growstack(zfx_State* l, int n);
+
+//跳回最近的一个保护调用, 相当于lua的luaD_throw
+[[noreturn]] void zfx_throw(zfx_State* l, int errcode);
+
+//在栈顶上分配bytes字节, 按64字节对齐, 放不下的话抛ZFX_ERRSTACK
+void* zfx_pushframe(zfx_State* l, std::size_t bytes);
+
+//释放这一帧, 栈顶回到分配之前
+void zfx_popframe(zfx_State* l, void* frame);
+
+//栈上还能不能再分配bytes字节的一帧, 在保护调用之外分配之前用它检查
+bool zfx_hasroom(zfx_State* l, std::size_t bytes);
+
+//一帧寄存器, 每个寄存器ZFX_LANES个lane, T是程序的数值类型
+template <class T = float>
+inline std::size_t zfx_framesize(std::uint32_t nregs) {
+    return sizeof(T) * ZFX_LANES * nregs;
+}
+
+template <class T = float>
+inline T* zfx_pushregs(zfx_State* l, std::uint32_t nregs) {
+    return static_cast<T*>(zfx_pushframe(l, zfx_framesize<T>(nregs)));
+}
+
+inline void zfx_popregs(zfx_State* l, void* regs) {
+    zfx_popframe(l, regs);
+}
+
+//budget减到0时调用, 被取消或者超时了就抛ZFX_CANCELLED, 时间片用完了返回1表示应该挂起
+int zfx_checkcancel(zfx_State* l);
+
+//在保护模式下执行f, 返回ZFX_OK或者错误码
+int zfx_rawrunprotected(zfx_State* l, Pfunc f, void* ud);
+
+//当前线程正在保护模式下执行的状态, 没有的话是nullptr, 信号处理函数里也可以调用
+zfx_State* zfx_running();
@@ -0,0 +1,145 @@
+//
+// Created by admin on 2022/9/23.
+//
+#include "zdump.h"
+#include "../ZFXFunction.h"
+#include "../../magic_enum.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::string reg(const zfx_RegRange& r) {
+    if (r.n <= 1) {
+        return "r" + std::to_string(r.reg);
+    }
+    return "r" + std::to_string(r.reg) + "..r" + std::to_string(r.reg + r.n - 1);
+}
+
+//去掉开头的k, 小写
+std::string mnemonic(OpCode op) {
+    auto name = magic_enum::enum_name(op);
+    if (name.empty()) {
+        return "op" + std::to_string(static_cast<int>(op));
+    }
+    std::string s(name.substr(1));
+    for (char& ch : s) {
+        ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+    }
+    return s;
+}
+
+std::string operands(const Proto* p, std::size_t pc, const zfx_InsnInfo& d, std::string* comment) {
+    const std::vector<std::uint32_t>& code = p->code;
+    auto sym = [&](int i) {
+        return static_cast<std::size_t>(i) < p->syms.size() ? "@" + p->syms[i] : "@#" + std::to_string(i);
+    };
+    std::string s = d.def.n != 0 ? reg(d.def) : "";
+    switch (d.op) {
+        case OpCode::kLoadConstInt:
+            *comment = std::to_string(static_cast<std::int32_t>(code[pc + 1]));
+            return s;
+        case OpCode::kLoadConstFloat: {
+            float v;
+            std::memcpy(&v, &code[pc + 1], sizeof(v));
+            *comment = std::to_string(v);
+            return s;
+        }
+        case OpCode::kLoadConstDouble: {
+            std::uint64_t bits = code[pc + 1] | (static_cast<std::uint64_t>(code[pc + 2]) << 32);
+            double v;
+            std::memcpy(&v, &bits, sizeof(v));
+            *comment = std::to_string(v);
+            return s;
+        }
+        case OpCode::kLoadPtr:
+            return s + ", " + sym(d.b);
+        case OpCode::kStorePtr:
+            return sym(d.b) + ", " + reg(d.use[0]);
+        case OpCode::kJump:
+        case OpCode::kJumpIfNot:
+            *comment = "-> " + std::to_string(d.target);
+            return d.nuse != 0 ? reg(d.use[0]) + ", " + std::to_string(ZFX_INSN_sBx(code[pc])) :
+                                 std::to_string(ZFX_INSN_sBx(code[pc]));
+        case OpCode::kFastCall:
+            if (static_cast<std::size_t>(d.b) < zfx_cfunctionCount()) {
+                *comment = zfx_cfunctions()[d.b].name;
+            }
+            break;
+        case OpCode::kSample:
+            *comment = static_cast<std::size_t>(d.b) < p->tables.size() ? p->tables[d.b] : "table #" + std::to_string(d.b);
+            *comment += (ZFX_EXT_F(d.ext) & ZFX_SAMPLE_CUBIC) ? " cubic" : " linear";
+            break;
+        default:
+            break;
+    }
+    for (int k = 0; k < d.nuse; k++) {
+        s += (s.empty() ? "" : ", ") + reg(d.use[k]);
+    }
+    if (zfx_hasext(d.op) && d.op != OpCode::kSample) {
+        std::string flags = "w=" + std::to_string(ZFX_EXT_W(d.ext));
+        if (ZFX_EXT_F(d.ext) & ZFX_VEC_SCALAR) {
+            flags += " scalar";
+        }
+        if ((ZFX_EXT_F(d.ext) & ZFX_VEC_FAST) && d.op == OpCode::kNormalize) {
+            flags += " fast";
+        }
+        *comment = flags;
+    }
+    return s;
+}
+
+std::vector<std::string_view> splitLines(std::string_view source) {
+    std::vector<std::string_view> lines;
+    while (!source.empty()) {
+        std::size_t eol = source.find('\n');
+        lines.push_back(source.substr(0, eol));
+        source = eol == std::string_view::npos ? std::string_view{} : source.substr(eol + 1);
+    }
+    return lines;
+}
+
+}
+
+void zfx_disassemble(const Proto* p, std::FILE* out, std::string_view source) {
+    zfx_Analysis a = zfx_analyze(p);
+    std::vector<std::string_view> lines = splitLines(source);
+
+    std::fprintf(out, "function %s: %zu words, %u registers, %s\n", p->name.empty() ? "<main>" : p->name.c_str(),
+                 p->code.size(), p->nregs, p->number == Zfx_NumberType::kDouble ? "double" : "float");
+    std::fprintf(out, "%6s %5s %3s %4s %7s  %-16s %s\n", "pc", "line", "u/v", "live", "cycles", "op", "operands");
+    std::uint32_t lastLine = 0;
+    double total = 0, uniform = 0;
+    for (std::size_t i = 0; i < a.insns.size(); i++) {
+        const zfx_InsnInfo& d = a.insns[i];
+        std::size_t pc = a.pcs[i];
+        const LineInfo* li = zfx_getlineinfo(p, pc);
+        std::uint32_t line = li != nullptr ? li->line : 0;
+        if (line != lastLine && line >= 1 && line <= lines.size()) {
+            std::string_view text = lines[line - 1];
+            std::fprintf(out, "; %u: %.*s\n", line, static_cast<int>(text.size()), text.data());
+        }
+        lastLine = line;
+        std::string comment;
+        std::string ops = operands(p, pc, d, &comment);
+        std::string lineText = line != 0 ? std::to_string(line) : "-";
+        if (!comment.empty()) {
+            ops.resize(std::max<std::size_t>(ops.size(), 24), ' ');
+            ops += " ; " + comment;
+        }
+        std::fprintf(out, "%6zu %5s %3s %4d %7.1f  %-16s %s\n", pc, lineText.c_str(), a.varying[i] ? "V" : "U",
+                     a.live[i], a.cost[i], mnemonic(d.op).c_str(), ops.c_str());
+        total += a.cost[i];
+        if (!a.varying[i]) {
+            uniform += a.cost[i];
+        }
+    }
+    std::fprintf(out, "; %zu instructions, max %d live registers, %.1f cycles per point straight-line (%.1f uniform)\n\n",
+                 a.insns.size(), a.maxlive, total, uniform);
+    for (auto const& sub : p->p) {
+        zfx_disassemble(&sub, out, source);
+    }
+}
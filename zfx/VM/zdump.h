@@ -0,0 +1,17 @@
+//
+// Created by admin on 2022/9/23.
+//
+/*
+ * 反汇编编译好的程序, 每条指令一行:
+ *   pc  行号  U/V  寄存器压力  每点周期  指令  操作数  ; 属性名, 常量, 函数名, 跳转目标
+ * U是所有点结果都一样的指令(可以提到循环外或者只算一次), V是每个点不同的, 分析见zcost.h
+ * 给了源码的话, 行号变化的地方先打一行源码
+ * 最后是这个函数的汇总, 然后依次反汇编它的子函数
+ * */
+#pragma once
+
+#include "zcost.h"
+#include <cstdio>
+#include <string_view>
+
+void zfx_disassemble(const Proto* p, std::FILE* out, std::string_view source = {});
@@ -0,0 +1,187 @@
+//
+// Created by admin on 2022/9/15.
+//
+/*
+ * 查找表和曲线的采样, 每一维先算出要读的格点和权重, 再按张量积把各维的格点加起来
+ * 线性插值每维读2个格点, Catmull-Rom每维读4个, 边上的格点按wrap处理
+ * 曲线的格点不等距, Catmull-Rom的切线按格点的实际间距算
+ * */
+#include "zlut.h"
+#include "../bc.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+//一维上要读的格点下标和对应的权重, 不用的维只有一个权重为1的格点
+template <class T>
+struct Taps {
+    int idx[4];
+    T w[4];
+    int count;
+};
+
+template <class T>
+inline void weights(Taps<T>& taps, T f, bool cubic) {
+    if (cubic) {
+        T f2 = f * f, f3 = f2 * f;
+        taps.w[0] = T(-0.5) * f3 + f2 - T(0.5) * f;
+        taps.w[1] = T(1.5) * f3 - T(2.5) * f2 + T(1);
+        taps.w[2] = T(-1.5) * f3 + T(2) * f2 + T(0.5) * f;
+        taps.w[3] = T(0.5) * f3 - T(0.5) * f2;
+        taps.count = 4;
+    } else {
+        taps.w[0] = T(1) - f;
+        taps.w[1] = f;
+        taps.count = 2;
+    }
+}
+
+//等距格点, x换算到格点坐标以后拆成整数部分和小数部分
+template <class T>
+inline void uniform(Taps<T>& taps, const zfx_Table& t, int d, T x, bool cubic) {
+    int size = t.size[d];
+    T extent = T(t.hi[d]) - T(t.lo[d]);
+    T u;
+    int i0;
+    if (t.wrap == Zfx_Wrap::kRepeat) {
+        u = (x - T(t.lo[d])) * T(size) / extent;
+        u -= std::floor(u / T(size)) * T(size);
+        //NaN和舍入到size的都当作0
+        if (!(u >= T(0) && u < T(size))) {
+            u = T(0);
+        }
+        i0 = static_cast<int>(u);
+    } else {
+        u = (x - T(t.lo[d])) * T(size - 1) / extent;
+        if (!(u > T(0))) {
+            u = T(0);
+        }
+        if (u > T(size - 1)) {
+            u = T(size - 1);
+        }
+        i0 = static_cast<int>(u);
+    }
+    weights(taps, u - T(i0), cubic);
+    int first = cubic ? i0 - 1 : i0;
+    for (int k = 0; k < taps.count; k++) {
+        int j = first + k;
+        if (t.wrap == Zfx_Wrap::kRepeat) {
+            j = (j + size) % size;
+        } else {
+            j = j < 0 ? 0 : (j >= size ? size - 1 : j);
+        }
+        taps.idx[k] = j;
+    }
+}
+
+/*
+ * 不等距的Catmull-Rom, 在[k1, k2]上做Hermite插值, 切线m1 = (p2 - p0) / (k2 - k0), m2 = (p3 - p1) / (k3 - k1)
+ * 两头外面的格点按最边上的间距补一个, 值取边上的, 格点等距的时候和weights算出来的一样
+ * */
+template <class T>
+inline void nonuniform(Taps<T>& taps, const float* keys, int size, int j, T f) {
+    auto key = [&](int i) {
+        if (i < 0) {
+            return T(2) * T(keys[0]) - T(keys[1]);
+        }
+        if (i >= size) {
+            return T(2) * T(keys[size - 1]) - T(keys[size - 2]);
+        }
+        return T(keys[i]);
+    };
+    T k0 = key(j - 1), k1 = key(j), k2 = key(j + 1), k3 = key(j + 2);
+    T h = k2 - k1;
+    T f2 = f * f, f3 = f2 * f;
+    T h00 = T(2) * f3 - T(3) * f2 + T(1);
+    T h10 = f3 - T(2) * f2 + f;
+    T h01 = T(-2) * f3 + T(3) * f2;
+    T h11 = f3 - f2;
+    T a = h * h10 / (k2 - k0), b = h * h11 / (k3 - k1);
+    taps.w[0] = -a;
+    taps.w[1] = h00 - b;
+    taps.w[2] = h01 + a;
+    taps.w[3] = b;
+    taps.count = 4;
+}
+
+//曲线的格点不等距, 二分查找x所在的区间
+template <class T>
+inline void curve(Taps<T>& taps, const zfx_Table& t, T x, bool cubic) {
+    const float* keys = t.keys.data();
+    int size = t.size[0];
+    int j;
+    T f;
+    if (!(x > T(keys[0]))) {
+        j = 0;
+        f = T(0);
+    } else if (x >= T(keys[size - 1])) {
+        j = size - 1;
+        f = T(0);
+    } else {
+        j = static_cast<int>(std::upper_bound(keys, keys + size, x,
+                                              [](T v, float k) { return v < T(k); }) - keys) - 1;
+        f = (x - T(keys[j])) / (T(keys[j + 1]) - T(keys[j]));
+    }
+    //只有一个格点的时候没有间距可算, f总是0, 按等距的算就行
+    if (cubic && size > 1) {
+        nonuniform(taps, keys, size, j, f);
+    } else {
+        weights(taps, f, cubic);
+    }
+    int first = cubic ? j - 1 : j;
+    for (int k = 0; k < taps.count; k++) {
+        int i = first + k;
+        taps.idx[k] = i < 0 ? 0 : (i >= size ? size - 1 : i);
+    }
+}
+
+}
+
+template <class T>
+void zfx_sample(const zfx_Table& t, T* out, const T* p, int n, int flags) {
+    bool cubic = flags & ZFX_SAMPLE_CUBIC;
+    int ch = t.channels;
+    //第d维走一格在data里跨过多少个float
+    int stride[3] = {ch, ch * t.size[0], ch * t.size[0] * t.size[1]};
+    const float* data = t.data.data();
+    //先写到局部数组里, out和p是同一个寄存器的时候不会读到写了一半的坐标
+    T res[4][ZFX_LANES];
+
+    for (int i = 0; i < n; i++) {
+        Taps<T> taps[3];
+        for (int d = 0; d < 3; d++) {
+            if (d >= t.dims) {
+                taps[d] = {{0}, {T(1)}, 1};
+            } else if (!t.keys.empty()) {
+                curve(taps[d], t, p[i], cubic);
+            } else {
+                uniform(taps[d], t, d, p[d * ZFX_LANES + i], cubic);
+            }
+        }
+        T acc[4] = {T(0), T(0), T(0), T(0)};
+        for (int z = 0; z < taps[2].count; z++) {
+            for (int y = 0; y < taps[1].count; y++) {
+                T wyz = taps[1].w[y] * taps[2].w[z];
+                int base = taps[1].idx[y] * stride[1] + taps[2].idx[z] * stride[2];
+                for (int x = 0; x < taps[0].count; x++) {
+                    T w = taps[0].w[x] * wyz;
+                    const float* v = data + base + taps[0].idx[x] * stride[0];
+                    for (int c = 0; c < ch; c++) {
+                        acc[c] += w * T(v[c]);
+                    }
+                }
+            }
+        }
+        for (int c = 0; c < ch; c++) {
+            res[c][i] = acc[c];
+        }
+    }
+
+    for (int c = 0; c < ch; c++) {
+        std::copy(res[c], res[c] + n, out + c * ZFX_LANES);
+    }
+}
+
+template void zfx_sample<float>(const zfx_Table&, float*, const float*, int, int);
+template void zfx_sample<double>(const zfx_Table&, double*, const double*, int, int);
@@ -0,0 +1,18 @@
+//
+// Created by admin on 2022/9/15.
+//
+
+#pragma once
+
+#include "zstate.h"
+
+/*
+ * kSample的实现, 对n个lane查表t
+ * p是第一个坐标分量, out是第一个输出通道, 后面的分量和通道都隔ZFX_LANES放, 和寄存器里的向量一样
+ * flags是ZFX_SAMPLE_LINEAR或者ZFX_SAMPLE_CUBIC, out和p可以是同一个寄存器
+ * */
+template <class T>
+void zfx_sample(const zfx_Table& t, T* out, const T* p, int n, int flags);
+
+extern template void zfx_sample<float>(const zfx_Table&, float*, const float*, int, int);
+extern template void zfx_sample<double>(const zfx_Table&, double*, const double*, int, int);
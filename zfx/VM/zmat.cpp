@@ -0,0 +1,299 @@
+//
+// Created by admin on 2022/9/16.
+//
+/*
+ * 矩阵和四元数, 每个分量是一个寄存器, 最里层对lane循环, 编译器会把它向量化
+ * 结果都先写到局部数组里再拷到A, 所以A和输入是同一组寄存器也没关系
+ * */
+#include "zmat.h"
+#include "../ZFX.h"
+#include <algorithm>
+
+using zeno::zfx::OpCode;
+
+namespace {
+
+//最大的结果是mat4
+template <class T>
+using Result = T[16][ZFX_LANES];
+
+template <class T>
+inline const T* comp(const T* r, int k) {
+    return r + k * ZFX_LANES;
+}
+
+template <class T>
+inline void store(T* a, const Result<T>& res, int count, int n) {
+    for (int k = 0; k < count; k++) {
+        std::copy(res[k], res[k] + n, a + k * ZFX_LANES);
+    }
+}
+
+//按列存, 第r行第c列
+inline int at(int dim, int r, int c) {
+    return c * dim + r;
+}
+
+template <class T>
+void matmul(Result<T>& res, const T* b, const T* c, int dim, int n) {
+    for (int col = 0; col < dim; col++) {
+        for (int row = 0; row < dim; row++) {
+            T* o = res[at(dim, row, col)];
+            std::fill(o, o + n, T(0));
+            for (int k = 0; k < dim; k++) {
+                const T* x = comp(b, at(dim, row, k));
+                const T* y = comp(c, at(dim, k, col));
+                for (int i = 0; i < n; i++) {
+                    o[i] += x[i] * y[i];
+                }
+            }
+        }
+    }
+}
+
+template <class T>
+void transpose(Result<T>& res, const T* b, int dim, int n) {
+    for (int col = 0; col < dim; col++) {
+        for (int row = 0; row < dim; row++) {
+            const T* x = comp(b, at(dim, col, row));
+            std::copy(x, x + n, res[at(dim, row, col)]);
+        }
+    }
+}
+
+/*
+ * 伴随矩阵和行列式, 公式对按行存和按列存都成立
+ * 转置的伴随矩阵就是伴随矩阵的转置, 所以m按列存的时候得到的inv也是按列存的
+ * */
+template <class T>
+T adjugate3(T* inv, const T* m) {
+    inv[0] = m[4] * m[8] - m[5] * m[7];
+    inv[1] = m[2] * m[7] - m[1] * m[8];
+    inv[2] = m[1] * m[5] - m[2] * m[4];
+    inv[3] = m[5] * m[6] - m[3] * m[8];
+    inv[4] = m[0] * m[8] - m[2] * m[6];
+    inv[5] = m[2] * m[3] - m[0] * m[5];
+    inv[6] = m[3] * m[7] - m[4] * m[6];
+    inv[7] = m[1] * m[6] - m[0] * m[7];
+    inv[8] = m[0] * m[4] - m[1] * m[3];
+    return m[0] * inv[0] + m[1] * inv[3] + m[2] * inv[6];
+}
+
+//先算12个2x2子式, 每个余子式再由3个子式组合出来
+template <class T>
+T adjugate4(T* inv, const T* m) {
+    T s0 = m[0] * m[5] - m[4] * m[1];
+    T s1 = m[0] * m[6] - m[4] * m[2];
+    T s2 = m[0] * m[7] - m[4] * m[3];
+    T s3 = m[1] * m[6] - m[5] * m[2];
+    T s4 = m[1] * m[7] - m[5] * m[3];
+    T s5 = m[2] * m[7] - m[6] * m[3];
+    T c5 = m[10] * m[15] - m[14] * m[11];
+    T c4 = m[9] * m[15] - m[13] * m[11];
+    T c3 = m[9] * m[14] - m[13] * m[10];
+    T c2 = m[8] * m[15] - m[12] * m[11];
+    T c1 = m[8] * m[14] - m[12] * m[10];
+    T c0 = m[8] * m[13] - m[12] * m[9];
+    inv[0] = m[5] * c5 - m[6] * c4 + m[7] * c3;
+    inv[1] = -m[1] * c5 + m[2] * c4 - m[3] * c3;
+    inv[2] = m[13] * s5 - m[14] * s4 + m[15] * s3;
+    inv[3] = -m[9] * s5 + m[10] * s4 - m[11] * s3;
+    inv[4] = -m[4] * c5 + m[6] * c2 - m[7] * c1;
+    inv[5] = m[0] * c5 - m[2] * c2 + m[3] * c1;
+    inv[6] = -m[12] * s5 + m[14] * s2 - m[15] * s1;
+    inv[7] = m[8] * s5 - m[10] * s2 + m[11] * s1;
+    inv[8] = m[4] * c4 - m[5] * c2 + m[7] * c0;
+    inv[9] = -m[0] * c4 + m[1] * c2 - m[3] * c0;
+    inv[10] = m[12] * s4 - m[13] * s2 + m[15] * s0;
+    inv[11] = -m[8] * s4 + m[9] * s2 - m[11] * s0;
+    inv[12] = -m[4] * c3 + m[5] * c1 - m[6] * c0;
+    inv[13] = m[0] * c3 - m[1] * c1 + m[2] * c0;
+    inv[14] = -m[12] * s3 + m[13] * s1 - m[14] * s0;
+    inv[15] = m[8] * s3 - m[9] * s1 + m[10] * s0;
+    return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+}
+
+template <class T>
+T adjugate(T* inv, const T* m, int dim) {
+    return dim == 3 ? adjugate3(inv, m) : adjugate4(inv, m);
+}
+
+//把第i个lane的矩阵取出来
+template <class T>
+void gather(T* m, const T* b, int count, int i) {
+    for (int k = 0; k < count; k++) {
+        m[k] = b[k * ZFX_LANES + i];
+    }
+}
+
+template <class T>
+void inverse(Result<T>& res, const T* b, int dim, int n) {
+    int count = dim * dim;
+    for (int i = 0; i < n; i++) {
+        T m[16], inv[16];
+        gather(m, b, count, i);
+        T det = adjugate(inv, m, dim);
+        T s = det != T(0) ? T(1) / det : T(0);
+        for (int k = 0; k < count; k++) {
+            res[k][i] = inv[k] * s;
+        }
+    }
+}
+
+template <class T>
+void determinant(Result<T>& res, const T* b, int dim, int n) {
+    for (int i = 0; i < n; i++) {
+        T m[16], inv[16];
+        gather(m, b, dim * dim, i);
+        res[0][i] = adjugate(inv, m, dim);
+    }
+}
+
+//point为真的时候mat4加上最后一列的平移
+template <class T>
+void transform(Result<T>& res, const T* b, const T* c, int dim, bool point, int n) {
+    for (int row = 0; row < 3; row++) {
+        T* o = res[row];
+        if (point && dim == 4) {
+            const T* t = comp(b, at(dim, row, 3));
+            std::copy(t, t + n, o);
+        } else {
+            std::fill(o, o + n, T(0));
+        }
+        for (int k = 0; k < 3; k++) {
+            const T* x = comp(b, at(dim, row, k));
+            const T* v = comp(c, k);
+            for (int i = 0; i < n; i++) {
+                o[i] += x[i] * v[i];
+            }
+        }
+    }
+}
+
+//法线乘的是逆的转置, 就是伴随矩阵的转置除以行列式
+template <class T>
+void transformNormal(Result<T>& res, const T* b, const T* c, int dim, int n) {
+    for (int i = 0; i < n; i++) {
+        T m[9], inv[9];
+        for (int col = 0; col < 3; col++) {
+            for (int row = 0; row < 3; row++) {
+                m[at(3, row, col)] = b[at(dim, row, col) * ZFX_LANES + i];
+            }
+        }
+        T det = adjugate3(inv, m);
+        T s = det != T(0) ? T(1) / det : T(0);
+        T x = c[i], y = c[ZFX_LANES + i], z = c[2 * ZFX_LANES + i];
+        for (int row = 0; row < 3; row++) {
+            res[row][i] = (inv[at(3, 0, row)] * x + inv[at(3, 1, row)] * y + inv[at(3, 2, row)] * z) * s;
+        }
+    }
+}
+
+template <class T>
+void quatmul(Result<T>& res, const T* b, const T* c, int n) {
+    const T *bx = comp(b, 0), *by = comp(b, 1), *bz = comp(b, 2), *bw = comp(b, 3);
+    const T *cx = comp(c, 0), *cy = comp(c, 1), *cz = comp(c, 2), *cw = comp(c, 3);
+    for (int i = 0; i < n; i++) {
+        res[0][i] = bw[i] * cx[i] + bx[i] * cw[i] + by[i] * cz[i] - bz[i] * cy[i];
+        res[1][i] = bw[i] * cy[i] - bx[i] * cz[i] + by[i] * cw[i] + bz[i] * cx[i];
+        res[2][i] = bw[i] * cz[i] + bx[i] * cy[i] - by[i] * cx[i] + bz[i] * cw[i];
+        res[3][i] = bw[i] * cw[i] - bx[i] * cx[i] - by[i] * cy[i] - bz[i] * cz[i];
+    }
+}
+
+//v + w * t + q × t, t = 2 * (q × v), 比先转成矩阵少一半乘法
+template <class T>
+void quatrotate(Result<T>& res, const T* b, const T* c, int n) {
+    const T *qx = comp(b, 0), *qy = comp(b, 1), *qz = comp(b, 2), *qw = comp(b, 3);
+    const T *vx = comp(c, 0), *vy = comp(c, 1), *vz = comp(c, 2);
+    for (int i = 0; i < n; i++) {
+        T tx = T(2) * (qy[i] * vz[i] - qz[i] * vy[i]);
+        T ty = T(2) * (qz[i] * vx[i] - qx[i] * vz[i]);
+        T tz = T(2) * (qx[i] * vy[i] - qy[i] * vx[i]);
+        res[0][i] = vx[i] + qw[i] * tx + (qy[i] * tz - qz[i] * ty);
+        res[1][i] = vy[i] + qw[i] * ty + (qz[i] * tx - qx[i] * tz);
+        res[2][i] = vz[i] + qw[i] * tz + (qx[i] * ty - qy[i] * tx);
+    }
+}
+
+template <class T>
+void quattomat(Result<T>& res, const T* b, int dim, int n) {
+    const T *qx = comp(b, 0), *qy = comp(b, 1), *qz = comp(b, 2), *qw = comp(b, 3);
+    for (int i = 0; i < n; i++) {
+        T x = qx[i], y = qy[i], z = qz[i], w = qw[i];
+        res[at(dim, 0, 0)][i] = T(1) - T(2) * (y * y + z * z);
+        res[at(dim, 1, 0)][i] = T(2) * (x * y + w * z);
+        res[at(dim, 2, 0)][i] = T(2) * (x * z - w * y);
+        res[at(dim, 0, 1)][i] = T(2) * (x * y - w * z);
+        res[at(dim, 1, 1)][i] = T(1) - T(2) * (x * x + z * z);
+        res[at(dim, 2, 1)][i] = T(2) * (y * z + w * x);
+        res[at(dim, 0, 2)][i] = T(2) * (x * z + w * y);
+        res[at(dim, 1, 2)][i] = T(2) * (y * z - w * x);
+        res[at(dim, 2, 2)][i] = T(1) - T(2) * (x * x + y * y);
+    }
+    if (dim == 4) {
+        for (int k = 0; k < 3; k++) {
+            std::fill(res[at(4, k, 3)], res[at(4, k, 3)] + n, T(0));
+            std::fill(res[at(4, 3, k)], res[at(4, 3, k)] + n, T(0));
+        }
+        std::fill(res[at(4, 3, 3)], res[at(4, 3, 3)] + n, T(1));
+    }
+}
+
+}
+
+template <class T>
+bool zfx_matrix(OpCode op, T* a, const T* b, const T* c, int dim, int n) {
+    Result<T> res;
+    switch (op) {
+        case OpCode::kQuatMul:
+            quatmul(res, b, c, n);
+            store(a, res, 4, n);
+            return true;
+        case OpCode::kQuatRotate:
+            quatrotate(res, b, c, n);
+            store(a, res, 3, n);
+            return true;
+        default:
+            break;
+    }
+    if (dim != 3 && dim != 4) {
+        return false;
+    }
+    switch (op) {
+        case OpCode::kMatMul:
+            matmul(res, b, c, dim, n);
+            store(a, res, dim * dim, n);
+            return true;
+        case OpCode::kTranspose:
+            transpose(res, b, dim, n);
+            store(a, res, dim * dim, n);
+            return true;
+        case OpCode::kInverse:
+            inverse(res, b, dim, n);
+            store(a, res, dim * dim, n);
+            return true;
+        case OpCode::kDeterminant:
+            determinant(res, b, dim, n);
+            store(a, res, 1, n);
+            return true;
+        case OpCode::kTransformPoint:
+        case OpCode::kTransformVector:
+            transform(res, b, c, dim, op == OpCode::kTransformPoint, n);
+            store(a, res, 3, n);
+            return true;
+        case OpCode::kTransformNormal:
+            transformNormal(res, b, c, dim, n);
+            store(a, res, 3, n);
+            return true;
+        case OpCode::kQuatToMat:
+            quattomat(res, b, dim, n);
+            store(a, res, dim * dim, n);
+            return true;
+        default:
+            return false;
+    }
+}
+
+template bool zfx_matrix<float>(OpCode, float*, const float*, const float*, int, int);
+template bool zfx_matrix<double>(OpCode, double*, const double*, const double*, int, int);
@@ -0,0 +1,18 @@
+//
+// Created by admin on 2022/9/16.
+//
+
+#pragma once
+
+#include "../bc.h"
+
+/*
+ * kMatMul到kQuatToMat这几条指令的实现, 对n个lane做op
+ * a b c是A B C寄存器, 分量之间隔ZFX_LANES, dim是扩展字里的W
+ * 矩阵指令的dim不是3或者4的时候什么都不做, 返回false
+ * */
+template <class T>
+bool zfx_matrix(zeno::zfx::OpCode op, T* a, const T* b, const T* c, int dim, int n);
+
+extern template bool zfx_matrix<float>(zeno::zfx::OpCode, float*, const float*, const float*, int, int);
+extern template bool zfx_matrix<double>(zeno::zfx::OpCode, double*, const double*, const double*, int, int);
@@ -1,77 +1,460 @@
 //
 // Created by admin on 2022/7/7.
 //
+/*
+ * 内置数学函数的lane版本, 一次算一整批
+ * 每个核心函数都是没有分支的多项式, 循环可以被编译器向量化,
+ * x86上再用target_clones生成AVX-512, AVX2和默认SSE三个版本, 运行时按cpu挑一个
+ * 精确档在double里做范围约简和多项式, 最后舍入成float, 误差不超过1ULP
+ * 快速档是cephes的float多项式, 误差不超过4ULP, exp不产生非规格化数, 那一段直接是0
+ * */
+//gcc默认要保留浮点异常标志, 不肯把两边都算的三目运算if-convert成blend, 整个lane循环就不向量化了
+//这里不关心异常标志和errno, 结果的特殊值最后都用libm修正. 要写在include前面, 不然<cmath>里的函数选项不一致不能内联
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize("no-trapping-math", "no-math-errno")
+#endif
+
+#include "zbuiltins.h"
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+template <class To, class From>
+inline To bits(From f) {
+    static_assert(sizeof(To) == sizeof(From));
+    To t;
+    std::memcpy(&t, &f, sizeof(t));
+    return t;
+}
+
+constexpr double kPi = 3.14159265358979311600e+00;
+constexpr double kPio2 = 1.57079632679489655800e+00;
+constexpr double kPio4 = 7.85398163397448278999e-01;
+constexpr double kTwoOverPi = 6.36619772367581382433e-01;
+//pi/2拆成三段, 前两段只有33位有效数字, 和k相乘是精确的
+constexpr double kPio2_1 = 1.57079632673412561417e+00;
+constexpr double kPio2_2 = 6.07710050630396597660e-11;
+constexpr double kPio2_2t = 2.02226624879595063154e-21;
+constexpr double kLn2Hi = 6.93147180369123816490e-01;
+constexpr double kLn2Lo = 1.90821492927058770002e-10;
+constexpr double kLog2e = 1.44269504088896338700e+00;
+constexpr double kSqrt2 = 1.41421356237309514547e+00;
+//加上再减掉这个数就是四舍五入到整数, 而且和的低位就是那个整数
+constexpr double kRound = 0x1.8p52;
+
+//超过这个范围的三角函数参数交给libm, 三段约简在这以内都是精确的
+constexpr float kTrigLimit = 1.6e6f;
 
+/* ---------------- 精确档, double ---------------- */
 
-static int math_abs() {
+struct SinCosD {
+    double s, c;
+    std::int64_t k;
+};
 
-    return 1;
+inline SinCosD sincos_d(double x) {
+    double t = x * kTwoOverPi + kRound;
+    auto k = static_cast<std::int64_t>(bits<std::uint64_t>(t) - bits<std::uint64_t>(kRound));
+    double kd = t - kRound;
+    double r = x - kd * kPio2_1;
+    r = r - kd * kPio2_2;
+    r = r - kd * kPio2_2t;
+    double z = r * r;
+    double s = r + r * z * (-1.66666666666666666667e-01 + z * (8.33333333333333333333e-03
+             + z * (-1.98412698412698412698e-04 + z * (2.75573192239858906526e-06
+             + z * -2.50521083854417187751e-08))));
+    double c = 1.0 + z * (-0.5 + z * (4.16666666666666666667e-02 + z * (-1.38888888888888888889e-03
+             + z * (2.48015873015873015873e-05 + z * (-2.75573192239858906526e-07
+             + z * 2.08767569878680989792e-09)))));
+    return {s, c, k};
 }
 
-static int math_sin(zfx_State* l) {
-//默认都是对栈顶的值求sin
+inline float sin_p(float xf) {
+    SinCosD sc = sincos_d(xf);
+    double v = (sc.k & 1) ? sc.c : sc.s;
+    return static_cast<float>((sc.k & 2) ? -v : v);
+}
 
-    zfx_pushnumber(l, sin());
-    //checknumber(L,1)得逻辑是
-    //zfx_tonumberx(l, narg, &isnum)
-    return 1;
+inline float cos_p(float xf) {
+    SinCosD sc = sincos_d(xf);
+    double v = (sc.k & 1) ? sc.s : sc.c;
+    return static_cast<float>(((sc.k + 1) & 2) ? -v : v);
 }
 
-//双曲正弦
-static int math_sinh(zfx_State* l) {
-    zfx_pushnumber(l, sinh());
-    return 1;
+inline float tan_p(float xf) {
+    SinCosD sc = sincos_d(xf);
+    return static_cast<float>((sc.k & 1) ? -sc.c / sc.s : sc.s / sc.c);
 }
 
-static int math_cos(zfx_State* l) {
-    zfx_pushnumber(l, cos());
-    return 1;
+//|r| <= 0.35时的exp(r)
+inline double exp_d(double x) {
+    double t = x * kLog2e + kRound;
+    auto k = static_cast<std::int64_t>(bits<std::uint64_t>(t) - bits<std::uint64_t>(kRound));
+    double kd = t - kRound;
+    double r = x - kd * kLn2Hi - kd * kLn2Lo;
+    double p = 1.0 + r * (1.0 + r * (0.5 + r * (1.66666666666666666667e-01 + r * (4.16666666666666666667e-02
+             + r * (8.33333333333333333333e-03 + r * (1.38888888888888888889e-03 + r * (1.98412698412698412698e-04
+             + r * (2.48015873015873015873e-05 + r * 2.75573192239858906526e-06))))))));
+    double scale = bits<double>(static_cast<std::uint64_t>(k + 1023) << 52);
+    return p * scale;
 }
 
-//
-static int math_cosh(zfx_State* l) {
-    zfx_pushnumber(l, cosh());
+inline float exp_p(float xf) {
+    //float能表示的结果都在这个范围里, 外面的直接上溢或者下溢
+    double x = xf < -150.0f ? -150.0 : (xf > 100.0f ? 100.0 : static_cast<double>(xf));
+    return static_cast<float>(exp_d(x));
+}
+
+//x是正的有限数
+inline double log_d(double x) {
+    auto b = bits<std::uint64_t>(x);
+    auto e = static_cast<std::int64_t>((b >> 52) & 0x7ff) - 1023;
+    double m = bits<double>((b & 0x000fffffffffffffull) | 0x3ff0000000000000ull);
+    bool big = m > kSqrt2;
+    m = big ? m * 0.5 : m;
+    e = big ? e + 1 : e;
+    double f = m - 1.0;
+    double s = f / (2.0 + f);
+    double z = s * s;
+    double p = 2.0 * s * (1.0 + z * (3.33333333333333333333e-01 + z * (2.0e-01 + z * (1.42857142857142857143e-01
+             + z * (1.11111111111111111111e-01 + z * (9.09090909090909090909e-02 + z * 7.69230769230769230769e-02))))));
+    auto ed = static_cast<double>(e);
+    return ed * kLn2Hi + (ed * kLn2Lo + p);
+}
+
+inline float log_p(float xf) {
+    return static_cast<float>(log_d(xf));
+}
+
+inline double atan_d(double t) {
+    double a = std::fabs(t);
+    bool big = a > 2.41421356237309514547e+00;
+    bool mid = a > 4.14213562373095145475e-01;
+    double y0 = big ? kPio2 : (mid ? kPio4 : 0.0);
+    double u = big ? -1.0 / a : (mid ? (a - 1.0) / (a + 1.0) : a);
+    double z = u * u;
+    double p = u + u * z * (-3.33333333333333333333e-01 + z * (2.0e-01 + z * (-1.42857142857142857143e-01
+             + z * (1.11111111111111111111e-01 + z * (-9.09090909090909090909e-02 + z * (7.69230769230769230769e-02
+             + z * (-6.66666666666666666667e-02 + z * (5.88235294117647058824e-02 + z * (-5.26315789473684210526e-02
+             + z * 4.76190476190476190476e-02)))))))));
+    return std::copysign(y0 + p, t);
+}
+
+inline float atan_p(float xf) {
+    return static_cast<float>(atan_d(xf));
+}
+
+inline float asin_p(float xf) {
+    double x = xf;
+    return static_cast<float>(atan_d(x / std::sqrt((1.0 - x) * (1.0 + x))));
+}
+
+inline float acos_p(float xf) {
+    double x = xf;
+    return static_cast<float>(2.0 * atan_d(std::sqrt((1.0 - x) / (1.0 + x))));
+}
+
+inline float atan2_p(float yf, float xf) {
+    double y = yf, x = xf;
+    double a = atan_d(std::fabs(y) / std::fabs(x));
+    a = x < 0.0 ? kPi - a : a;
+    return static_cast<float>(std::copysign(a, y));
+}
+
+inline float pow_p(float xf, float yf) {
+    double t = static_cast<double>(yf) * log_d(xf);
+    t = t < -150.0 ? -150.0 : (t > 100.0 ? 100.0 : t);
+    return static_cast<float>(exp_d(t));
+}
+
+/* ---------------- 快速档, float, cephes的系数 ---------------- */
+
+constexpr float kPio2f = 1.57079632679489661923f;
+constexpr float kPio4f = 0.785398163397448309616f;
+constexpr float kPif = 3.14159265358979323846f;
+constexpr float kRoundf = 0x1.8p23f;
+
+/*
+ * 三角函数在零点附近的相对误差完全取决于范围约简
+ * |x| <= kFastTrigLimit时pi/2拆成四段, 前三段只有11位有效数字, 和k相乘还有前两次减法都是精确的,
+ * 整个约简都在float里做, 误差不超过2.5ULP. 更大的参数float的约简会丢掉好几位, 退回double约简(kWide)
+ * */
+constexpr float kFastTrigLimit = 8192.0f;
+constexpr float kTwoOverPif = 0.636619772367581343076f;
+constexpr float kPio2f_1 = 0x1.92p0f;
+constexpr float kPio2f_2 = 0x1.fb4p-12f;
+constexpr float kPio2f_3 = 0x1.444p-24f;
+constexpr float kPio2f_4 = 0x1.68c234p-39f;
+
+struct SinCosF {
+    float s, c;
+    std::int32_t k;
+};
+
+template <bool kWide>
+inline SinCosF sincos_f(float xf) {
+    std::int32_t k;
+    float z;
+    if constexpr (kWide) {
+        double x = xf;
+        double t = x * kTwoOverPi + kRound;
+        k = static_cast<std::int32_t>(bits<std::uint64_t>(t) - bits<std::uint64_t>(kRound));
+        double kd = t - kRound;
+        z = static_cast<float>(((x - kd * kPio2_1) - kd * kPio2_2) - kd * kPio2_2t);
+    } else {
+        float t = xf * kTwoOverPif + kRoundf;
+        k = static_cast<std::int32_t>(bits<std::uint32_t>(t) - bits<std::uint32_t>(kRoundf));
+        float kf = t - kRoundf;
+        z = ((xf - kf * kPio2f_1) - kf * kPio2f_2) - kf * kPio2f_3;
+        z = z - kf * kPio2f_4;
+    }
+    float zz = z * z;
+    float c = ((2.443315711809948E-005f * zz - 1.388731625493765E-003f) * zz + 4.166664568298827E-002f) * zz * zz
+            - 0.5f * zz + 1.0f;
+    float s = ((-1.9515295891E-4f * zz + 8.3321608736E-3f) * zz - 1.6666654611E-1f) * zz * z + z;
+    return {s, c, k};
+}
+
+template <bool kWide>
+inline float sin_f(float x) {
+    SinCosF sc = sincos_f<kWide>(x);
+    float v = (sc.k & 1) ? sc.c : sc.s;
+    return (sc.k & 2) ? -v : v;
 }
 
-static int math_tan(zfx_State* l) {
-    zfx_pushnumber(l, tan());
-    return 1;
+template <bool kWide>
+inline float cos_f(float x) {
+    SinCosF sc = sincos_f<kWide>(x);
+    float v = (sc.k & 1) ? sc.s : sc.c;
+    return ((sc.k + 1) & 2) ? -v : v;
 }
 
-static int math_tanh() {
+template <bool kWide>
+inline float tan_f(float x) {
+    SinCosF sc = sincos_f<kWide>(x);
+    return (sc.k & 1) ? -sc.c / sc.s : sc.s / sc.c;
+}
 
+/*
+ * 超出范围的x直接饱和, 不交给libm: 大于89的结果本来就是inf,
+ * 结果比FLT_MIN小的直接给0, 产生非规格化数的乘法在x86上要慢几十倍, 快速档不要这一段
+ * 2^n拆成两半分两次乘, n到128也不会把指数域加成inf. 取整用加减kRoundf, 没有float到int的转换
+ * */
+inline float exp_f(float x) {
+    bool tiny = x < -87.3365447f;
+    x = tiny ? 0.0f : (x > 89.0f ? 89.0f : x);
+    float t = x * 1.44269504088896341f + kRoundf;
+    auto n = static_cast<std::int32_t>(bits<std::uint32_t>(t) - bits<std::uint32_t>(kRoundf));
+    float fx = t - kRoundf;
+    x = x - fx * 0.693359375f - fx * -2.12194440e-4f;
+    float z = x * x;
+    float y = (((((1.9875691500E-4f * x + 1.3981999507E-3f) * x + 8.3334519073E-3f) * x + 4.1665795894E-2f) * x
+            + 1.6666665459E-1f) * x + 5.0000001201E-1f) * z + x + 1.0f;
+    std::int32_t h = n / 2;
+    float s1 = bits<float>(static_cast<std::uint32_t>(h + 127) << 23);
+    float s2 = bits<float>(static_cast<std::uint32_t>(n - h + 127) << 23);
+    return tiny ? 0.0f : y * s1 * s2;
 }
 
-static int math_asin() {
+inline float log_f(float x) {
+    auto b = bits<std::uint32_t>(x);
+    auto e = static_cast<float>(static_cast<int>(b >> 23) - 126);
+    float m = bits<float>((b & 0x007fffffu) | 0x3f000000u);
+    bool small = m < 0.707106781186547524f;
+    e = small ? e - 1.0f : e;
+    x = small ? m + m - 1.0f : m - 1.0f;
+    float z = x * x;
+    float y = ((((((((7.0376836292E-2f * x - 1.1514610310E-1f) * x + 1.1676998740E-1f) * x - 1.2420140846E-1f) * x
+            + 1.4249322787E-1f) * x - 1.6668057665E-1f) * x + 2.0000714765E-1f) * x - 2.4999993993E-1f) * x
+            + 3.3333331174E-1f) * x * z;
+    y += e * -2.12194440e-4f;
+    y += -0.5f * z;
+    x = x + y;
+    return x + e * 0.693359375f;
+}
 
-    return 1;
+inline float atan_f(float x) {
+    float a = std::fabs(x);
+    bool big = a > 2.414213562373095f;
+    bool mid = a > 0.4142135623730950f;
+    float y0 = big ? kPio2f : (mid ? kPio4f : 0.0f);
+    float u = big ? -1.0f / a : (mid ? (a - 1.0f) / (a + 1.0f) : a);
+    float z = u * u;
+    float y = (((8.05374449538e-2f * z - 1.38776856032E-1f) * z + 1.99777106478E-1f) * z - 3.33329491539E-1f) * z * u + u;
+    return std::copysign(y0 + y, x);
 }
 
-static int math_acos() {
-    return 1;
+//|t| <= 0.5时的asin(t)
+inline float asin_core_f(float t) {
+    float z = t * t;
+    return ((((4.2163199048E-2f * z + 2.4181311049E-2f) * z + 4.5470025998E-2f) * z + 7.4953002686E-2f) * z
+           + 1.6666752422E-1f) * z * t + t;
 }
 
-static int math_atan() {
-    return 1;
+inline float asin_f(float x) {
+    float a = std::fabs(x);
+    bool big = a > 0.5f;
+    float t = big ? std::sqrt(0.5f * (1.0f - a)) : a;
+    float p = asin_core_f(t);
+    return std::copysign(big ? kPio2f - 2.0f * p : p, x);
 }
 
-static int math_atan2() {
+inline float acos_f(float x) {
+    float lo = kPif - 2.0f * asin_core_f(std::sqrt(0.5f * (1.0f + x)));
+    float hi = 2.0f * asin_core_f(std::sqrt(0.5f * (1.0f - x)));
+    float mid = kPio2f - asin_core_f(x);
+    return x < -0.5f ? lo : (x > 0.5f ? hi : mid);
+}
 
+inline float atan2_f(float y, float x) {
+    float a = atan_f(std::fabs(y) / std::fabs(x));
+    a = x < 0.0f ? kPif - a : a;
+    return std::copysign(a, y);
 }
 
-static int math_ceil() {
-    return 1;
+inline bool atan2_special(float y, float x) {
+    return !(std::isfinite(x) && std::isfinite(y)) || (x == 0.0f && y == 0.0f);
 }
 
-static int math_floor() {
-    return 1;
+//负数, 零, inf, nan的底数和非有限的指数交给libm处理各种特殊规则
+inline bool pow_special(float x, float y) {
+    return !(x > 0.0f && x <= 3.40282347e+38f && std::isfinite(y));
 }
 
-static int math_sqrt() {
-    return 1;
 }
 
-static int math_pow() {
-    return 1;
-}
\ No newline at end of file
+/* ---------------- lane循环 ---------------- */
+
+/*
+ * 对每个lane做同一个没有分支的核心函数, 然后把不在适用范围里的lane用libm修正
+ * 修正的时候还要看输入, 所以每ZFX_LANES个点先算到栈上, 这样out和x可以是同一个数组
+ * 要不要修正先用一个能向量化的int或运算看, 一批里都不用修正就跳过逐个lane判断的标量循环
+ * */
+#define ZFX_UNARY_KERNEL(name, precise, fast, special, fallback) \
+    ZFX_SIMD_CLONES void name(float* out, const float* x, int n, Zfx_MathPrecision prec) { \
+        for (int b = 0; b < n; b += ZFX_LANES) { \
+            int m = n - b < ZFX_LANES ? n - b : ZFX_LANES; \
+            const float* xb = x + b; \
+            float r[ZFX_LANES]; \
+            if (prec == Zfx_MathPrecision::kPrecise) { \
+                for (int i = 0; i < m; i++) r[i] = precise(xb[i]); \
+            } else { \
+                for (int i = 0; i < m; i++) r[i] = fast(xb[i]); \
+            } \
+            int fix = 0; \
+            for (int i = 0; i < m; i++) { \
+                [[maybe_unused]] float v = xb[i]; \
+                fix |= (special) ? 1 : 0; \
+            } \
+            for (int i = 0; fix && i < m; i++) { \
+                float v = xb[i]; \
+                if (special) r[i] = static_cast<float>(fallback(static_cast<double>(v))); \
+            } \
+            for (int i = 0; i < m; i++) out[b + i] = r[i]; \
+        } \
+    }
+
+/*
+ * 三角函数的快速档先看这一批的最大参数, 都在kFastTrigLimit以内就整批用float约简
+ * 比较写成a > amax, nan不会被算进去, 反正最后也是交给libm
+ * */
+#define ZFX_TRIG_KERNEL(name, precise, fast, fallback) \
+    ZFX_SIMD_CLONES void name(float* out, const float* x, int n, Zfx_MathPrecision prec) { \
+        for (int b = 0; b < n; b += ZFX_LANES) { \
+            int m = n - b < ZFX_LANES ? n - b : ZFX_LANES; \
+            const float* xb = x + b; \
+            float r[ZFX_LANES]; \
+            if (prec == Zfx_MathPrecision::kPrecise) { \
+                for (int i = 0; i < m; i++) r[i] = precise(xb[i]); \
+            } else { \
+                int wide = 0; \
+                for (int i = 0; i < m; i++) wide |= std::fabs(xb[i]) <= kFastTrigLimit ? 0 : 1; \
+                if (!wide) { \
+                    for (int i = 0; i < m; i++) r[i] = fast<false>(xb[i]); \
+                } else { \
+                    for (int i = 0; i < m; i++) r[i] = fast<true>(xb[i]); \
+                } \
+            } \
+            int fix = 0; \
+            for (int i = 0; i < m; i++) fix |= std::fabs(xb[i]) <= kTrigLimit ? 0 : 1; \
+            for (int i = 0; fix && i < m; i++) { \
+                float v = xb[i]; \
+                if (!(std::fabs(v) <= kTrigLimit)) r[i] = static_cast<float>(fallback(static_cast<double>(v))); \
+            } \
+            for (int i = 0; i < m; i++) out[b + i] = r[i]; \
+        } \
+    }
+
+ZFX_TRIG_KERNEL(zfx_vsin, sin_p, sin_f, std::sin)
+ZFX_TRIG_KERNEL(zfx_vcos, cos_p, cos_f, std::cos)
+ZFX_TRIG_KERNEL(zfx_vtan, tan_p, tan_f, std::tan)
+ZFX_UNARY_KERNEL(zfx_vasin, asin_p, asin_f, false, std::asin)
+ZFX_UNARY_KERNEL(zfx_vacos, acos_p, acos_f, false, std::acos)
+ZFX_UNARY_KERNEL(zfx_vatan, atan_p, atan_f, false, std::atan)
+ZFX_UNARY_KERNEL(zfx_vexp, exp_p, exp_f, std::isnan(v), std::exp)
+ZFX_UNARY_KERNEL(zfx_vlog, log_p, log_f, !(v >= 1.17549435e-38f && v <= 3.40282347e+38f), std::log)
+
+ZFX_SIMD_CLONES void zfx_vatan2(float* out, const float* y, const float* x, int n, Zfx_MathPrecision prec) {
+    for (int b = 0; b < n; b += ZFX_LANES) {
+        int m = n - b < ZFX_LANES ? n - b : ZFX_LANES;
+        const float* yb = y + b;
+        const float* xb = x + b;
+        float r[ZFX_LANES];
+        if (prec == Zfx_MathPrecision::kPrecise) {
+            for (int i = 0; i < m; i++) r[i] = atan2_p(yb[i], xb[i]);
+        } else {
+            for (int i = 0; i < m; i++) r[i] = atan2_f(yb[i], xb[i]);
+        }
+        int fix = 0;
+        for (int i = 0; i < m; i++) fix |= atan2_special(yb[i], xb[i]) ? 1 : 0;
+        for (int i = 0; fix && i < m; i++) {
+            if (atan2_special(yb[i], xb[i])) {
+                r[i] = static_cast<float>(std::atan2(static_cast<double>(yb[i]), static_cast<double>(xb[i])));
+            }
+        }
+        for (int i = 0; i < m; i++) out[b + i] = r[i];
+    }
+}
+
+ZFX_SIMD_CLONES void zfx_vpow(float* out, const float* x, const float* y, int n, Zfx_MathPrecision) {
+    for (int b = 0; b < n; b += ZFX_LANES) {
+        int m = n - b < ZFX_LANES ? n - b : ZFX_LANES;
+        const float* xb = x + b;
+        const float* yb = y + b;
+        float r[ZFX_LANES];
+        for (int i = 0; i < m; i++) r[i] = pow_p(xb[i], yb[i]);
+        int fix = 0;
+        for (int i = 0; i < m; i++) fix |= pow_special(xb[i], yb[i]) ? 1 : 0;
+        for (int i = 0; fix && i < m; i++) {
+            if (pow_special(xb[i], yb[i])) {
+                r[i] = static_cast<float>(std::pow(static_cast<double>(xb[i]), static_cast<double>(yb[i])));
+            }
+        }
+        for (int i = 0; i < m; i++) out[b + i] = r[i];
+    }
+}
+
+//2^23以上的float本来就是整数, nan也原样返回, 转成int之前先换成0, 不然超出int范围是UB
+ZFX_SIMD_CLONES void zfx_vfloor(float* out, const float* x, int n) {
+    for (int i = 0; i < n; i++) {
+        float v = x[i];
+        bool small = std::fabs(v) < 8388608.0f;
+        float c = small ? v : 0.0f;
+        auto t = static_cast<float>(static_cast<int>(c));
+        t = t > c ? t - 1.0f : t;
+        out[i] = small ? std::copysign(t, v) : v;
+    }
+}
+
+ZFX_SIMD_CLONES void zfx_vceil(float* out, const float* x, int n) {
+    for (int i = 0; i < n; i++) {
+        float v = x[i];
+        bool small = std::fabs(v) < 8388608.0f;
+        float c = small ? v : 0.0f;
+        auto t = static_cast<float>(static_cast<int>(c));
+        t = t < c ? t + 1.0f : t;
+        out[i] = small ? std::copysign(t, v) : v;
+    }
+}
@@ -0,0 +1,113 @@
+//
+// Created by admin on 2022/9/24.
+//
+#include "zmetrics.h"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+const char* const names[] = {
+    "zfx_runs_total",
+    "zfx_calls_total",
+    "zfx_points_total",
+    "zfx_batches_total",
+    "zfx_instructions_total",
+    "zfx_run_nanoseconds_total",
+    "zfx_errors_total",
+    "zfx_cancels_total",
+    "zfx_yields_total",
+    "zfx_parallel_runs_total",
+    "zfx_parallel_chunks_total",
+    "zfx_states_created_total",
+    "zfx_states_closed_total",
+    "zfx_stack_cache_hits_total",
+    "zfx_stack_cache_misses_total",
+    "zfx_stack_grows_total",
+    "zfx_states_live",
+    "zfx_stack_bytes",
+};
+
+static_assert(sizeof(names) / sizeof(names[0]) == static_cast<int>(Zfx_Metric::kCount), "every metric needs a name");
+
+constexpr int kMetrics = static_cast<int>(Zfx_Metric::kCount);
+
+/*
+ * 还活着的线程的计数, 退出了的线程留下的总数, 以及上次清零时的总数
+ * 别的线程的计数不能直接清零, 清零只是记下当时的值, 快照的时候减掉
+ * */
+struct Shards {
+    std::mutex lock;
+    std::vector<zfx_MetricShard*> live;
+    std::uint64_t retired[kMetrics] = {};
+    std::uint64_t reset[kMetrics] = {};
+};
+
+//线程局部变量的析构可能在静态变量之后, 所以不释放
+Shards& shards() {
+    static Shards* s = new Shards;
+    return *s;
+}
+
+//调用的时候要拿着锁
+void totals(Shards& s, std::uint64_t* out) {
+    for (int i = 0; i < kMetrics; i++) {
+        out[i] = zfx_metricValues[i].value.load(std::memory_order_relaxed) + s.retired[i];
+    }
+    for (zfx_MetricShard* shard : s.live) {
+        for (int i = 0; i < kMetrics; i++) {
+            out[i] += shard->values[i].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+}
+
+zfx_MetricShard::zfx_MetricShard() {
+    Shards& s = shards();
+    std::lock_guard<std::mutex> guard(s.lock);
+    s.live.push_back(this);
+}
+
+zfx_MetricShard::~zfx_MetricShard() {
+    Shards& s = shards();
+    std::lock_guard<std::mutex> guard(s.lock);
+    for (int i = 0; i < kMetrics; i++) {
+        s.retired[i] += values[i].load(std::memory_order_relaxed);
+    }
+    s.live.erase(std::find(s.live.begin(), s.live.end(), this));
+}
+
+zfx_Metrics zfx_getMetrics() {
+    zfx_Metrics m;
+    Shards& s = shards();
+    std::lock_guard<std::mutex> guard(s.lock);
+    totals(s, m.values);
+    for (int i = 0; i < kMetrics; i++) {
+        if (!zfx_metricIsGauge(static_cast<Zfx_Metric>(i))) {
+            m.values[i] -= s.reset[i];
+        }
+    }
+    return m;
+}
+
+void zfx_resetMetrics() {
+    Shards& s = shards();
+    std::lock_guard<std::mutex> guard(s.lock);
+    totals(s, s.reset);
+}
+
+const char* zfx_metricName(Zfx_Metric m) {
+    return names[static_cast<int>(m)];
+}
+
+bool zfx_metricIsGauge(Zfx_Metric m) {
+    return m == Zfx_Metric::kStatesLive || m == Zfx_Metric::kStackBytes;
+}
+
+void zfx_writeMetrics(const zfx_Metrics& m, std::FILE* out) {
+    for (int i = 0; i < static_cast<int>(Zfx_Metric::kCount); i++) {
+        std::fprintf(out, "%s %llu\n", names[i], static_cast<unsigned long long>(m.values[i]));
+    }
+}
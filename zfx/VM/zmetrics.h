@@ -0,0 +1,96 @@
+//
+// Created by admin on 2022/9/24.
+//
+/*
+ * 整个进程的运行时指标, 宿主可以随时取一个快照导出到监控
+ * 热路径上只累加状态自己的普通字段, 每次zfx_run/zfx_resume/函数调用结束时才加到当前线程自己的计数上(zfx_metricCount),
+ * 只有这个线程写, 不用带lock的原子加法, 也不会和别的线程抢缓存行, 快照的时候再把所有线程的加起来
+ * 不频繁的事件和gauge用zfx_metricAdd直接加到全局的原子变量上, 每个变量占一整条缓存行
+ * counter只增不减, zfx_resetMetrics会清零; gauge是当前值, 清零时保留
+ * 前端的编译缓存, GC和JIT还不存在, 等它们有了再往这里加
+ * */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+enum class Zfx_Metric : std::uint8_t {
+    kRuns,              //zfx_run, zfx_resume和并行执行里每一块的执行次数
+    kCalls,             //宿主通过Function调用zfx函数的次数
+    kPoints,            //执行完的点
+    kBatches,           //执行完的批, 每批ZFX_LANES个点
+    kInstructions,      //解释执行的指令, 出错的那一批不算
+    kRunNanos,          //花在执行上的时间
+    kErrors,            //以错误码结束的执行, 不含取消
+    kCancels,           //被取消或者超时的执行
+    kYields,            //时间片用完挂起的次数
+    kParallelRuns,      //zfx_runparallel的调用次数
+    kParallelChunks,    //工作线程领走的块
+    kStatesCreated,
+    kStatesClosed,
+    kStackCacheHits,    //新建状态时直接用了线程缓存里的栈
+    kStackCacheMisses,  //新建状态时要重新mmap栈
+    kStackGrows,        //栈按需提交的次数
+    kStatesLive,        //gauge: 还没关闭的状态
+    kStackBytes,        //gauge: 已经提交的栈内存, 包括线程缓存里的
+    kCount
+};
+
+struct alignas(64) zfx_MetricSlot {
+    std::atomic<std::uint64_t> value{0};
+};
+
+inline zfx_MetricSlot zfx_metricValues[static_cast<int>(Zfx_Metric::kCount)];
+
+//计数的地方用, 在信号处理函数里也可以调用
+inline void zfx_metricAdd(Zfx_Metric m, std::uint64_t n = 1) {
+    zfx_metricValues[static_cast<int>(m)].value.fetch_add(n, std::memory_order_relaxed);
+}
+
+inline void zfx_metricSub(Zfx_Metric m, std::uint64_t n = 1) {
+    zfx_metricValues[static_cast<int>(m)].value.fetch_sub(n, std::memory_order_relaxed);
+}
+
+/*
+ * 一个线程自己的counter, 第一次计数的时候登记, 线程退出的时候加到全局的总数上再注销
+ * 值只有这个线程写, 快照的线程会同时读, 所以还是原子变量, 但是写的时候只是普通的load和store
+ * */
+struct alignas(64) zfx_MetricShard {
+    std::atomic<std::uint64_t> values[static_cast<int>(Zfx_Metric::kCount)] = {};
+
+    zfx_MetricShard();
+    ~zfx_MetricShard();
+    zfx_MetricShard(const zfx_MetricShard&) = delete;
+    zfx_MetricShard& operator=(const zfx_MetricShard&) = delete;
+};
+
+inline thread_local zfx_MetricShard zfx_localMetrics;
+
+//热路径上的counter用这个, 不能在信号处理函数里调用, 第一次调用要登记
+inline void zfx_metricCount(Zfx_Metric m, std::uint64_t n = 1) {
+    auto& v = zfx_localMetrics.values[static_cast<int>(m)];
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+struct zfx_Metrics {
+    std::uint64_t values[static_cast<int>(Zfx_Metric::kCount)] = {};
+
+    std::uint64_t operator[](Zfx_Metric m) const {
+        return values[static_cast<int>(m)];
+    }
+};
+
+//所有指标的快照, 各个值分别读, 不保证彼此之间一致
+zfx_Metrics zfx_getMetrics();
+
+//counter清零, gauge不动
+void zfx_resetMetrics();
+
+//导出用的名字, 比如"zfx_runs_total", gauge没有_total
+const char* zfx_metricName(Zfx_Metric m);
+
+bool zfx_metricIsGauge(Zfx_Metric m);
+
+//每行"名字 值", 可以直接给prometheus的textfile收集器
+void zfx_writeMetrics(const zfx_Metrics& m, std::FILE* out);
@@ -0,0 +1,358 @@
+//
+// Created by admin on 2022/9/12.
+//
+/*
+ * 梯度噪声内置函数, perlin和simplex都是1到4维, 还有curl和fbm
+ * 每个lane的计算都是没有分支的, 格点用整数哈希打散, 梯度从小表里取, lane循环可以直接向量化
+ * 为了让不同的SIMD宽度得到一模一样的结果, 这个文件里关掉了乘加合并,
+ * 也不用rcp/rsqrt这种每代cpu精度都不一样的近似指令
+ * */
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include "zbuiltins.h"
+#include <cstdint>
+
+#if defined(__GNUC__)
+#define ZFX_NOISE_INLINE inline __attribute__((always_inline))
+#else
+#define ZFX_NOISE_INLINE inline
+#endif
+
+namespace {
+
+//和std::floor一样, 但是直接得到整数, |x| < 2^31, 调用之前要先clampcoord
+ZFX_NOISE_INLINE int floori(float x) {
+    int i = static_cast<int>(x);
+    return x < static_cast<float>(i) ? i - 1 : i;
+}
+
+/*
+ * 坐标限制在±2^24以内, 再大的float都是整数, 噪声本来就退化了, 截掉不影响结果, 但是转成int不会溢出
+ * simplex斜切以后坐标最多放大到(1+D*F)倍, 也还在int的范围里. nan换成边界, 不然转int是UB
+ * */
+constexpr float kCoordLimit = 16777216.0f;
+
+ZFX_NOISE_INLINE float clampcoord(float x) {
+    x = x < kCoordLimit ? x : kCoordLimit;
+    return x > -kCoordLimit ? x : -kCoordLimit;
+}
+
+template <int D>
+ZFX_NOISE_INLINE std::uint32_t hash(const int* c) {
+    constexpr std::uint32_t primes[4] = {0x8da6b343u, 0xd8163841u, 0xcb1ab31fu, 0x165667b1u};
+    std::uint32_t h = 0x9e3779b9u;
+    for (int d = 0; d < D; d++) {
+        h ^= static_cast<std::uint32_t>(c[d]) * primes[d];
+    }
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+constexpr float kGrad1[16] = {
+    0.125f, 0.25f, 0.375f, 0.5f, 0.625f, 0.75f, 0.875f, 1.0f,
+    -0.125f, -0.25f, -0.375f, -0.5f, -0.625f, -0.75f, -0.875f, -1.0f,
+};
+
+constexpr float kGrad2[8][2] = {
+    {1, 1}, {-1, 1}, {1, -1}, {-1, -1}, {1, 0}, {-1, 0}, {0, 1}, {0, -1},
+};
+
+//立方体的12条棱, 补到16个
+constexpr float kGrad3[16][3] = {
+    {1, 1, 0}, {-1, 1, 0}, {1, -1, 0}, {-1, -1, 0},
+    {1, 0, 1}, {-1, 0, 1}, {1, 0, -1}, {-1, 0, -1},
+    {0, 1, 1}, {0, -1, 1}, {0, 1, -1}, {0, -1, -1},
+    {1, 1, 0}, {-1, 1, 0}, {0, -1, 1}, {0, -1, -1},
+};
+
+constexpr float kGrad4[32][4] = {
+    {0, 1, 1, 1}, {0, 1, 1, -1}, {0, 1, -1, 1}, {0, 1, -1, -1},
+    {0, -1, 1, 1}, {0, -1, 1, -1}, {0, -1, -1, 1}, {0, -1, -1, -1},
+    {1, 0, 1, 1}, {1, 0, 1, -1}, {1, 0, -1, 1}, {1, 0, -1, -1},
+    {-1, 0, 1, 1}, {-1, 0, 1, -1}, {-1, 0, -1, 1}, {-1, 0, -1, -1},
+    {1, 1, 0, 1}, {1, 1, 0, -1}, {1, -1, 0, 1}, {1, -1, 0, -1},
+    {-1, 1, 0, 1}, {-1, 1, 0, -1}, {-1, -1, 0, 1}, {-1, -1, 0, -1},
+    {1, 1, 1, 0}, {1, 1, -1, 0}, {1, -1, 1, 0}, {1, -1, -1, 0},
+    {-1, 1, 1, 0}, {-1, 1, -1, 0}, {-1, -1, 1, 0}, {-1, -1, -1, 0},
+};
+
+template <int D>
+ZFX_NOISE_INLINE void gradient(std::uint32_t h, float* g) {
+    if constexpr (D == 1) {
+        g[0] = kGrad1[h & 15];
+    } else if constexpr (D == 2) {
+        for (int d = 0; d < 2; d++) g[d] = kGrad2[h & 7][d];
+    } else if constexpr (D == 3) {
+        for (int d = 0; d < 3; d++) g[d] = kGrad3[h & 15][d];
+    } else {
+        for (int d = 0; d < 4; d++) g[d] = kGrad4[h & 31][d];
+    }
+}
+
+//把结果缩放到大致[-1, 1]
+constexpr float kPerlinScale[5] = {0.0f, 2.0f, 1.0f, 1.0f, 0.87f};
+constexpr float kSimplexScale[5] = {0.0f, 3.16f, 70.0f, 32.0f, 27.0f};
+
+ZFX_NOISE_INLINE float fade(float t) {
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+ZFX_NOISE_INLINE float dfade(float t) {
+    return 30.0f * t * t * (t * (t - 2.0f) + 1.0f);
+}
+
+/*
+ * 2^D个角上的梯度和距离做点积, 再沿每一维用fade插值
+ * 角c的第d位就是这个角在第d维上的偏移
+ * 传了dn的话同时求出对每个坐标的偏导
+ * */
+template <int D>
+ZFX_NOISE_INLINE float perlin(const float* x, float* dn = nullptr) {
+    constexpr int kCorners = 1 << D;
+    int i[D];
+    float f[D], u[D];
+    for (int d = 0; d < D; d++) {
+        float xd = clampcoord(x[d]);
+        i[d] = floori(xd);
+        f[d] = xd - static_cast<float>(i[d]);
+        u[d] = fade(f[d]);
+    }
+    float v[kCorners];
+    float g[kCorners][D];
+    for (int c = 0; c < kCorners; c++) {
+        int ci[D];
+        float dot = 0.0f;
+        for (int d = 0; d < D; d++) {
+            int o = (c >> d) & 1;
+            ci[d] = i[d] + o;
+        }
+        gradient<D>(hash<D>(ci), g[c]);
+        for (int d = 0; d < D; d++) {
+            dot += g[c][d] * (f[d] - static_cast<float>((c >> d) & 1));
+        }
+        v[c] = dot;
+    }
+    if (dn != nullptr) {
+        //n = sum_c w_c * v_c, w_c是每一维的u或者1-u的乘积
+        for (int e = 0; e < D; e++) {
+            float s = 0.0f;
+            for (int c = 0; c < kCorners; c++) {
+                float w = 1.0f, dw = 1.0f;
+                for (int d = 0; d < D; d++) {
+                    bool hi = (c >> d) & 1;
+                    float wd = hi ? u[d] : 1.0f - u[d];
+                    w *= wd;
+                    dw *= d == e ? (hi ? 1.0f : -1.0f) * dfade(f[d]) : wd;
+                }
+                s += dw * v[c] + w * g[c][e];
+            }
+            dn[e] = s * kPerlinScale[D];
+        }
+    }
+    for (int d = 0, m = kCorners; d < D; d++) {
+        m >>= 1;
+        for (int k = 0; k < m; k++) {
+            v[k] = v[2 * k] + (v[2 * k + 1] - v[2 * k]) * u[d];
+        }
+    }
+    return v[0] * kPerlinScale[D];
+}
+
+ZFX_NOISE_INLINE float simplex1(float x) {
+    x = clampcoord(x);
+    int i0 = floori(x);
+    float x0 = x - static_cast<float>(i0);
+    float x1 = x0 - 1.0f;
+    int i1 = i0 + 1;
+    float g0, g1;
+    gradient<1>(hash<1>(&i0), &g0);
+    gradient<1>(hash<1>(&i1), &g1);
+    float t0 = 1.0f - x0 * x0;
+    float t1 = 1.0f - x1 * x1;
+    t0 *= t0;
+    t1 *= t1;
+    return (t0 * t0 * g0 * x0 + t1 * t1 * g1 * x1) * kSimplexScale[1];
+}
+
+/*
+ * D维的simplex, 先斜切到超立方体格子里, 按坐标分量的大小排名决定走过哪D+1个角
+ * 排名的方法对任何维数都适用, 也没有分支
+ * */
+template <int D>
+ZFX_NOISE_INLINE float simplex(const float* xin) {
+    if constexpr (D == 1) {
+        return simplex1(xin[0]);
+    } else {
+        //F = (sqrt(D+1)-1)/D, G = (1-1/sqrt(D+1))/D
+        constexpr float kF = D == 2 ? 0.366025403784f : (D == 3 ? 1.0f / 3.0f : 0.309016994375f);
+        constexpr float kG = D == 2 ? 0.211324865405f : (D == 3 ? 1.0f / 6.0f : 0.138196601125f);
+        constexpr float kR2 = D == 2 ? 0.5f : 0.6f;
+        float x[D];
+        for (int d = 0; d < D; d++) x[d] = clampcoord(xin[d]);
+        float s = 0.0f;
+        for (int d = 0; d < D; d++) s += x[d];
+        s *= kF;
+        int i[D];
+        float t = 0.0f;
+        for (int d = 0; d < D; d++) {
+            i[d] = floori(x[d] + s);
+            t += static_cast<float>(i[d]);
+        }
+        t *= kG;
+        float x0[D];
+        for (int d = 0; d < D; d++) x0[d] = x[d] - (static_cast<float>(i[d]) - t);
+        int rank[D] = {};
+        for (int d = 0; d < D; d++) {
+            for (int e = d + 1; e < D; e++) {
+                bool ge = x0[d] >= x0[e];
+                rank[d] += ge ? 1 : 0;
+                rank[e] += ge ? 0 : 1;
+            }
+        }
+        float n = 0.0f;
+        for (int k = 0; k <= D; k++) {
+            int ci[D];
+            float xk[D];
+            float r2 = 0.0f;
+            for (int d = 0; d < D; d++) {
+                int o = rank[d] >= D - k ? 1 : 0;
+                ci[d] = i[d] + o;
+                xk[d] = x0[d] - static_cast<float>(o) + static_cast<float>(k) * kG;
+                r2 += xk[d] * xk[d];
+            }
+            float g[D];
+            gradient<D>(hash<D>(ci), g);
+            float dot = 0.0f;
+            for (int d = 0; d < D; d++) dot += g[d] * xk[d];
+            float tk = kR2 - r2;
+            tk = tk < 0.0f ? 0.0f : tk;
+            tk *= tk;
+            n += tk * tk * dot;
+        }
+        return n * kSimplexScale[D];
+    }
+}
+
+//错开三个势场, 避免它们在原点附近相关
+constexpr float kCurlOffset[3][3] = {
+    {0.0f, 0.0f, 0.0f},
+    {31.416f, -47.853f, 12.793f},
+    {-233.145f, -113.408f, -185.31f},
+};
+
+constexpr int kMaxOctaves = 16;
+//每一层错开一点, 不然所有层在整数格点上都是0
+constexpr float kOctaveShift = 19.19f;
+
+template <int D>
+ZFX_NOISE_INLINE void perlin_lanes(float* out, const float* const* p, int n) {
+    for (int i = 0; i < n; i++) {
+        float x[D];
+        for (int d = 0; d < D; d++) x[d] = p[d][i];
+        out[i] = perlin<D>(x);
+    }
+}
+
+template <int D>
+ZFX_NOISE_INLINE void simplex_lanes(float* out, const float* const* p, int n) {
+    for (int i = 0; i < n; i++) {
+        float x[D];
+        for (int d = 0; d < D; d++) x[d] = p[d][i];
+        out[i] = simplex<D>(x);
+    }
+}
+
+/*
+ * 外层按octave循环, 里层按lane, 每一层在所有lane上一起算, 层数是这一批里最多的那个
+ * 层数少的lane后面几层照样算, 但是用选择丢掉, 不能乘0的权重:
+ * 那时候freq可能已经乘成了inf, perlin是nan, 0乘nan还是nan
+ * */
+template <int D>
+ZFX_NOISE_INLINE void fbm_lanes(float* out, const float* const* p, const float* octaves,
+                                const float* lacunarity, const float* gain, int n) {
+    float maxoct = 0.0f;
+    for (int i = 0; i < n; i++) maxoct = octaves[i] > maxoct ? octaves[i] : maxoct;
+    int layers = maxoct < static_cast<float>(kMaxOctaves) ? floori(maxoct) + 1 : kMaxOctaves;
+    float freq[ZFX_LANES], amp[ZFX_LANES], norm[ZFX_LANES];
+    for (int i = 0; i < n; i++) {
+        out[i] = 0.0f;
+        freq[i] = 1.0f;
+        amp[i] = 1.0f;
+        norm[i] = 0.0f;
+    }
+    for (int o = 0; o < layers; o++) {
+        float shift = static_cast<float>(o) * kOctaveShift;
+        for (int i = 0; i < n; i++) {
+            float x[D];
+            for (int d = 0; d < D; d++) x[d] = p[d][i] * freq[i] + shift;
+            float w = octaves[i] - static_cast<float>(o);
+            bool on = w > 0.0f;
+            w = w > 1.0f ? 1.0f : w;
+            float v = perlin<D>(x);
+            out[i] += on ? w * amp[i] * v : 0.0f;
+            norm[i] += on ? w * amp[i] : 0.0f;
+            freq[i] *= lacunarity[i];
+            amp[i] *= gain[i];
+        }
+    }
+    for (int i = 0; i < n; i++) out[i] = norm[i] > 0.0f ? out[i] / norm[i] : 0.0f;
+}
+
+}
+
+ZFX_SIMD_CLONES void zfx_vperlin(float* out, int dim, const float* const* p, int n) {
+    switch (dim) {
+        case 1: perlin_lanes<1>(out, p, n); break;
+        case 2: perlin_lanes<2>(out, p, n); break;
+        case 3: perlin_lanes<3>(out, p, n); break;
+        default: perlin_lanes<4>(out, p, n); break;
+    }
+}
+
+ZFX_SIMD_CLONES void zfx_vsimplex(float* out, int dim, const float* const* p, int n) {
+    switch (dim) {
+        case 1: simplex_lanes<1>(out, p, n); break;
+        case 2: simplex_lanes<2>(out, p, n); break;
+        case 3: simplex_lanes<3>(out, p, n); break;
+        default: simplex_lanes<4>(out, p, n); break;
+    }
+}
+
+//curl = (dz/dy - dy/dz, dx/dz - dz/dx, dy/dx - dx/dy), x y z是三个势场
+ZFX_SIMD_CLONES void zfx_vcurl(float* const* out, const float* const* p, int n) {
+    for (int i = 0; i < n; i++) {
+        float dn[3][3];
+        for (int k = 0; k < 3; k++) {
+            float x[3];
+            for (int d = 0; d < 3; d++) x[d] = p[d][i] + kCurlOffset[k][d];
+            perlin<3>(x, dn[k]);
+        }
+        out[0][i] = dn[2][1] - dn[1][2];
+        out[1][i] = dn[0][2] - dn[2][0];
+        out[2][i] = dn[1][0] - dn[0][1];
+    }
+}
+
+//fbm每次最多处理ZFX_LANES个点, 中间结果放在栈上
+ZFX_SIMD_CLONES void zfx_vfbm(float* out, int dim, const float* const* p, const float* octaves,
+                              const float* lacunarity, const float* gain, int n) {
+    for (int b = 0; b < n; b += ZFX_LANES) {
+        int m = n - b < ZFX_LANES ? n - b : ZFX_LANES;
+        const float* q[4] = {};
+        for (int d = 0; d < dim && d < 4; d++) q[d] = p[d] + b;
+        switch (dim) {
+            case 1: fbm_lanes<1>(out + b, q, octaves + b, lacunarity + b, gain + b, m); break;
+            case 2: fbm_lanes<2>(out + b, q, octaves + b, lacunarity + b, gain + b, m); break;
+            case 3: fbm_lanes<3>(out + b, q, octaves + b, lacunarity + b, gain + b, m); break;
+            default: fbm_lanes<4>(out + b, q, octaves + b, lacunarity + b, gain + b, m); break;
+        }
+    }
+}
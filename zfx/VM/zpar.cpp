@@ -0,0 +1,94 @@
+//
+// Created by admin on 2022/9/12.
+//
+#include "zpar.h"
+#include "zmetrics.h"
+#include "zperf.h"
+#include "zstats.h"
+#include "ztrace.h"
+#include "zvm.h"
+#include "../ZFXModule.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+int zfx_runparallel(zfx_State* l, std::size_t npoints, int nthreads) {
+    if (l->module == nullptr) {
+        return ZFX_ERRRUN;
+    }
+    const Proto* p = &l->module->main();
+    //每一块zfx_runrange还会再查, 这里先查一次, 绑定不对就不用起线程了
+    if (!zfx_checkattrs(l, p, npoints)) {
+        return ZFX_ERRRUN;
+    }
+    zfx_metricAdd(Zfx_Metric::kParallelRuns);
+    zfx_TraceSpan span("parallel", "points", static_cast<std::int64_t>(npoints));
+    std::atomic<std::size_t> next{0};
+    std::atomic<int> status{ZFX_OK};
+    std::mutex statsLock;
+
+    auto worker = [&] {
+        zfx_TraceSpan busy("worker");
+        zfx_State* w;
+        {
+            zfx_TraceSpan setup("newstate");
+            w = zfx_newstate(l->module);
+        }
+        w->attrs = l->attrs;
+        w->dattrs = l->dattrs;
+        w->resources = l->resources;
+        w->tables = l->tables;
+        w->cancel = l->cancel;
+#ifdef ZFX_OPSTATS
+        //每个线程自己计数, 结束时再合并, 不在热路径上争用
+        zfx_enableOpStats(w, l->opstats != nullptr);
+#endif
+        //硬件计数器只数打开它的线程, 所以每个工作线程打开自己的
+        if (l->perf) {
+            zfx_enablePerf(w, true);
+        }
+        while (status.load(std::memory_order_relaxed) == ZFX_OK) {
+            std::size_t begin = next.fetch_add(ZFX_CHUNK, std::memory_order_relaxed);
+            if (begin >= npoints) {
+                break;
+            }
+            zfx_metricCount(Zfx_Metric::kParallelChunks);
+            zfx_TraceSpan chunk("chunk", "begin", static_cast<std::int64_t>(begin));
+            int s = zfx_runrange(w, p, begin, std::min(begin + ZFX_CHUNK, npoints));
+            if (s != ZFX_OK) {
+                int expected = ZFX_OK;
+                status.compare_exchange_strong(expected, s);
+            }
+        }
+        if (w->perf) {
+            std::lock_guard<std::mutex> lock(statsLock);
+            zfx_mergePerf(l, w);
+        }
+#ifdef ZFX_OPSTATS
+        if (w->opstats) {
+            std::lock_guard<std::mutex> lock(statsLock);
+            zfx_mergeOpStats(l, w);
+        }
+#endif
+        zfx_close(w);
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < nthreads; i++) {
+        threads.emplace_back([&] {
+            if (zfx_tracing()) {
+                zfx_traceThreadName("zfx worker");
+            }
+            worker();
+        });
+    }
+    worker();
+    //调用线程做完自己的部分之后等其他线程的时间, 长的话说明分得不均
+    zfx_TraceSpan wait("join");
+    for (auto& t : threads) {
+        t.join();
+    }
+    return status.load();
+}
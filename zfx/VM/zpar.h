@@ -0,0 +1,17 @@
+//
+// Created by admin on 2022/9/12.
+//
+//多线程执行同一个程序, 每个工作线程有自己的zfx_State, 共享module和绑定的数据
+#pragma once
+
+#include "zstate.h"
+
+//每个工作线程一次领多少个点
+#define ZFX_CHUNK (64 * ZFX_LANES)
+
+/*
+ * 用nthreads个线程(包括调用线程)对npoints个点执行l绑定的module
+ * 工作线程的状态会复制l的属性, 资源和取消令牌, 所以超时或者取消对所有线程都有效
+ * 返回第一个出错的状态码, 有一个线程出错其他线程领完手上这一块就停
+ */
+int zfx_runparallel(zfx_State* l, std::size_t npoints, int nthreads);
@@ -0,0 +1,243 @@
+//
+// Created by admin on 2022/9/22.
+//
+#include "zperf.h"
+#include <thread>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr int kCounters = 5;
+
+//所有计数器在一个组里, 一次read全部读出来, 被复用的时候按enabled/running放大
+struct GroupValues {
+    std::uint64_t enabled = 0;
+    std::uint64_t running = 0;
+    std::uint64_t values[kCounters] = {};
+};
+
+}
+
+struct zfx_Perf {
+    zfx_PerfCounters total;
+    std::thread::id owner;          //计数器是在哪个线程上打开的
+    int fds[kCounters];
+    unsigned slots[kCounters];      //组里第i个值是哪个计数器, ZFX_PERF_*
+    int n = 0;
+    GroupValues start;
+
+    ~zfx_Perf() {
+        close();
+    }
+
+    void close();
+    unsigned open();
+    bool read(GroupValues* out) const;
+};
+
+void zfx_PerfDeleter::operator()(zfx_Perf* p) const {
+    delete p;
+}
+
+#if defined(__linux__)
+namespace {
+
+struct Event {
+    unsigned bit;
+    std::uint32_t type;
+    std::uint64_t config;
+};
+
+const Event events[kCounters] = {
+    {ZFX_PERF_CYCLES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {ZFX_PERF_INSTRUCTIONS, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {ZFX_PERF_BRANCHMISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {ZFX_PERF_L1DMISSES, PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {ZFX_PERF_LLCMISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+};
+
+int perf_open(const Event& e, int group) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = e.type;
+    attr.config = e.config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+}
+
+}
+
+void zfx_Perf::close() {
+    for (int i = 0; i < n; i++) {
+        ::close(fds[i]);
+    }
+    n = 0;
+    total.available = 0;
+}
+
+unsigned zfx_Perf::open() {
+    close();
+    owner = std::this_thread::get_id();
+    //第一个能打开的当组长, 其他的加不进组就放弃
+    for (const Event& e : events) {
+        int fd = perf_open(e, n == 0 ? -1 : fds[0]);
+        if (fd < 0) {
+            continue;
+        }
+        fds[n] = fd;
+        slots[n] = e.bit;
+        n++;
+        total.available |= e.bit;
+    }
+    return total.available;
+}
+
+bool zfx_Perf::read(GroupValues* out) const {
+    std::uint64_t buf[3 + kCounters];
+    if (n == 0 || ::read(fds[0], buf, sizeof(buf)) < static_cast<ssize_t>((3 + n) * sizeof(std::uint64_t))) {
+        return false;
+    }
+    out->enabled = buf[1];
+    out->running = buf[2];
+    for (int i = 0; i < n; i++) {
+        out->values[i] = buf[3 + i];
+    }
+    return true;
+}
+#else
+void zfx_Perf::close() {
+    n = 0;
+    total.available = 0;
+}
+
+unsigned zfx_Perf::open() {
+    owner = std::this_thread::get_id();
+    return 0;
+}
+
+bool zfx_Perf::read(GroupValues*) const {
+    return false;
+}
+#endif
+
+unsigned zfx_enablePerf(zfx_State* l, bool on) {
+    l->perf.reset();
+    if (!on) {
+        return 0;
+    }
+    std::unique_ptr<zfx_Perf, zfx_PerfDeleter> perf(new zfx_Perf{});
+    unsigned available = perf->open();
+    if (available != 0) {
+        l->perf = std::move(perf);
+    }
+    return available;
+}
+
+zfx_PerfCounters zfx_getPerf(const zfx_State* l) {
+    return l->perf ? l->perf->total : zfx_PerfCounters{};
+}
+
+void zfx_resetPerf(zfx_State* l) {
+    if (l->perf) {
+        unsigned available = l->perf->total.available;
+        l->perf->total = zfx_PerfCounters{};
+        l->perf->total.available = available;
+    }
+}
+
+void zfx_mergePerf(zfx_State* into, const zfx_State* from) {
+    if (!into->perf || !from->perf) {
+        return;
+    }
+    zfx_PerfCounters& a = into->perf->total;
+    const zfx_PerfCounters& b = from->perf->total;
+    a.cycles += b.cycles;
+    a.instructions += b.instructions;
+    a.branchMisses += b.branchMisses;
+    a.l1dMisses += b.l1dMisses;
+    a.llcMisses += b.llcMisses;
+    a.points += b.points;
+    a.runs += b.runs;
+}
+
+void zfx_perfbegin(zfx_State* l) {
+    zfx_Perf* p = l->perf.get();
+    if (p->owner != std::this_thread::get_id()) {
+        p->open();
+    }
+    if (!p->read(&p->start)) {
+        p->start = GroupValues{};
+    }
+}
+
+void zfx_perfend(zfx_State* l, std::size_t points) {
+    zfx_Perf* p = l->perf.get();
+    GroupValues now;
+    if (p->owner != std::this_thread::get_id() || !p->read(&now)) {
+        return;
+    }
+    std::uint64_t enabled = now.enabled - p->start.enabled;
+    std::uint64_t running = now.running - p->start.running;
+    //计数器太多被内核轮流调度的时候, 只数了running这么久, 按比例补上
+    double scale = running != 0 && running < enabled ? static_cast<double>(enabled) / static_cast<double>(running) : 1;
+    zfx_PerfCounters& t = p->total;
+    for (int i = 0; i < p->n; i++) {
+        auto delta = static_cast<std::uint64_t>(static_cast<double>(now.values[i] - p->start.values[i]) * scale);
+        switch (p->slots[i]) {
+            case ZFX_PERF_CYCLES: t.cycles += delta; break;
+            case ZFX_PERF_INSTRUCTIONS: t.instructions += delta; break;
+            case ZFX_PERF_BRANCHMISSES: t.branchMisses += delta; break;
+            case ZFX_PERF_L1DMISSES: t.l1dMisses += delta; break;
+            case ZFX_PERF_LLCMISSES: t.llcMisses += delta; break;
+        }
+    }
+    t.points += points;
+    t.runs++;
+}
+
+void zfx_dumpPerf(const zfx_State* l, std::FILE* out) {
+    if (!l->perf) {
+        std::fprintf(out, "perf: hardware counters not enabled or not available\n");
+        return;
+    }
+    const zfx_PerfCounters& t = l->perf->total;
+    std::fprintf(out, "perf: %llu points in %llu runs\n", static_cast<unsigned long long>(t.points),
+                 static_cast<unsigned long long>(t.runs));
+    auto row = [&](unsigned bit, const char* name, std::uint64_t v) {
+        if (t.available & bit) {
+            std::fprintf(out, "  %-16s %16llu %12.3f per point\n", name, static_cast<unsigned long long>(v),
+                         t.perPoint(v));
+        } else {
+            std::fprintf(out, "  %-16s %16s\n", name, "n/a");
+        }
+    };
+    row(ZFX_PERF_CYCLES, "cycles", t.cycles);
+    row(ZFX_PERF_INSTRUCTIONS, "instructions", t.instructions);
+    row(ZFX_PERF_BRANCHMISSES, "branch-misses", t.branchMisses);
+    row(ZFX_PERF_L1DMISSES, "L1d-misses", t.l1dMisses);
+    row(ZFX_PERF_LLCMISSES, "LLC-misses", t.llcMisses);
+    if ((t.available & (ZFX_PERF_CYCLES | ZFX_PERF_INSTRUCTIONS)) != (ZFX_PERF_CYCLES | ZFX_PERF_INSTRUCTIONS)) {
+        return;
+    }
+    //每千条CPU指令的缺失数, 阈值是经验值, 只是提示
+    double kinsn = static_cast<double>(t.instructions) / 1000;
+    double llc = kinsn > 0 ? static_cast<double>(t.llcMisses) / kinsn : 0;
+    double br = kinsn > 0 ? static_cast<double>(t.branchMisses) / kinsn : 0;
+    const char* verdict = "compute-bound";
+    if ((t.available & ZFX_PERF_LLCMISSES) && llc > 5) {
+        verdict = "memory-bound";
+    } else if ((t.available & ZFX_PERF_BRANCHMISSES) && br > 10) {
+        verdict = "dispatch-bound";
+    }
+    std::fprintf(out, "  IPC %.2f, %.2f LLC misses and %.2f branch misses per 1k instructions: likely %s\n", t.ipc(),
+                 llc, br, verdict);
+}
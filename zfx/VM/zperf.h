@@ -0,0 +1,60 @@
+//
+// Created by admin on 2022/9/22.
+//
+/*
+ * 用linux的perf_event_open读硬件计数器, 每次执行(zfx_run, zfx_resume, 并行执行的每一块)前后各读一次,
+ * 差值累计到状态上, 用来判断一个程序是卡在分派, 计算还是内存上
+ * 计数器只统计用户态, 而且只统计打开它的线程, 状态换了线程执行的话会在新线程上重新打开
+ * 容器和虚拟机里经常没有PMU或者perf_event_paranoid不允许, 打不开的计数器就是0, available里没有它
+ * 一个都打不开的时候zfx_enablePerf返回0, 状态照常执行, 不多任何开销
+ * */
+#pragma once
+
+#include "zstate.h"
+#include <cstdio>
+
+#define ZFX_PERF_CYCLES         (1u << 0)
+#define ZFX_PERF_INSTRUCTIONS   (1u << 1)
+#define ZFX_PERF_BRANCHMISSES   (1u << 2)
+#define ZFX_PERF_L1DMISSES      (1u << 3)   //L1数据缓存的读缺失
+#define ZFX_PERF_LLCMISSES      (1u << 4)   //最后一级缓存的缺失
+
+struct zfx_PerfCounters {
+    std::uint64_t cycles = 0;
+    std::uint64_t instructions = 0;     //CPU指令, 不是zfx指令
+    std::uint64_t branchMisses = 0;
+    std::uint64_t l1dMisses = 0;
+    std::uint64_t llcMisses = 0;
+    std::uint64_t points = 0;           //这些执行一共跑完了多少个点
+    std::uint64_t runs = 0;             //读了多少次计数器
+    unsigned available = 0;             //ZFX_PERF_*的组合, 没有的计数器一直是0
+
+    double ipc() const {
+        return cycles != 0 ? static_cast<double>(instructions) / static_cast<double>(cycles) : 0;
+    }
+
+    double perPoint(std::uint64_t v) const {
+        return points != 0 ? static_cast<double>(v) / static_cast<double>(points) : 0;
+    }
+};
+
+//在当前线程上打开计数器并清零, 返回打开了哪些, 一个都没有返回0并且不开启, on为false关闭
+unsigned zfx_enablePerf(zfx_State* l, bool on);
+
+//累计到现在的结果, 没有开启的话全是0
+zfx_PerfCounters zfx_getPerf(const zfx_State* l);
+
+void zfx_resetPerf(zfx_State* l);
+
+//把from的结果加到into上, 并行执行结束时把工作线程的计数合并回来
+void zfx_mergePerf(zfx_State* into, const zfx_State* from);
+
+/*
+ * 打印每个点的计数和一个粗略的判断:
+ *   LLC缺失多 -> memory-bound, 分支预测失败多(解释器的间接跳转) -> dispatch-bound, 否则compute-bound
+ * */
+void zfx_dumpPerf(const zfx_State* l, std::FILE* out);
+
+//zvm.cpp在每次执行前后调用, points是这次执行跑完的点数
+void zfx_perfbegin(zfx_State* l);
+void zfx_perfend(zfx_State* l, std::size_t points);
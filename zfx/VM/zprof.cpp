@@ -0,0 +1,164 @@
+//
+// Created by admin on 2022/9/21.
+//
+#include "zprof.h"
+#include "zdo.h"
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+namespace {
+
+//信号处理函数只用到这些, 都是无锁的
+std::unique_ptr<const Instruction*[]> samples;
+std::atomic<std::size_t> nsamples{0};
+std::atomic<std::size_t> noutside{0};
+//解释器每次进入execute读一次, 决定这一段要不要写profpc
+std::atomic<bool> profiling{false};
+
+}
+
+bool zfx_profilerRunning() {
+    return profiling.load(std::memory_order_relaxed);
+}
+
+#if defined(__linux__)
+static struct sigaction oldprof;
+
+static void prof_handler(int, siginfo_t*, void*) {
+    int saved = errno;
+    zfx_State* l = zfx_running();
+    const Instruction* pc = l != nullptr ? l->profpc : nullptr;
+    if (pc != nullptr) {
+        std::size_t i = nsamples.fetch_add(1, std::memory_order_relaxed);
+        if (i < ZFX_PROF_MAXSAMPLES) {
+            samples[i] = pc;
+        }
+    } else {
+        noutside.fetch_add(1, std::memory_order_relaxed);
+    }
+    errno = saved;
+}
+
+int zfx_startProfiler(int hz) {
+    if (profiling || hz <= 0) {
+        return 0;
+    }
+    if (!samples) {
+        samples = std::make_unique<const Instruction*[]>(ZFX_PROF_MAXSAMPLES);
+    }
+    struct sigaction sa{};
+    sa.sa_sigaction = prof_handler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, &oldprof) != 0) {
+        return 0;
+    }
+    long usec = std::max(1L, 1000000L / hz);
+    itimerval timer{};
+    timer.it_interval.tv_sec = usec / 1000000;
+    timer.it_interval.tv_usec = usec % 1000000;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+        sigaction(SIGPROF, &oldprof, nullptr);
+        return 0;
+    }
+    profiling = true;
+    return 1;
+}
+
+void zfx_stopProfiler() {
+    if (!profiling) {
+        return;
+    }
+    itimerval timer{};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &oldprof, nullptr);
+    profiling = false;
+}
+#else
+int zfx_startProfiler(int) {
+    return 0;
+}
+
+void zfx_stopProfiler() {
+}
+#endif
+
+void zfx_clearProfile() {
+    nsamples.store(0);
+    noutside.store(0);
+}
+
+std::size_t zfx_profileSamples(std::size_t* outside) {
+    if (outside != nullptr) {
+        *outside = noutside.load();
+    }
+    return std::min<std::size_t>(nsamples.load(), ZFX_PROF_MAXSAMPLES);
+}
+
+void zfx_dumpProfile(const Proto* main, std::string_view source, std::FILE* out, int top) {
+    std::vector<std::string_view> lines;
+    while (!source.empty()) {
+        std::size_t eol = source.find('\n');
+        lines.push_back(source.substr(0, eol));
+        source = eol == std::string_view::npos ? std::string_view{} : source.substr(eol + 1);
+    }
+
+    //(函数, 行号), 行号0表示这条指令没有调试信息
+    std::map<std::pair<const Proto*, std::uint32_t>, std::size_t> hits;
+    std::size_t outside = 0;
+    std::size_t total = zfx_profileSamples(&outside);
+    std::size_t others = 0;
+    for (std::size_t i = 0; i < total; i++) {
+        const Proto* p = zfx_findproto(main, samples[i]);
+        if (p == nullptr) {
+            others++;
+            continue;
+        }
+        const LineInfo* li = zfx_getlineinfo(p, static_cast<std::size_t>(samples[i] - p->code.data()));
+        hits[{p, li != nullptr ? li->line : 0}]++;
+    }
+    std::vector<std::pair<std::pair<const Proto*, std::uint32_t>, std::size_t>> rows(hits.begin(), hits.end());
+    std::sort(rows.begin(), rows.end(), [](auto const& a, auto const& b) {
+        return a.second > b.second;
+    });
+
+    std::fprintf(out, "profile: %zu samples in zfx code, %zu in other modules, %zu outside zfx\n", total - others,
+                 others, outside);
+    if (total == 0) {
+        return;
+    }
+    std::fprintf(out, "%8s %7s  %-16s %6s  %s\n", "samples", "%", "function", "line", "source");
+    int shown = 0;
+    for (auto const& [key, n] : rows) {
+        if (shown++ == top) {
+            break;
+        }
+        auto [p, line] = key;
+        std::string_view text = line >= 1 && line <= lines.size() ? lines[line - 1] : std::string_view{};
+        while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+            text.remove_prefix(1);
+        }
+        const char* name = p->name.empty() ? "<main>" : p->name.c_str();
+        if (line == 0) {
+            std::fprintf(out, "%8zu %6.2f%%  %-16s %6s  (no line info)\n", n, 100.0 * n / total, name, "-");
+        } else {
+            std::fprintf(out, "%8zu %6.2f%%  %-16s %6u  %.*s\n", n, 100.0 * n / total, name, line,
+                         static_cast<int>(text.size()), text.data());
+        }
+    }
+    if (others != 0) {
+        std::fprintf(out, "%8zu %6.2f%%  %-16s %6s  (other modules)\n", others, 100.0 * others / total, "-", "-");
+    }
+}
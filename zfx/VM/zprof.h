@@ -0,0 +1,41 @@
+//
+// Created by admin on 2022/9/21.
+//
+/*
+ * 按源码行统计热点的采样分析器
+ * 定时器信号(SIGPROF, 按进程消耗的CPU时间计时)到来时, 信号处理函数读出当前线程正在执行的zfx指令记下来,
+ * 结束之后再用Proto::lineinfo把指令换成行号, 按采样数从多到少列出最热的行
+ * 开着分析器的时候解释器每条指令多一次写profpc, 不开的时候不写, 查表全部在报告的时候做
+ * 解释器在每次开始执行一段代码(一批点或者一次调用)的时候才看分析器开没开, 中途打开的从下一段开始采到
+ * 定时器是整个进程共享的, 同一时间只能有一个分析器在跑, 多线程执行的采样会合在一起
+ * 只支持linux, 其他平台上zfx_startProfiler返回0
+ * */
+#pragma once
+
+#include "zdebug.h"
+#include <cstdio>
+#include <string_view>
+
+//最多记多少个采样, 满了之后的采样只计数不记录
+#define ZFX_PROF_MAXSAMPLES (1 << 20)
+
+//每秒采样hz次, 已经在跑或者平台不支持返回0
+int zfx_startProfiler(int hz = 1000);
+
+void zfx_stopProfiler();
+
+//分析器是不是在跑, 不支持的平台上永远是false
+bool zfx_profilerRunning();
+
+//丢掉已经记下的采样
+void zfx_clearProfile();
+
+//记下了多少个落在zfx代码里的采样, 和落在宿主代码里(没有在执行zfx)的采样数
+std::size_t zfx_profileSamples(std::size_t* outside = nullptr);
+
+/*
+ * 打印main和它的子函数里最热的top行, source是编译用的源码, 用来把那一行原样打出来, 可以为空
+ * 不属于这个程序的采样(比如同时在跑的别的Module)单独算一行
+ * 应该在zfx_stopProfiler之后调用
+ * */
+void zfx_dumpProfile(const Proto* main, std::string_view source, std::FILE* out, int top = 20);
@@ -0,0 +1,122 @@
+//
+// Created by admin on 2022/9/13.
+//
+/*
+ * 无状态的随机数, 用Philox4x32-10把(id, seed)直接映射成随机数
+ * 同一个点不管被哪个线程, 哪一批执行, 结果都一样, 也不需要在线程之间同步任何状态
+ * id和seed是int, 按值当作计数器和密钥, float和double程序里同一个id得到的随机数一样
+ * */
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#include "zbuiltins.h"
+#include <cmath>
+#include <cstdint>
+
+namespace {
+
+constexpr std::uint32_t kPhiloxM0 = 0xD2511F53u;
+constexpr std::uint32_t kPhiloxM1 = 0xCD9E8D57u;
+constexpr std::uint32_t kPhiloxW0 = 0x9E3779B9u;
+constexpr std::uint32_t kPhiloxW1 = 0xBB67AE85u;
+//密钥的第二个字, 和zfx以外的Philox流区分开
+constexpr std::uint32_t kKeyHi = 0x7a66782eu;
+
+constexpr float kTwoPi = 6.28318530717958647692f;
+constexpr int kRounds = 10;
+
+struct Philox {
+    std::uint32_t v[4];
+};
+
+inline std::uint32_t keybits(int i) {
+    return static_cast<std::uint32_t>(i);
+}
+
+//channel区分同一个点上的不同用途, 比如rand和randn
+inline Philox philox(std::uint32_t id, std::uint32_t seed, std::uint32_t channel) {
+    std::uint32_t c0 = id, c1 = channel, c2 = 0, c3 = 0;
+    std::uint32_t k0 = seed, k1 = kKeyHi;
+    for (int r = 0; r < kRounds; r++) {
+        std::uint64_t p0 = static_cast<std::uint64_t>(kPhiloxM0) * c0;
+        std::uint64_t p1 = static_cast<std::uint64_t>(kPhiloxM1) * c2;
+        auto hi0 = static_cast<std::uint32_t>(p0 >> 32), lo0 = static_cast<std::uint32_t>(p0);
+        auto hi1 = static_cast<std::uint32_t>(p1 >> 32), lo1 = static_cast<std::uint32_t>(p1);
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+        k0 += kPhiloxW0;
+        k1 += kPhiloxW1;
+    }
+    return {{c0, c1, c2, c3}};
+}
+
+//高24位变成[0, 1)里的float, 每个值都能精确表示
+inline float unit(std::uint32_t u) {
+    return static_cast<float>(u >> 8) * (1.0f / 16777216.0f);
+}
+
+//(0, 1], 给log用的
+inline float unitpos(std::uint32_t u) {
+    return static_cast<float>((u >> 8) + 1) * (1.0f / 16777216.0f);
+}
+
+enum Channel : std::uint32_t {
+    kUniform,
+    kNormal,
+    kSphere,
+};
+
+}
+
+ZFX_SIMD_CLONES void zfx_vrand(float* out, const int* id, const int* seed, int n) {
+    for (int i = 0; i < n; i++) {
+        out[i] = unit(philox(keybits(id[i]), keybits(seed[i]), kUniform).v[0]);
+    }
+}
+
+/*
+ * Box-Muller, 对数和三角函数用精确档的lane函数, 同样和SIMD宽度无关
+ * 每次最多ZFX_LANES个点, 中间结果放在栈上
+ * */
+ZFX_SIMD_CLONES void zfx_vrandn(float* out, const int* id, const int* seed, int n) {
+    for (int b = 0; b < n; b += ZFX_LANES) {
+        int m = n - b < ZFX_LANES ? n - b : ZFX_LANES;
+        float r[ZFX_LANES], a[ZFX_LANES];
+        for (int i = 0; i < m; i++) {
+            Philox p = philox(keybits(id[b + i]), keybits(seed[b + i]), kNormal);
+            r[i] = unitpos(p.v[0]);
+            a[i] = kTwoPi * unit(p.v[1]);
+        }
+        zfx_vlog(r, r, m, Zfx_MathPrecision::kPrecise);
+        zfx_vcos(a, a, m, Zfx_MathPrecision::kPrecise);
+        for (int i = 0; i < m; i++) {
+            out[b + i] = std::sqrt(-2.0f * r[i]) * a[i];
+        }
+    }
+}
+
+//z在[-1, 1]上均匀, 方位角均匀, 就是球面上的均匀分布
+ZFX_SIMD_CLONES void zfx_vrandsphere(float* const* out, const int* id, const int* seed, int n) {
+    for (int b = 0; b < n; b += ZFX_LANES) {
+        int m = n - b < ZFX_LANES ? n - b : ZFX_LANES;
+        float z[ZFX_LANES], s[ZFX_LANES], c[ZFX_LANES];
+        for (int i = 0; i < m; i++) {
+            Philox p = philox(keybits(id[b + i]), keybits(seed[b + i]), kSphere);
+            z[i] = 2.0f * unit(p.v[0]) - 1.0f;
+            s[i] = kTwoPi * unit(p.v[1]);
+        }
+        zfx_vcos(c, s, m, Zfx_MathPrecision::kPrecise);
+        zfx_vsin(s, s, m, Zfx_MathPrecision::kPrecise);
+        for (int i = 0; i < m; i++) {
+            float rxy = std::sqrt(1.0f - z[i] * z[i]);
+            out[0][b + i] = rxy * c[i];
+            out[1][b + i] = rxy * s[i];
+            out[2][b + i] = z[i];
+        }
+    }
+}
@@ -0,0 +1,153 @@
+//
+// Created by admin on 2022/9/26.
+//
+#include "zroofline.h"
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+//threads个线程同时跑f(i), 返回墙上时间
+template <class F>
+double timed(int threads, F f) {
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; i++) {
+        pool.emplace_back(f, i);
+    }
+    f(0);
+    for (auto& t : pool) {
+        t.join();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+//STREAM triad, 每个数组32MB, 比一般的末级缓存大
+double measureBandwidth(int threads) {
+    const std::size_t n = std::size_t(1) << 23;
+    std::vector<float> a(n), b(n, 1.0f), c(n, 2.0f);
+    const float s = 3.0f;
+    auto triad = [&](int t) {
+        std::size_t begin = n * t / threads, end = n * (t + 1) / threads;
+        for (std::size_t i = begin; i < end; i++) {
+            a[i] = b[i] + s * c[i];
+        }
+    };
+    double best = 1e30;
+    for (int rep = 0; rep < 5; rep++) {
+        best = std::min(best, timed(threads, triad));
+    }
+    volatile float sink = a[n / 2];
+    (void)sink;
+    return 3.0 * sizeof(float) * static_cast<double>(n) / best;
+}
+
+//64个互不依赖的乘加, 编译器会把它向量化, 足够盖住乘加的延迟
+double measureFlops(int threads) {
+    constexpr int kWidth = 64;
+    const long iters = 1 << 20;
+    std::vector<float> out(static_cast<std::size_t>(threads));
+    auto fma = [&](int t) {
+        float acc[kWidth];
+        for (int k = 0; k < kWidth; k++) {
+            acc[k] = static_cast<float>(k + t);
+        }
+        volatile float mv = 0.999f, av = 0.001f;
+        float m = mv, a = av;
+        for (long i = 0; i < iters; i++) {
+            for (int k = 0; k < kWidth; k++) {
+                acc[k] = acc[k] * m + a;
+            }
+        }
+        float sum = 0;
+        for (float v : acc) {
+            sum += v;
+        }
+        out[static_cast<std::size_t>(t)] = sum;
+    };
+    double best = 1e30;
+    for (int rep = 0; rep < 3; rep++) {
+        best = std::min(best, timed(threads, fma));
+    }
+    volatile float sink = out[0];
+    (void)sink;
+    return 2.0 * kWidth * static_cast<double>(iters) * threads / best;
+}
+
+}
+
+zfx_Machine zfx_measureMachine(int threads) {
+    static std::mutex lock;
+    static std::map<int, zfx_Machine> cache;
+    threads = std::max(1, threads);
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = cache.find(threads);
+    if (it != cache.end()) {
+        return it->second;
+    }
+    zfx_Machine m;
+    m.threads = threads;
+    m.bandwidth = measureBandwidth(threads);
+    m.flops = measureFlops(threads);
+    cache[threads] = m;
+    return m;
+}
+
+zfx_Roofline zfx_roofline(const Proto* p, double pointsPerSec, int threads, double insnsPerBatch) {
+    zfx_Roofline r;
+    r.traffic = zfx_traffic(p);
+    //比直线执行一遍多出来的指令都算在循环体上, 所有循环按同样的次数估计
+    zfx_Traffic& t = r.traffic;
+    if (t.loops && insnsPerBatch > 0 && t.loopInsns > 0) {
+        double extra = std::max(0.0, insnsPerBatch - t.insns) / t.loopInsns;
+        t.flops += extra * t.loopFlops;
+        t.scaled = true;
+    }
+    r.machine = zfx_measureMachine(threads);
+    r.pointsPerSec = pointsPerSec;
+    double peak = p->number == Zfx_NumberType::kDouble ? r.machine.flops / 2 : r.machine.flops;
+    r.memoryRoof = r.traffic.bytes() > 0 ? r.machine.bandwidth / r.traffic.bytes() : 0;
+    bool reliable = !r.traffic.loops || r.traffic.scaled;
+    r.computeRoof = reliable && r.traffic.flops > 0 ? peak / r.traffic.flops : 0;
+    if (r.memoryRoof > 0 && (r.computeRoof == 0 || r.memoryRoof < r.computeRoof)) {
+        r.roof = r.memoryRoof;
+        r.memoryBound = true;
+    } else {
+        r.roof = r.computeRoof;
+    }
+    r.efficiency = r.roof > 0 ? pointsPerSec / r.roof : 0;
+    return r;
+}
+
+void zfx_dumpRoofline(const zfx_Roofline& r, std::FILE* out) {
+    const zfx_Traffic& t = r.traffic;
+    std::fprintf(out, "  per point: %.0f bytes read (%d attrs), %.0f written (%d attrs), %.1f flops, "
+                      "intensity %.3f flop/byte\n",
+                 t.bytesRead, t.attrsRead, t.bytesWritten, t.attrsWritten, t.flops, t.intensity());
+    if (t.loops) {
+        std::fprintf(out, "  %s\n", t.scaled ? "program loops, trip count estimated from the executed instruction count"
+                                              : "flops unreliable: program loops, compute roof left out");
+    }
+    std::fprintf(out, "  machine (%d threads): %.2f GB/s, %.2f GFLOP/s\n", r.machine.threads, r.machine.bandwidth / 1e9,
+                 r.machine.flops / 1e9);
+    std::fprintf(out, "  achieved: %.4g points/s = %.2f GB/s, %.2f GFLOP/s\n", r.pointsPerSec,
+                 r.pointsPerSec * t.bytes() / 1e9, r.pointsPerSec * t.flops / 1e9);
+    std::fprintf(out, "  roofs: memory %.4g points/s, compute %.4g points/s -> %.1f%% of the %s roof\n", r.memoryRoof,
+                 r.computeRoof, r.efficiency * 100, r.memoryBound ? "memory" : "compute");
+    const char* verdict;
+    if (r.roof == 0) {
+        verdict = "no attribute traffic or arithmetic to bound it";
+    } else if (r.efficiency >= 0.8) {
+        verdict = r.memoryBound ? "at the memory roof, only reading or writing fewer attributes will help"
+                                : "at the compute roof, only doing less arithmetic will help";
+    } else if (r.efficiency >= 0.3) {
+        verdict = "near the roof, some headroom left";
+    } else {
+        verdict = "far below the roof, interpreter overhead dominates and there is room to optimize";
+    }
+    std::fprintf(out, "  verdict: %s\n", verdict);
+}
@@ -0,0 +1,44 @@
+//
+// Created by admin on 2022/9/26.
+//
+/*
+ * 每个程序的带宽和roofline报告, 回答"这个脚本还有没有优化的余地"
+ * 静态部分就是zfx_traffic, 见zcost.h
+ *   有循环的时候直线执行一遍的浮点数差得很远, 要用实际执行的指令数(kInstructions / kBatches)估计循环走了几遍,
+ *   没有这个数就不算浮点的屋顶, 报告里写明不可靠
+ * 机器部分: 第一次用到某个线程数时用STREAM的triad测内存带宽, 用一段乘加循环测峰值浮点, 结果缓存下来
+ *   峰值是按这次构建的编译选项测的, double程序按float峰值的一半算
+ * 执行之后把实际的每秒点数放到两条屋顶线下面比较
+ * */
+#pragma once
+
+#include "zcost.h"
+#include <cstdio>
+
+struct zfx_Machine {
+    int threads = 1;
+    double bandwidth = 0;       //字节每秒
+    double flops = 0;           //float的浮点运算每秒
+};
+
+struct zfx_Roofline {
+    zfx_Traffic traffic;
+    zfx_Machine machine;
+    double pointsPerSec = 0;        //实际达到的
+    double memoryRoof = 0;          //只受带宽限制的时候每秒能跑多少个点
+    double computeRoof = 0;         //只受浮点限制的时候
+    double roof = 0;                //两者取小的
+    bool memoryBound = false;
+    double efficiency = 0;          //pointsPerSec / roof
+};
+
+//同一个线程数只测一次, 线程安全
+zfx_Machine zfx_measureMachine(int threads = 1);
+
+/*
+ * 用threads个线程执行p达到了每秒pointsPerSec个点
+ * insnsPerBatch是同一次执行里每批实际执行的指令数, 有循环的程序靠它估计浮点运算数, 不知道就给0
+ * */
+zfx_Roofline zfx_roofline(const Proto* p, double pointsPerSec, int threads = 1, double insnsPerBatch = 0);
+
+void zfx_dumpRoofline(const zfx_Roofline& r, std::FILE* out);
@@ -3,17 +3,52 @@
 //
 //做一些虚拟机栈的操作
 #include "zstate.h"
+#include "zdo.h"
+#include "zmetrics.h"
+#include "zbuiltins.h"
+#include "../ZFXFunction.h"
 
 
-static void stack_init() {
-    //初始化栈
+static void stack_init(zfx_State* l) {
+    //初始化栈, 只是预留虚拟地址, 真正的物理页在第一次访问时才提交
+    zfx_stackinit(l);
 }
 
 
-static void close_state() {
+static void close_state(zfx_State* l) {
     //清空虚拟机栈
+    zfx_stackfree(l);
 }
 
-void lua_close() {
+zfx_State* zfx_newstate() {
+    auto* l = new zfx_State{};
+    zfx_metricAdd(Zfx_Metric::kStatesCreated);
+    zfx_metricAdd(Zfx_Metric::kStatesLive);
+    l->status = ZFX_OK;
+    l->budget = ZFX_CHECKINTERVAL;
+    //内置函数注册在全局的宿主函数表里, 只有第一次会真正注册
+    zfx_openlibs();
+    stack_init(l);
+    return l;
+}
+
+zfx_State* zfx_newstate(std::shared_ptr<const zeno::zfx::Module> module) {
+    zfx_State* l = zfx_newstate();
+    l->module = std::move(module);
+    return l;
+}
+
+void zfx_close(zfx_State* l) {
+    zfx_metricAdd(Zfx_Metric::kStatesClosed);
+    zfx_metricSub(Zfx_Metric::kStatesLive);
+    close_state(l);
+    delete l;
+}
 
+//编号是脚本算出来的, 不对的话是运行时错误
+span<float const> zfx_getresource(zfx_State* l, int idx) {
+    if (idx < 0 || static_cast<std::size_t>(idx) >= l->resources.size()) {
+        zfx_throw(l, ZFX_ERRRUN);
+    }
+    return l->resources[static_cast<std::size_t>(idx)];
 }
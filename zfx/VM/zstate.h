@@ -5,14 +5,161 @@
 #pragma once
 
 #include "../Object.h"
+#include "../ZFX.h"
+#include "../span.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <vector>
 
+using zeno::zfx::Object;
 
+namespace zeno::zfx {
+class Module;
+}
+
+struct zfx_longjmp;
+
+/*
+ * 一段预留好的虚拟内存, 只有前committed个字节是可读写的, 后面全部是PROT_NONE
+ * 越界访问会触发SIGSEGV, 由zdo.cpp里的信号处理函数按需提交或者报错
+ * 最后一页永远不会被提交, 作为真正的guard page
+ */
+struct zfx_Region {
+    char* base = nullptr;
+    std::size_t committed = 0;
+    std::size_t reserved = 0;
+};
+
+/*
+ * 取消执行用的令牌, 一次并行执行的所有工作线程共享同一个
+ * 虚拟机只在循环回边和函数调用处递减计数器, 减到0才去看这里的标志和时钟
+ * 有一个线程发现超时就会把cancelled置上, 其他线程下一次检查就会停下来
+ */
+struct zfx_CancelToken {
+    std::atomic<bool> cancelled{false};
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+    void cancel() noexcept {
+        cancelled.store(true, std::memory_order_relaxed);
+    }
+};
+
+/*
+ * 一批里的lane条件不一样, 走了不同分支的时候, 哪些lane在执行, 其他的lane停在哪条指令等着汇合
+ * 执行的时候是zvm.cpp里的局部变量, 只有在分支里挂起的时候才保存在这里
+ */
+struct zfx_LaneMask {
+    static_assert(ZFX_LANES <= 64, "lane masks are 64 bits");
+
+    struct Parked {
+        const std::uint32_t* pc;
+        std::uint64_t lanes;
+    };
+
+    std::uint64_t active = 0;       //0表示这一批的所有lane都在执行
+    int nparked = 0;
+    Parked parked[ZFX_LANES];       //按pc从大到小, 每个lane只会停在一处, 所以最多ZFX_LANES个
+};
+
+/*
+ * 正在执行的那一段点的位置, 挂起的时候保存在这里, zfx_resume从这里接着跑
+ * 寄存器帧还留在栈上, 所以寄存器里的中间结果不会丢
+ */
+struct zfx_CallInfo {
+    const zeno::zfx::Proto* p = nullptr;
+    const std::uint32_t* savedpc = nullptr; //nullptr表示从这一批的第一条指令开始
+    void* regs = nullptr;                   //类型由p->number决定
+    std::size_t first = 0;                  //当前这一批的第一个点
+    std::size_t end = 0;
+    zfx_LaneMask mask;                      //savedpc不为空的时候才有意义
+};
+
+enum class Zfx_Wrap : std::uint8_t {
+    kClamp,     //超出范围的取边上的值
+    kRepeat,    //周期延拓, 最后一个格点和第一个格点之间也插值
+};
+
+/*
+ * 宿主传进来的查找表, 对所有点都是一样的, 比如颜色ramp, 衰减曲线, 3D LUT
+ * data按x变化最快, 然后是y, z, 每个格点channels个float挨着放
+ * kClamp的时候lo对应第一个格点, hi对应最后一个格点; kRepeat的时候[lo, hi)是一个周期, hi又回到第一个格点
+ * keys不为空的时候是一条1D曲线, keys[i]是第i个格点的位置, 必须递增, 这时候不看lo, hi和wrap, 两头取边上的值
+ */
+struct zfx_Table {
+    span<float const> data{};
+    span<float const> keys{};           //span的默认构造不清零, 这里要值初始化
+    int dims = 1;                   //1到3
+    int size[3] = {1, 1, 1};        //每一维的格点数
+    int channels = 1;               //1到4
+    float lo[3] = {0, 0, 0};
+    float hi[3] = {1, 1, 1};
+    Zfx_Wrap wrap = Zfx_Wrap::kClamp;
+};
+
+#ifdef ZFX_OPSTATS
+//按log2(周期数)分桶的直方图有多少个桶
+#define ZFX_OPSTATS_BUCKETS 32
+
+/*
+ * 每种指令执行了多少次, 平均每ZFX_OPSTATS_SAMPLE条指令用rdtsc量一次这条指令花的周期
+ * 间隔是随机的, 固定间隔会和循环的长度对齐, 一直量到同一条指令
+ * 只在定义了ZFX_OPSTATS的构建里存在, 见zstats.h
+ */
+struct zfx_OpStats {
+    std::uint64_t count[256] = {};
+    std::uint64_t sampled[256] = {};
+    std::uint64_t cycles[256] = {};                     //采样到的周期数之和
+    std::uint32_t hist[256][ZFX_OPSTATS_BUCKETS] = {};
+    std::uint32_t countdown = 1;                        //还有几条指令到下一次采样
+    std::uint32_t seed = 0x9e3779b9u;
+    std::uint64_t overhead = 0;                         //两次rdtsc之间本身的开销, 采样结果里扣掉
+};
+#endif
+
+//打开的硬件计数器和累计的结果, 见zperf.h, 只有打开了计数的状态才有
+struct zfx_Perf;
+struct zfx_PerfDeleter {
+    void operator()(zfx_Perf* p) const;
+};
+
+/*
+ * 一次执行的全部状态, 只有栈(寄存器帧也开在栈上)和宿主绑定的数据
+ * 编译好的代码放在不可变的Module里, 任意多个状态可以跨线程共享同一个Module
+ * 所以每个工作线程或者任务各自新建一个状态就行, 不需要加锁
+ */
 struct zfx_State {
     std::uint8_t status;
-    Object top;
-    Object base;
-    Object stack_last;
-    Object stack;
+    Object* top;        //栈顶的下一个空位
+    Object* base;       //当前函数的栈底
+    Object* stack_last; //已提交区域的末尾, 只有没有guard page的平台才用它做检查
+    Object* stack;      //栈的起始地址, 整个生命周期内不会移动
 
     int stackSize;
-}
\ No newline at end of file
+    zfx_Region stackRegion;
+
+    struct zfx_longjmp* errorJmp; //当前的错误恢复点
+
+    std::shared_ptr<const zeno::zfx::Module> module; //这个状态执行的程序, 只读共享
+
+    std::shared_ptr<zfx_CancelToken> cancel;    //没有的话永远不会取消
+    int budget;                                 //还剩多少次回边或者调用才去检查cancel
+
+    zfx_CallInfo ci;
+    const std::uint32_t* volatile profpc;       //正在执行的指令, 给采样分析器的信号处理函数读, 分析器没开的时候不写
+    std::uint64_t ninsns;                       //执行了多少条指令, 每次执行结束时加到全局指标上
+    std::chrono::steady_clock::time_point yieldAt = std::chrono::steady_clock::time_point::max(); //到了这个时间就在安全点挂起
+
+    std::vector<span<float>> attrs;             //宿主绑定的属性数组, 按Proto::syms的下标
+    std::vector<span<double>> dattrs;           //double程序用的属性数组, 和attrs一样按下标
+    std::vector<span<float const>> resources;   //宿主传进来的只读数组, span类型参数通过编号取
+    std::vector<zfx_Table> tables;              //查找表, 按Proto::tables的下标
+#ifdef ZFX_OPSTATS
+    std::unique_ptr<zfx_OpStats> opstats;       //为空就不统计
+#endif
+    std::unique_ptr<zfx_Perf, zfx_PerfDeleter> perf; //为空就不读硬件计数器
+};
+
+//新建一个执行module的状态, 栈优先从当前线程缓存里取
+zfx_State* zfx_newstate(std::shared_ptr<const zeno::zfx::Module> module);
@@ -0,0 +1,136 @@
+//
+// Created by admin on 2022/9/20.
+//
+#include "zstats.h"
+#include "../bc.h"
+#include "../../magic_enum.hpp"
+#include <algorithm>
+#include <vector>
+
+using zeno::zfx::OpCode;
+
+#ifdef ZFX_OPSTATS
+namespace {
+
+//两次紧挨着的rdtsc之间最少差多少, 取很多次里的最小值
+std::uint64_t calibrate() {
+    std::uint64_t best = ~std::uint64_t(0);
+    for (int i = 0; i < 1000; i++) {
+        std::uint64_t t0 = zfx_rdtsc();
+        std::uint64_t t1 = zfx_rdtsc();
+        best = std::min(best, t1 - t0);
+    }
+    return best;
+}
+
+//直方图里第q分位落在哪个桶, 返回这个桶的上界, 没有采样的话返回0
+std::uint64_t percentile(const std::uint32_t* hist, std::uint64_t total, double q) {
+    if (total == 0) {
+        return 0;
+    }
+    std::uint64_t want = static_cast<std::uint64_t>(q * static_cast<double>(total));
+    std::uint64_t seen = 0;
+    for (int b = 0; b < ZFX_OPSTATS_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen > want) {
+            return std::uint64_t(1) << (b + 1);
+        }
+    }
+    return std::uint64_t(1) << ZFX_OPSTATS_BUCKETS;
+}
+
+}
+
+int zfx_enableOpStats(zfx_State* l, bool on) {
+    if (!on) {
+        l->opstats.reset();
+        return 1;
+    }
+    l->opstats = std::make_unique<zfx_OpStats>();
+    l->opstats->overhead = calibrate();
+    return 1;
+}
+
+void zfx_resetOpStats(zfx_State* l) {
+    if (l->opstats) {
+        std::uint64_t overhead = l->opstats->overhead;
+        *l->opstats = zfx_OpStats{};
+        l->opstats->overhead = overhead;
+    }
+}
+
+void zfx_mergeOpStats(zfx_State* into, const zfx_State* from) {
+    if (!into->opstats || !from->opstats) {
+        return;
+    }
+    zfx_OpStats& a = *into->opstats;
+    const zfx_OpStats& b = *from->opstats;
+    for (int op = 0; op < 256; op++) {
+        a.count[op] += b.count[op];
+        a.sampled[op] += b.sampled[op];
+        a.cycles[op] += b.cycles[op];
+        for (int k = 0; k < ZFX_OPSTATS_BUCKETS; k++) {
+            a.hist[op][k] += b.hist[op][k];
+        }
+    }
+}
+
+void zfx_dumpOpStats(zfx_State* l, std::FILE* out) {
+    if (!l->opstats) {
+        std::fprintf(out, "opstats: not enabled on this state\n");
+        return;
+    }
+    const zfx_OpStats& s = *l->opstats;
+    struct Row {
+        int op;
+        double mean;
+        double total;       //估计的总周期
+    };
+    std::vector<Row> rows;
+    std::uint64_t count = 0;
+    double cycles = 0;
+    for (int op = 0; op < 256; op++) {
+        if (s.count[op] == 0) {
+            continue;
+        }
+        double mean = s.sampled[op] ? static_cast<double>(s.cycles[op]) / static_cast<double>(s.sampled[op]) : 0;
+        rows.push_back({op, mean, mean * static_cast<double>(s.count[op])});
+        count += s.count[op];
+        cycles += rows.back().total;
+    }
+    std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+        return a.total > b.total;
+    });
+
+    std::fprintf(out, "opstats: %llu instructions, 1/%d sampled, rdtsc overhead %llu cycles subtracted\n",
+                 static_cast<unsigned long long>(count), ZFX_OPSTATS_SAMPLE,
+                 static_cast<unsigned long long>(s.overhead));
+    std::fprintf(out, "%-20s %14s %7s %10s %10s %8s %8s %8s\n", "opcode", "count", "count%", "samples", "mean", "p50<=",
+                 "p90<=", "cycles%");
+    for (const Row& r : rows) {
+        auto name = magic_enum::enum_name(static_cast<OpCode>(r.op));
+        std::string label = name.empty() ? "op" + std::to_string(r.op) : std::string(name);
+        std::fprintf(out, "%-20s %14llu %6.2f%% %10llu %10.1f %8llu %8llu %7.2f%%\n", label.c_str(),
+                     static_cast<unsigned long long>(s.count[r.op]),
+                     100.0 * static_cast<double>(s.count[r.op]) / static_cast<double>(count),
+                     static_cast<unsigned long long>(s.sampled[r.op]), r.mean,
+                     static_cast<unsigned long long>(percentile(s.hist[r.op], s.sampled[r.op], 0.5)),
+                     static_cast<unsigned long long>(percentile(s.hist[r.op], s.sampled[r.op], 0.9)),
+                     cycles > 0 ? 100.0 * r.total / cycles : 0.0);
+    }
+}
+#else
+int zfx_enableOpStats(zfx_State*, bool) {
+    return 0;
+}
+
+void zfx_resetOpStats(zfx_State*) {
+}
+
+void zfx_mergeOpStats(zfx_State*, const zfx_State*) {
+}
+
+void zfx_dumpOpStats(zfx_State*, std::FILE* out) {
+    std::fprintf(out, "opstats: not compiled in, configure with -DZFX_OPSTATS=ON\n");
+}
+#endif
@@ -0,0 +1,70 @@
+//
+// Created by admin on 2022/9/20.
+//
+/*
+ * 按指令统计执行次数和周期, 用来找值得特化或者合并的指令
+ * 只有定义了ZFX_OPSTATS(cmake -DZFX_OPSTATS=ON)的构建才会把计数编译进解释器, 否则下面的钩子都是空的
+ * 编译进去以后还要对每个状态调用zfx_enableOpStats才开始统计, 没打开的状态每条指令只多一次判空
+ * */
+#pragma once
+
+#include "zstate.h"
+#include <cstdio>
+
+#ifdef ZFX_OPSTATS
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//平均每隔多少条指令量一次周期, 必须是2的幂
+#define ZFX_OPSTATS_SAMPLE 64
+
+inline std::uint64_t zfx_rdtsc() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+//返回开始的时间戳, 这一条不采样的话返回0
+inline std::uint64_t zfx_opstats_enter(zfx_OpStats* s, std::uint32_t insn) {
+    s->count[insn & 0xff]++;
+    if (--s->countdown != 0) {
+        return 0;
+    }
+    //xorshift32, 下一次间隔在[1, 2*ZFX_OPSTATS_SAMPLE-1]里均匀分布, 平均正好是ZFX_OPSTATS_SAMPLE
+    s->seed ^= s->seed << 13;
+    s->seed ^= s->seed >> 17;
+    s->seed ^= s->seed << 5;
+    s->countdown = 1 + s->seed % (2 * ZFX_OPSTATS_SAMPLE - 1);
+    return zfx_rdtsc();
+}
+
+inline void zfx_opstats_leave(zfx_OpStats* s, std::uint32_t insn, std::uint64_t t0) {
+    if (t0 == 0) {
+        return;
+    }
+    std::uint64_t dt = zfx_rdtsc() - t0;
+    dt = dt > s->overhead ? dt - s->overhead : 0;
+    int bucket = 0;
+    while (bucket + 1 < ZFX_OPSTATS_BUCKETS && (dt >> (bucket + 1)) != 0) {
+        bucket++;
+    }
+    unsigned op = insn & 0xff;
+    s->sampled[op]++;
+    s->cycles[op] += dt;
+    s->hist[op][bucket]++;
+}
+#endif
+
+//打开或者关闭l的指令统计, 打开的时候清零, 构建时没有ZFX_OPSTATS的话什么都不做, 返回0
+int zfx_enableOpStats(zfx_State* l, bool on);
+
+void zfx_resetOpStats(zfx_State* l);
+
+//把from的统计加到into上, 并行执行结束时把工作线程的统计合并回来
+void zfx_mergeOpStats(zfx_State* into, const zfx_State* from);
+
+//按估计的总周期(次数乘平均周期)从大到小打印一张表, 没有统计的话只打印一行说明
+void zfx_dumpOpStats(zfx_State* l, std::FILE* out);
@@ -0,0 +1,158 @@
+//
+// Created by admin on 2022/9/25.
+//
+#include "ztrace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct Event {
+    const char* name;
+    const char* argName;
+    std::int64_t arg;
+    std::uint64_t begin;
+    std::uint64_t end;
+};
+
+struct Buffer {
+    int tid;
+    const char* name = nullptr;
+    std::unique_ptr<Event[]> events = std::make_unique<Event[]>(ZFX_TRACE_CAPACITY);
+    std::atomic<std::size_t> n{0};      //只有所属的线程写
+    std::atomic<std::size_t> dropped{0};
+    std::atomic<std::uint64_t> epoch{0};//登记时对应的那次记录, 不是这一次的话先清空
+};
+
+/*
+ * 线程退出之后缓冲区还留着, 到写出的时候再用, 同时放进空闲列表
+ * 新的线程先从空闲列表里拿, 接着往里记, 在时间线上和退出的那个线程是同一行, 反正两个线程的事件不会重叠
+ * zfx_runparallel每次都起新线程, 这样缓冲区的个数只和同时在记录的线程数有关
+ * 下一次开始记录的时候, 空闲的缓冲区里都是过期的事件, 直接释放
+ * */
+std::mutex registryLock;
+std::vector<std::unique_ptr<Buffer>> buffers;
+std::vector<Buffer*> freeBuffers;
+int nextTid = 0;
+std::atomic<std::uint64_t> epoch{0};
+std::atomic<std::chrono::steady_clock::rep> origin{0};     //开始记录的时刻
+
+struct Owner {
+    Buffer* buffer = nullptr;
+
+    ~Owner() {
+        if (buffer != nullptr) {
+            std::lock_guard<std::mutex> lock(registryLock);
+            freeBuffers.push_back(buffer);
+        }
+    }
+};
+
+Buffer* threadBuffer() {
+    thread_local Owner owner;
+    Buffer*& buffer = owner.buffer;
+    if (buffer == nullptr) {
+        std::lock_guard<std::mutex> lock(registryLock);
+        if (!freeBuffers.empty()) {
+            buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+        } else {
+            buffers.push_back(std::make_unique<Buffer>());
+            buffer = buffers.back().get();
+            buffer->tid = ++nextTid;
+        }
+    }
+    std::uint64_t e = epoch.load(std::memory_order_acquire);
+    if (buffer->epoch.load(std::memory_order_relaxed) != e) {
+        buffer->n.store(0, std::memory_order_relaxed);
+        buffer->dropped.store(0, std::memory_order_relaxed);
+        buffer->epoch.store(e, std::memory_order_relaxed);
+    }
+    return buffer;
+}
+
+}
+
+void zfx_startTrace() {
+    {
+        std::lock_guard<std::mutex> lock(registryLock);
+        origin.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+        //各个线程下次记事件时发现epoch变了就自己清空, 这里不碰别的线程的缓冲区
+        epoch.fetch_add(1, std::memory_order_release);
+        //已经退出的线程留下的都过期了
+        for (Buffer* b : freeBuffers) {
+            buffers.erase(std::find_if(buffers.begin(), buffers.end(), [b](auto const& p) { return p.get() == b; }));
+        }
+        freeBuffers.clear();
+    }
+    zfx_traceEnabled.store(true, std::memory_order_release);
+}
+
+void zfx_stopTrace() {
+    zfx_traceEnabled.store(false, std::memory_order_release);
+}
+
+void zfx_traceThreadName(const char* name) {
+    threadBuffer()->name = name;
+}
+
+std::uint64_t zfx_traceNow() {
+    std::chrono::steady_clock::duration since(std::chrono::steady_clock::now().time_since_epoch().count() -
+                                              origin.load(std::memory_order_relaxed));
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(since).count());
+}
+
+void zfx_traceComplete(const char* name, std::uint64_t begin, std::uint64_t end, const char* argName,
+                       std::int64_t arg) {
+    Buffer* b = threadBuffer();
+    std::size_t i = b->n.load(std::memory_order_relaxed);
+    if (i >= ZFX_TRACE_CAPACITY) {
+        b->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    b->events[i] = {name, argName, arg, begin, end};
+    b->n.store(i + 1, std::memory_order_release);
+}
+
+bool zfx_writeTrace(const char* path) {
+    std::FILE* f = std::fopen(path, "w");
+    if (f == nullptr) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(registryLock);
+    std::uint64_t e = epoch.load(std::memory_order_acquire);
+    std::size_t dropped = 0;
+    bool first = true;
+    auto sep = [&] {
+        std::fprintf(f, first ? "\n  " : ",\n  ");
+        first = false;
+    };
+    std::fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    for (auto const& b : buffers) {
+        if (b->epoch.load(std::memory_order_relaxed) != e) {
+            continue;
+        }
+        sep();
+        std::fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                        "\"args\": {\"name\": \"%s\"}}", b->tid, b->name != nullptr ? b->name : "thread");
+        std::size_t n = b->n.load(std::memory_order_acquire);
+        dropped += b->dropped.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < n; i++) {
+            const Event& ev = b->events[i];
+            sep();
+            std::fprintf(f, "{\"name\": \"%s\", \"cat\": \"zfx\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+                            "\"ts\": %.3f, \"dur\": %.3f", ev.name, b->tid, ev.begin / 1000.0,
+                         (ev.end - ev.begin) / 1000.0);
+            if (ev.argName != nullptr) {
+                std::fprintf(f, ", \"args\": {\"%s\": %lld}", ev.argName, static_cast<long long>(ev.arg));
+            }
+            std::fprintf(f, "}");
+        }
+    }
+    std::fprintf(f, "\n], \"otherData\": {\"dropped_events\": %zu}}\n", dropped);
+    return std::fclose(f) == 0;
+}
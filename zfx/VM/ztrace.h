@@ -0,0 +1,68 @@
+//
+// Created by admin on 2022/9/25.
+//
+/*
+ * 输出chrome://tracing(或者ui.perfetto.dev)能打开的trace_event JSON, 用来看多线程执行的时间线
+ * 每个线程第一次记事件的时候登记一个自己的缓冲区, 之后只有这个线程往里写, 不加锁
+ * 线程退出以后缓冲区交给后来的线程接着用, 所以缓冲区的个数和同时在记录的线程数一样多
+ * 缓冲区满了之后的事件直接丢掉, 丢了多少写在输出的元数据里
+ * 没有开始记录的时候每个埋点只多读一次原子变量, 宿主也可以用zfx_TraceSpan记自己的事件(比如读写文件)
+ * zfx_writeTrace要在zfx_stopTrace之后, 所有在记录的线程都停下来以后再调用
+ * */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+//每个线程最多记多少个事件
+#define ZFX_TRACE_CAPACITY (1 << 16)
+
+inline std::atomic<bool> zfx_traceEnabled{false};
+
+inline bool zfx_tracing() {
+    return zfx_traceEnabled.load(std::memory_order_relaxed);
+}
+
+//清空所有线程的缓冲区, 开始记录
+void zfx_startTrace();
+
+void zfx_stopTrace();
+
+//写出到path, 失败返回false
+bool zfx_writeTrace(const char* path);
+
+//当前线程在时间线上显示的名字, name要一直有效
+void zfx_traceThreadName(const char* name);
+
+//从开始记录算起的纳秒
+std::uint64_t zfx_traceNow();
+
+//记一个完整的区间事件, name和argName要一直有效(一般是字符串字面量), argName为空就没有参数
+void zfx_traceComplete(const char* name, std::uint64_t begin, std::uint64_t end, const char* argName = nullptr,
+                       std::int64_t arg = 0);
+
+//作用域内的一个区间, 构造时没在记录的话什么都不做
+class zfx_TraceSpan {
+public:
+    explicit zfx_TraceSpan(const char* name, const char* argName = nullptr, std::int64_t arg = 0)
+        : m_name(zfx_tracing() ? name : nullptr), m_argName(argName), m_arg(arg) {
+        if (m_name != nullptr) {
+            m_begin = zfx_traceNow();
+        }
+    }
+
+    zfx_TraceSpan(const zfx_TraceSpan&) = delete;
+    zfx_TraceSpan& operator=(const zfx_TraceSpan&) = delete;
+
+    ~zfx_TraceSpan() {
+        if (m_name != nullptr) {
+            zfx_traceComplete(m_name, m_begin, zfx_traceNow(), m_argName, m_arg);
+        }
+    }
+
+private:
+    const char* m_name;
+    const char* m_argName;
+    std::int64_t m_arg;
+    std::uint64_t m_begin = 0;
+};
@@ -2,60 +2,995 @@
 // Created by admin on 2022/7/7.
 //
 #include "zvm.h"
+#include "zdebug.h"
+#include "zdo.h"
+#include "zlut.h"
+#include "zmat.h"
+#include "zmetrics.h"
+#include "zperf.h"
+#include "zprof.h"
+#include "zstats.h"
+#include "ztrace.h"
+#include "../ZFXFunction.h"
+#include "../ZFXModule.h"
+#include "../enumtools.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
 
-#define VM_CASE(op) CASE_##OP;
-#define VM_NEXT()
-//虚拟机解释执行的核心引擎
+#define VM_CASE(op) case OpCode::op:
+#define VM_NEXT() break
+//对这一批的每个lane做同一件事, 编译器会把它向量化
+#define VM_ALL(expr) for (int i = 0; i < n; i++) { expr; }
+//只对正在执行的lane做, 没有分叉的时候和VM_ALL一样, 分叉了才按下标一个一个做
+#define VM_LANES(expr) \
+    if (dv.dense) { \
+        for (int i = 0; i < n; i++) { expr; } \
+    } else { \
+        for (int k_ = 0; k_ < dv.nact; k_++) { int i = dv.act[k_]; expr; } \
+    }
+#define RA (regs + ZFX_INSN_A(insn) * ZFX_LANES)
+#define RB (regs + ZFX_INSN_B(insn) * ZFX_LANES)
+#define RC (regs + ZFX_INSN_C(insn) * ZFX_LANES)
+//只在回边和调用处递减, 直线代码没有任何额外开销
+//要挂起的话记下当前这条指令, 恢复的时候重新执行它
+#define VM_CHECKCANCEL() \
+    if (--l->budget <= 0 && zfx_checkcancel(l)) { \
+        l->ci.savedpc = pc - 1; \
+        dv.save(&l->ci.mask); \
+        l->ninsns += executed; \
+        return ZFX_EXEC_YIELD; \
+    }
+//指令统计, 没有定义ZFX_OPSTATS的时候整个消失
+#ifdef ZFX_OPSTATS
+#define VM_STATS_DECL() zfx_OpStats* stats = l->opstats.get()
+#define VM_STATS_ENTER() std::uint64_t t0 = stats ? zfx_opstats_enter(stats, insn) : 0
+#define VM_STATS_LEAVE() if (stats) zfx_opstats_leave(stats, insn, t0)
+#else
+#define VM_STATS_DECL()
+#define VM_STATS_ENTER()
+#define VM_STATS_LEAVE()
+#endif
 
-static void zfx_execute(zfx_State* l) {
+using zeno::bit_cast;
+using zfx_details::toint;
+using zfx_details::fromint;
+using zfx_details::numint_t;
 
-    Object* base;
+template <class T>
+static inline T truth(bool b) {
+    return b ? T(1) : T(0);
+}
 
-    const Instruction* pc;//using Instruction = std::uin32_t;
-    base = l->base;
+//寄存器r的第k个分量
+template <class T>
+static inline T* comp(T* r, int k) {
+    return r + k * ZFX_LANES;
+}
 
-    {
-        VM_CASE(kLoadConstInt) {
-            Instruction insn = *pc++;
-            Object ra ;
-            setnilvalue(ra);
-            VM_NEXT();//取下一条指令
-        }
+//按分量累加, 先放在局部数组里, A和B C相同的时候也不会读到写了一半的结果
+template <class T>
+static inline void dot_lanes(T* acc, const T* rb, const T* rc, int w, int n) {
+    VM_ALL(acc[i] = T(0));
+    for (int k = 0; k < w; k++) {
+        const T* b = comp(rb, k); const T* c = comp(rc, k);
+        VM_ALL(acc[i] += b[i] * c[i]);
+    }
+}
 
-        VM_CASE(kLoadConstFloat) {
-            Instruction insn = *pc++;
+template <class T>
+static inline void distsq_lanes(T* acc, const T* rb, const T* rc, int w, int n) {
+    VM_ALL(acc[i] = T(0));
+    for (int k = 0; k < w; k++) {
+        const T* b = comp(rb, k); const T* c = comp(rc, k);
+        VM_ALL(T d = b[i] - c[i]; acc[i] += d * d);
+    }
+}
+
+/*
+ * 一批lane的分叉和汇合
+ * kJumpIfNot的条件在lane之间不一样的时候, 一部分lane停在它们要去的指令上, 其余的接着执行
+ * 每次都先执行停在最前面的那组lane(最小pc优先), 结构化的if/else和循环会在出口处重新汇合
+ * 没有分叉的时候dense为true, 每条指令只多一次rejoin的比较
+ */
+struct Divergence {
+    std::uint64_t all;
+    std::uint64_t active;
+    bool dense = true;
+    int nact = 0;                   //dense的时候不用
+    int act[ZFX_LANES];             //正在执行的lane的下标
+    int nparked = 0;
+    zfx_LaneMask::Parked parked[ZFX_LANES];
+    const Instruction* rejoin = nullptr;    //parked里最小的pc
+
+    explicit Divergence(int n)
+        : all(n >= 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << n) - 1), active(all) {
+    }
 
-            VM_NEXT();
+    void set(std::uint64_t lanes) {
+        active = lanes;
+        dense = lanes == all;
+        if (!dense) {
+            nact = 0;
+            for (; lanes != 0; lanes &= lanes - 1) {
+                act[nact++] = __builtin_ctzll(lanes);
+            }
         }
+    }
 
-        VM_CASE(kAddrSymbol) {
-            Instruction insn = *pc++;
+    //lanes停在pc等着, 已经有lane停在那里的话合在一起
+    void park(const Instruction* pc, std::uint64_t lanes) {
+        int j = nparked;
+        for (int k = 0; k < nparked; k++) {
+            if (parked[k].pc == pc) {
+                parked[k].lanes |= lanes;
+                return;
+            }
+        }
+        while (j > 0 && parked[j - 1].pc < pc) {
+            parked[j] = parked[j - 1];
+            j--;
+        }
+        parked[j] = {pc, lanes};
+        nparked++;
+        rejoin = parked[nparked - 1].pc;
+    }
 
+    //当前这组lane不再执行, 换成停得最靠前的那组, 返回从哪里接着执行
+    const Instruction* resume() {
+        zfx_LaneMask::Parked top = parked[--nparked];
+        rejoin = nparked != 0 ? parked[nparked - 1].pc : nullptr;
+        set(top.lanes);
+        return top.pc;
+    }
+
+    //执行到了rejoin, 停在这里的lane回来一起执行
+    void merge() {
+        std::uint64_t lanes = active | parked[nparked - 1].lanes;
+        nparked--;
+        rejoin = nparked != 0 ? parked[nparked - 1].pc : nullptr;
+        set(lanes);
+    }
+
+    //当前这组lane要跳到target, 前面还有停着的lane的话先去执行它们
+    const Instruction* jump(const Instruction* target) {
+        if (rejoin != nullptr && rejoin < target) {
+            park(target, active);
+            return resume();
         }
+        return target;
+    }
 
-        VM_CASE(kAddrOffest) {
+    void save(zfx_LaneMask* m) const {
+        m->active = dense ? 0 : active;
+        m->nparked = nparked;
+        std::copy(parked, parked + nparked, m->parked);
+    }
 
+    void load(const zfx_LaneMask* m) {
+        nparked = m->nparked;
+        std::copy(m->parked, m->parked + nparked, parked);
+        rejoin = nparked != 0 ? parked[nparked - 1].pc : nullptr;
+        set(m->active != 0 ? m->active : all);
+    }
+};
+
+//对整批写结果的指令(宿主函数, 查表, 矩阵)在分叉的时候用, 不在执行的lane执行完再改回原来的值
+template <class T, class F>
+static void keep_idle(zfx_State* l, T* r, int nregs, std::uint64_t idle, F&& op) {
+    auto* saved = static_cast<T*>(zfx_pushframe(l, sizeof(T) * ZFX_LANES * nregs));
+    std::memcpy(saved, r, sizeof(T) * ZFX_LANES * nregs);
+    op();
+    for (int k = 0; k < nregs; k++) {
+        for (std::uint64_t lanes = idle; lanes != 0; lanes &= lanes - 1) {
+            int i = __builtin_ctzll(lanes);
+            r[k * ZFX_LANES + i] = saved[k * ZFX_LANES + i];
         }
+    }
+    zfx_popframe(l, saved);
+}
+
+//位运算猜一个初值再做两次牛顿迭代, 相对误差不超过5e-6, 没有除法也没有sqrt
+static inline float rsqrt_fast(float x) {
+    float y = fromint<float>(0x5f375a86 - (toint(x) >> 1));
+    y = y * (1.5f - 0.5f * x * y * y);
+    y = y * (1.5f - 0.5f * x * y * y);
+    return y;
+}
 
-        VM_CASE(kLoadPtr) {
+//整数的除法和取模, 除以0得到0, 最小值除以-1回绕成它自己
+template <class Int>
+static inline Int int_div(Int b, Int c) {
+    using UInt = std::make_unsigned_t<Int>;
+    if (c == 0) {
+        return 0;
+    }
+    return c == Int(-1) ? static_cast<Int>(UInt(0) - static_cast<UInt>(b)) : b / c;
+}
+
+template <class Int>
+static inline Int int_mod(Int b, Int c) {
+    return c == 0 || c == Int(-1) ? Int(0) : b % c;
+}
 
+//先判断范围再转换, 超出范围和NaN直接转是未定义行为
+template <class T>
+static inline numint_t<T> float_to_int(T v) {
+    using Int = numint_t<T>;
+    constexpr T lo = static_cast<T>(std::numeric_limits<Int>::min());
+    if (!(v == v)) {
+        return 0;
+    }
+    if (v >= -lo) {
+        return std::numeric_limits<Int>::max();
+    }
+    return v < lo ? std::numeric_limits<Int>::min() : static_cast<Int>(v);
+}
+
+template <class T>
+static inline T smoothstep(T e0, T e1, T x) {
+    T t = (x - e0) / (e1 - e0);
+    t = t < T(0) ? T(0) : (t > T(1) ? T(1) : t);
+    return t * t * (T(3) - T(2) * t);
+}
+
+//float程序读写attrs, double程序读写dattrs
+template <class T>
+static inline std::vector<span<T>>& attrs_of(zfx_State* l) {
+    if constexpr (std::is_same_v<T, double>) {
+        return l->dattrs;
+    } else {
+        return l->attrs;
+    }
+}
+
+template <class T>
+static bool attrs_bound(zfx_State* l, const Proto* p, std::size_t end) {
+    auto const& attrs = attrs_of<T>(l);
+    if (attrs.size() < p->syms.size()) {
+        return false;
+    }
+    for (std::size_t k = 0; k < p->syms.size(); k++) {
+        if (attrs[k].size() < end) {
+            return false;
         }
+    }
+    return true;
+}
 
-        VM_CASE(kStorePtr) {
+bool zfx_checkattrs(zfx_State* l, const Proto* p, std::size_t end) {
+    if (p->number == Zfx_NumberType::kDouble) {
+        return attrs_bound<double>(l, p, end);
+    }
+    return attrs_bound<float>(l, p, end);
+}
+
+//虚拟机解释执行的核心引擎, T是寄存器的数值类型, int按位存成同样宽度的整数
+template <class T>
+static int execute(zfx_State* l, const Proto* p, T* regs, std::size_t first, int n, const Instruction* pc) {
+    using Int = numint_t<T>;
+    using UInt = std::make_unsigned_t<Int>;
+    constexpr Int kShiftMask = sizeof(T) * 8 - 1;
+    const Instruction* end = p->code.data() + p->code.size();
+    //只有恢复挂起的执行才接着用保存的lane掩码, 新的一批和宿主直接调用都从所有lane开始
+    bool resuming = pc != nullptr;
+    if (!resuming) {
+        pc = p->code.data();
+    }
+    const zfx_CFunctionInfo* cfuncs = zfx_cfunctions().data();
+    //在寄存器里计数, 返回的时候才写回状态
+    std::uint64_t executed = 0;
+    VM_STATS_DECL();
+    Divergence dv(n);
+    if (resuming) {
+        dv.load(&l->ci.mask);
+    }
+    //不开分析器的时候每条指令省掉一次volatile写
+    bool prof = zfx_profilerRunning();
 
+    while (pc != end) {
+        if (pc == dv.rejoin) {
+            dv.merge();
         }
+        if (prof) {
+            l->profpc = pc;
+        }
+        Instruction insn = *pc++;
+        executed++;
+        VM_STATS_ENTER();
+        switch (static_cast<OpCode>(ZFX_INSN_OP(insn))) {
+            //常量放在下一个字里, 对所有lane广播
+            VM_CASE(kLoadConstInt) {
+                T k = fromint<T>(bit_cast<std::int32_t>(*pc++));
+                T* ra = RA;
+                VM_LANES(ra[i] = k);
+                VM_NEXT();
+            }
+
+            VM_CASE(kLoadConstFloat) {
+                T k = bit_cast<float>(*pc++);
+                T* ra = RA;
+                VM_LANES(ra[i] = k);
+                VM_NEXT();
+            }
+
+            //从属性数组里读这一批点
+            VM_CASE(kLoadPtr) {
+                T* ra = RA;
+                const T* src = attrs_of<T>(l)[ZFX_INSN_B(insn)].data() + first;
+                VM_LANES(ra[i] = src[i]);
+                VM_NEXT();
+            }
+
+            VM_CASE(kStorePtr) {
+                const T* ra = RA;
+                T* dst = attrs_of<T>(l)[ZFX_INSN_B(insn)].data() + first;
+                VM_LANES(dst[i] = ra[i]);
+                VM_NEXT();
+            }
+
+            VM_CASE(kAssign) {
+                T* ra = RA; const T* rb = RB;
+                VM_LANES(ra[i] = rb[i]);
+                VM_NEXT();
+            }
+
+            VM_CASE(kNegate) {
+                T* ra = RA; const T* rb = RB;
+                VM_LANES(ra[i] = -rb[i]);
+                VM_NEXT();
+            }
+
+            VM_CASE(kPlus) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = rb[i] + rc[i]);
+                VM_NEXT();
+            }
+
+            VM_CASE(kMinus) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = rb[i] - rc[i]);
+                VM_NEXT();
+            }
+
+            VM_CASE(kMultiply) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = rb[i] * rc[i]);
+                VM_NEXT();
+            }
+
+            VM_CASE(kDivide) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = rb[i] / rc[i]);
+                VM_NEXT();
+            }
+
+            VM_CASE(kModulus) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = std::fmod(rb[i], rc[i]));
+                VM_NEXT();
+            }
+
+            //位运算按int处理
+            VM_CASE(kBitInverse) {
+                T* ra = RA; const T* rb = RB;
+                VM_LANES(ra[i] = fromint<T>(~toint(rb[i])));
+                VM_NEXT();
+            }
+
+            VM_CASE(kBitAnd) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = fromint<T>(toint(rb[i]) & toint(rc[i])));
+                VM_NEXT();
+            }
+
+            VM_CASE(kBitOr) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = fromint<T>(toint(rb[i]) | toint(rc[i])));
+                VM_NEXT();
+            }
+
+            VM_CASE(kBitXor) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = fromint<T>(toint(rb[i]) ^ toint(rc[i])));
+                VM_NEXT();
+            }
+
+            VM_CASE(kBitShl) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = fromint<T>(toint(rb[i]) << (toint(rc[i]) & kShiftMask)));
+                VM_NEXT();
+            }
+
+            VM_CASE(kBitShr) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = fromint<T>(toint(rb[i]) >> (toint(rc[i]) & kShiftMask)));
+                VM_NEXT();
+            }
+
+            //逻辑运算和比较的结果是1.0或者0.0, 比较按浮点数比, int要用kIntCmpXXX
+            VM_CASE(kLogicNot) {
+                T* ra = RA; const T* rb = RB;
+                VM_LANES(ra[i] = truth<T>(rb[i] == 0.0f));
+                VM_NEXT();
+            }
+
+            VM_CASE(kLogicAnd) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = truth<T>(rb[i] != 0.0f && rc[i] != 0.0f));
+                VM_NEXT();
+            }
+
+            VM_CASE(kLogicOr) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = truth<T>(rb[i] != 0.0f || rc[i] != 0.0f));
+                VM_NEXT();
+            }
+
+            VM_CASE(kCmpEqual) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = truth<T>(rb[i] == rc[i]));
+                VM_NEXT();
+            }
 
-        VM_CASE(Assign) {
+            VM_CASE(kCmpNotEqual) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = truth<T>(rb[i] != rc[i]));
+                VM_NEXT();
+            }
 
+            VM_CASE(kCmpLessThan) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = truth<T>(rb[i] < rc[i]));
+                VM_NEXT();
+            }
+
+            VM_CASE(kCmpLessEqual) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = truth<T>(rb[i] <= rc[i]));
+                VM_NEXT();
+            }
+
+            VM_CASE(kCmpGreaterThan) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = truth<T>(rb[i] > rc[i]));
+                VM_NEXT();
+            }
+
+            VM_CASE(kCmpGreaterEqual) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = truth<T>(rb[i] >= rc[i]));
+                VM_NEXT();
+            }
+
+            //宿主函数的包装是zfx_register生成的, 自己从寄存器里取参数, 按批注册的函数在这里一批只调用一次
+            //分叉的时候按lane调用的函数只对正在执行的lane调用, 按批的函数整批调用, 不在执行的lane的结果丢掉
+            VM_CASE(kFastCall) {
+                VM_CHECKCANCEL();
+                const zfx_CFunctionInfo& f = cfuncs[ZFX_INSN_B(insn)];
+                auto fn = f.template get<T>();
+                if (dv.dense) {
+                    fn(l, regs, ZFX_INSN_A(insn), ZFX_INSN_C(insn), n);
+                } else if (!f.batched) {
+                    //寄存器按lane挪过去, 包装函数看到的第0个lane就是第i个
+                    for (int k = 0; k < dv.nact; k++) {
+                        fn(l, regs + dv.act[k], ZFX_INSN_A(insn), ZFX_INSN_C(insn), 1);
+                    }
+                } else {
+                    keep_idle(l, RA, f.nrets, dv.all & ~dv.active, [&] {
+                        fn(l, regs, ZFX_INSN_A(insn), ZFX_INSN_C(insn), n);
+                    });
+                }
+                VM_NEXT();
+            }
+
+            //还有lane停在后面的话只是这组lane结束了
+            VM_CASE(kReturn) {
+                if (dv.nparked != 0) {
+                    pc = dv.resume();
+                    VM_NEXT();
+                }
+                l->ninsns += executed;
+                return static_cast<int>(ZFX_INSN_A(insn));
+            }
+
+            VM_CASE(kJump) {
+                int off = ZFX_INSN_sBx(insn);
+                if (off < 0) {
+                    VM_CHECKCANCEL();
+                }
+                pc = dv.jump(pc + off);
+                VM_NEXT();
+            }
+
+            //条件是0的lane跳转, 其余的接着往下执行, 两边都有lane的时候分叉
+            VM_CASE(kJumpIfNot) {
+                const T* ra = RA;
+                int off = ZFX_INSN_sBx(insn);
+                int ntrue = 0;
+                VM_LANES(ntrue += ra[i] != 0.0f);
+                if (ntrue == (dv.dense ? n : dv.nact) || off == 0) {
+                    VM_NEXT();
+                }
+                if (off < 0) {
+                    VM_CHECKCANCEL();
+                }
+                if (ntrue == 0) {
+                    pc = dv.jump(pc + off);
+                    VM_NEXT();
+                }
+                std::uint64_t taken = 0;
+                VM_LANES(taken |= static_cast<std::uint64_t>(ra[i] == 0.0f) << i);
+                if (off > 0) {
+                    dv.park(pc + off, taken);
+                    dv.set(dv.active & ~taken);
+                } else {
+                    //往回跳的那组pc更小, 先执行它们
+                    dv.park(pc, dv.active & ~taken);
+                    dv.set(taken);
+                    pc += off;
+                }
+                VM_NEXT();
+            }
+
+            //向量指令, 扩展字给出分量数和第四个操作数
+            VM_CASE(kDot) {
+                Instruction ext = *pc++;
+                T acc[ZFX_LANES];
+                dot_lanes(acc, RB, RC, ZFX_EXT_W(ext), n);
+                T* ra = RA;
+                VM_LANES(ra[i] = acc[i]);
+                VM_NEXT();
+            }
+
+            VM_CASE(kCross) {
+                pc++;
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(
+                    T bx = rb[i]; T by = comp(rb, 1)[i]; T bz = comp(rb, 2)[i];
+                    T cx = rc[i]; T cy = comp(rc, 1)[i]; T cz = comp(rc, 2)[i];
+                    ra[i] = by * cz - bz * cy;
+                    comp(ra, 1)[i] = bz * cx - bx * cz;
+                    comp(ra, 2)[i] = bx * cy - by * cx);
+                VM_NEXT();
+            }
+
+            VM_CASE(kLength) {
+                Instruction ext = *pc++;
+                T acc[ZFX_LANES];
+                dot_lanes(acc, RB, RB, ZFX_EXT_W(ext), n);
+                T* ra = RA;
+                VM_LANES(ra[i] = std::sqrt(acc[i]));
+                VM_NEXT();
+            }
+
+            VM_CASE(kDistance) {
+                Instruction ext = *pc++;
+                T acc[ZFX_LANES];
+                distsq_lanes(acc, RB, RC, ZFX_EXT_W(ext), n);
+                T* ra = RA;
+                VM_LANES(ra[i] = std::sqrt(acc[i]));
+                VM_NEXT();
+            }
+
+            VM_CASE(kNormalize) {
+                Instruction ext = *pc++;
+                int w = ZFX_EXT_W(ext);
+                T* ra = RA; const T* rb = RB;
+                T inv[ZFX_LANES];
+                dot_lanes(inv, rb, rb, w, n);
+                if (std::is_same_v<T, float> && (ZFX_EXT_F(ext) & ZFX_VEC_FAST)) {
+                    //长度为0的时候rsqrt_fast给出的是一个很大的有限数, 乘出来还是0
+                    VM_LANES(inv[i] = rsqrt_fast(static_cast<float>(inv[i])));
+                } else {
+                    VM_LANES(inv[i] = inv[i] > T(0) ? T(1) / std::sqrt(inv[i]) : T(0));
+                }
+                for (int k = 0; k < w; k++) {
+                    T* a = comp(ra, k); const T* b = comp(rb, k);
+                    VM_LANES(a[i] = b[i] * inv[i]);
+                }
+                VM_NEXT();
+            }
+
+            VM_CASE(kLerp) {
+                Instruction ext = *pc++;
+                int w = static_cast<int>(ZFX_EXT_W(ext));
+                bool scalar = ZFX_EXT_F(ext) & ZFX_VEC_SCALAR;
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                const T* rd = regs + ZFX_EXT_D(ext) * ZFX_LANES;
+                for (int k = 0; k < w; k++) {
+                    T* a = comp(ra, k); const T* b = comp(rb, k); const T* c = comp(rc, k);
+                    const T* t = scalar ? rd : comp(rd, k);
+                    VM_LANES(a[i] = b[i] + (c[i] - b[i]) * t[i]);
+                }
+                VM_NEXT();
+            }
+
+            VM_CASE(kClamp) {
+                Instruction ext = *pc++;
+                int w = static_cast<int>(ZFX_EXT_W(ext));
+                bool scalar = ZFX_EXT_F(ext) & ZFX_VEC_SCALAR;
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                const T* rd = regs + ZFX_EXT_D(ext) * ZFX_LANES;
+                for (int k = 0; k < w; k++) {
+                    T* a = comp(ra, k); const T* b = comp(rb, k);
+                    const T* lo = scalar ? rc : comp(rc, k);
+                    const T* hi = scalar ? rd : comp(rd, k);
+                    VM_LANES(T v = b[i] < lo[i] ? lo[i] : b[i]; a[i] = v > hi[i] ? hi[i] : v);
+                }
+                VM_NEXT();
+            }
+
+            VM_CASE(kSmoothstep) {
+                Instruction ext = *pc++;
+                int w = static_cast<int>(ZFX_EXT_W(ext));
+                bool scalar = ZFX_EXT_F(ext) & ZFX_VEC_SCALAR;
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                const T* rd = regs + ZFX_EXT_D(ext) * ZFX_LANES;
+                for (int k = 0; k < w; k++) {
+                    T* a = comp(ra, k); const T* x = comp(rd, k);
+                    const T* e0 = scalar ? rb : comp(rb, k);
+                    const T* e1 = scalar ? rc : comp(rc, k);
+                    VM_LANES(a[i] = smoothstep(e0[i], e1[i], x[i]));
+                }
+                VM_NEXT();
+            }
+
+            VM_CASE(kReflect) {
+                Instruction ext = *pc++;
+                int w = ZFX_EXT_W(ext);
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                T d[ZFX_LANES];
+                dot_lanes(d, rc, rb, w, n);
+                for (int k = 0; k < w; k++) {
+                    T* a = comp(ra, k); const T* b = comp(rb, k); const T* c = comp(rc, k);
+                    VM_LANES(a[i] = b[i] - 2.0f * d[i] * c[i]);
+                }
+                VM_NEXT();
+            }
+
+            VM_CASE(kMin) {
+                Instruction ext = *pc++;
+                int w = static_cast<int>(ZFX_EXT_W(ext));
+                bool scalar = ZFX_EXT_F(ext) & ZFX_VEC_SCALAR;
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                for (int k = 0; k < w; k++) {
+                    T* a = comp(ra, k); const T* b = comp(rb, k);
+                    const T* c = scalar ? rc : comp(rc, k);
+                    VM_LANES(a[i] = c[i] < b[i] ? c[i] : b[i]);
+                }
+                VM_NEXT();
+            }
+
+            VM_CASE(kMax) {
+                Instruction ext = *pc++;
+                int w = static_cast<int>(ZFX_EXT_W(ext));
+                bool scalar = ZFX_EXT_F(ext) & ZFX_VEC_SCALAR;
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                for (int k = 0; k < w; k++) {
+                    T* a = comp(ra, k); const T* b = comp(rb, k);
+                    const T* c = scalar ? rc : comp(rc, k);
+                    VM_LANES(a[i] = c[i] > b[i] ? c[i] : b[i]);
+                }
+                VM_NEXT();
+            }
+
+            VM_CASE(kLoadConstDouble) {
+                std::uint64_t bits = pc[0] | static_cast<std::uint64_t>(pc[1]) << 32;
+                pc += 2;
+                auto k = static_cast<T>(bit_cast<double>(bits));
+                T* ra = RA;
+                VM_LANES(ra[i] = k);
+                VM_NEXT();
+            }
+
+            //表没有绑定, 或者通道和坐标超出了寄存器帧, 都是运行时错误
+            VM_CASE(kSample) {
+                Instruction ext = *pc++;
+                std::size_t idx = ZFX_INSN_B(insn);
+                if (idx >= l->tables.size() || l->tables[idx].data.empty()) {
+                    zfx_throw(l, ZFX_ERRRUN);
+                }
+                if (ZFX_INSN_A(insn) + static_cast<std::uint32_t>(l->tables[idx].channels) > p->nregs ||
+                    ZFX_INSN_C(insn) + static_cast<std::uint32_t>(l->tables[idx].dims) > p->nregs) {
+                    zfx_throw(l, ZFX_ERRRUN);
+                }
+                if (dv.dense) {
+                    zfx_sample(l->tables[idx], RA, RC, n, ZFX_EXT_F(ext));
+                } else {
+                    keep_idle(l, RA, l->tables[idx].channels, dv.all & ~dv.active, [&] {
+                        zfx_sample(l->tables[idx], RA, RC, n, ZFX_EXT_F(ext));
+                    });
+                }
+                VM_NEXT();
+            }
+
+            VM_CASE(kMatMul)
+            VM_CASE(kTranspose)
+            VM_CASE(kInverse)
+            VM_CASE(kDeterminant)
+            VM_CASE(kTransformPoint)
+            VM_CASE(kTransformVector)
+            VM_CASE(kTransformNormal)
+            VM_CASE(kQuatMul)
+            VM_CASE(kQuatRotate)
+            VM_CASE(kQuatToMat) {
+                Instruction ext = *pc++;
+                auto op = static_cast<OpCode>(ZFX_INSN_OP(insn));
+                bool ok = true;
+                if (dv.dense) {
+                    ok = zfx_matrix(op, RA, RB, RC, ZFX_EXT_W(ext), n);
+                } else {
+                    zfx_InsnInfo d = zfx_decode(p, static_cast<std::size_t>(pc - 2 - p->code.data()));
+                    keep_idle(l, RA, d.def.n, dv.all & ~dv.active, [&] {
+                        ok = zfx_matrix(op, RA, RB, RC, ZFX_EXT_W(ext), n);
+                    });
+                }
+                if (!ok) {
+                    zfx_throw(l, ZFX_ERRRUN);
+                }
+                VM_NEXT();
+            }
+
+            //整数的加减乘按无符号算, 溢出回绕而不是未定义行为
+            VM_CASE(kIntNegate) {
+                T* ra = RA; const T* rb = RB;
+                VM_LANES(ra[i] = fromint<T>(static_cast<Int>(UInt(0) - static_cast<UInt>(toint(rb[i])))));
+                VM_NEXT();
+            }
+
+            VM_CASE(kIntPlus) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = fromint<T>(static_cast<Int>(static_cast<UInt>(toint(rb[i])) +
+                                                             static_cast<UInt>(toint(rc[i])))));
+                VM_NEXT();
+            }
+
+            VM_CASE(kIntMinus) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = fromint<T>(static_cast<Int>(static_cast<UInt>(toint(rb[i])) -
+                                                             static_cast<UInt>(toint(rc[i])))));
+                VM_NEXT();
+            }
+
+            VM_CASE(kIntMultiply) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = fromint<T>(static_cast<Int>(static_cast<UInt>(toint(rb[i])) *
+                                                             static_cast<UInt>(toint(rc[i])))));
+                VM_NEXT();
+            }
+
+            VM_CASE(kIntDivide) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = fromint<T>(int_div(toint(rb[i]), toint(rc[i]))));
+                VM_NEXT();
+            }
+
+            VM_CASE(kIntModulus) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = fromint<T>(int_mod(toint(rb[i]), toint(rc[i]))));
+                VM_NEXT();
+            }
+
+            VM_CASE(kIntCmpEqual) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = truth<T>(toint(rb[i]) == toint(rc[i])));
+                VM_NEXT();
+            }
+
+            VM_CASE(kIntCmpNotEqual) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = truth<T>(toint(rb[i]) != toint(rc[i])));
+                VM_NEXT();
+            }
+
+            VM_CASE(kIntCmpLessThan) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = truth<T>(toint(rb[i]) < toint(rc[i])));
+                VM_NEXT();
+            }
+
+            VM_CASE(kIntCmpLessEqual) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = truth<T>(toint(rb[i]) <= toint(rc[i])));
+                VM_NEXT();
+            }
+
+            VM_CASE(kIntCmpGreaterThan) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = truth<T>(toint(rb[i]) > toint(rc[i])));
+                VM_NEXT();
+            }
+
+            VM_CASE(kIntCmpGreaterEqual) {
+                T* ra = RA; const T* rb = RB; const T* rc = RC;
+                VM_LANES(ra[i] = truth<T>(toint(rb[i]) >= toint(rc[i])));
+                VM_NEXT();
+            }
+
+            VM_CASE(kIntToFloat) {
+                T* ra = RA; const T* rb = RB;
+                VM_LANES(ra[i] = static_cast<T>(toint(rb[i])));
+                VM_NEXT();
+            }
+
+            VM_CASE(kFloatToInt) {
+                T* ra = RA; const T* rb = RB;
+                VM_LANES(ra[i] = fromint<T>(float_to_int(rb[i])));
+                VM_NEXT();
+            }
+
+            //kAddrSymbol kAddrOffset还没有生成它们的地方
+            default:
+                zfx_throw(l, ZFX_ERRRUN);
         }
+        VM_STATS_LEAVE();
+    }
+    l->ninsns += executed;
+    return ZFX_EXEC_END;
+}
 
-        VM_CASE(kPlus) {
+int zfx_execute(zfx_State* l, const Proto* p, void* regs, std::size_t first, int n, const Instruction* pc) {
+    if (p->number == Zfx_NumberType::kDouble) {
+        return execute(l, p, static_cast<double*>(regs), first, n, pc);
+    }
+    return execute(l, p, static_cast<float*>(regs), first, n, pc);
+}
 
+//按l->ci一批一批往下执行, 挂起的时候寄存器帧留在栈上
+static void run_protected(zfx_State* l, void* ud) {
+    auto* status = static_cast<int*>(ud);
+    zfx_CallInfo& ci = l->ci;
+    int batches = 0;
+    while (ci.first < ci.end) {
+        std::size_t rest = ci.end - ci.first;
+        int n = rest < ZFX_LANES ? static_cast<int>(rest) : ZFX_LANES;
+        const Instruction* pc = ci.savedpc;
+        ci.savedpc = nullptr;
+        if (zfx_execute(l, ci.p, ci.regs, ci.first, n, pc) == ZFX_EXEC_YIELD) {
+            *status = ZFX_YIELD;
+            return;
+        }
+        //这一批执行完了, 挂起时保存的掩码不能留给下一批
+        ci.mask.active = 0;
+        ci.mask.nparked = 0;
+        ci.first += ZFX_LANES;
+        //直线代码没有回边和调用, 在批之间检查取消和时间片, 挂起的时候savedpc是空的, 恢复时从下一批开始
+        if (++batches == ZFX_BATCHCHECK) {
+            batches = 0;
+            if (zfx_checkcancel(l) && ci.first < ci.end) {
+                *status = ZFX_YIELD;
+                return;
+            }
         }
+    }
+    zfx_popregs(l, ci.regs);
+    ci = zfx_CallInfo{};
+}
+
+static int continue_run(zfx_State* l) {
+    std::size_t first = l->ci.first;
+    std::size_t end = l->ci.end;
+    if (l->perf) {
+        zfx_perfbegin(l);
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    int status = ZFX_OK;
+    int err = zfx_rawrunprotected(l, run_protected, &status);
+    l->profpc = nullptr;
+    //挂起的话只算已经跑完的批, 出错的话不算点数
+    std::size_t done = err != ZFX_OK ? 0 : status == ZFX_YIELD ? l->ci.first - first : end - first;
+    if (l->perf) {
+        zfx_perfend(l, done);
+    }
+    zfx_metricCount(Zfx_Metric::kRunNanos, static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count()));
+    zfx_metricCount(Zfx_Metric::kRuns);
+    zfx_metricCount(Zfx_Metric::kPoints, done);
+    zfx_metricCount(Zfx_Metric::kBatches, (done + ZFX_LANES - 1) / ZFX_LANES);
+    zfx_metricCount(Zfx_Metric::kInstructions, l->ninsns);
+    l->ninsns = 0;
+    if (err == ZFX_CANCELLED) {
+        zfx_metricCount(Zfx_Metric::kCancels);
+    } else if (err != ZFX_OK) {
+        zfx_metricCount(Zfx_Metric::kErrors);
+    } else if (status == ZFX_YIELD) {
+        zfx_metricCount(Zfx_Metric::kYields);
+    }
+    if (err != ZFX_OK) {
+        //栈顶回到了执行之前, 寄存器帧是在那之前开的, 还要弹掉
+        zfx_popregs(l, l->ci.regs);
+        l->ci = zfx_CallInfo{};
+        status = err;
+    }
+    l->status = static_cast<std::uint8_t>(status);
+    return status;
+}
 
-        VM_CASE(kMinus) {
-            
+int zfx_runrange(zfx_State* l, const Proto* p, std::size_t begin, std::size_t end) {
+    //kLoadPtr和kStorePtr不检查下标和长度, 在这里一次查完
+    if (!zfx_checkattrs(l, p, end)) {
+        return ZFX_ERRRUN;
+    }
+    if (l->ci.p != nullptr) {
+        //宿主函数里对同一个状态再执行, 会覆盖外面正在用的ci
+        if (l->status != ZFX_YIELD) {
+            return ZFX_ERRRUN;
         }
-        //接下来还有一些
+        //挂起的执行不再恢复, 它的寄存器帧还在栈上
+        zfx_popregs(l, l->ci.regs);
+        l->ci = zfx_CallInfo{};
+        l->status = ZFX_OK;
+    }
+    bool dbl = p->number == Zfx_NumberType::kDouble;
+    void* regs = dbl ? static_cast<void*>(zfx_pushregs<double>(l, p->nregs))
+                     : static_cast<void*>(zfx_pushregs<float>(l, p->nregs));
+    //分叉的时候不执行的lane保留原来的值, 可能会当参数传给宿主函数, 不能是栈上的垃圾
+    std::memset(regs, 0, dbl ? zfx_framesize<double>(p->nregs) : zfx_framesize<float>(p->nregs));
+    l->ci = zfx_CallInfo{p, nullptr, regs, begin, end, zfx_LaneMask{}};
+    return continue_run(l);
+}
+
+int zfx_run(zfx_State* l, const Proto* p, std::size_t npoints) {
+    zfx_TraceSpan span("run", "points", static_cast<std::int64_t>(npoints));
+    return zfx_runrange(l, p, 0, npoints);
+}
+
+int zfx_runmain(zfx_State* l, std::size_t npoints) {
+    if (l->module == nullptr) {
+        return ZFX_ERRRUN;
+    }
+    return zfx_run(l, &l->module->main(), npoints);
+}
+
+int zfx_start(zfx_State* l, const Proto* p, std::size_t npoints, std::chrono::nanoseconds slice) {
+    zfx_TraceSpan span("start", "points", static_cast<std::int64_t>(npoints));
+    l->yieldAt = std::chrono::steady_clock::now() + slice;
+    int status = zfx_runrange(l, p, 0, npoints);
+    l->yieldAt = std::chrono::steady_clock::time_point::max();
+    return status;
+}
+
+int zfx_resume(zfx_State* l, std::chrono::nanoseconds slice) {
+    if (l->status != ZFX_YIELD) {
+        return ZFX_ERRRUN;
+    }
+    zfx_TraceSpan span("resume");
+    l->yieldAt = std::chrono::steady_clock::now() + slice;
+    int status = continue_run(l);
+    l->yieldAt = std::chrono::steady_clock::time_point::max();
+    return status;
+}
+
+struct CallArgs {
+    const Proto* p;
+    void* regs;
+    int ret;
+};
+
+static void call_protected(zfx_State* l, void* ud) {
+    auto* args = static_cast<CallArgs*>(ud);
+    args->ret = zfx_execute(l, args->p, args->regs, 0, 1);
+}
+
+int zfx_callproto(zfx_State* l, const Proto* p, void* regs, int* retreg) {
+    if (!zfx_checkattrs(l, p, 1)) {
+        *retreg = -1;
+        return ZFX_ERRRUN;
     }
-}
\ No newline at end of file
+    CallArgs args{p, regs, -1};
+    //宿主直接调用的函数不能挂起
+    auto yieldAt = l->yieldAt;
+    l->yieldAt = std::chrono::steady_clock::time_point::max();
+    //宿主函数里再调用zfx函数时, 返回后采样还要算在外面那条调用指令上
+    const Instruction* profpc = l->profpc;
+    int status = zfx_rawrunprotected(l, call_protected, &args);
+    l->profpc = profpc;
+    zfx_metricCount(Zfx_Metric::kCalls);
+    zfx_metricCount(Zfx_Metric::kInstructions, l->ninsns);
+    l->ninsns = 0;
+    l->yieldAt = yieldAt;
+    *retreg = args.ret;
+    return status;
+}
@@ -4,3 +4,47 @@
 
 #pragma once
 
+#include "zstate.h"
+#include "../bc.h"
+
+#include <chrono>
+
+using Instruction = std::uint32_t;
+using zeno::zfx::Proto;
+using zeno::zfx::OpCode;
+
+//zfx_execute除了返回值寄存器以外的返回值
+#define ZFX_EXEC_END    (-1)
+#define ZFX_EXEC_YIELD  (-2)
+
+//解释执行一批点, first是这一批第一个点的下标, n是有效的lane数, regs是这一帧的寄存器
+//寄存器是float还是double由p->number决定, float和double两份实现都编译在里面
+//pc不为空就从pc开始执行, 用来恢复挂起的执行
+//返回kReturn给出的返回值寄存器, 执行完返回ZFX_EXEC_END, 在安全点挂起返回ZFX_EXEC_YIELD
+int zfx_execute(zfx_State* l, const Proto* p, void* regs, std::size_t first, int n,
+                const Instruction* pc = nullptr);
+
+//p声明的属性是不是都绑定了, 而且至少有end个点, 执行的时候读写属性不再检查
+bool zfx_checkattrs(zfx_State* l, const Proto* p, std::size_t end);
+
+//保护模式下只用第一个lane执行一次p, 参数已经放好在regs里, 返回值寄存器写到retreg
+int zfx_callproto(zfx_State* l, const Proto* p, void* regs, int* retreg);
+
+//保护模式下对npoints个点运行整个程序, 返回ZFX_OK或者错误码
+int zfx_run(zfx_State* l, const Proto* p, std::size_t npoints);
+
+//只运行[begin, end)这一段点, 并行执行时每个工作线程领一段
+//状态上有挂起的执行的话先丢掉它, 在这个状态正在执行的宿主函数里调用返回ZFX_ERRRUN
+//p->syms里有属性没有绑定, 或者绑定的数组不到end个点, 也返回ZFX_ERRRUN, 什么都不执行
+int zfx_runrange(zfx_State* l, const Proto* p, std::size_t begin, std::size_t end);
+
+//执行状态绑定的module的顶层代码
+int zfx_runmain(zfx_State* l, std::size_t npoints);
+
+/*
+ * 像lua的协程那样分时间片执行, 最多执行slice这么久就在下一个安全点(循环回边, 函数调用, 或者每ZFX_BATCHCHECK批之间)挂起, 返回ZFX_YIELD
+ * 之后用zfx_resume从挂起的地方接着执行, 全部执行完返回ZFX_OK
+ * */
+int zfx_start(zfx_State* l, const Proto* p, std::size_t npoints, std::chrono::nanoseconds slice);
+
+int zfx_resume(zfx_State* l, std::chrono::nanoseconds slice);
@@ -7,11 +7,26 @@
 #include <functional>
 
 //如果zfx可以调用cpp写的函数，那么需要做一个转换才能注册到zfx的虚拟机中去
-//using Zfx_CFunction = std::function<int()>
+//不用std::function, 用zfx_register<&fn>("name")在编译期生成包装函数, 见ZFXFunction.h
 //zfx虚拟机的一些参数
 //索引如果为-1的化
 #define ZFX_REGISTRYINDEX (-1000)
 
+//虚拟机的运行状态,和lua的LUA_OK LUA_ERRRUN一个意思
+#define ZFX_OK          0
+#define ZFX_YIELD       1
+#define ZFX_ERRRUN      2
+#define ZFX_ERRSYNTAX   3
+#define ZFX_ERRMEM      4
+#define ZFX_ERRSTACK    5
+#define ZFX_CANCELLED   6
+
+//C++调用zfx时保证栈上至少有这么多空位
+#define ZFX_MINSTACK    20
+
+//虚拟机一次同时执行多少个点, 每个寄存器就是这么多个lane
+#define ZFX_LANES       64
+
 enum class Zfx_Type {
 
 };
@@ -19,45 +34,93 @@ enum class Zfx_Type {
 using Zfx_Number = double;
 using Zfx_Integer = int;
 
+struct Zfx_Vec3 {
+    float x, y, z;
+};
+
+//四元数, w是实部, 和寄存器里的顺序一样
+struct Zfx_Quat {
+    float x, y, z, w;
+};
+
+//矩阵按列存, m[c * N + r]是第r行第c列, 在寄存器里也是一列一列挨着放
+struct Zfx_Mat3 {
+    float m[9];
+};
+
+struct Zfx_Mat4 {
+    float m[16];
+};
+
+//内置数学函数的精度档位
+enum class Zfx_MathPrecision : uint8_t {
+    kPrecise,   //误差不超过1ULP
+    kFast,      //误差不超过4ULP
+};
+
+//寄存器和属性用的数值类型, 每个程序编译的时候选一个
+enum class Zfx_NumberType : uint8_t {
+    kFloat,     //float32, 一个SIMD寄存器能放两倍的lane, 带宽减半, 适合粒子
+    kDouble,    //float64, 适合大场景的地形坐标
+};
+
+//宿主函数和zfx函数的参数/返回值类型
+enum class Zfx_ArgKind : uint8_t {
+    kVoid,
+    kFloat,
+    kInt,
+    kVec3,
+    kSpan,
+    kQuat,
+    kMat3,
+    kMat4,
+};
+
+struct zfx_State;
 
 //接下来两个函数一共是创建zfx的虚拟机栈，另一个是销毁虚拟机栈
+extern zfx_State* zfx_newstate();
+
+extern void zfx_close(zfx_State* l);
 
 //接下来是关于虚拟机栈的操作
 
-extern int zfx_absIndex();
+extern int zfx_absIndex(zfx_State* l, int idx);
 
 //返回栈中元素的个数,也就是返回栈顶元素的索引
-extern int zfx_getTop();
+extern int zfx_getTop(zfx_State* l);
 
 //设置栈顶的位置，高了的话用nil补足
-extern void zfx_setTop();
+extern void zfx_setTop(zfx_State* l, int idx);
 
 //将指定索引值压入栈中
-extern void zfx_pushValue();
+extern void zfx_pushValue(zfx_State* l, int idx);
 
 //移除掉指定索引上的值
-extern void zfx_remove();
+extern void zfx_remove(zfx_State* l, int idx);
 
 //将栈顶的值插入到指定索引位置处
-extern void zfx_insert();
+extern void zfx_insert(zfx_State* l, int idx);
 
 //弹出栈顶的值，并将该值设置到指定索引位置处
-extern void zfx_replace();
+extern void zfx_replace(zfx_State* l, int idx);
 
-//用来检查栈中是否有足够空间
-extern void zfx_checkStack();
+//用来检查栈中是否有足够空间, 有guard page的平台上永远返回1
+extern int zfx_checkStack(zfx_State* l, int n);
 
 //留给Cpp语言调用zfx的接口
-extern void zfx_pushNil();
+extern void zfx_pushNil(zfx_State* l);
 
 //注意number是浮点数float
-extern void zfx_pushNumber();
+extern void zfx_pushNumber(zfx_State* l, float n);
+
+extern void zfx_pushInteger(zfx_State* l, int n);
 
-extern void zfx_pushInteger();
+extern void zfx_pushVector(zfx_State* l, float x, float y, float z);
 
 //zfx函数的调用操作接口
 
 
 //加载和运行zfx函数
 
-extern void zfx_call();
\ No newline at end of file
+extern void zfx_call();
@@ -5,11 +5,15 @@
 #include <cstdint>
 #include "span.h"
 #include <string_view>
+#include "ZFX.h"
 
 namespace zeno::zfx {
 
 struct zfx_CompileOptions {
-
+    //sin, exp这些内置函数用哪一档, kFast的时候调用的是sin_fast
+    Zfx_MathPrecision mathPrecision = Zfx_MathPrecision::kPrecise;
+    //写到Proto::number里, 虚拟机按它选float或者double的实现
+    Zfx_NumberType numberType = Zfx_NumberType::kFloat;
 };
 
 std::string zfx_compile(std::string_view source, size_t size, zfx_CompileOptions& options) {
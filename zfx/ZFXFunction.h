@@ -0,0 +1,526 @@
+//
+// Created by admin on 2022/9/5.
+//
+/*
+ * 把C++函数注册到zfx虚拟机里, 通过kFastCall调用
+ * zfx_register<&myNoise>("noise") 在编译期推导出函数签名, 生成一个包装函数,
+ * 直接从寄存器的lane里按类型取参数, 结果写回寄存器, 不经过std::function, 不装箱, 也不碰值栈
+ * 支持的参数类型: float, int, Zfx_Vec3(占三个寄存器), Zfx_Quat(四个), Zfx_Mat3(九个), Zfx_Mat4(十六个),
+ * span<float const>(寄存器里放的是zfx_State::resources的编号)
+ *
+ * 宿主函数自己已经做了SIMD的话, 用zfx_registerBatch<&fn>("name")注册成按批调用的形式,
+ * fn的签名是void(span<float> out..., span<float const> in...), 每一批点只调用一次, 每个span就是一个寄存器的有效lane
+ * 输入也可以是span<int const>, 和int参数一样按值取出来, float和double程序里看到的是同一个数
+ *
+ * 每个宿主函数都有float和double两个包装, 按程序的Zfx_NumberType选
+ * 按批调用的函数在double程序里默认先转成float再调用, 也可以用zfx_registerBatch<&f, &fd>再给一个span<double>的版本
+ * */
+#pragma once
+
+#include "ZFX.h"
+#include "span.h"
+#include "enumtools.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+struct zfx_State;
+
+//A:结果寄存器 C:第一个参数寄存器 n:这一批有多少个lane是有效的
+template <class T>
+using zfx_CFunctionT = void (*)(zfx_State* l, T* regs, std::uint32_t a, std::uint32_t c, int n);
+using zfx_CFunction = zfx_CFunctionT<float>;
+using zfx_CFunctionD = zfx_CFunctionT<double>;
+
+struct zfx_CFunctionInfo {
+    std::string name;
+    zfx_CFunction fn;
+    Zfx_ArgKind ret;
+    std::vector<Zfx_ArgKind> args;
+    bool batched = false;   //每一批只调用一次, 参数是整批的lane
+    int nrets = 1;          //按批调用时输出几个寄存器, 从A开始
+    zfx_CFunctionD fnd = nullptr;   //double程序用的包装
+
+    template <class T>
+    zfx_CFunctionT<T> get() const {
+        if constexpr (std::is_same_v<T, double>) {
+            return fnd;
+        } else {
+            return fn;
+        }
+    }
+};
+
+/*
+ * 宿主函数表, kFastCall的B操作数就是这里的下标
+ * B操作数只有8位, 一开始就预留256项, 追加的时候已有的项不会移动, 正在执行的状态拿着的data()一直有效
+ * 注册之间用zfx_cfunctionLock互斥, 注册好的个数在zfx_cfunctionCount里, 那一项构造好之后才发布
+ * 所以在别的线程执行的时候也可以注册新的函数, 只是替换已有的函数不能和用到它的执行同时进行
+ * */
+inline std::vector<zfx_CFunctionInfo>& zfx_cfunctions() {
+    static std::vector<zfx_CFunctionInfo> table = [] {
+        std::vector<zfx_CFunctionInfo> t;
+        t.reserve(256);
+        return t;
+    }();
+    return table;
+}
+
+inline std::mutex& zfx_cfunctionLock() {
+    static std::mutex lock;
+    return lock;
+}
+
+namespace zfx_details {
+
+inline std::atomic<std::size_t>& cfunctionCount() {
+    static std::atomic<std::size_t> count{0};
+    return count;
+}
+
+}
+
+//已经注册好的函数个数, 检查编号用这个, 不要用zfx_cfunctions().size()
+inline std::size_t zfx_cfunctionCount() {
+    return zfx_details::cfunctionCount().load(std::memory_order_acquire);
+}
+
+//span参数要从zfx_State里取, 定义在zstate.cpp, 编号不是登记过的资源就抛ZFX_ERRRUN
+span<float const> zfx_getresource(zfx_State* l, int idx);
+
+namespace zfx_details {
+
+//int在寄存器里是按位存的, double的寄存器里存的是int64
+template <class N>
+struct numtraits;
+
+template <>
+struct numtraits<float> {
+    using Int = std::int32_t;
+};
+
+template <>
+struct numtraits<double> {
+    using Int = std::int64_t;
+};
+
+template <class N>
+using numint_t = typename numtraits<N>::Int;
+
+template <class N>
+inline numint_t<N> toint(N v) {
+    return zeno::bit_cast<numint_t<N>>(v);
+}
+
+template <class N>
+inline N fromint(numint_t<N> i) {
+    return zeno::bit_cast<N>(i);
+}
+
+template <class T>
+struct argtraits;
+
+template <>
+struct argtraits<void> {
+    static constexpr int nregs = 0;
+    static constexpr Zfx_ArgKind kind = Zfx_ArgKind::kVoid;
+};
+
+//N是寄存器的类型, float或者double
+template <>
+struct argtraits<float> {
+    static constexpr int nregs = 1;
+    static constexpr Zfx_ArgKind kind = Zfx_ArgKind::kFloat;
+
+    template <class N>
+    static float load(zfx_State*, const N* r, int i) {
+        return static_cast<float>(r[i]);
+    }
+
+    template <class N>
+    static void store(N* r, int i, float v) {
+        r[i] = v;
+    }
+};
+
+//在zfx里和float是同一种类型, double程序里不会丢精度
+template <>
+struct argtraits<double> {
+    static constexpr int nregs = 1;
+    static constexpr Zfx_ArgKind kind = Zfx_ArgKind::kFloat;
+
+    template <class N>
+    static double load(zfx_State*, const N* r, int i) {
+        return r[i];
+    }
+
+    template <class N>
+    static void store(N* r, int i, double v) {
+        r[i] = static_cast<N>(v);
+    }
+};
+
+template <>
+struct argtraits<int> {
+    static constexpr int nregs = 1;
+    static constexpr Zfx_ArgKind kind = Zfx_ArgKind::kInt;
+
+    template <class N>
+    static int load(zfx_State*, const N* r, int i) {
+        return static_cast<int>(toint(r[i]));
+    }
+
+    template <class N>
+    static void store(N* r, int i, int v) {
+        r[i] = fromint<N>(v);
+    }
+};
+
+template <>
+struct argtraits<Zfx_Vec3> {
+    static constexpr int nregs = 3;
+    static constexpr Zfx_ArgKind kind = Zfx_ArgKind::kVec3;
+
+    template <class N>
+    static Zfx_Vec3 load(zfx_State*, const N* r, int i) {
+        return {static_cast<float>(r[i]), static_cast<float>(r[ZFX_LANES + i]),
+                static_cast<float>(r[2 * ZFX_LANES + i])};
+    }
+
+    template <class N>
+    static void store(N* r, int i, Zfx_Vec3 v) {
+        r[i] = v.x;
+        r[ZFX_LANES + i] = v.y;
+        r[2 * ZFX_LANES + i] = v.z;
+    }
+};
+
+//四元数和矩阵就是K个float, 每个分量占一个寄存器
+template <class V, int K, Zfx_ArgKind Kind>
+struct packedtraits {
+    static_assert(sizeof(V) == K * sizeof(float), "packedtraits: V must be K floats");
+    static constexpr int nregs = K;
+    static constexpr Zfx_ArgKind kind = Kind;
+
+    template <class N>
+    static V load(zfx_State*, const N* r, int i) {
+        float f[K];
+        for (int k = 0; k < K; k++) {
+            f[k] = static_cast<float>(r[k * ZFX_LANES + i]);
+        }
+        V v;
+        std::memcpy(&v, f, sizeof(v));
+        return v;
+    }
+
+    template <class N>
+    static void store(N* r, int i, const V& v) {
+        float f[K];
+        std::memcpy(f, &v, sizeof(v));
+        for (int k = 0; k < K; k++) {
+            r[k * ZFX_LANES + i] = f[k];
+        }
+    }
+};
+
+template <>
+struct argtraits<Zfx_Quat> : packedtraits<Zfx_Quat, 4, Zfx_ArgKind::kQuat> {};
+
+template <>
+struct argtraits<Zfx_Mat3> : packedtraits<Zfx_Mat3, 9, Zfx_ArgKind::kMat3> {};
+
+template <>
+struct argtraits<Zfx_Mat4> : packedtraits<Zfx_Mat4, 16, Zfx_ArgKind::kMat4> {};
+
+//资源编号是uniform的, 只看第一个lane
+template <>
+struct argtraits<span<float const>> {
+    static constexpr int nregs = 1;
+    static constexpr Zfx_ArgKind kind = Zfx_ArgKind::kSpan;
+
+    template <class N>
+    static span<float const> load(zfx_State* l, const N* r, int) {
+        return zfx_getresource(l, static_cast<int>(toint(r[0])));
+    }
+};
+
+template <class T>
+using argtraits_t = argtraits<std::remove_cv_t<std::remove_reference_t<T>>>;
+
+//第I个参数相对于C的寄存器偏移
+template <class ...Args>
+constexpr int argoffset(std::size_t index) {
+    constexpr int sizes[] = {argtraits_t<Args>::nregs..., 0};
+    int off = 0;
+    for (std::size_t i = 0; i < index; i++) {
+        off += sizes[i];
+    }
+    return off;
+}
+
+template <class Sig>
+struct signature;
+
+template <class R, class ...Args>
+struct signature<R (*)(Args...)> {
+    using ret = R;
+
+    static std::vector<Zfx_ArgKind> args() {
+        return {argtraits_t<Args>::kind...};
+    }
+
+    template <auto F, class N, std::size_t ...Is>
+    static void call(zfx_State* l, N* regs, std::uint32_t a, std::uint32_t c, int n,
+                     std::index_sequence<Is...>) {
+        N* ra = regs + a * ZFX_LANES;
+        const N* rc = regs + c * ZFX_LANES;
+        for (int i = 0; i < n; i++) {
+            if constexpr (std::is_void_v<R>) {
+                F(argtraits_t<Args>::load(l, rc + argoffset<Args...>(Is) * ZFX_LANES, i)...);
+            } else {
+                argtraits_t<R>::store(ra, i,
+                    F(argtraits_t<Args>::load(l, rc + argoffset<Args...>(Is) * ZFX_LANES, i)...));
+            }
+        }
+    }
+
+    template <auto F, class N>
+    static void wrapper(zfx_State* l, N* regs, std::uint32_t a, std::uint32_t c, int n) {
+        call<F>(l, regs, a, c, n, std::index_sequence_for<Args...>{});
+    }
+};
+
+/*
+ * 按批调用的签名, 输出的span<float>必须都在输入的span<float const>前面
+ * 寄存器按64字节对齐, 而且后面一直到ZFX_LANES都是可以访问的, 宿主可以放心地按整向量读写
+ * */
+template <class T>
+struct batchtraits;
+
+template <class N>
+struct batchtraits<span<N>> {
+    static constexpr bool output = !std::is_const_v<N>;
+    static constexpr Zfx_ArgKind kind = Zfx_ArgKind::kFloat;
+    using number = std::remove_const_t<N>;
+};
+
+//寄存器里是按位存的int, 要拷出来转成int32, 不能直接把寄存器交给宿主
+template <>
+struct batchtraits<span<int const>> {
+    static constexpr bool output = false;
+    static constexpr Zfx_ArgKind kind = Zfx_ArgKind::kInt;
+    using number = int;
+};
+
+template <class Sig>
+struct batchsignature;
+
+template <class ...Args>
+struct batchsignature<void (*)(Args...)> {
+    static constexpr bool outputs[] = {batchtraits<Args>::output..., false};
+
+    static constexpr int nouts() {
+        int k = 0;
+        while (k < static_cast<int>(sizeof...(Args)) && outputs[k]) {
+            k++;
+        }
+        return k;
+    }
+
+    static constexpr bool ordered() {
+        for (std::size_t i = nouts(); i < sizeof...(Args); i++) {
+            if (outputs[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static_assert(ordered(), "zfx_registerBatch: output spans must come before input spans");
+
+    static constexpr int nrets = nouts();
+
+    //输出几个寄存器就是哪种返回值, 和argtraits的寄存器数对应, kSpan表示没有对应的类型
+    static constexpr Zfx_ArgKind retkind() {
+        switch (nrets) {
+            case 0:
+                return Zfx_ArgKind::kVoid;
+            case 1:
+                return Zfx_ArgKind::kFloat;
+            case 3:
+                return Zfx_ArgKind::kVec3;
+            case 4:
+                return Zfx_ArgKind::kQuat;
+            case 9:
+                return Zfx_ArgKind::kMat3;
+            case 16:
+                return Zfx_ArgKind::kMat4;
+            default:
+                return Zfx_ArgKind::kSpan;
+        }
+    }
+
+    static_assert(retkind() != Zfx_ArgKind::kSpan,
+                  "zfx_registerBatch: the number of output spans must be 0, 1, 3, 4, 9 or 16");
+
+    static constexpr bool hasints = ((batchtraits<Args>::kind == Zfx_ArgKind::kInt) || ...);
+
+    static std::vector<Zfx_ArgKind> args() {
+        std::vector<Zfx_ArgKind> kinds = {batchtraits<Args>::kind...};
+        kinds.erase(kinds.begin(), kinds.begin() + nrets);
+        return kinds;
+    }
+
+    template <class T, std::size_t I, class N>
+    static T lanes(N* regs, std::uint32_t a, std::uint32_t c, int n) {
+        static_assert(std::is_same_v<typename batchtraits<T>::number, N>,
+                      "zfx_registerBatch: span element type must match the register type");
+        N* r;
+        if constexpr (batchtraits<T>::output) {
+            r = regs + (a + I) * ZFX_LANES;
+        } else {
+            r = regs + (c + I - nrets) * ZFX_LANES;
+        }
+        return T{r, r + n};
+    }
+
+    template <auto F, class N, std::size_t ...Is>
+    static void call(N* regs, std::uint32_t a, std::uint32_t c, int n, std::index_sequence<Is...>) {
+        F(lanes<Args, Is>(regs, a, c, n)...);
+    }
+
+    //寄存器类型和span的类型一样, 直接把寄存器交给宿主, 有int参数的话走convert
+    template <auto F, class N>
+    static void wrapper(zfx_State*, N* regs, std::uint32_t a, std::uint32_t c, int n) {
+        if constexpr (hasints) {
+            convert<F>(regs, a, c, n, std::index_sequence_for<Args...>{});
+        } else {
+            call<F>(regs, a, c, n, std::index_sequence_for<Args...>{});
+        }
+    }
+
+    template <class T>
+    static T view(float* f, int* i, int n) {
+        if constexpr (batchtraits<T>::kind == Zfx_ArgKind::kInt) {
+            return T{i, i + n};
+        } else {
+            return T{f, f + n};
+        }
+    }
+
+    /*
+     * 参数先拷到float的临时寄存器, 算完再拷回去
+     * float的实现在double程序里用, 或者有int参数的时候用
+     * int按值转成int32, double程序里的int64直接当double转会变成非规格化数, 再转float就成0了
+     * */
+    template <auto F, class N, std::size_t ...Is>
+    static void convert(N* regs, std::uint32_t a, std::uint32_t c, int n, std::index_sequence<Is...>) {
+        constexpr Zfx_ArgKind kinds[] = {batchtraits<Args>::kind..., Zfx_ArgKind::kVoid};
+        alignas(64) float tmp[sizeof...(Args)][ZFX_LANES] = {};
+        alignas(64) int itmp[sizeof...(Args)][ZFX_LANES] = {};
+        auto reg = [&](std::size_t i) {
+            return regs + (i < static_cast<std::size_t>(nrets) ? a + i : c + i - nrets) * ZFX_LANES;
+        };
+        for (std::size_t i = nrets; i < sizeof...(Args); i++) {
+            const N* r = reg(i);
+            if (kinds[i] == Zfx_ArgKind::kInt) {
+                for (int j = 0; j < n; j++) itmp[i][j] = static_cast<int>(toint(r[j]));
+            } else {
+                for (int j = 0; j < n; j++) tmp[i][j] = static_cast<float>(r[j]);
+            }
+        }
+        F(view<Args>(tmp[Is], itmp[Is], n)...);
+        for (int i = 0; i < nrets; i++) {
+            N* r = reg(i);
+            for (int j = 0; j < n; j++) r[j] = tmp[i][j];
+        }
+    }
+
+    template <auto F>
+    static void widen(zfx_State*, double* regs, std::uint32_t a, std::uint32_t c, int n) {
+        convert<F>(regs, a, c, n, std::index_sequence_for<Args...>{});
+    }
+};
+
+}
+
+/*
+ * 同名而且签名一样的替换掉原来的实现, 否则追加到表的末尾
+ * 已经校验过的module按原来的参数个数和类型调用, 所以同名但是签名不一样的抛std::invalid_argument
+ * */
+inline int zfx_addCFunction(zfx_CFunctionInfo info) {
+    std::lock_guard<std::mutex> guard(zfx_cfunctionLock());
+    auto& table = zfx_cfunctions();
+    for (std::size_t i = 0; i < table.size(); i++) {
+        zfx_CFunctionInfo& f = table[i];
+        if (f.name == info.name) {
+            if (f.ret != info.ret || f.args != info.args || f.batched != info.batched || f.nrets != info.nrets) {
+                throw std::invalid_argument("zfx_register: " + info.name +
+                                            " is already registered with a different signature");
+            }
+            f.fn = info.fn;
+            f.fnd = info.fnd;
+            return static_cast<int>(i);
+        }
+    }
+    //B操作数只有8位
+    if (table.size() > 0xff) {
+        throw std::length_error("zfx_register: too many host functions");
+    }
+    table.push_back(std::move(info));
+    zfx_details::cfunctionCount().store(table.size(), std::memory_order_release);
+    return static_cast<int>(table.size() - 1);
+}
+
+/*
+ * 注册一个宿主函数, 返回kFastCall里用的编号
+ * 同名同签名的函数会覆盖之前注册的那个, 签名不一样的抛std::invalid_argument
+ * */
+template <auto F>
+int zfx_register(std::string name) {
+    using Sig = zfx_details::signature<decltype(F)>;
+    return zfx_addCFunction({std::move(name), &Sig::template wrapper<F, float>,
+                             zfx_details::argtraits_t<typename Sig::ret>::kind, Sig::args(), false, 1,
+                             &Sig::template wrapper<F, double>});
+}
+
+/*
+ * 注册一个按批调用的宿主函数, 同样通过kFastCall调用
+ * 输出的个数决定返回值类型: 1是float, 3是vec3, 4是quat, 9和16是mat3和mat4, 其他个数编译不过
+ * FD是可选的double版本, 参数个数和输出个数必须和F一样
+ * */
+template <auto F, auto FD = nullptr>
+int zfx_registerBatch(std::string name) {
+    using Sig = zfx_details::batchsignature<decltype(F)>;
+    constexpr Zfx_ArgKind ret = Sig::retkind();
+    zfx_CFunctionD fnd;
+    if constexpr (std::is_null_pointer_v<decltype(FD)>) {
+        fnd = &Sig::template widen<F>;
+    } else {
+        using SigD = zfx_details::batchsignature<decltype(FD)>;
+        static_assert(SigD::nrets == Sig::nrets, "zfx_registerBatch: float and double versions differ");
+        static_assert(!SigD::hasints, "zfx_registerBatch: int spans are only supported in the float version");
+        fnd = &SigD::template wrapper<FD, double>;
+    }
+    return zfx_addCFunction({std::move(name), &Sig::template wrapper<F, float>, ret, Sig::args(), true,
+                             Sig::nrets, fnd});
+}
+
+//给编译器用的, 根据名字找宿主函数编号, 找不到返回-1
+inline int zfx_findCFunction(std::string_view name) {
+    auto& table = zfx_cfunctions();
+    std::size_t n = zfx_cfunctionCount();
+    for (std::size_t i = 0; i < n; i++) {
+        if (table[i].name == name) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
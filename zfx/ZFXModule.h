@@ -0,0 +1,163 @@
+//
+// Created by admin on 2022/9/8.
+//
+/*
+ * C++调用zfx函数的接口
+ * auto falloff = module.get<float(Zfx_Vec3, float)>("falloff");
+ * 名字查找和签名检查都在get的时候做一次, 之后每次调用只是在栈上开一帧寄存器, 把参数直接写进去执行
+ * 寄存器按Proto::number开成float或者double的
+ *
+ * Module编译好之后就不再修改, 用Module::create得到shared_ptr<const Module>,
+ * 任意多个线程的zfx_State可以同时执行同一个Module, 每个状态只有自己的栈和绑定
+ * module.estimate()是创建时算好的静态代价估计, 调度器可以据此决定线程数, 要不要合并节点或者JIT
+ * */
+#pragma once
+
+#include "Object.h"
+#include "ZFXFunction.h"
+#include "VM/zvm.h"
+#include "VM/zdo.h"
+#include "VM/zcost.h"
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace zeno::zfx {
+
+class Module;
+
+template <class Sig>
+class Function;
+
+template <class R, class ...Args>
+class Function<R(Args...)> {
+    static_assert(((zfx_details::argtraits_t<Args>::kind != Zfx_ArgKind::kSpan) && ...),
+                  "zfx functions cannot take span parameters");
+
+public:
+    Function() = default;
+
+    //持有module的引用, 句柄活着的时候Proto一直有效
+    Function(std::shared_ptr<const Module> module, const Proto* proto) noexcept
+        : m_module(std::move(module)), m_proto(proto) {
+    }
+
+    explicit operator bool() const noexcept {
+        return m_proto != nullptr;
+    }
+
+    R operator()(zfx_State* l, Args... args) const {
+        if (m_proto->number == Zfx_NumberType::kDouble) {
+            return call<double>(l, args...);
+        }
+        return call<float>(l, args...);
+    }
+
+private:
+    template <class N>
+    R call(zfx_State* l, Args... args) const {
+        //参数在保护调用之外写进帧里, 越过guard page就没有地方可以跳回去了, 所以先检查
+        if (!zfx_hasroom(l, zfx_framesize<N>(m_proto->nregs))) {
+            throw std::runtime_error("zfx: stack overflow calling function " + m_proto->name);
+        }
+        N* regs = zfx_pushregs<N>(l, m_proto->nregs);
+        store(regs, std::index_sequence_for<Args...>{}, args...);
+        int ret = -1;
+        int status = zfx_callproto(l, m_proto, regs, &ret);
+        if (status != ZFX_OK) {
+            zfx_popregs(l, regs);
+            throw std::runtime_error("zfx: error " + std::to_string(status) + " in function " + m_proto->name);
+        }
+        if constexpr (std::is_void_v<R>) {
+            zfx_popregs(l, regs);
+        } else {
+            //没有执行到kReturn就走完了代码
+            if (ret < 0) {
+                zfx_popregs(l, regs);
+                throw std::runtime_error("zfx: function " + m_proto->name + " ended without returning a value");
+            }
+            R result = zfx_details::argtraits_t<R>::load(l, regs + ret * ZFX_LANES, 0);
+            zfx_popregs(l, regs);
+            return result;
+        }
+    }
+
+    template <class N, std::size_t ...Is>
+    static void store(N* regs, std::index_sequence<Is...>, Args... args) {
+        (zfx_details::argtraits_t<Args>::store(regs + zfx_details::argoffset<Args...>(Is) * ZFX_LANES, 0, args), ...);
+    }
+
+    std::shared_ptr<const Module> m_module;
+    const Proto* m_proto = nullptr;
+};
+
+class Module : public std::enable_shared_from_this<Module> {
+    struct Private {};
+
+public:
+    Module(Private, Proto main) : m_main(std::move(main)), m_estimate(zfx_estimate(&m_main)) {
+    }
+
+    Module(Module const&) = delete;
+    Module& operator=(Module const&) = delete;
+
+    //字节码有问题就抛异常, 见zfx_verify, 用到的宿主函数要先注册
+    static std::shared_ptr<const Module> create(Proto main) {
+        std::string err = zfx_verify(&main);
+        if (!err.empty()) {
+            throw std::invalid_argument("zfx: bad bytecode in " + err);
+        }
+        return std::make_shared<Module>(Private{}, std::move(main));
+    }
+
+    const Proto& main() const noexcept {
+        return m_main;
+    }
+
+    //main每个点的周期数, 寄存器和属性读写量, 子函数用zfx_estimate(find(name))
+    const zfx_Estimate& estimate() const noexcept {
+        return m_estimate;
+    }
+
+    //找不到返回nullptr
+    const Proto* find(std::string_view name) const {
+        for (auto const& p : m_main.p) {
+            if (p.name == name) {
+                return &p;
+            }
+        }
+        return nullptr;
+    }
+
+    //绑定的时候检查签名, 不匹配直接抛异常
+    template <class Sig>
+    Function<Sig> get(std::string_view name) const {
+        const Proto* p = find(name);
+        if (p == nullptr) {
+            throw std::invalid_argument("zfx: no function named " + std::string(name));
+        }
+        if (!SigCheck<Sig>::match(*p)) {
+            throw std::invalid_argument("zfx: signature mismatch for function " + std::string(name));
+        }
+        return Function<Sig>(shared_from_this(), p);
+    }
+
+private:
+    template <class Sig>
+    struct SigCheck;
+
+    template <class R, class ...Args>
+    struct SigCheck<R(Args...)> {
+        static bool match(const Proto& p) {
+            std::vector<Zfx_ArgKind> params{zfx_details::argtraits_t<Args>::kind...};
+            return p.ret == zfx_details::argtraits_t<R>::kind && p.params == params;
+        }
+    };
+
+    const Proto m_main;
+    const zfx_Estimate m_estimate;
+};
+
+}
@@ -13,11 +13,34 @@ namespace zeno::zfx {
  * */
 //我想把OpCode大小设置为uin8_t，那这样指令Op A B C 总共为32字节
 //使用一个位运算获取op, insn是一个uin32_t的数字
-#define ZFX_INSN_0P(insn) ((insn) & 0xff)
+#define ZFX_INSN_OP(insn) ((insn) & 0xff)
 //左移八位取出操作数
 #define ZFX_INSN_A(insn) (((insn) >> 8) & 0xff)
 #define ZFX_INSN_B(insn) (((insn) >> 16) & 0xff)
-#deFINE ZFX_INSN_C(insn) (((insn) >> 24) & 0xff)
+#define ZFX_INSN_C(insn) (((insn) >> 24) & 0xff)
+//跳转指令把B C合起来当作一个有符号的16位偏移, 相对于下一条指令
+#define ZFX_INSN_sBx(insn) (static_cast<std::int16_t>(((insn) >> 16) & 0xffff))
+//反过来把op a b c拼成一条指令
+#define ZFX_INSN_ABC(op, a, b, c) \
+    (static_cast<std::uint32_t>(op) | (static_cast<std::uint32_t>(a) << 8) \
+    | (static_cast<std::uint32_t>(b) << 16) | (static_cast<std::uint32_t>(c) << 24))
+#define ZFX_INSN_AsBx(op, a, sbx) \
+    (static_cast<std::uint32_t>(op) | (static_cast<std::uint32_t>(a) << 8) \
+    | (static_cast<std::uint32_t>(static_cast<std::uint16_t>(sbx)) << 16))
+//向量指令后面跟一个扩展字: W向量的分量数(1到4) D第四个操作数 F标志位
+#define ZFX_EXT_W(ext) ((ext) & 0xff)
+#define ZFX_EXT_D(ext) (((ext) >> 8) & 0xff)
+#define ZFX_EXT_F(ext) (((ext) >> 16) & 0xff)
+#define ZFX_INSN_EXT(w, d, f) \
+    (static_cast<std::uint32_t>(w) | (static_cast<std::uint32_t>(d) << 8) \
+    | (static_cast<std::uint32_t>(f) << 16))
+//标量参数广播到所有分量, 具体是哪几个参数见下面每条指令的说明
+#define ZFX_VEC_SCALAR  0x1
+//normalize用rsqrt近似, 只在fast-math下生成
+#define ZFX_VEC_FAST    0x2
+//kSample的插值方式, 多维的时候就是双线性/三线性和双三次/三三次
+#define ZFX_SAMPLE_LINEAR   0x0
+#define ZFX_SAMPLE_CUBIC    0x1
 
 enum class OpCode : std::uint8_t {
     kLoadConstInt,
@@ -54,8 +77,113 @@ enum class OpCode : std::uint8_t {
     kCmpLessEqual,
     kCmpGreaterThan,
     kCmpGreaterEqual,
-    kFastCall
+    //A:结果寄存器 B:宿主函数的编号 C:第一个参数寄存器, 参数依次放在C之后连续的寄存器里
+    kFastCall,
+    //A:返回值所在的第一个寄存器, 执行到这里就结束当前函数
+    kReturn,
+    //无条件跳转sBx, 往回跳的就是循环的回边
+    kJump,
+    /*
+     * A是0的lane跳转到sBx, 其余的lane往下执行
+     * 两边都有lane的时候分叉: 跳转目标更靠后的那组lane先停下来, 另一组执行到那里再汇合
+     * 所以分支和循环里的指令只写正在执行的lane, 代码生成不需要自己按条件混合
+     * 汇合点按pc判断, 只适用于结构化的控制流: 分支的两边都在汇合点之前, 循环只从出口出去
+     * */
+    kJumpIfNot,
+    /*
+     * 向量内置函数, 一个vecN占N个连续的寄存器, 后面都跟一个扩展字
+     * A可以和向量输入相同, 但是不能和输入部分重叠, 也不能是广播的标量输入
+     * */
+    //A = dot(B, C)
+    kDot,
+    //A..A+2 = cross(B, C), W必须是3
+    kCross,
+    //A = length(B)
+    kLength,
+    //A = length(B - C)
+    kDistance,
+    //A = B / length(B), 长度为0的向量得到0, ZFX_VEC_FAST用rsqrt
+    kNormalize,
+    //A = B + (C - B) * D, ZFX_VEC_SCALAR: D是标量
+    kLerp,
+    //A = min(max(B, C), D), ZFX_VEC_SCALAR: C和D是标量
+    kClamp,
+    //A = smoothstep(B, C, D), B C是两个边界, ZFX_VEC_SCALAR: B和C是标量
+    kSmoothstep,
+    //A = B - 2 * dot(C, B) * C, B是入射方向, C是法线
+    kReflect,
+    //ZFX_VEC_SCALAR: C是标量
+    kMin,
+    kMax,
+    //A = 后面两个字拼成的double, 低位在前, float程序里会舍入成float
+    kLoadConstDouble,
+    //A..A+通道数-1 = 查表, B是Proto::tables的下标, C开始是维数个坐标, F是ZFX_SAMPLE_xxx
+    kSample,
+    /*
+     * 矩阵和四元数内置函数, 后面跟一个扩展字, W是矩阵的阶数N(3或者4)
+     * matN按列占N*N个连续的寄存器, 四元数占4个(x y z w), A可以和输入相同, 但是不能部分重叠
+     * */
+    //A = B * C
+    kMatMul,
+    //A = B的转置
+    kTranspose,
+    //A = B的逆, 行列式为0的时候得到全0
+    kInverse,
+    //A = B的行列式
+    kDeterminant,
+    //A..A+2 = B * C, W=4的时候C补上w=1, 不做透视除法
+    kTransformPoint,
+    //A..A+2 = B * C, W=4的时候只用左上角的3x3
+    kTransformVector,
+    //A..A+2 = B左上角3x3的逆的转置 * C, 结果不归一化
+    kTransformNormal,
+    //A = B * C, 先做C的旋转再做B的, W不用
+    kQuatMul,
+    //A..A+2 = 用单位四元数B旋转向量C, W不用
+    kQuatRotate,
+    //A = 单位四元数B对应的N阶旋转矩阵
+    kQuatToMat,
+    /*
+     * 整数运算, 没有扩展字
+     * int在寄存器里按位存成和数值类型一样宽的整数(float程序int32, double程序int64), kLoadConstInt就是这样放的
+     * kPlus到kModulus和比较指令把寄存器当浮点数, 对int的位模式算出来的结果没有意义, 代码生成必须用下面这些
+     * 溢出按补码回绕, 除以0和取模0得到0, 比较的结果和浮点比较一样是1.0或者0.0
+     * */
+    kIntNegate,
+    kIntPlus,
+    kIntMinus,
+    kIntMultiply,
+    kIntDivide,
+    kIntModulus,
+    kIntCmpEqual,
+    kIntCmpNotEqual,
+    kIntCmpLessThan,
+    kIntCmpLessEqual,
+    kIntCmpGreaterThan,
+    kIntCmpGreaterEqual,
+    //A = B转成浮点数
+    kIntToFloat,
+    //A = B向0取整转成int, NaN得到0, 超出范围的取int的最大最小值
+    kFloatToInt,
 };
+
+//kDot到kQuatToMat后面跟一个扩展字(kLoadConstDouble后面是两个字的常量)
+inline bool zfx_hasext(OpCode op) {
+    return op >= OpCode::kDot && op <= OpCode::kQuatToMat && op != OpCode::kLoadConstDouble;
+}
+
+//指令占几个字, 常量和向量指令后面还有一个字
+inline int zfx_insnsize(OpCode op) {
+    switch (op) {
+        case OpCode::kLoadConstInt:
+        case OpCode::kLoadConstFloat:
+            return 2;
+        case OpCode::kLoadConstDouble:
+            return 3;
+        default:
+            return zfx_hasext(op) ? 2 : 1;
+    }
+}
 //就是zfx的字节码定义的格式是啥样的，是那种OpCode + 左右操作数那种嘛
 
 /*
@@ -77,10 +205,4 @@ enum class OpCode : std::uint8_t {
         ZFX_MATH_POW
     };
 
-    //定义一些有用的宏，用来获取op a, b, c
-    #define ZFX_INSN_0P(insn)
-
-    #define ZFX_INSN_A(insn)
-    #define ZFX_INSN_B(insn)
-    #deFINE ZFX_INSN_C(insn)
 }
@@ -36,6 +36,7 @@ namespace zeno::zfx {
     //打印字节码用来调试
     class BCModulesDumper {
     public:
+        //现在的字节码是Proto, 反汇编用VM/zdump.h里的zfx_disassemble, 这里等BCModule换成Proto之后再接上
         void dump(BCModule &bcModule) {
             //new 一个SymbolDumper
             //从常量池中循环取出内容,并且判断类型调用相应的visit